@@ -41,6 +41,8 @@
 #include "sysdeps.h"
 
 #include "1541d64.h"
+#include "D64Image.h"
+#include "DirIndex.h"
 #include "IEC.h"
 #include "Prefs.h"
 #include "Display.h"
@@ -69,6 +71,7 @@ const int NUM_TRACKS = 35;
 const int NUM_SECTORS = 683;
 
 // Prototypes
+static bool find_match(uint8 *p, uint8 *n);
 static bool match(uint8 *p, uint8 *n);
 
 
@@ -78,9 +81,14 @@ static bool match(uint8 *p, uint8 *n);
 
 D64Drive::D64Drive(IEC *iec, char *filepath) : Drive(iec)
 {
-	the_file = NULL;
+	the_image = NULL;
 	ram = NULL;
 
+	dir_index = new DirIndex(0xa0);
+	dir_entries = NULL;
+	max_dir_entries = 0;
+	dir_valid = false;
+
 	Ready = false;
 	strcpy(orig_d64_name, filepath);
 	for (int i=0; i<=14; i++) {
@@ -91,7 +99,7 @@ D64Drive::D64Drive(IEC *iec, char *filepath) : Drive(iec)
 
 	// Open .d64 file
 	open_close_d64_file(filepath);
-	if (the_file != NULL) {
+	if (the_image != NULL) {
 
 		// Allocate 1541 RAM
 		ram = new uint8[0x800];
@@ -112,6 +120,8 @@ D64Drive::~D64Drive()
 	// Close .d64 file
 	open_close_d64_file("");
 
+	delete[] dir_entries;
+	delete dir_index;
 	delete[] ram;
 	Ready = false;
 }
@@ -123,43 +133,25 @@ D64Drive::~D64Drive()
 
 void D64Drive::open_close_d64_file(const char *d64name)
 {
-	long size;
-	uint8 magic[4];
+	dir_valid = false;
 
 	// Close old .d64, if open
-	if (the_file != NULL) {
+	if (the_image != NULL) {
 		close_all_channels();
-		fclose(the_file);
-		the_file = NULL;
+		the_image->Release();
+		the_image = NULL;
 	}
 
 	// Open new .d64 file
 	if (d64name[0]) {
-		if ((the_file = fopen(d64name, "rb")) != NULL) {
-			// Check length
-			fseek(the_file, 0, SEEK_END);
-			if ((size = ftell(the_file)) < NUM_SECTORS * 256) {
-				fclose(the_file);
-				the_file = NULL;
-				return;
-			}
+		if ((the_image = D64Image::Open(d64name)) != NULL) {
 
-			// x64 image?
-			rewind(the_file);
-			fread(&magic, 4, 1, the_file);
-			if (magic[0] == 0x43 && magic[1] == 0x15 && magic[2] == 0x41 && magic[3] == 0x64)
-				image_header = 64;
+			// Load sector error info from .d64 file, if present,
+			// otherwise all sectors have no error
+			if (the_image->ErrorInfo())
+				memcpy(error_info, the_image->ErrorInfo(), NUM_SECTORS);
 			else
-				image_header = 0;
-
-			// Preset error info (all sectors no error)
-			memset(error_info, 1, NUM_SECTORS);
-
-			// Load sector error info from .d64 file, if present
-			if (!image_header && size == NUM_SECTORS * 257) {
-				fseek(the_file, NUM_SECTORS * 256, SEEK_SET);
-				fread(&error_info, NUM_SECTORS, 1, the_file);
-			}
+				memset(error_info, 1, NUM_SECTORS);
 		}
 	}
 }
@@ -291,6 +283,52 @@ void D64Drive::convert_filename(char *srcname, char *destname, int *filemode, in
 }
 
 
+/*
+ *  Read all directory blocks into dir_entries, unless the image and
+ *  the directory pointer in the BAM are unchanged since the last time
+ */
+
+void D64Drive::scan_directory(void)
+{
+	if (dir_valid && dir_track == bam->dir_track && dir_sector == bam->dir_sector
+		&& (the_image == NULL || dir_generation == the_image->Generation()))
+		return;
+
+	dir_valid = true;
+	dir_track = bam->dir_track;
+	dir_sector = bam->dir_sector;
+	if (the_image)
+		dir_generation = the_image->Generation();
+	dir_error = ERR_OK;
+	dir_index->Clear();
+
+	// Scan all directory blocks (no more than there are on a disk,
+	// in case the chain is circular)
+	dir.next_track = bam->dir_track;
+	dir.next_sector = bam->dir_sector;
+
+	for (int blocks=0; dir.next_track && blocks<NUM_SECTORS; blocks++) {
+		if (!read_sector(dir.next_track, dir.next_sector, (uint8 *) &dir.next_track)) {
+			dir_error = the_image ? ERR_ILLEGALTS : ERR_NOTREADY;
+			return;
+		}
+
+		if (dir_index->Size() + 8 > max_dir_entries) {
+			max_dir_entries = max_dir_entries ? max_dir_entries * 2 : 144;
+			DirEntry *new_entries = new DirEntry[max_dir_entries];
+			memcpy(new_entries, dir_entries, dir_index->Size() * sizeof(DirEntry));
+			delete[] dir_entries;
+			dir_entries = new_entries;
+		}
+
+		for (int j=0; j<8; j++) {
+			dir_entries[dir_index->Size()] = dir.entry[j];
+			dir_index->Add(dir.entry[j].name);
+		}
+	}
+}
+
+
 /*
  *  Search file in directory, find first track and sector
  *  false: not found, true: found
@@ -298,45 +336,38 @@ void D64Drive::convert_filename(char *srcname, char *destname, int *filemode, in
 
 bool D64Drive::find_file(char *filename, int *track, int *sector)
 {
-	int i, j;
-	uint8 *p, *q;
-	DirEntry *de;
-
-	// Scan all directory blocks
-	dir.next_track = bam->dir_track;
-	dir.next_sector = bam->dir_sector;
+	scan_directory();
 
-	while (dir.next_track) {
-		if (!read_sector(dir.next_track, dir.next_sector, (uint8 *) &dir.next_track))
-			return false;
+	int num;
+	const int *entries = dir_index->Candidates(filename, &num);
+	for (int i=0; i<num; i++) {
+		DirEntry *de = &dir_entries[entries[i]];
 
-		// Scan all 8 entries of a block
-		for (j=0; j<8; j++) {
-			de = &dir.entry[j];
+		// Stuart Carnie: resolve
+		if ((de->type & 0x07) && find_match((uint8 *)filename, de->name)) {
 			*track = de->track;
 			*sector = de->sector;
+			return true;
+		}
+	}
 
-			// Stuart Carnie: resolve
-			if (de->type & 0x07) {
-				p = (uint8 *)filename;
-				q = de->name;
-				for (i=0; i<16 && *p; i++, p++, q++) {
-					if (*p == '*')	// Wildcard '*' matches all following characters
-						return true;
-					if (*p != *q) {
-						if (*p != '?') goto next_entry;	// Wildcard '?' matches single character
-						if (*q == 0xa0) goto next_entry;
-					}
-				}
+	return false;
+}
 
-				if (i == 16 || *q == 0xa0)
-					return true;
-			}
-next_entry: ;
+// Return true if name 'n' matches file name 'p'
+static bool find_match(uint8 *p, uint8 *n)
+{
+	int i;
+	for (i=0; i<16 && *p; i++, p++, n++) {
+		if (*p == '*')	// Wildcard '*' matches all following characters
+			return true;
+		if (*p != *n) {
+			if (*p != '?') return false;	// Wildcard '?' matches single character
+			if (*n == 0xa0) return false;
 		}
 	}
 
-	return false;
+	return i == 16 || *n == 0xa0;
 }
 
 
@@ -385,7 +416,7 @@ static bool match(uint8 *p, uint8 *n)
 
 uint8 D64Drive::open_directory(char *pattern)
 {
-	int i, j, n, m;
+	int i, j, n, m, num;
 	uint8 *p, *q;
 	DirEntry *de;
 	uint8 c;
@@ -422,69 +453,70 @@ uint8 D64Drive::open_directory(char *pattern)
 	*(p-7) = '\"';
 	*p++ = 0;
 
-	// Scan all directory blocks
-	dir.next_track = bam->dir_track;
-	dir.next_sector = bam->dir_sector;
-
-	while (dir.next_track) {
-		if (!read_sector(dir.next_track, dir.next_sector, (uint8 *) &dir.next_track))
-			return ST_OK;
-
-		// Scan all 8 entries of a block
-		for (j=0; j<8; j++) {
-			de = &dir.entry[j];
-
-			if (de->type && match((uint8 *)pattern, de->name)) {
-				*p++ = 0x01; // Dummy line link
-				*p++ = 0x01;
-
-				*p++ = de->num_blocks_l; // Line number
-				*p++ = de->num_blocks_h;
-
+	// List all matching directory entries (as many as fit into the
+	// buffer together with the final line)
+	scan_directory();
+
+	const int *entries = dir_index->Candidates(pattern, &num);
+	for (j=0; j<num && p<chan_buf[0]+8192-64; j++) {
+		de = &dir_entries[entries[j]];
+
+		if (de->type && match((uint8 *)pattern, de->name)) {
+			*p++ = 0x01; // Dummy line link
+			*p++ = 0x01;
+
+			*p++ = de->num_blocks_l; // Line number
+			*p++ = de->num_blocks_h;
+
+			*p++ = ' ';
+			n = (de->num_blocks_h << 8) + de->num_blocks_l;
+			if (n<10) *p++ = ' ';
+			if (n<100) *p++ = ' ';
+
+			*p++ = '\"';
+			q = de->name;
+			m = 0;
+			for (i=0; i<16; i++) {
+				if ((c = *q++) == 0xa0) {
+					if (m)
+						*p++ = ' ';		// Replace all 0xa0 by spaces
+					else
+						m = *p++ = '\"';	// But the first by a '"'
+				} else
+					*p++ = c;
+			}
+			if (m)
 				*p++ = ' ';
-				n = (de->num_blocks_h << 8) + de->num_blocks_l;
-				if (n<10) *p++ = ' ';
-				if (n<100) *p++ = ' ';
-
-				*p++ = '\"';
-				q = de->name;
-				m = 0;
-				for (i=0; i<16; i++) {
-					if ((c = *q++) == 0xa0) {
-						if (m)
-							*p++ = ' ';		// Replace all 0xa0 by spaces
-						else
-							m = *p++ = '\"';	// But the first by a '"'
-					} else
-						*p++ = c;
-				}
-				if (m)
-					*p++ = ' ';
-				else
-					*p++ = '\"';			// No 0xa0, then append a space
-
-				if (de->type & 0x80)
-					*p++ = ' ';
-				else
-					*p++ = '*';
+			else
+				*p++ = '\"';			// No 0xa0, then append a space
 
-				*p++ = type_char_1[de->type & 0x0f];
-				*p++ = type_char_2[de->type & 0x0f];
-				*p++ = type_char_3[de->type & 0x0f];
+			if (de->type & 0x80)
+				*p++ = ' ';
+			else
+				*p++ = '*';
 
-				if (de->type & 0x40)
-					*p++ = '<';
-				else
-					*p++ = ' ';
+			*p++ = type_char_1[de->type & 0x0f];
+			*p++ = type_char_2[de->type & 0x0f];
+			*p++ = type_char_3[de->type & 0x0f];
 
+			if (de->type & 0x40)
+				*p++ = '<';
+			else
 				*p++ = ' ';
-				if (n >= 10) *p++ = ' ';
-				if (n >= 100) *p++ = ' ';
-				*p++ = 0;
-			}
+
+			*p++ = ' ';
+			if (n >= 10) *p++ = ' ';
+			if (n >= 100) *p++ = ' ';
+			*p++ = 0;
 		}
 	}
 
+	// The chain ended with an error, no final line
+	if (dir_error != ERR_OK) {
+		set_error(dir_error);
+		return ST_OK;
+	}
+
 	// Final line
 	q = p;
 	for (i=0; i<29; i++)
@@ -1002,13 +1034,17 @@ bool D64Drive::read_sector(int track, int sector, uint8 *buffer)
 		return false;
 	}
 
-	if (the_file == NULL) {
+	if (the_image == NULL) {
 		set_error(ERR_NOTREADY);
 		return false;
 	}
 
-	fseek(the_file, offset + image_header, SEEK_SET);
-	fread(buffer, 256, 1, the_file);
+	const uint8 *p = the_image->Sector(offset);
+	if (p == NULL) {
+		set_error(ERR_ILLEGALTS);	// Track not in the image
+		return false;
+	}
+	memcpy(buffer, p, 256);
 	return true;
 }
 
@@ -28,6 +28,9 @@
 
 #include "IEC.h"
 
+class D64Image;
+class DirIndex;
+
 
 // BAM structure
 typedef struct {
@@ -84,6 +87,7 @@ private:
 	void open_close_d64_file(const char *d64name);
 	uint8 open_file(int channel, char *filename);
 	void convert_filename(char *srcname, char *destname, int *filemode, int *filetype);
+	void scan_directory(void);
 	bool find_file(char *filename, int *track, int *sector);
 	uint8 open_file_ts(int channel, int track, int sector);
 	uint8 open_directory(char *pattern);
@@ -102,12 +106,20 @@ private:
 
 	char orig_d64_name[256]; // Original path of .d64 file
 
-	FILE *the_file;			// File pointer for .d64 file
+	D64Image *the_image;	// Mapped .d64 file
 
 	uint8 *ram;				// 2KB 1541 RAM
 	BAM *bam;				// Pointer to BAM
 	Directory dir;			// Buffer for directory blocks
 
+	DirIndex *dir_index;	// Names of dir_entries
+	DirEntry *dir_entries;	// All directory entries, read by scan_directory()
+	int max_dir_entries;
+	bool dir_valid;			// dir_entries is up to date with...
+	uint32 dir_generation;	// ...this image generation...
+	uint8 dir_track, dir_sector;	// ...and BAM directory pointer
+	int dir_error;			// Error that ended the directory chain, ERR_OK if none
+
 	int chan_mode[16];		// Channel mode
 	int chan_buf_num[16];	// Buffer number of channel (for direct access channels)
 	uint8 *chan_buf[16];	// Pointer to buffer
@@ -119,8 +131,6 @@ private:
 	char cmd_buffer[44];	// Buffer for incoming command strings
 	int cmd_len;			// Length of received command
 
-	int image_header;		// Length of .d64 file header
-
 	uint8 error_info[683];	// Sector error information (1 byte/sector)
 };
 
@@ -32,6 +32,8 @@
  *    GCR reading/writing).
  *  - The preferences settings for drive 8 are used to
  *    specify the .d64 file
+ *  - Tracks are GCR encoded when the head moves onto them,
+ *    the last GCR_CACHED_TRACKS encoded tracks are kept
  *
  * Incompatibilities:
  * ------------------
@@ -47,6 +49,7 @@
 #include "1541job.h"
 #include "CPU1541.h"
 #include "Prefs.h"
+#include "D64Image.h"
 
 
 // Number of tracks/sectors
@@ -55,8 +58,7 @@ const int NUM_SECTORS = 683;
 
 // Size of GCR encoded data
 const int GCR_SECTOR_SIZE = 1+10+9+1+325+8;			// SYNC Header Gap SYNC Data Gap (should be 5 SYNC bytes each)
-const int GCR_TRACK_SIZE = GCR_SECTOR_SIZE * 21;	// Each track in gcr_data has 21 sectors
-const int GCR_DISK_SIZE = GCR_TRACK_SIZE * NUM_TRACKS;
+const int GCR_TRACK_SIZE = GCR_SECTOR_SIZE * 21;	// Each track buffer has room for 21 sectors
 
 // Job return codes
 const int RET_OK = 1;				// No error
@@ -88,18 +90,25 @@ const int sector_offset[36] = {
  *   emulation is enabled
  */
 
-Job1541::Job1541(uint8 *ram1541) : ram(ram1541)
+Job1541::Job1541(uint8 *ram1541, Prefs *prefs) : ram(ram1541), the_prefs(prefs)
 {
-	the_file = NULL;
+	the_image = NULL;
+
+	for (int i=0; i<GCR_CACHED_TRACKS; i++) {
+		gcr_tracks[i] = NULL;
+		gcr_track_num[i] = 0;
+		gcr_track_used[i] = 0;
+	}
+	gcr_clock = 0;
 
-	gcr_data = gcr_ptr = gcr_track_start = new uint8[GCR_DISK_SIZE];
-	gcr_track_end = gcr_track_start + GCR_TRACK_SIZE;
 	current_halftrack = 2;
+	gcr_ptr = gcr_track_start = load_track(1);
+	gcr_track_end = gcr_track_start + num_sectors[1] * GCR_SECTOR_SIZE;
 
 	disk_changed = true;
 
-	if (ThePrefs.Emul1541Proc)
-		open_d64_file(ThePrefs.DrivePath);
+	if (the_prefs->Emul1541Proc)
+		open_d64_file(the_prefs->DrivePath);
 }
 
 
@@ -110,7 +119,8 @@ Job1541::Job1541(uint8 *ram1541) : ram(ram1541)
 Job1541::~Job1541()
 {
 	close_d64_file();
-	delete[] gcr_data;
+	for (int i=0; i<GCR_CACHED_TRACKS; i++)
+		delete[] gcr_tracks[i];
 }
 
 
@@ -125,11 +135,11 @@ void Job1541::NewPrefs(Prefs *prefs)
 		close_d64_file();
 
 	// 1541 emulation turned on?
-	else if (!ThePrefs.Emul1541Proc && prefs->Emul1541Proc)
+	else if (!the_prefs->Emul1541Proc && prefs->Emul1541Proc)
 		open_d64_file(prefs->DrivePath);
 
 	// .d64 file name changed?
-	else if (strcmp(ThePrefs.DrivePath, prefs->DrivePath)) {
+	else if (strcmp(the_prefs->DrivePath, prefs->DrivePath)) {
 		close_d64_file();
 		open_d64_file(prefs->DrivePath);
 		disk_changed = true;
@@ -143,55 +153,28 @@ void Job1541::NewPrefs(Prefs *prefs)
 
 void Job1541::open_d64_file(char *filepath)
 {
-	long size;
-	uint8 magic[4];
-	uint8 bam[256];
-
-	// Clear GCR buffer
-	memset(gcr_data, 0x55, GCR_DISK_SIZE);
-
-	// Try opening the file for reading/writing first, then for reading only
-	write_protected = false;
-	the_file = fopen(filepath, "rb+");
-	if (the_file == NULL) {
-		write_protected = true;
-		the_file = fopen(filepath, "rb");
-	}
-	if (the_file != NULL) {
-
-		// Check length
-		fseek(the_file, 0, SEEK_END);
-		if ((size = ftell(the_file)) < NUM_SECTORS * 256) {
-			fclose(the_file);
-			the_file = NULL;
-			return;
-		}
-
-		// x64 image?
-		fseek(the_file, 0, SEEK_SET);
-		fread(&magic, 4, 1, the_file);
-		if (magic[0] == 0x43 && magic[1] == 0x15 && magic[2] == 0x41 && magic[3] == 0x64)
-			image_header = 64;
+	// The image is writable if the file is
+	write_protected = true;
+	the_image = D64Image::Open(filepath);
+	if (the_image != NULL) {
+		write_protected = the_image->WriteProtected();
+
+		// Load sector error info from .d64 file, if present,
+		// otherwise all sectors have no error
+		if (the_image->ErrorInfo())
+			memcpy(error_info, the_image->ErrorInfo(), NUM_SECTORS);
 		else
-			image_header = 0;
-
-		// Preset error info (all sectors no error)
-		memset(error_info, 1, NUM_SECTORS);
-
-		// Load sector error info from .d64 file, if present
-		if (!image_header && size == NUM_SECTORS * 257) {
-			fseek(the_file, NUM_SECTORS * 256, SEEK_SET);
-			fread(&error_info, NUM_SECTORS, 1, the_file);
-		};
+			memset(error_info, 1, NUM_SECTORS);
 
 		// Read BAM and get ID
-		read_sector(18, 0, bam);
+		const uint8 *bam = read_sector(18, 0);
 		id1 = bam[162];
 		id2 = bam[163];
-
-		// Create GCR encoded disk data from image
-		disk2gcr();
 	}
+
+	// Tracks are encoded when the head reaches them
+	flush_tracks();
+	set_track();
 }
 
 
@@ -201,9 +184,9 @@ void Job1541::open_d64_file(char *filepath)
 
 void Job1541::close_d64_file(void)
 {
-	if (the_file != NULL) {
-		fclose(the_file);
-		the_file = NULL;
+	if (the_image != NULL) {
+		the_image->Release();
+		the_image = NULL;
 	}
 }
 
@@ -219,8 +202,11 @@ void Job1541::WriteSector(void)
 	uint16 buf = ram[0x30] | (ram[0x31] << 8);
 
 	if (buf <= 0x0700)
-		if (write_sector(track, sector, ram + buf))
-			sector2gcr(track, sector);
+		if (write_sector(track, sector, ram + buf)) {
+			uint8 *gcr = cached_track(track);
+			if (gcr)
+				sector2gcr(track, sector, gcr);
+		}
 }
 
 
@@ -243,9 +229,11 @@ void Job1541::FormatTrack(void)
 	buf[0] = 0x4b;
 
 	// Write block to all sectors on track
+	uint8 *gcr = cached_track(track);
 	for(int sector=0; sector<num_sectors[track]; sector++) {
 		write_sector(track, sector, buf);
-		sector2gcr(track, sector);
+		if (gcr)
+			sector2gcr(track, sector, gcr);
 	}
 
 	// Clear error info (all sectors no error)
@@ -256,21 +244,19 @@ void Job1541::FormatTrack(void)
 
 
 /*
- *  Read sector (256 bytes)
- *  true: success, false: error
+ *  Get sector (256 bytes) in the image
+ *  NULL: error
  */
 
-inline bool Job1541::read_sector(int track, int sector, uint8 *buffer)
+inline const uint8 *Job1541::read_sector(int track, int sector)
 {
 	int offset;
 
 	// Convert track/sector to byte offset in file
-	if ((offset = offset_from_ts(track, sector)) < 0)
-		return false;
+	if (the_image == NULL || (offset = offset_from_ts(track, sector)) < 0)
+		return NULL;
 
-	fseek(the_file, offset + image_header, SEEK_SET);
-	fread(buffer, 256, 1, the_file);
-	return true;
+	return the_image->Sector(offset);
 }
 
 
@@ -284,11 +270,9 @@ inline bool Job1541::write_sector(int track, int sector, uint8 *buffer)
 	int offset;
 
 	// Convert track/sector to byte offset in file
-	if ((offset = offset_from_ts(track, sector)) < 0)
+	if (the_image == NULL || (offset = offset_from_ts(track, sector)) < 0)
 		return false;
-	fseek(the_file, offset + image_header, SEEK_SET);
-	fwrite(buffer, 256, 1, the_file);
-	return true;
+	return the_image->WriteSector(offset, buffer);
 }
 
 
@@ -346,16 +330,17 @@ inline void Job1541::gcr_conv4(uint8 *from, uint8 *to)
 
 
 /*
- *  Create GCR encoded disk data from image
+ *  Create GCR encoded sector in track buffer gcr from image
  */
 
-void Job1541::sector2gcr(int track, int sector)
+void Job1541::sector2gcr(int track, int sector, uint8 *gcr)
 {
-	uint8 block[256];
 	uint8 buf[4];
-	uint8 *p = gcr_data + (track-1) * GCR_TRACK_SIZE + sector * GCR_SECTOR_SIZE;
+	uint8 *p = gcr + sector * GCR_SECTOR_SIZE;
 
-	read_sector(track, sector, block);
+	const uint8 *block = read_sector(track, sector);
+	if (block == NULL)
+		return;
 
 	// Create GCR header
 	*p++ = 0xff;							// SYNC
@@ -399,12 +384,62 @@ void Job1541::sector2gcr(int track, int sector)
 	memset(p, 0x55, 8);						// Gap
 }
 
-void Job1541::disk2gcr(void)
+/*
+ *  Encoded tracks are kept in GCR_CACHED_TRACKS buffers, the least
+ *  recently used one is reused for the next track
+ */
+
+// Buffer of track, NULL if it is not encoded
+uint8 *Job1541::cached_track(int track)
+{
+	for (int i=0; i<GCR_CACHED_TRACKS; i++)
+		if (gcr_track_num[i] == track)
+			return gcr_tracks[i];
+	return NULL;
+}
+
+// Buffer of track, encoded from the image if necessary
+uint8 *Job1541::load_track(int track)
+{
+	int lru = 0;
+	for (int i=0; i<GCR_CACHED_TRACKS; i++) {
+		if (gcr_track_num[i] == track) {
+			gcr_track_used[i] = ++gcr_clock;
+			return gcr_tracks[i];
+		}
+		if (gcr_track_used[i] < gcr_track_used[lru])
+			lru = i;
+	}
+
+	if (gcr_tracks[lru] == NULL)
+		gcr_tracks[lru] = new uint8[GCR_TRACK_SIZE];
+	uint8 *gcr = gcr_tracks[lru];
+	gcr_track_num[lru] = track;
+	gcr_track_used[lru] = ++gcr_clock;
+
+	memset(gcr, 0x55, GCR_TRACK_SIZE);		// No disk
+	for (int sector=0; sector<num_sectors[track]; sector++)
+		sector2gcr(track, sector, gcr);
+	return gcr;
+}
+
+// Forget all encoded tracks (disk changed)
+void Job1541::flush_tracks(void)
+{
+	for (int i=0; i<GCR_CACHED_TRACKS; i++) {
+		gcr_track_num[i] = 0;
+		gcr_track_used[i] = 0;
+	}
+}
+
+// Encode the track under the head again, the head keeps its position
+void Job1541::set_track(void)
 {
-	// Convert all tracks and sectors
-	for (int track=1; track<=NUM_TRACKS; track++)
-		for(int sector=0; sector<num_sectors[track]; sector++)
-			sector2gcr(track, sector);
+	int track = current_halftrack >> 1;
+	int pos = gcr_ptr - gcr_track_start;
+	gcr_track_start = load_track(track);
+	gcr_track_end = gcr_track_start + num_sectors[track] * GCR_SECTOR_SIZE;
+	gcr_ptr = gcr_track_start + pos;
 }
 
 
@@ -420,7 +455,7 @@ void Job1541::MoveHeadOut(void)
 #ifndef __riscos__
 	printf("Head move %d\n", current_halftrack);
 #endif
-	gcr_ptr = gcr_track_start = gcr_data + ((current_halftrack >> 1) - 1) * GCR_TRACK_SIZE;
+	gcr_ptr = gcr_track_start = load_track(current_halftrack >> 1);
 	gcr_track_end = gcr_track_start + num_sectors[current_halftrack >> 1] * GCR_SECTOR_SIZE;
 }
 
@@ -437,7 +472,7 @@ void Job1541::MoveHeadIn(void)
 #ifndef __riscos__
 	printf("Head move %d\n", current_halftrack);
 #endif
-	gcr_ptr = gcr_track_start = gcr_data + ((current_halftrack >> 1) - 1) * GCR_TRACK_SIZE;
+	gcr_ptr = gcr_track_start = load_track(current_halftrack >> 1);
 	gcr_track_end = gcr_track_start + num_sectors[current_halftrack >> 1] * GCR_SECTOR_SIZE;
 }
 
@@ -449,7 +484,7 @@ void Job1541::MoveHeadIn(void)
 void Job1541::GetState(Job1541State *state)
 {
 	state->current_halftrack = current_halftrack;
-	state->gcr_ptr = gcr_ptr - gcr_data;
+	state->gcr_ptr = ((current_halftrack >> 1) - 1) * GCR_TRACK_SIZE + (gcr_ptr - gcr_track_start);	// Offset in the whole disk
 	state->write_protected = write_protected;
 	state->disk_changed = disk_changed;
 }
@@ -462,9 +497,9 @@ void Job1541::GetState(Job1541State *state)
 void Job1541::SetState(Job1541State *state)
 {
 	current_halftrack = state->current_halftrack;
-	gcr_ptr = gcr_data + state->gcr_ptr;
-	gcr_track_start = gcr_data + ((current_halftrack >> 1) - 1) * GCR_TRACK_SIZE;
+	gcr_ptr = gcr_track_start = load_track(current_halftrack >> 1);
 	gcr_track_end = gcr_track_start + num_sectors[current_halftrack >> 1] * GCR_SECTOR_SIZE;
+	gcr_ptr += state->gcr_ptr - ((current_halftrack >> 1) - 1) * GCR_TRACK_SIZE;
 	write_protected = state->write_protected;
 	disk_changed = state->disk_changed;
 }
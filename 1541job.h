@@ -29,11 +29,15 @@
 
 class MOS6502_1541;
 class Prefs;
+class D64Image;
+
+// Number of GCR encoded tracks kept in memory
+const int GCR_CACHED_TRACKS = 8;
 struct Job1541State;
 
 class Job1541 {
 public:
-	Job1541(uint8 *ram1541);
+	Job1541(uint8 *ram1541, Prefs *prefs);
 	~Job1541();
 
 	void GetState(Job1541State *state);
@@ -50,23 +54,30 @@ public:
 private:
 	void open_d64_file(char *filepath);
 	void close_d64_file(void);
-	bool read_sector(int track, int sector, uint8 *buffer);
+	const uint8 *read_sector(int track, int sector);
 	bool write_sector(int track, int sector, uint8 *buffer);
 	void format_disk(void);
 	int secnum_from_ts(int track, int sector);
 	int offset_from_ts(int track, int sector);
 	void gcr_conv4(uint8 *from, uint8 *to);
-	void sector2gcr(int track, int sector);
-	void disk2gcr(void);
+	void sector2gcr(int track, int sector, uint8 *gcr);
+	uint8 *cached_track(int track);
+	uint8 *load_track(int track);
+	void flush_tracks(void);
+	void set_track(void);
 
 	uint8 *ram;				// Pointer to 1541 RAM
-	FILE *the_file;			// File pointer for .d64 file
-	int image_header;		// Length of .d64/.x64 file header
+	Prefs *the_prefs;		// Pointer to preferences of the C64
+	D64Image *the_image;	// Mapped .d64 file
 
 	uint8 id1, id2;			// ID of disk
 	uint8 error_info[683];	// Sector error information (1 byte/sector)
 
-	uint8 *gcr_data;		// Pointer to GCR encoded disk data
+	uint8 *gcr_tracks[GCR_CACHED_TRACKS];	// GCR encoded tracks, allocated on first use
+	int gcr_track_num[GCR_CACHED_TRACKS];	// Track in each buffer, 0 if none
+	uint32 gcr_track_used[GCR_CACHED_TRACKS];	// gcr_clock at the last use of each buffer
+	uint32 gcr_clock;
+
 	uint8 *gcr_ptr;			// Pointer to GCR data under R/W head
 	uint8 *gcr_track_start;	// Pointer to start of GCR data of current track
 	uint8 *gcr_track_end;	// Pointer to end of GCR data of current track
@@ -43,6 +43,7 @@
 #include "sysdeps.h"
 
 #include "1541t64.h"
+#include "DirIndex.h"
 #include "IEC.h"
 #include "Prefs.h"
 
@@ -69,6 +70,7 @@ T64Drive::T64Drive(IEC *iec, char *filepath) : Drive(iec)
 {
 	the_file = NULL;
 	file_info = NULL;
+	dir_index = new DirIndex(0);
 
 	Ready = false;
 	strcpy(orig_t64_name, filepath);
@@ -93,6 +95,7 @@ T64Drive::~T64Drive()
 	// Close .t64 file
 	open_close_t64_file("");
 
+	delete dir_index;
 	Ready = false;
 }
 
@@ -113,6 +116,7 @@ void T64Drive::open_close_t64_file(const char *t64name)
 		the_file = NULL;
 		delete[] file_info;
 		file_info = NULL;
+		dir_index->Clear();
 	}
 
 	// Open new .t64 file
@@ -136,6 +140,10 @@ void T64Drive::open_close_t64_file(const char *t64name)
 				file_info = NULL;
 				return;
 			}
+
+			// Index the file names
+			for (int i=0; i<num_files; i++)
+				dir_index->Add((uint8 *)file_info[i].name);
 		}
 	}
 }
@@ -434,9 +442,11 @@ static bool match(char *p, char *n)
 
 bool T64Drive::find_first_file(char *name, int type, int *num)
 {
-	for (int i=0; i<num_files; i++)
-		if (match(name, file_info[i].name) && type == file_info[i].type) {
-			*num = i;
+	int count;
+	const int *entries = dir_index->Candidates(name, &count);
+	for (int i=0; i<count; i++)
+		if (match(name, file_info[entries[i]].name) && type == file_info[entries[i]].type) {
+			*num = entries[i];
 			return true;
 		}
 
@@ -454,7 +464,7 @@ uint8 T64Drive::open_directory(int channel, char *filename)
 	char str[NAMEBUF_LENGTH];
 	char pattern[NAMEBUF_LENGTH];
 	char *p, *q;
-	int i, num;
+	int i, num, count;
 	int filemode;
 	int filetype;
 
@@ -476,7 +486,9 @@ uint8 T64Drive::open_directory(int channel, char *filename)
 	fwrite(buf, 1, 32, file[channel]);
 
 	// Create and write one line for every directory entry
-	for (num=0; num<num_files; num++) {
+	const int *entries = dir_index->Candidates(pattern, &count);
+	for (int k=0; k<count; k++) {
+		num = entries[k];
 
 		// Include only files matching the pattern
 		if (match(pattern, file_info[num].name)) {
@@ -28,6 +28,7 @@
 
 #include "IEC.h"
 
+class DirIndex;
 
 // Information for file inside a .t64 file
 typedef struct {
@@ -71,6 +72,7 @@ private:
 
 	int num_files;			// Number of files in .t64 file and in file_info array
 	FileInfo *file_info;	// Pointer to array of file information structs for each file
+	DirIndex *dir_index;	// Names of file_info
 
 	char cmd_buffer[44];	// Buffer for incoming command strings
 	int cmd_len;			// Length of received command
@@ -27,12 +27,15 @@
 #define _C64_H
 
 #include "frodo_types.h"
-#include <CoreFoundation/CFDate.h>
+#include <sys/time.h>
 #include "Prefs.h"
+#include "EventQueue.h"
+#include "FrameSkip.h"
 
 #if !defined(_DISTRIBUTION)
 #define NPERFORMANCE_COUNTERS
 #define NPROFILE_VBLANK
+#define NPROFILE_6510
 #endif
 
 class C64Display;
@@ -48,14 +51,16 @@ class CmdPipe;
 class Keyboard;
 class CTouchStick;
 class CJoyStick;
+class ROMArena;
 struct lua_State;
 
 class C64 {
 public:
-	C64();
+	C64(ROMArena *roms, const Prefs &initial_prefs = ThePrefs);
 	~C64();
 
-	void Run(bool autoBoot);
+	void Run(bool autoBoot, uint32 max_frames = 0);
+	void RunFrames(uint32 frames);
 	void Quit(void);
 	void Pause(void);
 	void Resume(void);
@@ -73,8 +78,13 @@ public:
 	
 	void NMI(void);
 	void VBlank(bool draw_frame);
+	int SkipFrames(void);		// Draw every n-th frame
 	void NewPrefs(Prefs *prefs);
-	void PatchKernal(bool fast_reset, bool emul_1541_proc);
+	void PatchKernal(bool fast_reset, bool emul_1541_proc, bool fast_load);
+	void UnshareBasic(void);	// Give this C64 a private BASIC ROM before writing to it
+	void UnshareKernal(void);	// Give this C64 a private Kernal ROM before writing to it
+	static void PatchBasicROM(uint8 *basic);
+	static void PatchKernalROM(uint8 *kernal, const uint8 *orig, int variant);
 	
 	void SaveSnapshot(uint8 *block1, uint8 *block2);
 	bool LoadSnapshot(uint8 *block1, uint8 *block2);
@@ -96,8 +106,15 @@ public:
 	uint16 LoadVICStateOld(uint8 *p);
 	uint16 LoadCIAStateOld(uint8 *p);
 	
+	// Host wall clock in seconds
+	static inline double getAbsoluteTime() {
+		struct timeval tv;
+		gettimeofday(&tv, NULL);
+		return tv.tv_sec + tv.tv_usec / 1000000.0;
+	}
+	
 	inline uint32 getNow() {
-		double now = CFAbsoluteTimeGetCurrent();
+		double now = getAbsoluteTime();
 		now = now - time_start;
 		return (uint32)(now * 1000000UL);
 	};
@@ -112,6 +129,7 @@ public:
 	uint8 *Basic, *Kernal, *Char, *Color;		// C64
 	uint8 *IO_Ram; // Simulate RAM if jmp $dxxxx occurs
 	uint8 *RAM1541, *ROM1541;	// 1541
+	ROMArena *ROMs;				// Shared ROMs and tables; Char and ROM1541 always point into it
 
 	C64Display *TheDisplay;
 	Keyboard *TheKeyboard;		// virtual keyboard to push events
@@ -128,6 +146,10 @@ public:
 	Job1541 *TheJob1541;
 
 	uint32 CycleCounter;
+	EventQueue Events;			// Scheduler of the line-based emulation
+	FrameSkipController FrameSkip;	// Skip factor with Prefs::AdaptiveFrameSkip
+	
+	Prefs prefs;				// Preferences of this C64 (the global ThePrefs only seeds them)
 		
 #pragma mark Private Members
 private:
@@ -137,24 +159,38 @@ private:
 	void installAutoBootHandler();
 	void installReadyHandler();
 	void installStartupRoutine();
+	void select_kernal(int variant);
 	
 	void installLuaScript();
 	
 	void c64_ctor1(void);
 	uint8 poll_joystick(int port);
 	void thread_func(void);
+	void schedule_line_events(uint32 time);
+	void set_event_driven(bool on);
+	void dispatch_events(void);
+	void run_cpus(int from, int to);
 
 	bool thread_running;	// Emulation thread is running
 	bool quit_thyself;		// Emulation thread shall quit
 	bool have_a_break;		// Emulation thread shall pause
 	bool in_pause_loop;
+	bool auto_booting;
+	uint32 frame_limit;		// Frames left until the emulation thread quits (0: unlimited)
 
 	int joy_minx, joy_maxx, joy_miny, joy_maxy; // For dynamic joystick calibration
 
-	uint8 orig_kernal_1d84,	// Original contents of kernal locations $1d84 and $1d85
-		  orig_kernal_1d85;	// (for undoing the Fast Reset patch)
+	trap_t auto_boot_trap;	// Kernal traps installed by this C64
+	trap_t ready_trap;
+	
+	uint8 *basic_copy;		// Private BASIC and Kernal ROMs, NULL while they are shared
+	uint8 *kernal_copy;
+	int kernal_variant;		// Patches in the Kernal (KERNAL_*, see ROMArena.h)
+	
 	
 	uint32 tv_start, time_last;
+	uint32 frame_start;		// Host time the current frame started
+	int frames_since_draw;	// Frames emulated since the last drawn one, including the current one
 	double speed_index;
 	static double time_start;
 	
@@ -173,6 +209,7 @@ private:
 	uint32 seed;
 	bool SwitchToSC;
 	bool SwitchToStandard;
+	int line_cycles;		// 6510 cycles of the current raster line
 };
 
 
@@ -37,17 +37,20 @@
 #include "Prefs.h"
 #include "Keyboard.h"
 #include "JoyStick.h"
+#include "ROMArena.h"
 #include <sys/time.h>
+#if !defined(FRODO_HEADLESS)
 #include "frodo_lua.h"
+#endif
 
 const double FRAME_TIMER = 1 / (double)SCREEN_FREQ;
-double C64::time_start = CFAbsoluteTimeGetCurrent();
+double C64::time_start = C64::getAbsoluteTime();
 
 /*
  *  Constructor: Allocate objects and memory
  */
 
-C64::C64()
+C64::C64(ROMArena *roms, const Prefs &initial_prefs) : prefs(initial_prefs)
 {
 	int i,j;
 	uint8 *p;
@@ -57,6 +60,7 @@ C64::C64()
 	quit_thyself = false;
 	have_a_break = false;
 	in_pause_loop = false;
+	auto_booting = false;
 	
 	// System-dependent things
 	c64_ctor1();
@@ -69,27 +73,32 @@ C64::C64()
 	// Open display
 	TheDisplay = new C64Display(this);
 	
-	// Allocate RAM/ROM memory
+	// Allocate RAM, the ROMs are shared until written to (see UnshareBasic())
+	ROMs = roms;
+	ROMs->Retain();
+	basic_copy = kernal_copy = NULL;
+	kernal_variant = 0;
+	
 	RAM = new uint8[0x10000];
-	Basic = new uint8[0x2000];
-	Kernal = new uint8[0x2000];
-	Char = new uint8[0x1000];
+	Basic = (uint8 *)ROMs->Basic;
+	Kernal = (uint8 *)ROMs->Kernal;
+	Char = (uint8 *)ROMs->Char;
 	Color = new uint8[0x0400];
 	RAM1541 = new uint8[0x0800];
-	ROM1541 = new uint8[0x4000];
+	ROM1541 = (uint8 *)ROMs->ROM1541;
 	IO_Ram = new uint8[0x1000];
 	
 	// Create the chips
 	TheCPU = new MOS6510(this, RAM, Basic, Kernal, Char, Color, IO_Ram);
 	
-	TheJob1541 = new Job1541(RAM1541);
+	TheJob1541 = new Job1541(RAM1541, &prefs);
 	TheCPU1541 = new MOS6502_1541(this, TheJob1541, TheDisplay, RAM1541, ROM1541);
 	
 	TheVIC = TheCPU->TheVIC = new MOS6569(this, TheDisplay, TheCPU, RAM, Char, Color);
 	TheSID = TheCPU->TheSID = new MOS6581(this);
 	TheCIA1 = TheCPU->TheCIA1 = new MOS6526_1(TheCPU, TheVIC);
 	TheCIA2 = TheCPU->TheCIA2 = TheCPU1541->TheCIA2 = new MOS6526_2(TheCPU, TheVIC, TheCPU1541);
-	TheIEC = TheCPU->TheIEC = new IEC(TheDisplay);
+	TheIEC = TheCPU->TheIEC = new IEC(TheDisplay, &prefs);
 	
 	// Initialize RAM with powerup pattern
 	for (i=0, p=RAM; i<512; i++) {
@@ -109,8 +118,14 @@ C64::C64()
 	
 	CycleCounter = 0;
 	
+	line_cycles = 0;
+	schedule_line_events(Events.Now());
+	Events.StartLine(Events.Now() - CYCLES_PER_LINE);	// No line counted yet
+	set_event_driven(prefs.TimerEvents);
+	
 	SwitchToSC = false;
 	SwitchToStandard = false;
+	frame_limit = 0;
 	
 	LUA = NULL;
 }
@@ -123,9 +138,11 @@ C64::C64()
 C64::~C64()
 {
 	TheCPU->ClearTraps();
+#if !defined(FRODO_HEADLESS)
 	if (LUA) {
 		lua_closeFrodo(LUA);
 	}
+#endif
 	
 	delete TheJob1541;
 	delete TheIEC;
@@ -137,16 +154,44 @@ C64::~C64()
 	delete TheCPU;
 	delete TheDisplay;
 	delete TheKeyboard;
-	delete TheJoyStick;
+	// TheJoyStick points to the shared gTheJoystick
 	
 	delete[] RAM;
-	delete[] Basic;
-	delete[] Kernal;
-	delete[] Char;
+	delete[] basic_copy;
+	delete[] kernal_copy;
 	delete[] Color;
 	delete[] RAM1541;
-	delete[] ROM1541;
 	delete[] IO_Ram;
+	ROMs->Release();
+}
+
+
+/*
+ *  Copy the BASIC or Kernal ROM out of the shared arena, which is
+ *  read-only. Must be called before anything but PatchKernal() writes
+ *  to it.
+ */
+
+void C64::UnshareBasic(void)
+{
+	if (basic_copy)
+		return;
+	
+	basic_copy = new uint8[0x2000];
+	memcpy(basic_copy, Basic, 0x2000);
+	Basic = basic_copy;
+	TheCPU->NewROMs(Basic, Kernal);
+}
+
+void C64::UnshareKernal(void)
+{
+	if (kernal_copy)
+		return;
+	
+	kernal_copy = new uint8[0x2000];
+	memcpy(kernal_copy, Kernal, 0x2000);
+	Kernal = kernal_copy;
+	TheCPU->NewROMs(Basic, Kernal);
 }
 
 
@@ -167,8 +212,6 @@ void C64::Reset(void)
 	TheIEC->Reset();
 }
 
-bool auto_booting = false;
-
 trap_result_t C64::auto_boot(MOS6510 *TheCPU, void *d) {
 	TheCPU->the_c64->TheKeyboard->QueueKeyEvent(KeyCode_SHIFT_RUNSTOP, KeyStateDown);
 	TheCPU->the_c64->TheKeyboard->QueueKeyEvent(Keyboard::HoldKey);
@@ -177,7 +220,7 @@ trap_result_t C64::auto_boot(MOS6510 *TheCPU, void *d) {
 }
 
 trap_result_t C64::intercept_ready_handler(MOS6510 *TheCPU, void *d) {
-	if (auto_booting) return TRAP_REDO;
+	if (TheCPU->the_c64->auto_booting) return TRAP_REDO;
 	
 	TheCPU->the_c64->installStartupRoutine();
 	TheCPU->AsyncReset();
@@ -187,36 +230,39 @@ trap_result_t C64::intercept_ready_handler(MOS6510 *TheCPU, void *d) {
 // Resets the C64 and auto-boots the currently loaded disk image
 void C64::ResetAndAutoboot() {
 	// re-enables standard boot sequence
-	Kernal[0x039b] = 0x22;
-	Kernal[0x039c] = 0xe4;
+	select_kernal(kernal_variant | KERNAL_AUTO_BOOT);
 
 	Reset();
 	installAutoBootHandler();
 }
 
 void C64::installAutoBootHandler() {
-	static trap_t trap = { NULL, false, 0xE5CD, 0xA5, 0xC6, 0x85, (trap_handler_t)&C64::auto_boot, NULL, NULL };
+	const trap_t trap = { NULL, false, 0xE5CD, 0xA5, 0xC6, 0x85, (trap_handler_t)&C64::auto_boot, NULL, NULL };
 	installLuaScript();
-	TheCPU->InstallTrap(&trap);
+	auto_boot_trap = trap;
+	TheCPU->InstallTrap(&auto_boot_trap);
 }
 
 void C64::installReadyHandler() {
-	static trap_t trap = { NULL, false, 0xA47D, 0x20, 0x90, 0xFF, (trap_handler_t)&C64::intercept_ready_handler, NULL, NULL };
-	TheCPU->InstallTrap(&trap);
+	const trap_t trap = { NULL, false, 0xA47D, 0x20, 0x90, 0xFF, (trap_handler_t)&C64::intercept_ready_handler, NULL, NULL };
+	ready_trap = trap;
+	TheCPU->InstallTrap(&ready_trap);
 }
 
 void C64::installLuaScript() {
 	TheCPU->ClearTraps();
 
+#if !defined(FRODO_HEADLESS)
 	// run lua script
 	if (LUA) {
 		lua_closeFrodo(LUA);
 		LUA = NULL;
 	}
 	
-	if (ThePrefs.LuaScriptPath[0] != '\0') {
-		LUA = lua_openFrodo(ThePrefs.LuaScriptPath);
+	if (prefs.LuaScriptPath[0] != '\0') {
+		LUA = lua_openFrodo(this, prefs.LuaScriptPath);
 	}
+#endif
 }	
 
 /*
@@ -230,35 +276,51 @@ void C64::NMI(void)
 
 
 /*
- *  The preferences have changed. prefs is a pointer to the new
- *   preferences, ThePrefs still holds the previous ones.
- *   The emulation must be in the paused state!
+ *  The preferences have changed. new_prefs is a pointer to the new
+ *   preferences, prefs still holds the previous ones until the chips
+ *   have been notified. The emulation must be in the paused state!
  */
 
-void C64::NewPrefs(Prefs *prefs)
+void C64::NewPrefs(Prefs *new_prefs)
 {
-	PatchKernal(prefs->FastReset, prefs->Emul1541Proc);
-	TheIEC->NewPrefs(prefs);
-	TheJob1541->NewPrefs(prefs);
-	TheSID->NewPrefs(prefs);
-	TheVIC->NewPrefs(prefs);
-	
-	if(!ThePrefs.SingleCycleEmulation && prefs->SingleCycleEmulation)
+	PatchKernal(new_prefs->FastReset, new_prefs->Emul1541Proc, new_prefs->FastLoad);
+	TheIEC->NewPrefs(new_prefs);
+	TheJob1541->NewPrefs(new_prefs);
+	TheSID->NewPrefs(new_prefs);
+	TheVIC->NewPrefs(new_prefs);
+	TheDisplay->NewPrefs(new_prefs);
+	
+	if(!prefs.SingleCycleEmulation && new_prefs->SingleCycleEmulation)
 	{
 		// Single cycle emulation switched on
 		SwitchToSC = true;
 	}
 	
-	if(ThePrefs.SingleCycleEmulation && !prefs->SingleCycleEmulation)
+	if(prefs.SingleCycleEmulation && !new_prefs->SingleCycleEmulation)
 	{
 		// Single cycle emulation switched off
 		SwitchToStandard = true;
 	}
+	// Start the adaptive frame skipping from the fixed factor
+	bool adaptive = prefs.AdaptiveFrameSkip && prefs.LimitSpeed;
+	if (!adaptive && new_prefs->AdaptiveFrameSkip && new_prefs->LimitSpeed)
+		FrameSkip.Reset(new_prefs->SkipFrames);
+	
 	// Reset 1541 processor if turned on
-	if (!ThePrefs.Emul1541Proc && prefs->Emul1541Proc)
+	if (!prefs.Emul1541Proc && new_prefs->Emul1541Proc)
 	{
 		TheCPU1541->AsyncReset();
 	}
+	
+	// Bring the timers up to date with the old CIACycles/FloppyCycles
+	set_event_driven(false);
+	bool sid_changed = prefs.SIDOn != new_prefs->SIDOn;
+	
+	prefs = *new_prefs;
+	
+	set_event_driven(prefs.TimerEvents);
+	if (sid_changed)
+		schedule_line_events(Events.Time(EVENT_LINE));
 }
 
 /* this patch changes the startup message to 
@@ -351,95 +413,140 @@ void C64::installStartupRoutine() {
 		RAM[i] = p[j];
 	}
 	
-	Kernal[0x039b] = 0x00;
-	Kernal[0x039c] = 0xc0;
+	select_kernal(kernal_variant & ~KERNAL_AUTO_BOOT);
+}
+
+/*
+ *  Patch kernal IEC routines, select the patched BASIC and Kernal
+ */
+
+void C64::PatchKernal(bool fast_reset, bool emul_1541_proc, bool fast_load)
+{
+	if (basic_copy)
+		PatchBasicROM(basic_copy);
+	else
+		Basic = (uint8 *)ROMs->PatchedBasic;
+	
+	kernal_variant = (fast_reset ? KERNAL_FAST_RESET : 0)
+				   | (emul_1541_proc ? KERNAL_EMUL_1541_PROC : 0)
+				   | (fast_load ? KERNAL_FAST_LOAD : 0);
+	installStartupRoutine();
+}
+
+
+/*
+ *  Use the given variant of the patched Kernal: the shared one from the
+ *  ROMArena, or patch the private copy
+ */
+
+void C64::select_kernal(int variant)
+{
+	kernal_variant = variant;
+	if (kernal_copy)
+		PatchKernalROM(kernal_copy, ROMs->Kernal, variant);
+	else
+		Kernal = (uint8 *)ROMs->PatchedKernal[variant];
+	TheCPU->NewROMs(Basic, Kernal);
 }
 
+
 /*
- *  Patch kernal IEC routines
+ *  Apply the patches of PatchKernal() to a BASIC ROM image
  */
 
-void C64::PatchKernal(bool fast_reset, bool emul_1541_proc)
+void C64::PatchBasicROM(uint8 *basic)
 {
-	if (fast_reset) {
-		Kernal[0x1d84] = 0xa0;
-		Kernal[0x1d85] = 0x00;
+	basic[0x059d]		= 0xFF;	// disable ? (PRINT) command
+	basic[0x05a5]		= 0xFF;	// disable ability to enter line numbers
+	
+	// remove basic commands
+	for (int i=0x9e, j=0; i < 0x9e + 0x100; i++, j++) {
+		basic[i] = basic_patch1[j];
+	}
+}
+
+
+/*
+ *  Apply the patches of a Kernal variant (KERNAL_*) to a Kernal ROM
+ *  image, orig is the unpatched Kernal
+ */
+
+void C64::PatchKernalROM(uint8 *kernal, const uint8 *orig, int variant)
+{
+	if (variant & KERNAL_FAST_RESET) {
+		kernal[0x1d84] = 0xa0;
+		kernal[0x1d85] = 0x00;
 	} else {
-		Kernal[0x1d84] = orig_kernal_1d84;
-		Kernal[0x1d85] = orig_kernal_1d85;
+		kernal[0x1d84] = orig[0x1d84];
+		kernal[0x1d85] = orig[0x1d85];
 	}
 	
-	if (emul_1541_proc) {
-		Kernal[0x0d40] = 0x78;
-		Kernal[0x0d41] = 0x20;
-		Kernal[0x0d23] = 0x78;
-		Kernal[0x0d24] = 0x20;
-		Kernal[0x0d36] = 0x78;
-		Kernal[0x0d37] = 0x20;
-		Kernal[0x0e13] = 0x78;
-		Kernal[0x0e14] = 0xa9;
-		Kernal[0x0def] = 0x78;
-		Kernal[0x0df0] = 0x20;
-		Kernal[0x0dbe] = 0xad;
-		Kernal[0x0dbf] = 0x00;
-		Kernal[0x0dcc] = 0x78;
-		Kernal[0x0dcd] = 0x20;
-		Kernal[0x0e03] = 0x20;
-		Kernal[0x0e04] = 0xbe;
+	if (variant & KERNAL_EMUL_1541_PROC) {
+		kernal[0x0d40] = 0x78;
+		kernal[0x0d41] = 0x20;
+		kernal[0x0d23] = 0x78;
+		kernal[0x0d24] = 0x20;
+		kernal[0x0d36] = 0x78;
+		kernal[0x0d37] = 0x20;
+		kernal[0x0e13] = 0x78;
+		kernal[0x0e14] = 0xa9;
+		kernal[0x0def] = 0x78;
+		kernal[0x0df0] = 0x20;
+		kernal[0x0dbe] = 0xad;
+		kernal[0x0dbf] = 0x00;
+		kernal[0x0dcc] = 0x78;
+		kernal[0x0dcd] = 0x20;
+		kernal[0x0e03] = 0x20;
+		kernal[0x0e04] = 0xbe;
+	} else {
+		kernal[0x0d40] = 0xf2;	// IECOut
+		kernal[0x0d41] = 0x00;
+		kernal[0x0d23] = 0xf2;	// IECOutATN
+		kernal[0x0d24] = 0x01;
+		kernal[0x0d36] = 0xf2;	// IECOutSec
+		kernal[0x0d37] = 0x02;
+		kernal[0x0e13] = 0xf2;	// IECIn
+		kernal[0x0e14] = 0x03;
+		kernal[0x0def] = 0xf2;	// IECSetATN
+		kernal[0x0df0] = 0x04;
+		kernal[0x0dbe] = 0xf2;	// IECRelATN
+		kernal[0x0dbf] = 0x05;
+		kernal[0x0dcc] = 0xf2;	// IECTurnaround
+		kernal[0x0dcd] = 0x06;
+		kernal[0x0e03] = 0xf2;	// IECRelease
+		kernal[0x0e04] = 0x07;
+	}
+
+	// Byte loop of LOAD from serial devices
+	if ((variant & KERNAL_FAST_LOAD) && !(variant & KERNAL_EMUL_1541_PROC)) {
+		kernal[0x14f3] = 0xf2;	// FastLoad
+		kernal[0x14f4] = 0x08;
 	} else {
-		Kernal[0x0d40] = 0xf2;	// IECOut
-		Kernal[0x0d41] = 0x00;
-		Kernal[0x0d23] = 0xf2;	// IECOutATN
-		Kernal[0x0d24] = 0x01;
-		Kernal[0x0d36] = 0xf2;	// IECOutSec
-		Kernal[0x0d37] = 0x02;
-		Kernal[0x0e13] = 0xf2;	// IECIn
-		Kernal[0x0e14] = 0x03;
-		Kernal[0x0def] = 0xf2;	// IECSetATN
-		Kernal[0x0df0] = 0x04;
-		Kernal[0x0dbe] = 0xf2;	// IECRelATN
-		Kernal[0x0dbf] = 0x05;
-		Kernal[0x0dcc] = 0xf2;	// IECTurnaround
-		Kernal[0x0dcd] = 0x06;
-		Kernal[0x0e03] = 0xf2;	// IECRelease
-		Kernal[0x0e04] = 0x07;
+		kernal[0x14f3] = orig[0x14f3];
+		kernal[0x14f4] = orig[0x14f4];
 	}
 	
-	// 1541
-	ROM1541[0x2ae4] = 0xea;		// Don't check ROM checksum
-	ROM1541[0x2ae5] = 0xea;
-	ROM1541[0x2ae8] = 0xea;
-	ROM1541[0x2ae9] = 0xea;
-	ROM1541[0x2c9b] = 0xf2;		// DOS idle loop
-	ROM1541[0x2c9c] = 0x00;
-	ROM1541[0x3594] = 0x20;		// Write sector
-	ROM1541[0x3595] = 0xf2;
-	ROM1541[0x3596] = 0xf5;
-	ROM1541[0x3597] = 0xf2;
-	ROM1541[0x3598] = 0x01;
-	ROM1541[0x3b0c] = 0xf2;		// Format track
-	ROM1541[0x3b0d] = 0x02;
-	
-	//return;
+	// The 1541 ROM is patched once by ROMArena::Create()
+	
 	// disable STOP key in basic, to prevent disks / tapes from loading
 	// CMP #$80 (replaces CMP #$7F, which tests STOP key)
 	// $80 is just a dummy value
-	Kernal[0x16f0]	= 0x80;	
-	
-	Basic[0x059d]		= 0xFF;	// disable ? (PRINT) command
-	Basic[0x05a5]		= 0xFF;	// disable ability to enter line numbers
-	
-	// remove basic commands
-	for (int i=0x9e, j=0; i < 0x9e + 0x100; i++, j++) {
-		Basic[i] = basic_patch1[j];
-	}
+	kernal[0x16f0]	= 0x80;	
 	
 	// update BASIC startup message
 	for (int i=0x460, j=0; i < 0x460+0x4c; i++, j++) {
-		Kernal[i] = kernal_patch1[j];
+		kernal[i] = kernal_patch1[j];
 	}
 	
-	installStartupRoutine();
+	if (variant & KERNAL_AUTO_BOOT) {
+		// standard boot sequence, to load a game
+		kernal[0x039b] = 0x22;
+		kernal[0x039c] = 0xe4;
+	} else {
+		// boot into the startup routine (see installStartupRoutine())
+		kernal[0x039b] = 0x00;
+		kernal[0x039c] = 0xc0;
+	}
 }
 
 
@@ -451,7 +558,7 @@ void C64::PatchKernal(bool fast_reset, bool emul_1541_proc)
 
 uint32 C64::SaveCPUState(uint8 *p1, uint8 *p2)
 {
-	MOS6510State *state = (MOS6510State *) (((UInt32) p2+0x8000+0x403) & 0xfffffffc);
+	MOS6510State *state = (MOS6510State *) (((uintptr_t) p2+0x8000+0x403) & ~(uintptr_t)3);
 	TheCPU->GetState(state);
 	
 	memcpy(p1, RAM, 0x8000);
@@ -462,7 +569,7 @@ uint32 C64::SaveCPUState(uint8 *p1, uint8 *p2)
 	// p1 now contains 36k of memory
 	// p2 contains other 32k, then Color and CPU state
 	
-	return ((UInt32) state + sizeof(MOS6510State) - (UInt32) p2);
+	return ((uintptr_t) state + sizeof(MOS6510State) - (uintptr_t) p2);
 }
 
 
@@ -472,7 +579,7 @@ uint32 C64::SaveCPUState(uint8 *p1, uint8 *p2)
 
 uint16 C64::LoadCPUState(uint8 *p1, uint8 *p2)
 {
-	MOS6510State *state = (MOS6510State *) (((UInt32) p2+0x8000+0x403) & 0xfffffffc);
+	MOS6510State *state = (MOS6510State *) (((uintptr_t) p2+0x8000+0x403) & ~(uintptr_t)3);
 	
 	memcpy(RAM, p1, 0x8000);
 	memcpy(IO_Ram, p1+0x8000, 0x1000);
@@ -480,13 +587,13 @@ uint16 C64::LoadCPUState(uint8 *p1, uint8 *p2)
 	memcpy(Color, p2+0x8000, 0x400);
 	TheCPU->SetState(state);
 	
-	return ((UInt32) state + sizeof(MOS6510State) - (UInt32) p2);
+	return ((uintptr_t) state + sizeof(MOS6510State) - (uintptr_t) p2);
 }
 
 uint16 C64::LoadCPUStateOld(uint8 *p1, uint8 *p2)
 {
 	MOS6510State state;
-	MOS6510StateOld *stateOld = (MOS6510StateOld *) (((UInt32) p2+0x8000+0x403) & 0xfffffffc);
+	MOS6510StateOld *stateOld = (MOS6510StateOld *) (((uintptr_t) p2+0x8000+0x403) & ~(uintptr_t)3);
 	
 	state.ar = 0;
 	state.ar2 = 0;			// Address registers
@@ -519,7 +626,7 @@ uint16 C64::LoadCPUStateOld(uint8 *p1, uint8 *p2)
 	memcpy(Color, p2+0x8000, 0x400);
 	TheCPU->SetState(&state);
 	
-	return ((UInt32) stateOld + sizeof(MOS6510StateOld) - (UInt32) p2);
+	return ((uintptr_t) stateOld + sizeof(MOS6510StateOld) - (uintptr_t) p2);
 }
 
 
@@ -531,12 +638,12 @@ uint16 C64::LoadCPUStateOld(uint8 *p1, uint8 *p2)
 
 uint32 C64::Save1541State(uint8 *p)
 {
-	MOS6502State *state =  (MOS6502State *) ((UInt32) (p+0x803) & 0xfffffffc);
+	MOS6502State *state =  (MOS6502State *) ((uintptr_t) (p+0x803) & ~(uintptr_t)3);
 	TheCPU1541->GetState(state);
 	
 	memcpy(p, RAM1541, 0x800);
 	
-	return ((UInt32) state + sizeof(MOS6502State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(MOS6502State) - (uintptr_t) p);
 }
 
 
@@ -546,18 +653,18 @@ uint32 C64::Save1541State(uint8 *p)
 
 uint16 C64::Load1541State(uint8 *p)
 {
-	MOS6502State *state = (MOS6502State *) ((UInt32) (p+0x803) & 0xfffffffc);
+	MOS6502State *state = (MOS6502State *) ((uintptr_t) (p+0x803) & ~(uintptr_t)3);
 	
 	memcpy(RAM1541, p, 0x800);
 	TheCPU1541->SetState(state);
 	
-	return ((UInt32) state + sizeof(MOS6502State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(MOS6502State) - (uintptr_t) p);
 }
 
 uint16 C64::Load1541StateOld(uint8 *p)
 {
 	MOS6502State state;
-	MOS6502StateOld *stateOld = (MOS6502StateOld *) ((UInt32) (p+0x803) & 0xfffffffc);
+	MOS6502StateOld *stateOld = (MOS6502StateOld *) ((uintptr_t) (p+0x803) & ~(uintptr_t)3);
 	
 	memcpy(&state, stateOld, sizeof(MOS6502StateOld));
 	state.ar = 0;
@@ -569,7 +676,7 @@ uint16 C64::Load1541StateOld(uint8 *p)
 	memcpy(RAM1541, p, 0x800);
 	TheCPU1541->SetState(&state);
 	
-	return ((UInt32) stateOld + sizeof(MOS6502StateOld) - (UInt32) p);
+	return ((uintptr_t) stateOld + sizeof(MOS6502StateOld) - (uintptr_t) p);
 }
 
 
@@ -579,9 +686,9 @@ uint16 C64::Load1541StateOld(uint8 *p)
 
 uint16 C64::SaveVICState(uint8 *p)
 {
-	MOS6569State *state = (MOS6569State *) (((UInt32) p+3) & 0xfffffffc);
+	MOS6569State *state = (MOS6569State *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	TheVIC->GetState(state);
-	return ((UInt32) state + sizeof(MOS6569State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(MOS6569State) - (uintptr_t) p);
 }
 
 
@@ -591,17 +698,17 @@ uint16 C64::SaveVICState(uint8 *p)
 
 uint16 C64::LoadVICState(uint8 *p)
 {
-	MOS6569State *state = (MOS6569State *) (((UInt32) p+3) & 0xfffffffc);
+	MOS6569State *state = (MOS6569State *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	
 	TheVIC->SetState(state);
-	return ((UInt32) state + sizeof(MOS6569State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(MOS6569State) - (uintptr_t) p);
 }
 
 uint16 C64::LoadVICStateOld(uint8 *p)
 {
 	int i;
 	MOS6569State state;
-	MOS6569StateOld *stateOld = (MOS6569StateOld *) (((UInt32) p+3) & 0xfffffffc);
+	MOS6569StateOld *stateOld = (MOS6569StateOld *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	
 	state.m0x = stateOld->m0x;
 	state.m0y = stateOld->m0y;
@@ -689,12 +796,12 @@ uint16 C64::LoadVICStateOld(uint8 *p)
 	for(i=0; i<8; ++i)
 		state.sprite_base[i] = 0;	// Sprite bases
 	state.cycle = 0x102;				// Current cycle in line (1..63)
-	state.raster_x = (UInt16) (0xfffc + 8 * 53);		// Current raster x position
+	state.raster_x = (uint16) (0xfffc + 8 * 53);		// Current raster x position
 	state.ml_index = 0;			// Index in matrix/color_line[]
 	state.ud_border_on = true;		// Flag: Upper/lower border on
 	
 	TheVIC->SetState(&state);
-	return ((UInt32) stateOld + sizeof(MOS6569StateOld) - (UInt32) p);
+	return ((uintptr_t) stateOld + sizeof(MOS6569StateOld) - (uintptr_t) p);
 }
 
 /*
@@ -703,9 +810,9 @@ uint16 C64::LoadVICStateOld(uint8 *p)
 
 uint16 C64::SaveSIDState(uint8 *p)
 {
-	MOS6581State *state = (MOS6581State *) (((UInt32) p+3) & 0xfffffffc);
+	MOS6581State *state = (MOS6581State *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	TheSID->GetState(state);
-	return ((UInt32) state + sizeof(MOS6581State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(MOS6581State) - (uintptr_t) p);
 }
 
 
@@ -715,10 +822,10 @@ uint16 C64::SaveSIDState(uint8 *p)
 
 uint16 C64::LoadSIDState(uint8 *p)
 {
-	MOS6581State *state = (MOS6581State *) (((UInt32) p+3) & 0xfffffffc);
+	MOS6581State *state = (MOS6581State *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	
 	TheSID->SetState(state);
-	return ((UInt32) state + sizeof(MOS6581State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(MOS6581State) - (uintptr_t) p);
 }
 
 
@@ -728,12 +835,12 @@ uint16 C64::LoadSIDState(uint8 *p)
 
 uint16 C64::SaveCIAState(uint8 *p)
 {
-	MOS6526State *state = (MOS6526State *) (((UInt32) p+3) & 0xfffffffc);
+	MOS6526State *state = (MOS6526State *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	TheCIA1->GetState(state);
-	state = (MOS6526State *) (((UInt32) state + sizeof(MOS6526State) + 3) & 0xfffffffc);
+	state = (MOS6526State *) (((uintptr_t) state + sizeof(MOS6526State) + 3) & ~(uintptr_t)3);
 	TheCIA2->GetState(state);
 	
-	return ((UInt32) state + sizeof(MOS6526State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(MOS6526State) - (uintptr_t) p);
 }
 
 
@@ -743,19 +850,19 @@ uint16 C64::SaveCIAState(uint8 *p)
 
 uint16 C64::LoadCIAState(uint8 *p)
 {
-	MOS6526State *state = (MOS6526State *) (((UInt32) p+3) & 0xfffffffc);
+	MOS6526State *state = (MOS6526State *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	
 	TheCIA1->SetState(state);
-	state = (MOS6526State *) (((UInt32) state + sizeof(MOS6526State) + 3) & 0xfffffffc);
+	state = (MOS6526State *) (((uintptr_t) state + sizeof(MOS6526State) + 3) & ~(uintptr_t)3);
 	TheCIA2->SetState(state);
 	
-	return ((UInt32) state + sizeof(MOS6526State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(MOS6526State) - (uintptr_t) p);
 }
 
 uint16 C64::LoadCIAStateOld(uint8 *p)
 {
 	MOS6526State state;
-	MOS6526StateOld *stateOld = (MOS6526StateOld *) (((UInt32) p+3) & 0xfffffffc);
+	MOS6526StateOld *stateOld = (MOS6526StateOld *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	
 	memcpy(&state, stateOld, sizeof(MOS6526StateOld));
 	
@@ -776,7 +883,7 @@ uint16 C64::LoadCIAStateOld(uint8 *p)
 	TheCIA1->SetState(&state);
 	
 	// Same for CIA2
-	stateOld = (MOS6526StateOld *) (((UInt32) stateOld + sizeof(MOS6526StateOld) + 3) & 0xfffffffc);
+	stateOld = (MOS6526StateOld *) (((uintptr_t) stateOld + sizeof(MOS6526StateOld) + 3) & ~(uintptr_t)3);
 	memcpy(&state, stateOld, sizeof(MOS6526StateOld));
 	
 	state.CyclesTillAction = 1;
@@ -795,7 +902,7 @@ uint16 C64::LoadCIAStateOld(uint8 *p)
 	
 	TheCIA2->SetState(&state);
 	
-	return ((UInt32) stateOld + sizeof(MOS6526StateOld) - (UInt32) p);
+	return ((uintptr_t) stateOld + sizeof(MOS6526StateOld) - (uintptr_t) p);
 }
 
 
@@ -805,9 +912,9 @@ uint16 C64::LoadCIAStateOld(uint8 *p)
 
 uint16 C64::Save1541JobState(uint8 *p)
 {
-	Job1541State *state = (Job1541State *) (((UInt32) p+3) & 0xfffffffc);
+	Job1541State *state = (Job1541State *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	TheJob1541->GetState(state);
-	return ((UInt32) state + sizeof(Job1541State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(Job1541State) - (uintptr_t) p);
 }
 
 
@@ -817,10 +924,10 @@ uint16 C64::Save1541JobState(uint8 *p)
 
 uint16 C64::Load1541JobState(uint8 *p)
 {
-	Job1541State *state = (Job1541State *) (((UInt32) p+3) & 0xfffffffc);
+	Job1541State *state = (Job1541State *) (((uintptr_t) p+3) & ~(uintptr_t)3);
 	
 	TheJob1541->SetState(state);
-	return ((UInt32) state + sizeof(Job1541State) - (UInt32) p);
+	return ((uintptr_t) state + sizeof(Job1541State) - (uintptr_t) p);
 }
 
 #define SNAPSHOT_1541 1
@@ -843,7 +950,7 @@ void C64::SaveSnapshot(uint8 *block1, uint8 *block2)
 	*p1++='t'; *p1++='\n';
 	*p1++=SNAPSHOT_VERSION;	// Version number
 	flags = 0;
-	if (ThePrefs.Emul1541Proc)
+	if (prefs.Emul1541Proc)
 		flags |= SNAPSHOT_1541;
 	*p1++=flags;
 	p1+=SaveVICState(p1);
@@ -855,9 +962,9 @@ void C64::SaveSnapshot(uint8 *block1, uint8 *block2)
 	p2+=SaveCPUState(p1, p2);
 	p1+=0x9000;
 	
-	if (ThePrefs.Emul1541Proc) 
+	if (prefs.Emul1541Proc) 
 	{
-		//memcpy(p2, ThePrefs.DrivePath, 256);
+		//memcpy(p2, prefs.DrivePath, 256);
 		memset(p2, 0, 256); // After load of snapshot, we don't have a disk attached
 		p2+=256;
 		
@@ -914,13 +1021,12 @@ bool C64::LoadSnapshot(uint8 *block1, uint8 *block2)
 	if ((flags & SNAPSHOT_1541) != 0) 
 	{
 		// First switch on emulation
-		Prefs &TheNewPrefs = ThePrefs;
+		Prefs &TheNewPrefs = prefs;
 		//memcpy(TheNewPrefs.DrivePath, p2, 256);
 		memset(TheNewPrefs.DrivePath, 0, 256); // No information about disk
 		p2+=256;
 		TheNewPrefs.Emul1541Proc = true;
 		NewPrefs(&TheNewPrefs);
-		ThePrefs = TheNewPrefs;
 		
 		// Then read the context
 		if(bOldSnapshot)
@@ -934,12 +1040,11 @@ bool C64::LoadSnapshot(uint8 *block1, uint8 *block2)
 			p2+=Load1541JobState(p2);
 		}
 	} 
-	else if (ThePrefs.Emul1541Proc) 
+	else if (prefs.Emul1541Proc) 
 	{	// No emulation in snapshot, but currently active?
-		Prefs &TheNewPrefs = ThePrefs;
+		Prefs &TheNewPrefs = prefs;
 		TheNewPrefs.Emul1541Proc = false;
 		NewPrefs(&TheNewPrefs);
-		ThePrefs = TheNewPrefs;
 	}
 	
 	p1=vicptr;
@@ -966,16 +1071,18 @@ struct timeval lastupdate;
 #endif
 
 void C64::c64_ctor1(void) {
-	tv_start = time_last = getNow();
+	tv_start = time_last = frame_start = getNow();
+	frames_since_draw = 0;
+	FrameSkip.Reset(prefs.SkipFrames);
 #if defined(PROFILE_VBLANK)
 	gettimeofday(&lastupdate, NULL);
 #endif
 }
 
 /*
- *  Start emulation
+ *  Start emulation, max_frames > 0 stops the emulation after that many frames
  */
-void C64::Run(bool autoBoot)
+void C64::Run(bool autoBoot, uint32 max_frames)
 {
 	// Reset chips
 	TheCPU->Reset();
@@ -985,19 +1092,17 @@ void C64::Run(bool autoBoot)
 	TheCPU1541->Reset();
 	
 	// Patch kernal IEC routines
-	orig_kernal_1d84 = Kernal[0x1d84];
-	orig_kernal_1d85 = Kernal[0x1d85];
-	PatchKernal(ThePrefs.FastReset, ThePrefs.Emul1541Proc);
+	PatchKernal(prefs.FastReset, prefs.Emul1541Proc, prefs.FastLoad);
 		
 	// Start the CPU thread
 	thread_running = true;
 	quit_thyself = false;
 	have_a_break = false;
+	frame_limit = max_frames;
 	
 	if (autoBoot) {
 		// re-enables standard boot sequence to load game
-		Kernal[0x039b] = 0x22;
-		Kernal[0x039c] = 0xe4;
+		select_kernal(kernal_variant | KERNAL_AUTO_BOOT);
 		
 		installAutoBootHandler();
 	}
@@ -1006,6 +1111,21 @@ void C64::Run(bool autoBoot)
 }
 
 
+/*
+ *  Continue a stopped emulation for the given number of frames,
+ *  without resetting the chips
+ */
+void C64::RunFrames(uint32 frames)
+{
+	thread_running = true;
+	quit_thyself = false;
+	frame_limit = frames;
+	
+	thread_func();
+	thread_running = false;
+}
+
+
 /*
  *  Stop emulation
  */
@@ -1048,14 +1168,14 @@ void C64::VBlank(bool draw_frame)
 	TheDisplay->PollKeyboard(TheCIA1->KeyMatrix, TheCIA1->RevMatrix);
 	
 	// Poll joysticks
-	if (ThePrefs.JoystickSwap)
+	if (prefs.JoystickSwap)
 		TheCIA1->Joystick2 = poll_joystick(0);
 	else
 		TheCIA1->Joystick1 = poll_joystick(0);
 	
 	TheCIA1->UpdateDataPorts();
 	
-	if(ThePrefs.SIDOn)
+	if(prefs.SIDOn)
 		TheSID->VBlank();
 	
 	// Count TOD clocks
@@ -1075,16 +1195,23 @@ void C64::VBlank(bool draw_frame)
 	
 #endif
 	
-	if (draw_frame) {
+	if (draw_frame)
 		TheDisplay->Update();
+	
+	// Host time of this frame, before waiting for real time
+	uint32 now = getNow();
+	if (prefs.AdaptiveFrameSkip && prefs.LimitSpeed)
+		FrameSkip.Frame(draw_frame, now - frame_start, TheVIC->DirtyLineCount());
+	frames_since_draw++;
+	
+	if (draw_frame) {
 		const double kTimePerFrame = 20000;
-		uint32 now = getNow();
 		
 		double elapsed_time = now - tv_start;
-		speed_index = (double)kTimePerFrame / (elapsed_time + 1) * ThePrefs.SkipFrames * 100;
-		if ((speed_index > 100) && ThePrefs.LimitSpeed) {
+		speed_index = (double)kTimePerFrame / (elapsed_time + 1) * frames_since_draw * 100;
+		if ((speed_index > 100) && prefs.LimitSpeed) {
 			speed_index = 100;
-			usleep((unsigned long)(ThePrefs.SkipFrames * kTimePerFrame - elapsed_time));
+			usleep((unsigned long)(frames_since_draw * kTimePerFrame - elapsed_time));
 		}	
 
 #ifdef PERFORMANCE_COUNTERS
@@ -1101,7 +1228,24 @@ void C64::VBlank(bool draw_frame)
 #endif	
 		
 		tv_start = getNow();
+		frames_since_draw = 0;
 	}
+	frame_start = getNow();
+	
+	if (frame_limit && --frame_limit == 0)
+		quit_thyself = true;
+}
+
+
+/*
+ *  Skip factor for the next frames (set by the VIC after each drawn frame)
+ */
+
+int C64::SkipFrames(void)
+{
+	if (prefs.AdaptiveFrameSkip && prefs.LimitSpeed)
+		return FrameSkip.SkipFrames();
+	return prefs.SkipFrames;
 }
 
 
@@ -1129,6 +1273,100 @@ uint8 C64::poll_joystick(int port)
 }
 
 
+/*
+ *  Schedule the next raster line at the given time
+ */
+
+void C64::schedule_line_events(uint32 time)
+{
+	Events.Schedule(EVENT_LINE, time);
+	if (prefs.SIDOn)
+		Events.Schedule(EVENT_SID, time);
+	else
+		Events.Cancel(EVENT_SID);
+}
+
+
+/*
+ *  Switch the CIA and 1541 VIA timers to event driven mode or back
+ */
+
+void C64::set_event_driven(bool on)
+{
+	TheCIA1->SetEventDriven(on, prefs.ExactTimerEvents);
+	TheCIA2->SetEventDriven(on, prefs.ExactTimerEvents);
+	TheCPU1541->SetEventDriven(on);
+}
+
+
+/*
+ *  Dispatch the chip events that are due
+ */
+
+inline void C64::dispatch_events(void)
+{
+	int event;
+	while ((event = Events.Due()) >= 0) {
+		switch (event) {
+			case EVENT_LINE:
+				Events.StartLine(Events.Now());
+				Events.Schedule(EVENT_LINE, Events.Now() + CYCLES_PER_LINE);
+				line_cycles = TheVIC->EmulateLine();
+				if (!prefs.TimerEvents) {
+					// With PreciseCPUCycles, the 6510 counts the CIAs
+					if (!prefs.PreciseCPUCycles) {
+						if (TheCIA1->NeedToEmulateLine())
+							TheCIA1->EmulateLine(prefs.CIACycles);
+						if (TheCIA2->NeedToEmulateLine())
+							TheCIA2->EmulateLine(prefs.CIACycles);
+					}
+					if (prefs.Emul1541Proc)
+						TheCPU1541->CountVIATimers(prefs.FloppyCycles);
+				}
+				break;
+			case EVENT_SID:
+				Events.Schedule(EVENT_SID, Events.Now() + CYCLES_PER_LINE);
+				TheSID->EmulateLine();
+				break;
+			case EVENT_CIA1:
+				TheCIA1->TimerEvent();
+				break;
+			case EVENT_CIA2:
+				TheCIA2->TimerEvent();
+				break;
+			case EVENT_VIA:
+				TheCPU1541->VIAEvent();
+				break;
+		}
+	}
+}
+
+
+/*
+ *  Run the 6510 (and the 1541 processor) from cycle 'from' to cycle
+ *  'to' of the current raster line. The 6510 gets the first
+ *  line_cycles cycles of the line, the VIC takes the rest.
+ */
+
+inline void C64::run_cpus(int from, int to)
+{
+	int start = from < line_cycles ? from : line_cycles;
+	int end = (to >= (int)CYCLES_PER_LINE || to > line_cycles) ? line_cycles : to;
+	int cycles = end - start;
+
+	if (prefs.Emul1541Proc) {
+		int cycles_1541 = prefs.FloppyCycles * to / (int)CYCLES_PER_LINE - prefs.FloppyCycles * from / (int)CYCLES_PER_LINE;
+		if (!TheCPU1541->Idle && cycles_1541 > 0) {
+			TheCPU1541->EmulateLine(cycles_1541, cycles); // EmulateLine of CPUC64 called in there
+			return;
+		}
+	}
+
+	if (cycles > 0)
+		TheCPU->EmulateLine(cycles);
+}
+
+
 /*
  * The emulation's main loop
  */
@@ -1137,42 +1375,20 @@ void C64::thread_func(void)
 	while (!quit_thyself) 
 	{	
 #if SINGLE_CYCLE
-		if(ThePrefs.SingleCycleEmulation)
+		if(prefs.SingleCycleEmulation)
 		{
   			TheVIC->EmulateLineSC();
 		}
 		else
 #endif
 		{
-	  		// The order of calls is important here
-	  		int cycles = TheVIC->EmulateLine();
-	  		if(ThePrefs.SIDOn) {
-				TheSID->EmulateLine();
-			}
-#if !PRECISE_CIA_CYCLES
-			if(TheCIA1->NeedToEmulateLine())
-				TheCIA1->EmulateLine(ThePrefs.CIACycles);
-			
-			if (TheCIA2->NeedToEmulateLine())
-				TheCIA2->EmulateLine(ThePrefs.CIACycles);
-#endif
-	  		if (ThePrefs.Emul1541Proc) 
-	  		{
-	  			int cycles_1541 = ThePrefs.FloppyCycles;
-	  			TheCPU1541->CountVIATimers(cycles_1541);
-				
-	  			if (!TheCPU1541->Idle) 
-	  			{
-	  				TheCPU1541->EmulateLine(cycles_1541, cycles); // EmulateLine of CPUC64 called in there
-	  			} 
-	  			else
-	  				TheCPU->EmulateLine(cycles);
-	  		} 
-	  		else 
-	  		{
-	  			// 1541 processor disabled, only emulate 6510
-	  			TheCPU->EmulateLine(cycles);
-	  		}
+			// The chips schedule their work in Events, in between the
+			// processors run up to the next deadline (usually the end
+			// of the raster line)
+			dispatch_events();
+			uint32 next = Events.NextTime();
+			run_cpus(Events.Now() - Events.LineTime(), next - Events.LineTime());
+			Events.AdvanceTo(next);
 		}
 
 #if SINGLE_CYCLE
@@ -1184,19 +1400,21 @@ void C64::thread_func(void)
 			TheCIA2->SwitchToSC();
 			TheVIC->SwitchToSC();
 			TheCPU->SwitchToSC();
-			if(ThePrefs.Emul1541Proc)
+			if(prefs.Emul1541Proc)
 				TheCPU1541->SwitchToSC();
 		}
 		
 		if(SwitchToStandard)
 		{
-			// Single cycle emulation switched off
+			// Single cycle emulation switched off, start a new line
 			SwitchToStandard = false;
+			schedule_line_events(Events.Now());
+			Events.StartLine(Events.Now() - CYCLES_PER_LINE);
 			TheCIA1->SwitchToStandard();
 			TheCIA2->SwitchToStandard();
 			TheVIC->SwitchToStandard();
 			TheCPU->SwitchToStandard();
-			if(ThePrefs.Emul1541Proc)
+			if(prefs.Emul1541Proc)
 				TheCPU1541->SwitchToStandard();
 		}
 #endif
@@ -0,0 +1,260 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  C64Batch.cpp - Step many independent C64s in lockstep on a thread pool
+ *
+ *  A C64 object owns all of its emulation state, so different machines
+ *  can be run on different threads at the same time. The calling thread
+ *  works as worker 0 and returns from RunFrame() when every machine has
+ *  emulated exactly one more frame.
+ */
+
+#include "sysdeps.h"
+
+#include "C64Batch.h"
+#include "C64.h"
+
+
+/*
+ *  Constructor: Start the worker threads
+ */
+
+C64Batch::C64Batch(int num_threads)
+{
+	if (num_threads <= 0)
+		num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads <= 0)
+		num_threads = 1;
+
+	machines = NULL;
+	num_machines = max_machines = 0;
+
+	num_workers = num_threads;
+	queues = new WorkQueue[num_workers];
+	for (int i=0; i<num_workers; i++) {
+		pthread_mutex_init(&queues[i].lock, NULL);
+		queues[i].tasks = NULL;
+		queues[i].head = queues[i].tail = 0;
+	}
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&start_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+	generation = 0;
+	quit = false;
+	tasks_left = 0;
+	steals = 0;
+
+	threads = new pthread_t[num_workers];
+	args = new WorkerArg[num_workers];
+	for (int i=1; i<num_workers; i++) {
+		args[i].batch = this;
+		args[i].index = i;
+		pthread_create(&threads[i], NULL, thread_entry, &args[i]);
+	}
+}
+
+
+/*
+ *  Destructor: Stop the worker threads, the machines are not deleted
+ */
+
+C64Batch::~C64Batch()
+{
+	pthread_mutex_lock(&lock);
+	quit = true;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&lock);
+
+	for (int i=1; i<num_workers; i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i=0; i<num_workers; i++) {
+		pthread_mutex_destroy(&queues[i].lock);
+		delete[] queues[i].tasks;
+	}
+	pthread_cond_destroy(&done_cond);
+	pthread_cond_destroy(&start_cond);
+	pthread_mutex_destroy(&lock);
+
+	delete[] args;
+	delete[] threads;
+	delete[] queues;
+	delete[] machines;
+}
+
+
+/*
+ *  Add a machine (not while a frame is running)
+ */
+
+void C64Batch::Add(C64 *c64)
+{
+	if (num_machines == max_machines) {
+		max_machines = max_machines ? max_machines * 2 : 16;
+
+		C64 **new_machines = new C64 *[max_machines];
+		memcpy(new_machines, machines, num_machines * sizeof(C64 *));
+		delete[] machines;
+		machines = new_machines;
+
+		// A queue may have to hold all machines once the others are stolen empty
+		for (int i=0; i<num_workers; i++) {
+			delete[] queues[i].tasks;
+			queues[i].tasks = new int[max_machines];
+		}
+	}
+	machines[num_machines++] = c64;
+}
+
+
+/*
+ *  Advance every machine by one frame
+ */
+
+void C64Batch::RunFrame(void)
+{
+	if (num_machines == 0)
+		return;
+
+	// Deal contiguous blocks so a machine stays on the same thread
+	// from frame to frame unless it gets stolen
+	pthread_mutex_lock(&lock);
+	tasks_left = num_machines;
+	pthread_mutex_unlock(&lock);
+	for (int i=0; i<num_workers; i++) {
+		WorkQueue *q = &queues[i];
+		int first = num_machines * i / num_workers;
+		int last = num_machines * (i+1) / num_workers;
+
+		pthread_mutex_lock(&q->lock);
+		q->head = q->tail = 0;
+		for (int t=first; t<last; t++)
+			q->tasks[q->tail++] = t;
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	pthread_mutex_lock(&lock);
+	generation++;
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&lock);
+
+	run_tasks(0);
+
+	pthread_mutex_lock(&lock);
+	while (tasks_left)
+		pthread_cond_wait(&done_cond, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+void C64Batch::RunFrames(uint32 frames)
+{
+	while (frames--)
+		RunFrame();
+}
+
+
+/*
+ *  Worker threads
+ */
+
+void *C64Batch::thread_entry(void *arg)
+{
+	WorkerArg *a = (WorkerArg *)arg;
+	a->batch->worker_loop(a->index);
+	return NULL;
+}
+
+void C64Batch::worker_loop(int index)
+{
+	uint32 seen = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (generation == seen && !quit)
+			pthread_cond_wait(&start_cond, &lock);
+		seen = generation;
+		bool done = quit;
+		pthread_mutex_unlock(&lock);
+
+		if (done)
+			break;
+		run_tasks(index);
+	}
+}
+
+void C64Batch::run_tasks(int index)
+{
+	int task;
+
+	while (pop_task(index, &task) || steal_task(index, &task)) {
+		machines[task]->RunFrames(1);
+
+		pthread_mutex_lock(&lock);
+		if (--tasks_left == 0)
+			pthread_cond_signal(&done_cond);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+
+/*
+ *  Take the next machine from the own queue
+ */
+
+bool C64Batch::pop_task(int index, int *task)
+{
+	WorkQueue *q = &queues[index];
+	bool found = false;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->head != q->tail) {
+		*task = q->tasks[q->head++];
+		found = true;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+
+/*
+ *  Own queue is empty: take the last machine of another worker
+ */
+
+bool C64Batch::steal_task(int index, int *task)
+{
+	for (int i=1; i<num_workers; i++) {
+		WorkQueue *q = &queues[(index + i) % num_workers];
+		bool found = false;
+
+		pthread_mutex_lock(&q->lock);
+		if (q->head != q->tail) {
+			*task = q->tasks[--q->tail];
+			found = true;
+		}
+		pthread_mutex_unlock(&q->lock);
+
+		if (found) {
+			__sync_add_and_fetch(&steals, 1);
+			return true;
+		}
+	}
+	return false;
+}
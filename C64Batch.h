@@ -0,0 +1,84 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  C64Batch.h - Step many independent C64s in lockstep on a thread pool
+ */
+
+#ifndef _C64BATCH_H
+#define _C64BATCH_H
+
+#include <pthread.h>
+#include "sysdeps.h"
+
+class C64;
+
+// Runs a set of C64 objects one frame at a time. Each frame, every
+// machine is dealt to the queue of one worker thread; a worker that
+// runs out of machines steals from the other queues.
+class C64Batch {
+public:
+	C64Batch(int num_threads = 0);	// 0: one thread per online CPU
+	~C64Batch();
+
+	void Add(C64 *c64);				// The machine must have been started with C64::Run()
+	int Count(void) { return num_machines; }
+	C64 *Machine(int index) { return machines[index]; }
+	int Threads(void) { return num_workers; }
+	uint32 Steals(void) { return steals; }	// Machines run by a thread other than their owner
+
+	void RunFrame(void);			// Advance every machine by one frame
+	void RunFrames(uint32 frames);
+
+private:
+	struct WorkQueue {
+		pthread_mutex_t lock;
+		int *tasks;					// Indices into machines
+		int head, tail;				// Owner pops at head, thieves take from tail
+	};
+
+	struct WorkerArg {
+		C64Batch *batch;
+		int index;
+	};
+
+	static void *thread_entry(void *arg);
+	void worker_loop(int index);
+	void run_tasks(int index);
+	bool pop_task(int index, int *task);
+	bool steal_task(int index, int *task);
+
+	C64 **machines;
+	int num_machines, max_machines;
+
+	int num_workers;				// Including the calling thread (worker 0)
+	WorkQueue *queues;
+	pthread_t *threads;
+	WorkerArg *args;
+
+	pthread_mutex_t lock;			// Protects generation, quit and tasks_left
+	pthread_cond_t start_cond;		// Signalled when a new frame is dealt
+	pthread_cond_t done_cond;		// Signalled when tasks_left drops to 0
+	uint32 generation;				// Incremented for every frame
+	bool quit;
+	int tasks_left;					// Machines not yet finished in this frame
+	volatile uint32 steals;
+};
+
+#endif
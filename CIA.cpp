@@ -30,6 +30,17 @@
  *  - The EmulateLine() function is called for every emulated raster
  *    line. It counts down the timers and triggers interrupts if
  *    necessary.
+ *  - In event driven mode (Prefs::TimerEvents), EmulateLine() is
+ *    only called on the raster line a timer underflows. The CIA
+ *    schedules an event for that line in the C64's EventQueue. In
+ *    between, the timers are brought up to date by sync_timers() when
+ *    they are read or their control registers are written, which
+ *    gives exactly the values EmulateLine() would have produced.
+ *  - With Prefs::ExactTimerEvents, the event driven timers count
+ *    cycles instead of CIACycles per raster line and the event comes
+ *    on the cycle of the underflow, so the 6510 sees the interrupt in
+ *    the middle of the line. Register reads still see the timers as
+ *    of the start of the 6510's current time slice.
  *  - The TOD clocks are counted by CountTOD() during the VBlank, so
  *    the input frequency is 50Hz
  *  - The fields KeyMatrix and RevMatrix contain one bit for each
@@ -48,6 +59,7 @@
 #include "sysdeps.h"
 
 #include "CIA.h"
+#include "C64.h"
 #include "CPUC64.h"
 #include "CPU1541.h"
 #include "VIC.h"
@@ -58,10 +70,11 @@
  *  Constructors
  */
 
-MOS6526::MOS6526(MOS6510 *CPU) : the_cpu(CPU) {}
-MOS6526_1::MOS6526_1(MOS6510 *CPU, MOS6569 *VIC) : MOS6526(CPU), the_vic(VIC) { type=1; }
+MOS6526::MOS6526(MOS6510 *CPU) : the_cpu(CPU), the_prefs(&CPU->the_c64->prefs),
+	the_events(&CPU->the_c64->Events), event_driven(false), exact_events(false), sync_time(0) {}
+MOS6526_1::MOS6526_1(MOS6510 *CPU, MOS6569 *VIC) : MOS6526(CPU), the_vic(VIC) { type=1; event=EVENT_CIA1; }
 MOS6526_2::MOS6526_2(MOS6510 *CPU, MOS6569 *VIC, MOS6502_1541 *CPU1541) :
-	MOS6526(CPU), the_vic(VIC), the_cpu_1541(CPU1541) { type=2; }
+	MOS6526(CPU), the_vic(VIC), the_cpu_1541(CPU1541) { type=2; event=EVENT_CIA2; }
 
 
 /*
@@ -69,6 +82,10 @@ MOS6526_2::MOS6526_2(MOS6510 *CPU, MOS6569 *VIC, MOS6502_1541 *CPU1541) :
  */
 void MOS6526::SwitchToSC(void)
 {
+  if (event_driven) {
+    sync_timers(event_time());
+    the_events->Cancel(event);
+  }
   ta_irq_next_cycle = false;
   tb_irq_next_cycle = false;
   has_new_cra = false;
@@ -106,6 +123,11 @@ void MOS6526::SwitchToStandard(void)
   
   if(tb_irq_next_cycle)
 		TriggerInterrupt(2);
+
+  if (event_driven) {
+    sync_time = event_time();
+    schedule_timers();
+  }
 }
 
 
@@ -132,6 +154,9 @@ void MOS6526::Reset(void)
 	ta_state = tb_state = T_STOP;
 	CyclesTillAction = 1;
 	CyclesTillAction = 1;
+
+	sync_time = event_time();
+	the_events->Cancel(event);
 }
 
 void MOS6526_1::Reset(void)
@@ -164,6 +189,9 @@ void MOS6526_2::Reset(void)
 
 void MOS6526::GetState(MOS6526State *cs)
 {
+	if (event_driven)
+		sync_timers(event_time());
+
 	cs->pra = pra;
 	cs->prb = prb;
 	cs->ddra = ddra;
@@ -263,6 +291,10 @@ void MOS6526::SetState(MOS6526State *cs)
 	tb_cnt_ta = cs->tb_cnt_ta;
 
   SetMoreInfo(cs->more_info);
+
+	sync_time = event_time();
+	if (event_driven)
+		schedule_timers();
 }
 
 
@@ -304,20 +336,28 @@ uint8 MOS6526_1::ReadRegister(uint16 adr)
 		case 0x02: return ddra;
 		case 0x03: return ddrb;
 		case 0x04: 
-		  if(ThePrefs.SingleCycleEmulation)
+		  if(the_prefs->SingleCycleEmulation)
 		    UpdateTATB(false); 
+		  else if (event_driven)
+		    sync_timers(event_time());
 		  return ta;
 		case 0x05: 
-		  if(ThePrefs.SingleCycleEmulation)
+		  if(the_prefs->SingleCycleEmulation)
 		    UpdateTATB(false); 
+		  else if (event_driven)
+		    sync_timers(event_time());
 		  return ta >> 8;
 		case 0x06:
-		  if(ThePrefs.SingleCycleEmulation)
+		  if(the_prefs->SingleCycleEmulation)
 		    UpdateTATB(false); 
+		  else if (event_driven)
+		    sync_timers(event_time());
 		  return tb;
 		case 0x07: 
-		  if(ThePrefs.SingleCycleEmulation)
+		  if(the_prefs->SingleCycleEmulation)
 		    UpdateTATB(false); 
+		  else if (event_driven)
+		    sync_timers(event_time());
 		  return tb >> 8;
 		case 0x08: tod_halt = false; return tod_10ths;
 		case 0x09: return tod_sec;
@@ -351,20 +391,28 @@ uint8 MOS6526_2::ReadRegister(uint16 adr)
 		case 0x02: return ddra;
 		case 0x03: return ddrb;
 		case 0x04: 
-		  if(ThePrefs.SingleCycleEmulation)
+		  if(the_prefs->SingleCycleEmulation)
 		    UpdateTATB(false); 
+		  else if (event_driven)
+		    sync_timers(event_time());
 		  return ta;
 		case 0x05: 
-		  if(ThePrefs.SingleCycleEmulation)
+		  if(the_prefs->SingleCycleEmulation)
 		    UpdateTATB(false); 
+		  else if (event_driven)
+		    sync_timers(event_time());
 		  return ta >> 8;
 		case 0x06: 
-		  if(ThePrefs.SingleCycleEmulation)
+		  if(the_prefs->SingleCycleEmulation)
 		    UpdateTATB(false); 
+		  else if (event_driven)
+		    sync_timers(event_time());
 		  return tb;
 		case 0x07: 
-		  if(ThePrefs.SingleCycleEmulation)
+		  if(the_prefs->SingleCycleEmulation)
 		    UpdateTATB(false); 
+		  else if (event_driven)
+		    sync_timers(event_time());
 		  return tb >> 8;
 		case 0x08: tod_halt = false; return tod_10ths;
 		case 0x09: return tod_sec;
@@ -424,15 +472,25 @@ void MOS6526_1::WriteRegister(uint16 adr, uint8 byte)
 		case 0x4: latcha = (latcha & 0xff00) | byte; break;
 		case 0x5:
 			latcha = (latcha & 0xff) | (byte << 8);
-			if (!(cra & 1))	// Reload timer if stopped
+			if (!(cra & 1)) {	// Reload timer if stopped
+				if (event_driven)
+					sync_timers(event_time());
 				ta = latcha;
+				if (event_driven)
+					schedule_timers();
+			}
 			break;
 
 		case 0x6: latchb = (latchb & 0xff00) | byte; break;
 		case 0x7:
 			latchb = (latchb & 0xff) | (byte << 8);
-			if (!(crb & 1))	// Reload timer if stopped
+			if (!(crb & 1)) {	// Reload timer if stopped
+				if (event_driven)
+					sync_timers(event_time());
 				tb = latchb;
+				if (event_driven)
+					schedule_timers();
+			}
 			break;
 
 		case 0x8:
@@ -466,7 +524,7 @@ void MOS6526_1::WriteRegister(uint16 adr, uint8 byte)
 			break;
 
 		case 0xd:
-      if(ThePrefs.SingleCycleEmulation)
+      if(the_prefs->SingleCycleEmulation)
 			{
   			if (byte & 0x80)
   				int_mask |= byte & 0x7f;
@@ -479,7 +537,7 @@ void MOS6526_1::WriteRegister(uint16 adr, uint8 byte)
       }
       else
       {
-  			if (ThePrefs.CIAIRQHack)	// Hack for addressing modes that read from the address
+  			if (the_prefs->CIAIRQHack)	// Hack for addressing modes that read from the address
   				icr = 0;
   			if (byte & 0x80) {
   				int_mask |= byte & 0x7f;
@@ -493,7 +551,7 @@ void MOS6526_1::WriteRegister(uint16 adr, uint8 byte)
 			break;
 
 		case 0xe:
-      if(ThePrefs.SingleCycleEmulation)
+      if(the_prefs->SingleCycleEmulation)
       {
         UpdateTATB(true);
   			has_new_cra = true;		// Delay write by 1 cycle
@@ -502,15 +560,19 @@ void MOS6526_1::WriteRegister(uint16 adr, uint8 byte)
       }
       else
       {
+  			if (event_driven)
+  				sync_timers(event_time());
   			cra = byte & 0xef;
   			if (byte & 0x10) // Force load
   				ta = latcha;
   			ta_cnt_phi2 = ((byte & 0x21) == 0x01);
+  			if (event_driven)
+  				schedule_timers();
       }
 			break;
 
 		case 0xf:
-      if(ThePrefs.SingleCycleEmulation)
+      if(the_prefs->SingleCycleEmulation)
       {
         UpdateTATB(true);
   			has_new_crb = true;		// Delay write by 1 cycle
@@ -520,11 +582,15 @@ void MOS6526_1::WriteRegister(uint16 adr, uint8 byte)
       }
       else
       {
+  			if (event_driven)
+  				sync_timers(event_time());
   			crb = byte & 0xef;
   			if (byte & 0x10) // Force load
   				tb = latchb;
   			tb_cnt_phi2 = ((byte & 0x61) == 0x01);
   			tb_cnt_ta = ((byte & 0x61) == 0x41);
+  			if (event_driven)
+  				schedule_timers();
       }
 			break;
 	}
@@ -542,7 +608,7 @@ void MOS6526_2::WriteRegister(uint16 adr, uint8 byte)
 	switch (adr) {
 		case 0x0:{
 			pra = byte;
-			if(ThePrefs.SingleCycleEmulation)
+			if(the_prefs->SingleCycleEmulation)
 			{
 				the_vic->ChangedVA(~(pra | ~ddra) & 3);
 				old_lines = IECLines;
@@ -578,15 +644,25 @@ void MOS6526_2::WriteRegister(uint16 adr, uint8 byte)
 		case 0x4: latcha = (latcha & 0xff00) | byte; break;
 		case 0x5:
 			latcha = (latcha & 0xff) | (byte << 8);
-			if (!(cra & 1))	// Reload timer if stopped
+			if (!(cra & 1)) {	// Reload timer if stopped
+				if (event_driven)
+					sync_timers(event_time());
 				ta = latcha;
+				if (event_driven)
+					schedule_timers();
+			}
 			break;
 
 		case 0x6: latchb = (latchb & 0xff00) | byte; break;
 		case 0x7:
 			latchb = (latchb & 0xff) | (byte << 8);
-			if (!(crb & 1))	// Reload timer if stopped
+			if (!(crb & 1)) {	// Reload timer if stopped
+				if (event_driven)
+					sync_timers(event_time());
 				tb = latchb;
+				if (event_driven)
+					schedule_timers();
+			}
 			break;
 
 		case 0x8:
@@ -620,7 +696,7 @@ void MOS6526_2::WriteRegister(uint16 adr, uint8 byte)
 			break;
 
 		case 0xd:
-			if(ThePrefs.SingleCycleEmulation)
+			if(the_prefs->SingleCycleEmulation)
 			{
 				if (byte & 0x80)
 					int_mask |= byte & 0x7f;
@@ -633,7 +709,7 @@ void MOS6526_2::WriteRegister(uint16 adr, uint8 byte)
 			}
 			else
 			{
-				if (ThePrefs.CIAIRQHack)
+				if (the_prefs->CIAIRQHack)
 					icr = 0;
 				if (byte & 0x80) {
 					int_mask |= byte & 0x7f;
@@ -647,7 +723,7 @@ void MOS6526_2::WriteRegister(uint16 adr, uint8 byte)
 			break;
 
 		case 0xe:
-			if(ThePrefs.SingleCycleEmulation)
+			if(the_prefs->SingleCycleEmulation)
 			{
 				UpdateTATB(true);
 				has_new_cra = true;		// Delay write by 1 cycle
@@ -656,15 +732,19 @@ void MOS6526_2::WriteRegister(uint16 adr, uint8 byte)
 			}
 			else
 			{
+				if (event_driven)
+					sync_timers(event_time());
 				cra = byte & 0xef;
 				if (byte & 0x10) // Force load
 					ta = latcha;
 				ta_cnt_phi2 = ((byte & 0x21) == 0x01);
+				if (event_driven)
+					schedule_timers();
 			}
 			break;
 
 		case 0xf:
-			if(ThePrefs.SingleCycleEmulation)
+			if(the_prefs->SingleCycleEmulation)
 			{
 				UpdateTATB(true);
 				has_new_crb = true;		// Delay write by 1 cycle
@@ -674,11 +754,15 @@ void MOS6526_2::WriteRegister(uint16 adr, uint8 byte)
 			}
 			else
 			{
+				if (event_driven)
+					sync_timers(event_time());
 				crb = byte & 0xef;
 				if (byte & 0x10) // Force load
 					tb = latchb;
 				tb_cnt_phi2 = ((byte & 0x61) == 0x01);
 				tb_cnt_ta = ((byte & 0x61) == 0x41);
+				if (event_driven)
+					schedule_timers();
 			}
 			break;
 	}
@@ -1148,3 +1232,94 @@ tb_underflow:
 	}
 }
 
+
+/*
+ *  Switch between counting the timers in EmulateLine() for every
+ *  raster line and event driven mode
+ */
+
+void MOS6526::SetEventDriven(bool on, bool exact)
+{
+	if (event_driven)
+		sync_timers(event_time());
+	event_driven = on;
+	exact_events = exact;
+
+	sync_time = event_time();
+	if (on)
+		schedule_timers();
+	else
+		the_events->Cancel(event);
+}
+
+
+/*
+ *  Event driven mode: Time the timers are counted to, the start of
+ *  the current raster line unless they count cycles
+ */
+
+inline uint32 MOS6526::event_time(void)
+{
+	return exact_events ? the_events->Now() : the_events->LineTime();
+}
+
+
+/*
+ *  Event driven mode: Count the timers down to the given time. This
+ *  never crosses an underflow, the event for it comes first.
+ */
+
+void MOS6526::sync_timers(uint32 time)
+{
+	uint32 elapsed = time - sync_time;
+	sync_time = time;
+	if (!exact_events)
+		elapsed = elapsed / CYCLES_PER_LINE * the_prefs->CIACycles;
+
+	if (ta_cnt_phi2)
+		ta -= elapsed;
+	if (tb_cnt_phi2)
+		tb -= elapsed;
+}
+
+
+/*
+ *  Event driven mode: Schedule an event for the raster line (or the
+ *  cycle) on which the first of the timers counting Phi 2 underflows.
+ *  Timer B counting Timer A underflows only changes at these times.
+ */
+
+void MOS6526::schedule_timers(void)
+{
+	int cycles = exact_events ? 1 : the_prefs->CIACycles;	// Timer ticks per step
+	uint32 step = exact_events ? 1 : CYCLES_PER_LINE;
+	if (cycles <= 0 || !(ta_cnt_phi2 || tb_cnt_phi2)) {
+		the_events->Cancel(event);
+		return;
+	}
+
+	uint32 steps = 0x10000;
+	if (ta_cnt_phi2)
+		steps = ta / cycles + 1;
+	if (tb_cnt_phi2 && tb / cycles + 1 < steps)
+		steps = tb / cycles + 1;
+	the_events->Schedule(event, sync_time + steps * step);
+}
+
+
+/*
+ *  Event driven mode: A timer underflows now
+ */
+
+void MOS6526::TimerEvent(void)
+{
+	uint32 now = event_time();
+	if (exact_events)
+		EmulateLine(now - sync_time);
+	else {
+		sync_timers(now - CYCLES_PER_LINE);
+		EmulateLine(the_prefs->CIACycles);
+	}
+	sync_time = now;
+	schedule_timers();
+}
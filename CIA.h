@@ -32,6 +32,7 @@
 class MOS6510;
 class MOS6502_1541;
 class MOS6569;
+class EventQueue;
 struct MOS6526State;
 
 
@@ -61,6 +62,8 @@ public:
 	inline bool NeedToEmulateLine() { return ta_cnt_phi2 || tb_cnt_phi2; }
 	
 	void EmulateLine(int cycles);
+	void SetEventDriven(bool on, bool exact);
+	void TimerEvent(void);
 	void CountTOD(void);
 	void TriggerInterrupt(int bit);
 	uint8 GetMoreInfo(void);
@@ -72,8 +75,19 @@ public:
 
 protected:
 	uint16 CyclesTillAction;
+	uint32 event_time(void);
+	void sync_timers(uint32 time);
+	void schedule_timers(void);
+
 	MOS6510 *the_cpu;	// Pointer to 6510
+	Prefs *the_prefs;	// Pointer to preferences of the C64
+	EventQueue *the_events;	// Event queue of the C64
 	uint8 type;
+	int event;			// Event ID of timer underflows
+
+	bool event_driven;	// Flag: Timers are brought up to date lazily (not by EmulateLine())
+	bool exact_events;	// Flag: Event driven timers count cycles, not raster lines
+	uint32 sync_time;	// Event queue time the timers were last brought up to date
 
 	uint8 pra, prb, ddra, ddrb;
 
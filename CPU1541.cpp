@@ -68,6 +68,21 @@
  *  - The 1541 6502 emulation also includes a very simple VIA
  *    emulation (enough to make the IEC bus and GCR loading work).
  *    It's too small to move it to a source file of its own.
+ *  - In event driven mode (Prefs::TimerEvents), CountVIATimers() is
+ *    not called for every raster line. sync_vias() brings the VIA
+ *    timers up to date in one step when a VIA is accessed, and the
+ *    job IRQ of VIA 2 timer 1 is an event in the C64's EventQueue.
+ *  - While the 1541 polls the IEC bus or a VIA flag, its opcodes are
+ *    skipped. A backward jump starts a probe of the loop at its
+ *    target. If two iterations pass through the same register states
+ *    and the loop only reads RAM, ROM and VIA registers without side
+ *    effects (and only stores register values to RAM), every further
+ *    iteration is the same until an input from the C64 changes
+ *    (wait_inputs()). Then only the cycles of the opcodes are counted
+ *    and the 6510 keeps running in between, as before. When the 6510
+ *    is done with the line, whole iterations are skipped at once. The
+ *    loop stays parked on the next lines unless the VIA timer or IFR
+ *    registers it reads changed.
  *
  * Incompatibilities:
  * ------------------
@@ -87,12 +102,73 @@
 #include "CIA.h"
 #include "Display.h"
 #include "CPUC64.h"
+#include "VIC.h"
 
 
 enum {
 	INT_RESET = 3
 };
 
+// Wait loop detection states
+enum {
+	WAIT_NONE,		// No loop
+	WAIT_PROBE,		// Recording the first iteration
+	WAIT_VERIFY,	// Checking that the second iteration is the same
+	WAIT_PARKED		// Loop found, opcodes are skipped
+};
+
+const uintptr_t MAX_WAIT_BYTES = 64;	// Maximum distance of the backward jump that closes a wait loop
+
+// Addressing modes of the opcodes allowed in wait loops, 0 if not allowed
+enum {
+	WOP_IMP = 1,	// Implied, immediate, relative, JMP abs, stack
+	WOP_ZP,			// Zero page (plain, X or Y indexed)
+	WOP_ABS,
+	WOP_ABSX,
+	WOP_ABSY,
+	WOP_INDX,
+	WOP_INDY,
+	WOP_STORE = 8	// Writes its operand
+};
+
+#define I WOP_IMP
+#define Z WOP_ZP
+#define A WOP_ABS
+#define AX WOP_ABSX
+#define AY WOP_ABSY
+#define IX WOP_INDX
+#define IY WOP_INDY
+#define S WOP_STORE
+
+static const uint8 wait_op_mode[256] = {
+//	 x0 x1 x2 x3 x4   x5   x6   x7 x8 x9    xa xb xc   xd   xe   xf
+	 0, IX, 0, 0, 0,   Z,   0,   0, I, I,    I, 0, 0,   A,   0,   0,	// 0x
+	 I, IY, 0, 0, 0,   Z,   0,   0, I, AY,   0, 0, 0,   AX,  0,   0,	// 1x
+	 I, IX, 0, 0, Z,   Z,   0,   0, 0, I,    I, 0, A,   A,   0,   0,	// 2x
+	 I, IY, 0, 0, 0,   Z,   0,   0, I, AY,   0, 0, 0,   AX,  0,   0,	// 3x
+	 0, IX, 0, 0, 0,   Z,   0,   0, I, I,    I, 0, I,   A,   0,   0,	// 4x
+	 I, IY, 0, 0, 0,   Z,   0,   0, 0, AY,   0, 0, 0,   AX,  0,   0,	// 5x
+	 I, IX, 0, 0, 0,   Z,   0,   0, I, I,    I, 0, 0,   A,   0,   0,	// 6x
+	 I, IY, 0, 0, 0,   Z,   0,   0, 0, AY,   0, 0, 0,   AX,  0,   0,	// 7x
+	 0, 0,  0, 0, Z|S, Z|S, Z|S, 0, I, 0,    I, 0, A|S, A|S, A|S, 0,	// 8x
+	 I, 0,  0, 0, Z|S, Z|S, Z|S, 0, I, AY|S, I, 0, 0,   AX|S,0,   0,	// 9x
+	 I, IX, I, 0, Z,   Z,   Z,   0, I, I,    I, 0, A,   A,   A,   0,	// ax
+	 I, IY, 0, 0, Z,   Z,   Z,   0, I, AY,   I, 0, AX,  AX,  AY,  0,	// bx
+	 I, IX, 0, 0, Z,   Z,   0,   0, I, I,    I, 0, A,   A,   0,   0,	// cx
+	 I, IY, 0, 0, 0,   Z,   0,   0, I, AY,   0, 0, 0,   AX,  0,   0,	// dx
+	 I, IX, 0, 0, Z,   Z,   0,   0, I, I,    I, 0, A,   A,   0,   0,	// ex
+	 I, IY, 0, 0, 0,   Z,   0,   0, I, AY,   0, 0, 0,   AX,  0,   0		// fx
+};
+
+#undef I
+#undef Z
+#undef A
+#undef AX
+#undef AY
+#undef IX
+#undef IY
+#undef S
+
 
 /*
  *  6502 constructor: Initialize registers
@@ -118,6 +194,10 @@ MOS6502_1541::MOS6502_1541(C64 *c64, Job1541 *job, C64Display *disp, uint8 *Ram,
 
 	first_irq_cycle = 0;
 	Idle = false;
+	wait_state = WAIT_NONE;
+
+	via_event_driven = false;
+	via_sync_time = 0;
 }
 
 
@@ -126,6 +206,10 @@ MOS6502_1541::MOS6502_1541(C64 *c64, Job1541 *job, C64Display *disp, uint8 *Ram,
  */
 void MOS6502_1541::SwitchToSC(void)
 {
+  if (via_event_driven) {
+    sync_vias(the_c64->Events.LineTime());
+    the_c64->Events.Cancel(EVENT_VIA);
+  }
   pcSC = pc - pc_base;
   first_irq_cycle = 0;
   state = 0;
@@ -143,6 +227,10 @@ void MOS6502_1541::SwitchToStandard(void)
   jump(pcSC);
   borrowed_cycles = 0;
 #endif
+  via_sync_time = the_c64->Events.LineTime();
+  if (via_event_driven)
+    schedule_vias();
+  wait_state = WAIT_NONE;
 }
 
 
@@ -163,6 +251,9 @@ void MOS6502_1541::AsyncReset(void)
 
 void MOS6502_1541::GetState(MOS6502State *s)
 {
+	if (via_event_driven)
+		sync_vias(the_c64->Events.LineTime());
+
 	s->a = a;
 	s->x = x;
 	s->y = y;
@@ -174,7 +265,7 @@ void MOS6502_1541::GetState(MOS6502State *s)
 	if (!z_flag) s->p |= 0x02;
 	if (c_flag) s->p |= 0x01;
 	
-  if(ThePrefs.SingleCycleEmulation)
+  if(the_c64->prefs.SingleCycleEmulation)
 	  s->pc = pcSC;
   else
 	  s->pc = pc - pc_base;
@@ -227,7 +318,7 @@ void MOS6502_1541::SetState(MOS6502State *s)
 	z_flag = !(s->p & 0x02);
 	c_flag = s->p & 0x01;
 
-  if(ThePrefs.SingleCycleEmulation)
+  if(the_c64->prefs.SingleCycleEmulation)
 	  pcSC = s->pc;
 	else
   	jump(s->pc);
@@ -261,6 +352,11 @@ void MOS6502_1541::SetState(MOS6502State *s)
 	via2_sr = s->via2_sr;
 	via2_acr = s->via2_acr; via2_pcr = s->via2_pcr;
 	via2_ifr = s->via2_ifr; via2_ier = s->via2_ier;
+
+	via_sync_time = the_c64->Events.LineTime();
+	if (via_event_driven)
+		schedule_vias();
+	wait_state = WAIT_NONE;
 }
 
 
@@ -275,7 +371,10 @@ uint8 MOS6502_1541::read_byte(uint16 adr)
 	else if (adr < 0x1000)
 		return ram[adr & 0x07ff];
 
-	else if ((adr & 0xfc00) == 0x1800)	// VIA 1
+	if (via_event_driven && (adr & 0xf800) == 0x1800)
+		sync_vias(the_c64->Events.LineTime());
+
+	if ((adr & 0xfc00) == 0x1800)	// VIA 1
 		switch (adr & 0xf) {
 			case 0:
 				return (via1_prb & 0x1a
@@ -380,10 +479,15 @@ uint16 MOS6502_1541::read_word(uint16 adr)
 
 void MOS6502_1541::write_byte(uint16 adr, uint8 byte)
 {
-	if (adr < 0x1000)
+	if (adr < 0x1000) {
 		ram[adr & 0x7ff] = byte;
+		return;
+	}
 
-	else if ((adr & 0xfc00) == 0x1800)	// VIA 1
+	if (via_event_driven && (adr & 0xf800) == 0x1800)
+		sync_vias(the_c64->Events.LineTime());
+
+	if ((adr & 0xfc00) == 0x1800)	// VIA 1
 		switch (adr & 0xf) {
 			case 0:
 				via1_prb = byte;
@@ -474,6 +578,8 @@ void MOS6502_1541::write_byte(uint16 adr, uint8 byte)
 				via2_t1l = via2_t1l & 0xff | (byte << 8);
 				via2_ifr &= 0xbf;
 				via2_t1c = via2_t1l;
+				if (via_event_driven)
+					schedule_vias();
 				break;
 			case 7:
 				via2_t1l = via2_t1l & 0xff | (byte << 8);
@@ -491,6 +597,8 @@ void MOS6502_1541::write_byte(uint16 adr, uint8 byte)
 				break;
 			case 11:
 				via2_acr = byte;
+				if (via_event_driven)
+					schedule_vias();
 				break;
 			case 12:
 				via2_pcr = byte;
@@ -503,6 +611,8 @@ void MOS6502_1541::write_byte(uint16 adr, uint8 byte)
 					via2_ier |= byte & 0x7f;
 				else
 					via2_ier &= ~byte;
+				if (via_event_driven)
+					schedule_vias();
 				break;
 		}
 }
@@ -514,6 +624,9 @@ void MOS6502_1541::write_byte(uint16 adr, uint8 byte)
 
 void MOS6502_1541::Reset(void)
 {
+	if (via_event_driven)
+		sync_vias(the_c64->Events.LineTime());
+
 	// IEC lines and VIA registers
 	IECLines = 0xc0;
 
@@ -528,7 +641,7 @@ void MOS6502_1541::Reset(void)
 	interrupt.intr_any = 0;
 
 	// Read reset vector
-  if(ThePrefs.SingleCycleEmulation)
+  if(the_c64->prefs.SingleCycleEmulation)
   {
   	pcSC = read_word(0xfffc);
   	state = 0;
@@ -540,6 +653,112 @@ void MOS6502_1541::Reset(void)
 
 	// Wake up 1541
 	Idle = false;
+	wait_state = WAIT_NONE;
+
+	if (via_event_driven)
+		schedule_vias();
+}
+
+
+/*
+ *  Switch between counting the VIA timers in CountVIATimers() for
+ *  every raster line and event driven mode
+ */
+
+void MOS6502_1541::SetEventDriven(bool on)
+{
+	if (via_event_driven)
+		sync_vias(the_c64->Events.LineTime());
+	via_event_driven = on;
+
+	via_sync_time = the_c64->Events.LineTime();
+	if (on)
+		schedule_vias();
+	else
+		the_c64->Events.Cancel(EVENT_VIA);
+}
+
+
+/*
+ *  Event driven mode: Count a VIA timer down by 'lines' raster lines of
+ *  'cycles' cycles, with the same result as calling CountVIATimers()
+ *  for every line. Returns true if it underflowed.
+ */
+
+static bool count_via_timer(uint16 &counter, uint16 latch, bool free_run, uint32 lines, int cycles)
+{
+	uint32 first = counter / cycles + 1;	// Lines until the first underflow
+	if (lines < first) {
+		counter -= lines * cycles;
+		return false;
+	}
+
+	if (free_run)	// Reloaded from the latch on every underflow
+		counter = latch - (lines - first) % (latch / cycles + 1) * cycles;
+	else
+		counter -= lines * cycles;
+	return true;
+}
+
+
+/*
+ *  Event driven mode: Bring the VIA timers up to date at the given
+ *  time (the start of a raster line)
+ */
+
+void MOS6502_1541::sync_vias(uint32 time)
+{
+	uint32 lines = (time - via_sync_time) / CYCLES_PER_LINE;
+	via_sync_time = time;
+
+	int cycles = the_c64->prefs.FloppyCycles;
+	if (!lines || !the_c64->prefs.Emul1541Proc || cycles <= 0)
+		return;
+
+	if (count_via_timer(via1_t1c, via1_t1l, via1_acr & 0x40, lines, cycles))
+		via1_ifr |= 0x40;
+	if (!(via1_acr & 0x20) && count_via_timer(via1_t2c, 0, false, lines, cycles))
+		via1_ifr |= 0x20;
+
+	if (count_via_timer(via2_t1c, via2_t1l, via2_acr & 0x40, lines, cycles)) {
+		via2_ifr |= 0x40;
+		if (via2_ier & 0x40)
+			TriggerJobIRQ();
+	}
+	if (!(via2_acr & 0x20) && count_via_timer(via2_t2c, 0, false, lines, cycles))
+		via2_ifr |= 0x20;
+}
+
+
+/*
+ *  Event driven mode: Schedule an event for the raster line on which
+ *  VIA 2 timer 1 underflows if that triggers the job IRQ. The other
+ *  timers only set IFR bits, sync_vias() takes care of them.
+ */
+
+void MOS6502_1541::schedule_vias(void)
+{
+	int cycles = the_c64->prefs.FloppyCycles;
+	if (!the_c64->prefs.Emul1541Proc || cycles <= 0 || !(via2_ier & 0x40)) {
+		the_c64->Events.Cancel(EVENT_VIA);
+		return;
+	}
+
+	the_c64->Events.Schedule(EVENT_VIA, via_sync_time + (via2_t1c / cycles + 1) * CYCLES_PER_LINE);
+}
+
+
+/*
+ *  Event driven mode: VIA 2 timer 1 underflows on this raster line
+ */
+
+void MOS6502_1541::VIAEvent(void)
+{
+	uint32 now = the_c64->Events.LineTime();
+	sync_vias(now - CYCLES_PER_LINE);
+	CountVIATimers(the_c64->prefs.FloppyCycles);
+	via_sync_time = now;
+	schedule_vias();
 }
 
 
@@ -572,6 +791,226 @@ void MOS6502_1541::illegal_jump(uint16 at, uint16 to)
 	Reset();
 }
 
+/*
+ *  Check if the opcode at p may be part of a wait loop with the
+ *  current registers: It must not have side effects except for storing
+ *  registers to RAM, and read nothing that changes while the loop runs
+ */
+
+bool MOS6502_1541::wait_op_ok(const uint8 *p)
+{
+	uint8 mode = wait_op_mode[p[0]];
+	uint16 adr;
+
+	switch (mode & ~WOP_STORE) {
+		case WOP_IMP:
+		case WOP_ZP:
+			return true;
+		case WOP_ABS:
+			adr = p[1] | (p[2] << 8);
+			break;
+		case WOP_ABSX:
+			adr = (p[1] | (p[2] << 8)) + x;
+			break;
+		case WOP_ABSY:
+			adr = (p[1] | (p[2] << 8)) + y;
+			break;
+		case WOP_INDX:
+			adr = read_zp_word(p[1] + x);
+			break;
+		case WOP_INDY:
+			adr = read_zp_word(p[1]) + y;
+			break;
+		default:
+			return false;
+	}
+
+	if (mode & WOP_STORE)
+		return adr < 0x1000;
+	if (adr >= 0xc000 || adr < 0x1000 || (adr & 0xf800) != 0x1800)
+		return true;
+
+	switch (adr & 0xf) {
+		case 0:		// VIA 1: IEC lines, VIA 2: rotates the disk
+		case 1:
+		case 15:
+			return !(adr & 0x400);
+		case 2:
+		case 3:
+			return true;
+		case 4:		// Clear IFR bits
+		case 8:
+			return false;
+		default: {	// Timers, IFR: only the same on the next line if they did not change
+			int i = 0;
+			while (i < wait_num_regs && wait_regs[i] != adr)
+				i++;
+			if (i == wait_num_regs) {
+				if (i < MAX_WAIT_REGS)
+					wait_regs[wait_num_regs++] = adr;
+				else
+					wait_num_regs = -1;
+			}
+			return true;
+		}
+	}
+}
+
+
+/*
+ *  Inputs of the 1541 the C64 may change while a wait loop runs
+ */
+
+uint32 MOS6502_1541::wait_inputs(void)
+{
+	return TheCIA2->IECLines | (IECLines << 8) | (ram[0x7c] << 16) | (interrupt.intr_any ? 0x1000000 : 0);
+}
+
+
+/*
+ *  Save, restore and compare the register state of a wait loop opcode
+ */
+
+void MOS6502_1541::get_wait_step(WaitLoopStep &s)
+{
+	s.pc = pc; s.pc_base = pc_base;
+	s.a = a; s.x = x; s.y = y; s.sp = sp;
+	s.n_flag = n_flag; s.z_flag = z_flag;
+	s.v_flag = v_flag; s.d_flag = d_flag; s.c_flag = c_flag;
+}
+
+void MOS6502_1541::set_wait_step(const WaitLoopStep &s)
+{
+	pc = s.pc; pc_base = s.pc_base;
+	a = s.a; x = s.x; y = s.y; sp = s.sp;
+	n_flag = s.n_flag; z_flag = s.z_flag;
+	v_flag = s.v_flag; d_flag = s.d_flag; c_flag = s.c_flag;
+}
+
+bool MOS6502_1541::is_wait_step(const WaitLoopStep &s)
+{
+	return pc == s.pc && a == s.a && x == s.x && y == s.y && sp == s.sp
+		&& n_flag == s.n_flag && z_flag == s.z_flag
+		&& v_flag == s.v_flag && d_flag == s.d_flag && c_flag == s.c_flag;
+}
+
+
+/*
+ *  Check if a wait loop parked on the last line can go on: Nothing it
+ *  reads may have changed in between
+ */
+
+bool MOS6502_1541::wait_loop_valid(void)
+{
+	if (wait_state != WAIT_PARKED || wait_num_regs < 0 || wait_inputs() != wait_sig || !is_wait_step(wait_steps[wait_pos]))
+		return false;
+	for (int i=0; i<wait_num_regs; i++)
+		if (read_byte(wait_regs[i]) != wait_reg_values[i])
+			return false;
+	return true;
+}
+
+
+/*
+ *  Wait loop detection, called after every opcode that took 'cycles'
+ *  cycles and started at op_pc while a loop is probed or parked, and
+ *  after backward jumps. Returns true if the opcodes of the loop can
+ *  be skipped from here on.
+ */
+
+bool MOS6502_1541::wait_loop_step(int cycles, uint8 *op_pc)
+{
+	if (wait_state != WAIT_NONE && wait_inputs() != wait_sig)
+		wait_state = WAIT_NONE;
+
+	switch (wait_state) {
+		case WAIT_PROBE:
+			wait_steps[wait_len - 1].cycles = cycles;
+			if (pc == wait_steps[0].pc) {
+				if (!is_wait_step(wait_steps[0]))
+					break;	// Not the same state, probe again from here
+				if (!wait_op_ok(pc)) {
+					wait_state = WAIT_NONE;
+					return false;
+				}
+				wait_state = WAIT_VERIFY;
+				wait_pos = 0;
+				return false;
+			}
+			if (wait_len == MAX_WAIT_OPS || !wait_op_ok(pc)) {
+				wait_state = WAIT_NONE;
+				return false;
+			}
+			get_wait_step(wait_steps[wait_len++]);
+			return false;
+
+		case WAIT_VERIFY:
+		case WAIT_PARKED:
+			if (cycles != wait_steps[wait_pos].cycles)
+				break;
+			if (++wait_pos == wait_len)
+				wait_pos = 0;
+			if (!is_wait_step(wait_steps[wait_pos]))
+				break;
+			if (wait_state == WAIT_PARKED)
+				return true;
+			if (!wait_op_ok(pc))
+				break;
+			if (wait_pos)
+				return false;
+			wait_period = 0;
+			for (int i=0; i<wait_len; i++)
+				wait_period += wait_steps[i].cycles;
+			for (int i=0; i<wait_num_regs; i++)
+				wait_reg_values[i] = read_byte(wait_regs[i]);
+			wait_state = WAIT_PARKED;
+			return true;
+	}
+
+	// Start a probe at the target of a backward jump
+	wait_state = WAIT_NONE;
+	if ((uintptr_t)op_pc - (uintptr_t)pc > MAX_WAIT_BYTES)
+		return false;
+	wait_num_regs = 0;
+	if (!wait_op_ok(pc))
+		return false;
+	wait_state = WAIT_PROBE;
+	wait_len = 1;
+	wait_sig = wait_inputs();
+	get_wait_step(wait_steps[0]);
+	return false;
+}
+
+
+/*
+ *  Skip the opcodes of a parked wait loop, the last one took 'cycles'
+ *  cycles. Stops when the line is over or an input from the C64
+ *  changes, with the registers of the next opcode to execute. Returns
+ *  the cycles of the last skipped opcode.
+ */
+
+int MOS6502_1541::skip_wait_loop(int &cycles_left, int &cycles_c64, int cycles)
+{
+	while (cycles_left >= cycles) {
+		cycles_left -= cycles;
+		cycles = wait_steps[wait_pos].cycles;
+		if (++wait_pos == wait_len)
+			wait_pos = 0;
+
+		if (cycles_c64 >= 0) {
+			cycles_c64 = cycles_c64 - the_c64->TheCPU->EmulateLine(1);
+			if (wait_inputs() != wait_sig) {
+				wait_state = WAIT_NONE;
+				break;
+			}
+		} else
+			cycles_left %= wait_period;	// Nothing can change until the end of the line
+	}
+
+	set_wait_step(wait_steps[wait_pos]);
+	return cycles;
+}
+
 //************************************************************
 // Start of normal emulation (no single cycle)
 //************************************************************
@@ -693,9 +1132,18 @@ void MOS6502_1541::do_sbc_bcd(uint8 byte)
  */
 
 int MOS6502_1541::EmulateLine(int cycles_left, int cycles_c64)
+{
+	if (the_c64->prefs.PreciseCPUCycles)
+		return emulate_line<CPUPreciseCycles>(cycles_left, cycles_c64);
+	else
+		return emulate_line<CPUFastCycles>(cycles_left, cycles_c64);
+}
+
+template <class Core> int MOS6502_1541::emulate_line(int cycles_left, int cycles_c64)
 {
 	uint8 tmp;
 	uint16 adr;
+	uint8 *op_pc;
 	int last_cycles = 0;
 
 	// Any pending interrupts?
@@ -713,6 +1161,11 @@ handle_int:
 			Reset();
 	}
 
+	// Only a parked wait loop can go on from the last line
+	if (!wait_loop_valid())
+		wait_state = WAIT_NONE;
+	op_pc = pc;
+
 #define IS_CPU_1541
 #include "CPU_emulline.i"
 
@@ -740,6 +1193,14 @@ handle_int:
 
 		if(cycles_c64 >= 0)
 			cycles_c64 = cycles_c64 - the_c64->TheCPU->EmulateLine(1);
+
+		// Skip wait loops
+		if ((wait_state != WAIT_NONE || (uintptr_t)op_pc - (uintptr_t)pc <= MAX_WAIT_BYTES)
+		 && wait_loop_step(last_cycles + page_cycles, op_pc)) {
+			last_cycles = skip_wait_loop(cycles_left, cycles_c64, last_cycles + page_cycles);
+			page_cycles = 0;
+		}
+		op_pc = pc;
 	}
 
 	if(cycles_c64 > 0)
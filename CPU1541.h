@@ -45,6 +45,20 @@ class C64Display;
 struct MOS6502State;
 
 
+// Wait loops of up to this many opcodes are skipped, see CPU1541.cpp
+const int MAX_WAIT_OPS = 16;
+const int MAX_WAIT_REGS = 4;		// VIA timer registers a wait loop may read
+
+// Register state at the start of one opcode of a wait loop
+struct WaitLoopStep {
+	uint8 *pc, *pc_base;
+	uint8 a, x, y, sp;
+	uint8 n_flag, z_flag;
+	bool v_flag, d_flag, c_flag;
+	uint8 cycles;			// Cycles of the opcode
+};
+
+
 // 6502 emulation (1541)
 class MOS6502_1541 {
 public:
@@ -57,6 +71,8 @@ public:
 	void GetState(MOS6502State *s);
 	void SetState(MOS6502State *s);
 	void CountVIATimers(int cycles);
+	void SetEventDriven(bool on);
+	void VIAEvent(void);
 	void NewATNState(void);
 	void IECInterrupt(void);
 	void TriggerJobIRQ(void);
@@ -79,6 +95,8 @@ private:
 
 	uint16 read_zp_word(uint16 adr);
 
+	template <class Core> int emulate_line(int cycles_left, int cycles_c64);
+
 	void jump(uint16 adr);
 	void illegal_op(uint8 op, uint16 at);
 	void illegal_jump(uint16 at, uint16 to);
@@ -88,6 +106,18 @@ private:
 	void do_adc_bcd(uint8 byte);
 	void do_sbc_bcd(uint8 byte);
 
+	void sync_vias(uint32 time);
+	void schedule_vias(void);
+
+	bool wait_op_ok(const uint8 *p);
+	uint32 wait_inputs(void);
+	void get_wait_step(WaitLoopStep &s);
+	void set_wait_step(const WaitLoopStep &s);
+	bool is_wait_step(const WaitLoopStep &s);
+	bool wait_loop_valid(void);
+	bool wait_loop_step(int cycles, uint8 *op_pc);
+	int skip_wait_loop(int &cycles_left, int &cycles_c64, int cycles);
+
 	uint8 *ram;				// Pointer to main RAM
 	uint8 *rom;				// Pointer to ROM
 	C64 *the_c64;			// Pointer to C64 object
@@ -115,6 +145,19 @@ private:
 
 	int borrowed_cycles;	// Borrowed cycles from next line
 
+	bool via_event_driven;	// Flag: VIA timers are brought up to date lazily (not by CountVIATimers())
+	uint32 via_sync_time;	// Event queue time the VIA timers were last brought up to date
+
+	int wait_state;			// Wait loop detection state (WAIT_*)
+	int wait_len;			// Number of opcodes in the wait loop
+	int wait_pos;			// Index of the next opcode in wait_steps[]
+	int wait_period;		// Cycles of one iteration of the wait loop
+	uint32 wait_sig;		// Inputs from the C64 the wait loop was found with (wait_inputs())
+	int wait_num_regs;		// Number of registers in wait_regs[], -1 if the loop reads too many
+	uint16 wait_regs[MAX_WAIT_REGS];	// VIA registers the timers change that the wait loop reads
+	uint8 wait_reg_values[MAX_WAIT_REGS];	// Their values when the loop was found
+	WaitLoopStep wait_steps[MAX_WAIT_OPS];
+
 	uint8 via1_pra;		// PRA of VIA 1
 	uint8 via1_ddra;	// DDRA of VIA 1
 	uint8 via1_prb;		// PRB of VIA 1
@@ -46,6 +46,10 @@
  *    decoding. The read_zp() and write_zp() functions allow
  *    faster access to the zero page, the pop_byte() and
  *    push_byte() macros for the stack.
+ *  - The address decoding is a lookup in a table of 256 page
+ *    pointers for reading and one for writing. The tables of all
+ *    8 memory configurations are built by init_pages(), pages
+ *    without a pointer (I/O, zero page writes) have a handler.
  *  - If a write occurs to addresses 0 or 1, new_config is
  *    called to check whether the memory configuration has
  *    changed
@@ -71,6 +75,20 @@
  *  - The $f2 opcode that would normally crash the 6510 is
  *    used to implement emulator-specific functions, mainly
  *    those for the IEC routines
+ *  - With the CPUBlockCache preference, straight-line code is
+ *    decoded once into blocks of DecodedOps that hold a pointer
+ *    to the handler (a label in EmulateLine()) and the operand.
+ *    A block ends at a jump, branch, JSR or RTS, at an opcode
+ *    without a handler and at the end of a page. Blocks are
+ *    looked up by host address, which also tells the memory
+ *    configuration apart. write_byte() and poke() count writes
+ *    per RAM page and to the ROMs, and a block is decoded again
+ *    when the count of its memory has changed.
+ *  - With the CPUJIT preference (x86-64 only), a block that was
+ *    looked up JIT_THRESHOLD times is translated to native code
+ *    by JIT6510 (see CPUJIT.cpp). The code works on a copy of the
+ *    registers in jit_state and returns to the interpreter before
+ *    any opcode that may access I/O or ROM.
  *
  * Incompatibilities:
  * ------------------
@@ -95,11 +113,81 @@
 #include "Version.h"
 #include "CPU1541.h"
 
+#ifdef PROFILE_6510
+#include "CPUProfile.h"
+
+// Profiling hooks, also used by CPU_emulline.i
+#define PROFILE_FETCH() Profile->Fetch(pc - pc_base)
+#define PROFILE_INSTRUCTION(op, cyc) Profile->Instruction(op, cyc)
+#define PROFILE_CALL(kind, pushed) Profile->Call(kind, pc - pc_base, sp + (pushed))
+#define PROFILE_RETURN() Profile->Return(sp)
+#define PROFILE_READ() Profile->Read()
+#define PROFILE_IO_READ(chip) Profile->IORead(chip)
+#define PROFILE_IO_WRITE(chip) Profile->IOWrite(chip)
+#define PROFILE_BLOCK_FETCH() Profile->Fetch(blk->pc + bop->offset - pc_base)
+#define PROFILE_BLOCK_INSTRUCTION(cyc) Profile->Instruction(blk->pc[bop->offset], cyc)
+#else
+#define PROFILE_FETCH()
+#define PROFILE_INSTRUCTION(op, cyc)
+#define PROFILE_CALL(kind, pushed)
+#define PROFILE_RETURN()
+#define PROFILE_READ()
+#define PROFILE_IO_READ(chip)
+#define PROFILE_IO_WRITE(chip)
+#endif
+
 
 enum {
 	INT_RESET = 3
 };
 
+#if CPU_BLOCK_CACHE
+const int BLOCK_CACHE_SIZE = 4096;		// Power of 2
+const int BLOCK_OP_POOL_SIZE = 16384;
+const int MAX_BLOCK_OPS = 64;
+#if CPU_JIT
+const uint32 JIT_THRESHOLD = 32;		// Lookups before a block is translated
+#endif
+
+// block_op_info[] holds the length of the opcodes that have a block
+// handler (0 for the others) and whether they end a block
+const uint8 BLOCK_OP_LENGTH = 0x03;
+const uint8 BLOCK_OP_ENDS = 0x04;		// Jump, branch, JSR or RTS
+
+static const uint8 block_op_info[256] = {
+	0,2,0,0,0,2,2,0,1,2,1,0,0,3,3,0,	// $00
+	6,2,0,0,0,2,2,0,1,3,0,0,0,3,3,0,	// $10
+	7,2,0,0,2,2,2,0,0,2,1,0,3,3,3,0,	// $20
+	6,2,0,0,0,2,2,0,1,3,0,0,0,3,3,0,	// $30
+	0,2,0,0,0,2,2,0,1,2,1,0,7,3,3,0,	// $40
+	6,2,0,0,0,2,2,0,0,3,0,0,0,3,3,0,	// $50
+	5,2,0,0,0,2,2,0,1,2,1,0,7,3,3,0,	// $60
+	6,2,0,0,0,2,2,0,1,3,0,0,0,3,3,0,	// $70
+	0,2,0,0,2,2,2,0,1,0,1,0,3,3,3,0,	// $80
+	6,2,0,0,2,2,2,0,1,3,1,0,0,3,0,0,	// $90
+	2,2,2,0,2,2,2,0,1,2,1,0,3,3,3,0,	// $a0
+	6,2,0,0,2,2,2,0,1,3,1,0,3,3,3,0,	// $b0
+	2,2,0,0,2,2,2,0,1,2,1,0,3,3,3,0,	// $c0
+	6,2,0,0,0,2,2,0,1,3,0,0,0,3,3,0,	// $d0
+	2,2,0,0,2,2,2,0,1,2,1,0,3,3,3,0,	// $e0
+	6,2,0,0,0,2,2,0,1,3,0,0,0,3,3,0,	// $f0
+};
+
+// Block cache hook, also used by CPU_emulline.i
+#define BLOCK_DISPATCH() \
+	if (!Core::PRECISE_CYCLES && blocks != NULL && (blk = find_block(pc - 1)) != NULL) { \
+		JIT_DISPATCH(); \
+		bop = blk->ops; \
+		goto *bop->handler; \
+	}
+
+#if CPU_JIT
+#define JIT_DISPATCH() if (blk->native) goto run_native
+#else
+#define JIT_DISPATCH()
+#endif
+#endif
+
 /*
  *  6510 constructor: Initialize registers
  */
@@ -108,6 +196,8 @@ MOS6510::MOS6510(C64 *c64, uint8 *Ram, uint8 *Basic, uint8 *Kernal, uint8 *Char,
  : the_c64(c64), ram(Ram), basic_rom(Basic), kernal_rom(Kernal), char_rom(Char), color_ram(Color), io_ram(IO_Ram), halt(false)
 {
 	first_trap = NULL;
+	memset(trap_bits, 0, sizeof(trap_bits));
+	memset(trap_hash, 0, sizeof(trap_hash));
 	
 	a = x = y = 0;
 	sp = 0xff;
@@ -120,11 +210,203 @@ MOS6510::MOS6510(C64 *c64, uint8 *Ram, uint8 *Basic, uint8 *Kernal, uint8 *Char,
 
 	borrowed_cycles = 0;
 
-  for(int i=0; i<16; ++i)
-    mem_ptr[i] = ram + (i << 12);
+	init_pages();
+	read_page = read_pages[0];
+	write_page = write_pages[0];
+	pc = pc_base = ram;
+
+#if CPU_BLOCK_CACHE
+	blocks = NULL;
+	block_ops = NULL;
+	num_block_ops = 0;
+	block_handlers = NULL;
+	memset(ram_gen, 0, sizeof(ram_gen));
+	rom_gen = 0;
+#if CPU_JIT
+	jit = NULL;
+#endif
+#endif
+
+#ifdef PROFILE_6510
+	Profile = new CPUProfile;
+#endif
+}
+
+
+/*
+ *  6510 destructor
+ */
+
+MOS6510::~MOS6510()
+{
+#if CPU_BLOCK_CACHE
+	enable_blocks(false, false, NULL);
+#endif
+#ifdef PROFILE_6510
+	delete Profile;
+#endif
+}
+
+
+/*
+ *  The C64 moved the BASIC or Kernal ROM (see C64::UnshareBasic())
+ */
+
+void MOS6510::NewROMs(uint8 *Basic, uint8 *Kernal)
+{
+	uint16 adr = pc - pc_base;
+	basic_rom = Basic;
+	kernal_rom = Kernal;
+	init_pages();
+	new_config();
+	jump(adr);
+	FlushCode();
+}
+
+
+/*
+ *  Code may have been changed without write_byte(), drop all blocks
+ */
+
+void MOS6510::FlushCode(void)
+{
+#if CPU_BLOCK_CACHE
+	for (int i=0; i<256; i++)
+		ram_gen[i]++;
+	rom_gen++;
+#endif
 }
 
 
+#if CPU_BLOCK_CACHE
+/*
+ *  Allocate or free the block cache and the JIT
+ */
+
+void MOS6510::enable_blocks(bool enable, bool use_jit, void *const *handlers)
+{
+	delete[] blocks;
+	delete[] block_ops;
+	blocks = NULL;
+	block_ops = NULL;
+	num_block_ops = 0;
+#if CPU_JIT
+	delete jit;
+	jit = NULL;
+#endif
+
+	if (enable) {
+		blocks = new CodeBlock[BLOCK_CACHE_SIZE];
+		memset(blocks, 0, BLOCK_CACHE_SIZE * sizeof(CodeBlock));
+		block_ops = new DecodedOp[BLOCK_OP_POOL_SIZE];
+		block_handlers = handlers;
+#if CPU_JIT
+		if (use_jit)
+			jit = new JIT6510;	// Translates nothing if there is no executable memory
+#endif
+	}
+}
+
+
+/*
+ *  Drop all blocks and translations (the pools are full)
+ */
+
+void MOS6510::clear_blocks(void)
+{
+	memset(blocks, 0, BLOCK_CACHE_SIZE * sizeof(CodeBlock));
+	num_block_ops = 0;
+#if CPU_JIT
+	if (jit)
+		jit->Flush();
+#endif
+}
+
+
+/*
+ *  Find the block starting at host address p, NULL if there is none
+ */
+
+inline MOS6510::CodeBlock *MOS6510::find_block(uint8 *p)
+{
+	CodeBlock *b = &blocks[((uintptr_t)p ^ ((uintptr_t)p >> 12)) & (BLOCK_CACHE_SIZE - 1)];
+	if (b->pc != p || *b->gen_ptr != b->gen)
+		decode_block(b, p);
+#if CPU_JIT
+	if (jit && b->ops && ++b->hits == JIT_THRESHOLD) {
+		if (jit->Full()) {
+			clear_blocks();
+			decode_block(b, p);
+		}
+		b->native = jit->Translate(p, p - pc_base, pc_base == ram);
+	}
+#endif
+	return b->ops ? b : NULL;
+}
+
+
+/*
+ *  Decode the block starting at host address p (pc_base must match)
+ */
+
+void MOS6510::decode_block(CodeBlock *b, uint8 *p)
+{
+	if (num_block_ops + MAX_BLOCK_OPS + 1 > BLOCK_OP_POOL_SIZE)
+		clear_blocks();		// Pool exhausted, start over
+
+	uint16 adr = p - pc_base;
+	b->pc = p;
+	b->ops = NULL;
+#if CPU_JIT
+	b->hits = 0;
+	b->native = NULL;
+#endif
+
+	// The zero page and the stack are written without write_byte(),
+	// I/O space changes by itself, and the Char ROM is hardly worth
+	// it: no blocks there
+	if (pc_base == ram) {
+		b->gen_ptr = &ram_gen[adr >> 8];
+		b->gen = *b->gen_ptr;
+		if (adr < 0x0200)
+			return;
+	} else {
+		b->gen_ptr = &rom_gen;
+		b->gen = rom_gen;
+		if (pc_base != basic_rom - 0xa000 && pc_base != kernal_rom - 0xe000)
+			return;
+	}
+
+	DecodedOp *ops = block_ops + num_block_ops;
+	int room = 0x100 - (adr & 0xff);	// Blocks don't cross pages
+	int n = 0, offset = 0;
+	bool ends = false;
+	while (n < MAX_BLOCK_OPS && !ends) {
+		uint8 info = block_op_info[p[offset]];
+		int len = info & BLOCK_OP_LENGTH;
+		if (len == 0 || offset + len > room)
+			break;
+		ops[n].handler = block_handlers[p[offset]];
+		ops[n].operand = len == 3 ? p[offset+1] | (p[offset+2] << 8) : len == 2 ? p[offset+1] : 0;
+		ops[n].offset = offset;
+		n++;
+		offset += len;
+		ends = info & BLOCK_OP_ENDS;
+	}
+	if (n == 0)
+		return;
+
+	if (!ends) {
+		ops[n].handler = block_handlers[256];
+		ops[n].offset = offset;
+		n++;
+	}
+	b->ops = ops;
+	num_block_ops += n;
+}
+#endif
+
+
 /*
  *  Switch from standard emulation to single cycle emulation
  */
@@ -186,13 +468,28 @@ void MOS6510::AsyncNMI(void)
 
 #pragma mark Trap Handling
 
+// Index of the trap table for a trap
+static inline int trap_in_rom(trap_t *trap)
+{
+	return !trap->forceRam && ((trap->addr >= 0xa000 && trap->addr < 0xc000) || trap->addr >= 0xe000);
+}
+
+static inline int trap_bucket(uint16 adr)
+{
+	return (adr ^ (adr >> 8)) & (TRAP_HASH_SIZE - 1);
+}
+
 void MOS6510::ClearTraps() {
-	for(trap_t *trap = first_trap; trap; trap = trap->next_trap) {
+	trap_t *next;
+	for(trap_t *trap = first_trap; trap; trap = next) {
+		next = trap->next_trap;		// The release function may free the trap
 		poke(trap->addr, trap->org[0], trap->forceRam);
 		if (trap->trap_release)
 			trap->trap_release(trap);
 	}
 	first_trap = NULL;
+	memset(trap_bits, 0, sizeof(trap_bits));
+	memset(trap_hash, 0, sizeof(trap_hash));
 }
 
 int MOS6510::InstallTrap(trap_t *trap) {
@@ -210,6 +507,14 @@ int MOS6510::InstallTrap(trap_t *trap) {
 	poke(trap->addr, 0x00, trap->forceRam);
 	trap->next_trap = first_trap;
 	first_trap = trap;
+	
+	// Newer traps at the same address take precedence, as in the list
+	int rom = trap_in_rom(trap);
+	uint16 adr = trap->addr;
+	trap->next_hash = trap_hash[rom][trap_bucket(adr)];
+	trap_hash[rom][trap_bucket(adr)] = trap;
+	trap_bits[rom][adr >> 5] |= 1 << (adr & 31);
+	trap->hits = 0;
 	return 0;
 }
 
@@ -219,18 +524,21 @@ int MOS6510::InstallTrap(trap_t *trap) {
  */
 
 trap_result2_t* MOS6510::trap(void) {
-	static trap_result2_t result;
-	int currentPC = (pc - pc_base) - 1;
-	for(trap_t *trap = first_trap; trap != NULL; trap = trap->next_trap) {
-		if(trap->addr == currentPC) {
-			result.result = trap->handler(this, trap->data);
-			result.trap = trap;
-			return &result;
+	uint16 currentPC = (pc - pc_base) - 1;
+	int rom = pc_base != ram;
+	if (trap_bits[rom][currentPC >> 5] & (1 << (currentPC & 31))) {
+		for(trap_t *trap = trap_hash[rom][trap_bucket(currentPC)]; trap != NULL; trap = trap->next_hash) {
+			if(trap->addr == currentPC) {
+				trap->hits++;
+				trap_result.result = trap->handler(this, trap->data);
+				trap_result.trap = trap;
+				return &trap_result;
+			}
 		}
 	}
 	
-	result.result = TRAP_DO_BREAK;
-	return &result;
+	trap_result.result = TRAP_DO_BREAK;
+	return &trap_result;
 }
 
 uint8 MOS6510::peek(uint16 adr, bool forceram)
@@ -255,9 +563,17 @@ uint8 MOS6510::peek(uint16 adr, bool forceram)
 }
 
 void MOS6510::poke(uint16 adr, uint8 byte, bool forceram) {
+#if CPU_BLOCK_CACHE
+	ram_gen[adr >> 8]++;
+	rom_gen++;
+#endif
 	if (adr < 0xa000 || forceram)
 		ram[adr] = byte;
-	else
+	else {
+		// The cases fall through, a BASIC address also writes the Kernal
+		if (adr < 0xc000)
+			the_c64->UnshareBasic();
+		the_c64->UnshareKernal();
 		switch (adr >> 12) {
 			case 0xa:
 			case 0xb:
@@ -270,6 +586,7 @@ void MOS6510::poke(uint16 adr, uint8 byte, bool forceram) {
 			case 0xf:
 				kernal_rom[adr & 0x1fff] = byte;
 		}
+	}
 }
 
 
@@ -290,7 +607,7 @@ void MOS6510::GetState(MOS6510State *s)
 	if (!z_flag) s->p |= 0x02;
 	if (c_flag) s->p |= 0x01;
 	
-  if(ThePrefs.SingleCycleEmulation)
+  if(the_c64->prefs.SingleCycleEmulation)
   {
   	s->ddr = ddr;
   	s->pr = pr;
@@ -312,7 +629,7 @@ void MOS6510::GetState(MOS6510State *s)
   s->char_in = char_in;
   s->io_in = io_in;
 
-  if(ThePrefs.SingleCycleEmulation)
+  if(the_c64->prefs.SingleCycleEmulation)
 	  s->pc = pcSC;
   else
 	  s->pc = pc - pc_base;
@@ -345,7 +662,7 @@ void MOS6510::SetState(MOS6510State *s)
 	z_flag = !(s->p & 0x02);
 	c_flag = s->p & 0x01;
 	
-	if(ThePrefs.SingleCycleEmulation)
+	if(the_c64->prefs.SingleCycleEmulation)
 	{
 		ddr = s->ddr;
 		pr = s->pr;
@@ -367,7 +684,7 @@ void MOS6510::SetState(MOS6510State *s)
 	char_in = s->char_in;
 	io_in = s->io_in;
 	
-	if(ThePrefs.SingleCycleEmulation)
+	if(the_c64->prefs.SingleCycleEmulation)
 		pcSC = s->pc;
 	else {
 		jump(s->pc);
@@ -381,6 +698,9 @@ void MOS6510::SetState(MOS6510State *s)
 	interrupt.intr[INT_RESET] = s->intr[INT_RESET];
 	nmi_state = s->nmi_state;
 	dfff_byte = s->dfff_byte;
+
+	// The RAM was probably loaded with the state
+	FlushCode();
 }
 
 
@@ -391,7 +711,7 @@ void MOS6510::SetState(MOS6510State *s)
 void MOS6510::new_config(void)
 {
 	uint8 port;
-	if(ThePrefs.SingleCycleEmulation)
+	if(the_c64->prefs.SingleCycleEmulation)
 		port = ~ddr | pr;
 	else
 		port = ~ram[0] | ram[1];
@@ -401,11 +721,66 @@ void MOS6510::new_config(void)
 	char_in = (port & 3) && !(port & 4);
 	io_in = (port & 3) && (port & 4);
 	
-	mem_ptr[0xa] = basic_in ? basic_rom : ram + 0xa000;
-	mem_ptr[0xb] = basic_in ? basic_rom + 0x1000 : ram + 0xb000;
-	mem_ptr[0xd] = char_in ? char_rom : ram + 0xd000;
-	mem_ptr[0xe] = kernal_in ? kernal_rom : ram + 0xe000;
-	mem_ptr[0xf] = kernal_in ? kernal_rom + 0x1000 : ram + 0xf000;
+	read_page = read_pages[port & 7];
+	write_page = write_pages[port & 7];
+}
+
+
+/*
+ *  Build the page tables of all memory configurations
+ */
+
+void MOS6510::init_pages(void)
+{
+	for (int config=0; config<8; config++) {
+		bool basic = (config & 3) == 3;
+		bool kernal = config & 2;
+		bool chr = (config & 3) && !(config & 4);
+		bool io = (config & 3) && (config & 4);
+		
+		for (int page=0; page<0x100; page++) {
+			uint8 *rd = ram, *wr = ram;	// Writes to ROM go to the RAM below
+			if (page >= 0xa0 && page < 0xc0 && basic)
+				rd = basic_rom - 0xa000;
+			else if (page >= 0xd0 && page < 0xe0) {
+				if (io)
+					rd = wr = NULL;
+				else if (chr)
+					rd = char_rom - 0xd000;
+			} else if (page >= 0xe0 && kernal)
+				rd = kernal_rom - 0xe000;
+			if (page == 0)
+				wr = NULL;	// Processor port
+			read_pages[config][page] = rd;
+			write_pages[config][page] = wr;
+		}
+	}
+	
+	for (int page=0; page<0x100; page++) {
+		read_funcs[page] = NULL;
+		write_funcs[page] = NULL;
+	}
+	write_funcs[0x00] = &MOS6510::write_zero_page;
+	for (int page=0xd0; page<0xd4; page++) {
+		read_funcs[page] = &MOS6510::read_vic;
+		write_funcs[page] = &MOS6510::write_vic;
+	}
+	for (int page=0xd4; page<0xd8; page++) {
+		read_funcs[page] = &MOS6510::read_sid;
+		write_funcs[page] = &MOS6510::write_sid;
+	}
+	for (int page=0xd8; page<0xdc; page++) {
+		read_funcs[page] = &MOS6510::read_color;
+		write_funcs[page] = &MOS6510::write_color;
+	}
+	read_funcs[0xdc] = &MOS6510::read_cia1;
+	write_funcs[0xdc] = &MOS6510::write_cia1;
+	read_funcs[0xdd] = &MOS6510::read_cia2;
+	write_funcs[0xdd] = &MOS6510::write_cia2;
+	for (int page=0xde; page<0xe0; page++) {
+		read_funcs[page] = &MOS6510::read_open;
+		write_funcs[page] = &MOS6510::write_open;
+	}
 }
 
 
@@ -415,99 +790,68 @@ void MOS6510::new_config(void)
 
 uint8 MOS6510::read_byte(uint16 adr)
 {
-	if (adr < 0xa000)
-		return ram[adr];
+	PROFILE_READ();
+	uint8 *p = read_page[adr >> 8];
+	if (p)
+		return p[adr];
 	else
-  	switch (adr >> 12) {
-  		case 0xa:
-  		case 0xb:
-  			if (basic_in)
-  				return basic_rom[adr & 0x1fff];
-  			else
-  				return ram[adr];
-  		case 0xc:
-  			return ram[adr];
-  		case 0xd:
-  			if (io_in)
-  				switch ((adr >> 8) & 0x0f) {
-  					case 0x0:	// VIC
-  					case 0x1:
-  					case 0x2:
-  					case 0x3:
-  						return TheVIC->ReadRegister(adr & 0x3f);
-  					case 0x4:	// SID
-  					case 0x5:
-  					case 0x6:
-  					case 0x7:
-  						return TheSID->ReadRegister(adr & 0x1f);
-  					case 0x8:	// Color RAM
-  					case 0x9:
-  					case 0xa:
-  					case 0xb:
-						  return color_ram[adr & 0x03ff] & 0x0f | the_c64->Random() & 0xf0;
-  					case 0xc:	// CIA 1
-  						return TheCIA1->ReadRegister(adr & 0x0f);
-  					case 0xd:	// CIA 2
-  						return TheCIA2->ReadRegister(adr & 0x0f);
-  					case 0xe:	// REU/Open I/O
-  					case 0xf:
-  						if (adr < 0xdfff)
-  							return the_c64->Random();
-  						else
-  						{
-          			dfff_byte = ~dfff_byte;
-          			return dfff_byte;
-              }
-  				}
-  			else if (char_in)
-  				return char_rom[adr & 0x0fff];
-  			else
-  				return ram[adr];
-  		case 0xe:
-  		case 0xf:
-  			if (kernal_in)
-  				return kernal_rom[adr & 0x1fff];
-  			else
-  				return ram[adr];
-  		default:	// Can't happen
-  			return 0;
-  	}
+		return (this->*read_funcs[adr >> 8])(adr);
 }
 
 
+/*
+ *  Read a byte from a page without a pointer (I/O)
+ */
+
 uint8 MOS6510::read_byte_io(uint16 adr)
 {
-	switch ((adr >> 8) & 0x0f) {
-		case 0x0:	// VIC
-		case 0x1:
-		case 0x2:
-		case 0x3:
-			return TheVIC->ReadRegister(adr & 0x3f);
-		case 0x4:	// SID
-		case 0x5:
-		case 0x6:
-		case 0x7:
-			return TheSID->ReadRegister(adr & 0x1f);
-		case 0x8:	// Color RAM
-		case 0x9:
-		case 0xa:
-		case 0xb:
-		  return color_ram[adr & 0x03ff] & 0x0f | the_c64->Random() & 0xf0;
-		case 0xc:	// CIA 1
-			return TheCIA1->ReadRegister(adr & 0x0f);
-		case 0xd:	// CIA 2
-			return TheCIA2->ReadRegister(adr & 0x0f);
-		case 0xe:	// REU/Open I/O
-		case 0xf:
-			if (adr < 0xdfff)
-				return the_c64->Random();
-			else
-			{
-  			dfff_byte = ~dfff_byte;
-  			return dfff_byte;
-      }
+	return (this->*read_funcs[adr >> 8])(adr);
+}
+
+
+/*
+ *  I/O read handlers
+ */
+
+uint8 MOS6510::read_vic(uint16 adr)
+{
+	PROFILE_IO_READ(PROF_IO_VIC);
+	return TheVIC->ReadRegister(adr & 0x3f);
+}
+
+uint8 MOS6510::read_sid(uint16 adr)
+{
+	PROFILE_IO_READ(PROF_IO_SID);
+	return TheSID->ReadRegister(adr & 0x1f);
+}
+
+uint8 MOS6510::read_color(uint16 adr)
+{
+	PROFILE_IO_READ(PROF_IO_COLOR);
+	return color_ram[adr & 0x03ff] & 0x0f | the_c64->Random() & 0xf0;
+}
+
+uint8 MOS6510::read_cia1(uint16 adr)
+{
+	PROFILE_IO_READ(PROF_IO_CIA1);
+	return TheCIA1->ReadRegister(adr & 0x0f);
+}
+
+uint8 MOS6510::read_cia2(uint16 adr)
+{
+	PROFILE_IO_READ(PROF_IO_CIA2);
+	return TheCIA2->ReadRegister(adr & 0x0f);
+}
+
+uint8 MOS6510::read_open(uint16 adr)	// REU/Open I/O
+{
+	PROFILE_IO_READ(PROF_IO_OPEN);
+	if (adr < 0xdfff)
+		return the_c64->Random();
+	else {
+		dfff_byte = ~dfff_byte;
+		return dfff_byte;
 	}
-	return 0; // Keep the compiler happy
 }
 
 
@@ -531,6 +875,7 @@ void MOS6510::Reset(void)
 	if (ram[0x8004] == 0xc3 && ram[0x8005] == 0xc2 && ram[0x8006] == 0xcd
 	 && ram[0x8007] == 0x38 && ram[0x8008] == 0x30)
 		ram[0x8004] = 0;
+	FlushCode();
 
 	// Initialize extra 6510 registers and memory configuration
 	ddr = pr = 0;
@@ -542,7 +887,7 @@ void MOS6510::Reset(void)
 	nmi_state = false;
 
 	// Read reset vector
-  if(ThePrefs.SingleCycleEmulation)
+  if(the_c64->prefs.SingleCycleEmulation)
   {
   	pcSC = read_word(0xfffc);
   	state = 0;
@@ -569,6 +914,50 @@ void MOS6510::illegal_op(uint8 op, uint16 at)
 }
 
 
+/*
+ *  Fast LOAD: C64::PatchKernal() replaces the byte loop of the kernal
+ *  LOAD routine at $f4f3 by the extension opcode $f2 $08. This receives
+ *  the rest of the file from the IEC (up to EOI) and stores or verifies
+ *  it like the loop does, without running it for every byte. The STOP
+ *  key is not checked.
+ *  true: file complete, continue at $f528 (UNTALK, CLOSE)
+ *  false: timeout, continue at $f4f9 in the kernal loop
+ */
+
+bool MOS6510::fast_load(WriteFunc store)
+{
+	for (int n=0; n<0x10000; n++) {
+		uint8 byte;
+		ram[0x90] &= 0xfd;
+		ram[0x90] |= TheIEC->In(&byte);
+		if (ram[0x90] & 0x02)
+			break;
+
+		uint16 adr = ram[0xae] | (ram[0xaf] << 8);
+		a = x = byte;
+		y = 0;
+		if (ram[0x93] == 0)
+			(this->*store)(adr, byte);
+		else if (read_byte(adr) != byte)
+			a = ram[0x90] |= 0x10;		// Verify error
+		adr++;
+		ram[0xae] = adr & 0xff;
+		ram[0xaf] = adr >> 8;
+
+		// BIT $90
+		z_flag = a & ram[0x90];
+		n_flag = ram[0x90];
+		v_flag = ram[0x90] & 0x40;
+		if (v_flag)
+			return true;
+	}
+
+	// LDA #$fd, AND $90, STA $90 of the loop start
+	z_flag = n_flag = a = ram[0x90] &= 0xfd;
+	return false;
+}
+
+
 //************************************************************
 // Start of normal emulation (no single cycle)
 //************************************************************
@@ -578,42 +967,68 @@ void MOS6510::illegal_op(uint8 op, uint16 at)
  */
 void MOS6510::write_byte(uint16 adr, uint8 byte)
 {
-	if (adr < 0xd000 || !io_in || adr >= 0xe000) {
-		ram[adr] = byte;
-		if (adr < 2)
-			new_config();
-	} else  {
-		io_ram[adr & 0x0fff] = byte;		
-		switch ((adr >> 8) & 0x0f) {
-			case 0x0:	// VIC
-			case 0x1:
-			case 0x2:
-			case 0x3:
-				TheVIC->WriteRegister(adr & 0x3f, byte);
-				return;
-			case 0x4:	// SID
-			case 0x5:
-			case 0x6:
-			case 0x7:
-				TheSID->WriteRegister(adr & 0x1f, byte);
-				return;
-			case 0x8:	// Color RAM
-			case 0x9:
-			case 0xa:
-			case 0xb:
-				color_ram[adr & 0x03ff] = byte & 0x0f;
-				return;
-			case 0xc:	// CIA 1
-				TheCIA1->WriteRegister(adr & 0x0f, byte);
-				return;
-			case 0xd:	// CIA 2
-				TheCIA2->WriteRegister(adr & 0x0f, byte);
-				return;
-			case 0xe:	// REU/Open I/O
-			case 0xf:
-				return;
-		}
-	}
+	uint8 *p = write_page[adr >> 8];
+	if (p) {
+		p[adr] = byte;
+#if CPU_BLOCK_CACHE
+		ram_gen[adr >> 8]++;
+#endif
+	} else
+		(this->*write_funcs[adr >> 8])(adr, byte);
+}
+
+/*
+ *  Write handlers of the pages without a pointer
+ */
+void MOS6510::write_zero_page(uint16 adr, uint8 byte)
+{
+	ram[adr] = byte;
+#if CPU_BLOCK_CACHE
+	ram_gen[0]++;
+#endif
+	if (adr < 2)
+		new_config();
+}
+
+void MOS6510::write_vic(uint16 adr, uint8 byte)
+{
+	PROFILE_IO_WRITE(PROF_IO_VIC);
+	io_ram[adr & 0x0fff] = byte;
+	TheVIC->WriteRegister(adr & 0x3f, byte);
+}
+
+void MOS6510::write_sid(uint16 adr, uint8 byte)
+{
+	PROFILE_IO_WRITE(PROF_IO_SID);
+	io_ram[adr & 0x0fff] = byte;
+	TheSID->WriteRegister(adr & 0x1f, byte);
+}
+
+void MOS6510::write_color(uint16 adr, uint8 byte)
+{
+	PROFILE_IO_WRITE(PROF_IO_COLOR);
+	io_ram[adr & 0x0fff] = byte;
+	color_ram[adr & 0x03ff] = byte & 0x0f;
+}
+
+void MOS6510::write_cia1(uint16 adr, uint8 byte)
+{
+	PROFILE_IO_WRITE(PROF_IO_CIA1);
+	io_ram[adr & 0x0fff] = byte;
+	TheCIA1->WriteRegister(adr & 0x0f, byte);
+}
+
+void MOS6510::write_cia2(uint16 adr, uint8 byte)
+{
+	PROFILE_IO_WRITE(PROF_IO_CIA2);
+	io_ram[adr & 0x0fff] = byte;
+	TheCIA2->WriteRegister(adr & 0x0f, byte);
+}
+
+void MOS6510::write_open(uint16 adr, uint8 byte)	// REU/Open I/O
+{
+	PROFILE_IO_WRITE(PROF_IO_OPEN);
+	io_ram[adr & 0x0fff] = byte;
 }
 
 /*
@@ -647,49 +1062,10 @@ inline void MOS6510::write_zp(uint16 adr, uint8 byte)
  */
 void MOS6510::jump(uint16 adr)
 {
-	if (adr < 0xa000) {
-		pc = ram + adr;
-		pc_base = ram;
-	} else
-		switch (adr >> 12) {
-			case 0xa:
-			case 0xb:
-				if (basic_in) {
-					pc = basic_rom + (adr & 0x1fff);
-					pc_base = basic_rom - 0xa000;
-				} else {
-					pc = ram + adr;
-					pc_base = ram;
-				}
-				break;
-			case 0xc:
-				pc = ram + adr;
-				pc_base = ram;
-				break;
-			case 0xd:
-				if (io_in) {
-					pc = io_ram + (adr & 0x0fff);
-					pc_base = io_ram - 0xd000;
-				}
-				else if (char_in) {
-					pc = char_rom + (adr & 0x0fff);
-					pc_base = char_rom - 0xd000;
-				} else {
-					pc = ram + adr;
-					pc_base = ram;
-				}
-				break;
-			case 0xe:
-			case 0xf:
-				if (kernal_in) {
-					pc = kernal_rom + (adr & 0x1fff);
-					pc_base = kernal_rom - 0xe000;
-				} else {
-					pc = ram + adr;
-					pc_base = ram;
-				}
-				break;
-		}
+	pc_base = read_page[adr >> 8];
+	if (!pc_base)
+		pc_base = io_ram - 0xd000;
+	pc = pc_base + adr;
 }
 
 /*
@@ -791,10 +1167,45 @@ void MOS6510::illegal_jump(uint16 at, uint16 to)
  */
 
 int MOS6510::EmulateLine(int cycles_left)
+{
+	// Without lazy timers, precise timing also counts the CIAs here
+	if (!the_c64->prefs.PreciseCPUCycles)
+		return emulate_line<CPUFastCycles>(cycles_left);
+	else if (the_c64->prefs.TimerEvents)
+		return emulate_line<CPUPreciseCycles>(cycles_left);
+	else
+		return emulate_line<CPUPreciseCIACycles>(cycles_left);
+}
+
+template <class Core> int MOS6510::emulate_line(int cycles_left)
 {
 	uint8 tmp;
 	uint16 adr;		// Used by read_adr_abs()!
 	int last_cycles = 0;
+
+#if CPU_BLOCK_CACHE
+	static void *const handlers[257] = {
+#define BLOCK_HANDLER_TABLE
+#include "CPU_emulblock.i"
+#undef BLOCK_HANDLER_TABLE
+	};
+	CodeBlock *blk;		// Current block
+	DecodedOp *bop;		// Current DecodedOp in blk
+
+	// Blocks take the fixed cycles of each opcode, they are only
+	// used with that timing
+	if (!Core::PRECISE_CYCLES) {
+#if CPU_JIT
+		bool use_jit = the_c64->prefs.CPUJIT;
+		bool use_blocks = the_c64->prefs.CPUBlockCache || use_jit;
+		if (use_blocks != (blocks != NULL) || use_jit != (jit != NULL))
+			enable_blocks(use_blocks, use_jit, handlers);
+#else
+		if (the_c64->prefs.CPUBlockCache != (blocks != NULL))
+			enable_blocks(the_c64->prefs.CPUBlockCache, false, handlers);
+#endif
+	}
+#endif
 	
 	//if (halt) {
 	//	return 0;
@@ -809,6 +1220,7 @@ handle_int:
 			push_flags(false);
 			i_flag = true;
 			jump(read_word(0xfffa));
+			PROFILE_CALL(PROF_CALL_NMI, 3);
 			last_cycles = 7;
 
 		} else if ((interrupt.intr[INT_VICIRQ] || interrupt.intr[INT_CIAIRQ]) && !i_flag) {
@@ -816,6 +1228,7 @@ handle_int:
 			push_flags(false);
 			i_flag = true;
 			jump(read_word(0xfffe));
+			PROFILE_CALL(PROF_CALL_IRQ, 3);
 			last_cycles = 7;
 		}
 
@@ -869,12 +1282,55 @@ handle_int:
 					TheIEC->Release();
 					jump(0xedac);
 					break;
+				case 0x08:
+					jump(fast_load(&MOS6510::write_byte) ? 0xf528 : 0xf4f9);
+					break;
 				default:
 					illegal_op(0xf2, pc-pc_base-1);
 					break;
 			}
 			break;
 		}
+
+#if CPU_BLOCK_CACHE
+#include "CPU_emulblock.i"
+#endif
+
+#if CPU_JIT
+run_native:
+		{
+			JITState *s = &jit_state;
+			s->a = a; s->x = x; s->y = y; s->sp = sp;
+			s->n_flag = n_flag; s->z_flag = z_flag;
+			s->v_flag = v_flag; s->d_flag = d_flag; s->i_flag = i_flag; s->c_flag = c_flag;
+			s->cycles_left = cycles_left;
+			s->ram = ram;
+			s->ram_gen = ram_gen;
+
+			uint32 ret = blk->native(s);
+
+			a = s->a; x = s->x; y = s->y; sp = s->sp;
+			n_flag = s->n_flag; z_flag = s->z_flag;
+			v_flag = s->v_flag; d_flag = s->d_flag; i_flag = s->i_flag; c_flag = s->c_flag;
+			cycles_left = s->cycles_left;
+
+			int cyc = ret >> JIT_EXIT_CYCLES_SHIFT;
+			if (cyc == 0) {
+				// Stopped before the first opcode, run the block instead
+				bop = blk->ops;
+				goto *bop->handler;
+			}
+			if (ret & JIT_EXIT_JUMP)
+				jump(ret & 0xffff);
+			else
+				pc = pc_base + (ret & 0xffff);
+			last_cycles = cyc;
+			if (ret & JIT_EXIT_LINE_END)
+				break;
+			cycles_left += cyc;		// The loop subtracts them again
+			continue;
+		}
+#endif
 	}
 
 	return last_cycles;
@@ -1023,13 +1479,13 @@ inline void MOS6510::do_sbc(uint8 byte)
 #define read_to(adr, to) \
 	if (BALow) \
 		return; \
-  to = (((adr) & 0xf000) == 0xd000 && io_in) ? read_byte_io(adr) : mem_ptr[(adr) >> 12][(adr) & 0x0fff]
+  to = read_page[(adr) >> 8] ? read_page[(adr) >> 8][(adr)] : read_byte_io(adr)
   
 // Read byte from memory, throw away result
 #define read_idle(adr) \
 	if (BALow) \
 		return; \
-	if(((adr) & 0xf000) == 0xd000 && io_in) \
+	if(!read_page[(adr) >> 8]) \
 	  read_byte_io(adr);
 
 void MOS6510::EmulateCycle(bool BALow)
@@ -1112,6 +1568,9 @@ void MOS6510::EmulateCycle(bool BALow)
 					TheIEC->Release();
 					pcSC = 0xedac;
 					Last;
+				case 0x08:
+					pcSC = fast_load(&MOS6510::write_byteSC) ? 0xf528 : 0xf4f9;
+					Last;
 				default:
 					illegal_op(0xf2, pcSC-1);
 					break;
@@ -43,6 +43,21 @@ class MOS6526_1;
 class MOS6526_2;
 class IEC;
 struct MOS6510State;
+class CPUProfile;
+
+// The block cache needs labels as values (computed goto)
+#if defined(__GNUC__)
+#define CPU_BLOCK_CACHE 1
+#endif
+
+// Size of the hash table of the trap index (power of 2)
+const int TRAP_HASH_SIZE = 256;
+
+// Hot blocks can be translated to x86-64 code
+#if CPU_BLOCK_CACHE && defined(__x86_64__) && !defined(PROFILE_6510)
+#define CPU_JIT 1
+#include "CPUJIT.h"
+#endif
 
 
 // 6510 emulation (C64)
@@ -57,6 +72,7 @@ private:
 	
 public:
 	MOS6510(C64 *c64, uint8 *Ram, uint8 *Basic, uint8 *Kernal, uint8 *Char, uint8 *Color, uint8 *IO_Ram);
+	~MOS6510();
 	
 #if SINGLE_CYCLE
 	void EmulateCycle(bool BALow);			// Emulate one clock cycle
@@ -81,6 +97,9 @@ public:
 	
 	int InstallTrap(trap_t *trap);
 	void ClearTraps();
+	trap_t *Traps(void) { return first_trap; }	// List of installed traps (next_trap), newest first
+	void NewROMs(uint8 *Basic, uint8 *Kernal);
+	void FlushCode(void);	// RAM or ROM was written behind the CPU's back
 	
 	int ExtConfig;	// Memory configuration for ExtRead/WriteByte (0..7)
 	
@@ -91,6 +110,9 @@ public:
 	IEC *TheIEC;		// Pointer to drive array
 	
 	C64 *the_c64;		// Pointer to C64 object
+#ifdef PROFILE_6510
+	CPUProfile *Profile;	// Instruction-level profile, see CPUProfile.h
+#endif
 	
 	bool halt;
 	
@@ -111,7 +133,10 @@ private:
 	uint16 read_zp_word(uint16 adr);
 	void write_zp(uint16 adr, uint8 byte);
 	
+	template <class Core> int emulate_line(int cycles_left);
+	
 	void new_config(void);
+	void init_pages(void);
 	void jump(uint16 adr);
 	void illegal_op(uint8 op, uint16 at);
 	void illegal_jump(uint16 at, uint16 to);
@@ -122,6 +147,13 @@ private:
 	void do_sbc_bcd(uint8 byte);
 	
 	trap_t *first_trap;
+	trap_result2_t trap_result;	// Result of the last trap()
+	
+	// Trap index by address, separately for traps in RAM [0] and in the
+	// Basic/Kernal ROMs [1]. The bitmap tells whether there is any trap
+	// at an address, the hash table (chained through next_hash) finds it.
+	uint32 trap_bits[2][0x10000 / 32];
+	trap_t *trap_hash[2][TRAP_HASH_SIZE];
 	
 	uint8 *ram;			// Pointer to main RAM
 	uint8 *basic_rom, *kernal_rom, *char_rom, *color_ram; // Pointers to ROMs and color RAM
@@ -145,7 +177,71 @@ private:
 	bool basic_in, kernal_in, char_in, io_in;
 	uint8 dfff_byte;
 	
-	uint8 *mem_ptr[16];
+	// Memory map in pages of 256 bytes for each of the 8 configurations
+	// of the processor port (like ExtConfig). The page pointers are
+	// indexed with the full address; pages without a pointer (I/O, the
+	// processor port) go to the handlers in read_funcs[]/write_funcs[].
+	typedef uint8 (MOS6510::*ReadFunc)(uint16 adr);
+	typedef void (MOS6510::*WriteFunc)(uint16 adr, uint8 byte);
+
+	uint8 *read_pages[8][256];
+	uint8 *write_pages[8][256];
+	uint8 **read_page;			// read_pages[] of the current configuration
+	uint8 **write_page;			// write_pages[] of the current configuration
+	ReadFunc read_funcs[256];
+	WriteFunc write_funcs[256];
+
+	uint8 read_vic(uint16 adr);
+	uint8 read_sid(uint16 adr);
+	uint8 read_color(uint16 adr);
+	uint8 read_cia1(uint16 adr);
+	uint8 read_cia2(uint16 adr);
+	uint8 read_open(uint16 adr);
+	void write_zero_page(uint16 adr, uint8 byte);
+	void write_vic(uint16 adr, uint8 byte);
+	void write_sid(uint16 adr, uint8 byte);
+	void write_color(uint16 adr, uint8 byte);
+	void write_cia1(uint16 adr, uint8 byte);
+	void write_cia2(uint16 adr, uint8 byte);
+	void write_open(uint16 adr, uint8 byte);
+
+	bool fast_load(WriteFunc store);	// Kernal LOAD byte loop (extension opcode $f2 $08)
+
+#if CPU_BLOCK_CACHE
+	// Pre-decoded basic blocks, see decode_block()
+	struct DecodedOp {
+		void *handler;		// Label in EmulateLine()
+		uint16 operand;		// Immediate byte or absolute address
+		uint16 offset;		// Of the opcode from the start of the block
+	};
+
+	struct CodeBlock {
+		uint8 *pc;			// Host address of the first opcode, NULL if unused
+		uint32 *gen_ptr;	// Write generation of the memory the block was decoded from
+		uint32 gen;			// *gen_ptr when the block was decoded
+		DecodedOp *ops;		// NULL if there is no block at pc
+#if CPU_JIT
+		uint32 hits;		// Lookups since the block was decoded
+		JITCode native;		// Translation, NULL if not (yet) translated
+#endif
+	};
+
+	void enable_blocks(bool enable, bool use_jit, void *const *handlers);
+	void clear_blocks(void);
+	CodeBlock *find_block(uint8 *p);
+	void decode_block(CodeBlock *b, uint8 *p);
+
+	CodeBlock *blocks;				// Direct-mapped by host address, NULL if the cache is off
+	DecodedOp *block_ops;			// Pool for the DecodedOps of all blocks
+	int num_block_ops;
+	void *const *block_handlers;	// Labels indexed by opcode
+	uint32 ram_gen[256];			// Write generation per RAM page
+	uint32 rom_gen;					// Write generation of the BASIC and Kernal ROMs
+#if CPU_JIT
+	JIT6510 *jit;					// NULL if the JIT is off
+	JITState jit_state;
+#endif
+#endif
 };
 
 // 6510 state
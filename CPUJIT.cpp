@@ -0,0 +1,954 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  CPUJIT.cpp - Translation of hot 6510 blocks to x86-64 code
+ *
+ * Notes:
+ * ------
+ *
+ *  - The code is called as uint32 code(JITState *s) (System V ABI).
+ *    rdi holds s, rsi s->ram and r8 s->ram_gen; eax, ecx and edx
+ *    are scratch, r9d is used for loops (see below). The 6510 registers and flags stay in *s.
+ *  - Every opcode subtracts its cycles from s->cycles_left and
+ *    returns with JIT_EXIT_LINE_END if it underflows, like the
+ *    interpreter loop in CPU_emulline.i.
+ *  - Operands are only accessed directly in RAM: reads below $a000
+ *    and at $c000-$cfff, writes anywhere but $0000/$0001 and
+ *    $d000-$dfff. Absolute and zero page operands are checked when
+ *    translating, indexed and indirect ones at run time, and the
+ *    code returns before the opcode so that the interpreter executes
+ *    it with read_byte()/write_byte().
+ *  - Writes count the RAM page generation like write_byte(); a write
+ *    to the page of the block itself returns after the opcode, the
+ *    block cache then decodes the changed code again.
+ *  - A branch back to an opcode of the same translation jumps there
+ *    directly. That opcode can be reached from two opcodes, so its
+ *    exits take the cycles of the previous one from r9d.
+ *  - Code is only translated up to a JMP (ind), RTI, BRK, PLP or CLI
+ *    (the interpreter checks for interrupts or reads I/O there), an
+ *    illegal or $f2 opcode and the end of the page.
+ *  - The code buffer is never writable and executable at the same
+ *    time. It is mapped read/execute, Translate() makes the pages it
+ *    may write to read/write and switches them back when it is done.
+ */
+
+#include "sysdeps.h"
+#include "CPUC64.h"
+
+#if CPU_JIT
+#include <sys/mman.h>
+
+
+const size_t JIT_CODE_SIZE = 4 * 1024 * 1024;
+const int MAX_JIT_OPS = 64;
+const int MAX_JIT_OP_CODE = 256;		// Upper bound for the code of one opcode
+
+// x86 registers
+enum { EAX, ECX, EDX };
+
+// Two-register ALU opcodes (op r/m32, r32)
+enum { X_ADD = 0x01, X_OR = 0x09, X_AND = 0x21, X_SUB = 0x29, X_XOR = 0x31 };
+
+// /n of the immediate ALU and shift opcodes
+enum { I_ADD = 0, I_OR = 1, I_AND = 4, I_SUB = 5, I_XOR = 6, I_CMP = 7 };
+enum { S_SHL = 4, S_SHR = 5 };
+
+// Condition codes
+enum { CC_B = 2, CC_AE = 3, CC_E = 4, CC_NE = 5, CC_A = 7, CC_S = 8, CC_NS = 9 };
+
+// Offsets in JITState
+enum {
+	S_A = offsetof(JITState, a),
+	S_X = offsetof(JITState, x),
+	S_Y = offsetof(JITState, y),
+	S_SP = offsetof(JITState, sp),
+	S_N = offsetof(JITState, n_flag),
+	S_Z = offsetof(JITState, z_flag),
+	S_V = offsetof(JITState, v_flag),
+	S_D = offsetof(JITState, d_flag),
+	S_I = offsetof(JITState, i_flag),
+	S_C = offsetof(JITState, c_flag),
+	S_CYCLES = offsetof(JITState, cycles_left),
+	S_RAM = offsetof(JITState, ram),
+	S_RAM_GEN = offsetof(JITState, ram_gen)
+};
+
+// Addressing modes
+enum {
+	M_IMP, M_IMM, M_ZP, M_ZPX, M_ZPY, M_ABS, M_ABSX, M_ABSY, M_INDX, M_INDY, M_REL
+};
+
+static const int mode_length[] = {1, 2, 2, 2, 2, 3, 3, 3, 2, 2, 2};
+
+// Translated opcodes
+enum {
+	J_NONE,
+	J_LDA, J_LDX, J_LDY, J_STA, J_STX, J_STY,
+	J_ADC, J_SBC, J_AND, J_ORA, J_EOR, J_CMP, J_CPX, J_CPY, J_BIT,
+	J_INC, J_DEC, J_ASL, J_LSR, J_ROL, J_ROR,
+	J_INX, J_INY, J_DEX, J_DEY,
+	J_TAX, J_TAY, J_TXA, J_TYA, J_TSX, J_TXS,
+	J_CLC, J_SEC, J_CLD, J_SED, J_CLV, J_SEI,
+	J_PHA, J_PLA, J_PHP, J_NOP,
+	J_JMP, J_JSR, J_RTS, J_BRANCH
+};
+
+// Opcode, kind, addressing mode and cycles (as in CPU_emulline.i,
+// branches are handled separately)
+static const uint8 jit_ops[][4] = {
+	{0xa9, J_LDA, M_IMM, 2}, {0xa5, J_LDA, M_ZP, 3}, {0xb5, J_LDA, M_ZPX, 4}, {0xad, J_LDA, M_ABS, 4},
+	{0xbd, J_LDA, M_ABSX, 4}, {0xb9, J_LDA, M_ABSY, 4}, {0xa1, J_LDA, M_INDX, 6}, {0xb1, J_LDA, M_INDY, 5},
+	{0xa2, J_LDX, M_IMM, 2}, {0xa6, J_LDX, M_ZP, 3}, {0xb6, J_LDX, M_ZPY, 4}, {0xae, J_LDX, M_ABS, 4},
+	{0xbe, J_LDX, M_ABSY, 4},
+	{0xa0, J_LDY, M_IMM, 2}, {0xa4, J_LDY, M_ZP, 3}, {0xb4, J_LDY, M_ZPX, 4}, {0xac, J_LDY, M_ABS, 4},
+	{0xbc, J_LDY, M_ABSX, 4},
+	{0x85, J_STA, M_ZP, 3}, {0x95, J_STA, M_ZPX, 4}, {0x8d, J_STA, M_ABS, 4}, {0x9d, J_STA, M_ABSX, 5},
+	{0x99, J_STA, M_ABSY, 5}, {0x81, J_STA, M_INDX, 6}, {0x91, J_STA, M_INDY, 6},
+	{0x86, J_STX, M_ZP, 3}, {0x96, J_STX, M_ZPY, 4}, {0x8e, J_STX, M_ABS, 4},
+	{0x84, J_STY, M_ZP, 3}, {0x94, J_STY, M_ZPX, 4}, {0x8c, J_STY, M_ABS, 4},
+	{0x69, J_ADC, M_IMM, 2}, {0x65, J_ADC, M_ZP, 3}, {0x75, J_ADC, M_ZPX, 4}, {0x6d, J_ADC, M_ABS, 4},
+	{0x7d, J_ADC, M_ABSX, 4}, {0x79, J_ADC, M_ABSY, 4}, {0x61, J_ADC, M_INDX, 6}, {0x71, J_ADC, M_INDY, 5},
+	{0xe9, J_SBC, M_IMM, 2}, {0xe5, J_SBC, M_ZP, 3}, {0xf5, J_SBC, M_ZPX, 4}, {0xed, J_SBC, M_ABS, 4},
+	{0xfd, J_SBC, M_ABSX, 4}, {0xf9, J_SBC, M_ABSY, 4}, {0xe1, J_SBC, M_INDX, 6}, {0xf1, J_SBC, M_INDY, 5},
+	{0x29, J_AND, M_IMM, 2}, {0x25, J_AND, M_ZP, 3}, {0x35, J_AND, M_ZPX, 4}, {0x2d, J_AND, M_ABS, 4},
+	{0x3d, J_AND, M_ABSX, 4}, {0x39, J_AND, M_ABSY, 4}, {0x21, J_AND, M_INDX, 6}, {0x31, J_AND, M_INDY, 5},
+	{0x09, J_ORA, M_IMM, 2}, {0x05, J_ORA, M_ZP, 3}, {0x15, J_ORA, M_ZPX, 4}, {0x0d, J_ORA, M_ABS, 4},
+	{0x1d, J_ORA, M_ABSX, 4}, {0x19, J_ORA, M_ABSY, 4}, {0x01, J_ORA, M_INDX, 6}, {0x11, J_ORA, M_INDY, 5},
+	{0x49, J_EOR, M_IMM, 2}, {0x45, J_EOR, M_ZP, 3}, {0x55, J_EOR, M_ZPX, 4}, {0x4d, J_EOR, M_ABS, 4},
+	{0x5d, J_EOR, M_ABSX, 4}, {0x59, J_EOR, M_ABSY, 4}, {0x41, J_EOR, M_INDX, 6}, {0x51, J_EOR, M_INDY, 5},
+	{0xc9, J_CMP, M_IMM, 2}, {0xc5, J_CMP, M_ZP, 3}, {0xd5, J_CMP, M_ZPX, 4}, {0xcd, J_CMP, M_ABS, 4},
+	{0xdd, J_CMP, M_ABSX, 4}, {0xd9, J_CMP, M_ABSY, 4}, {0xc1, J_CMP, M_INDX, 6}, {0xd1, J_CMP, M_INDY, 5},
+	{0xe0, J_CPX, M_IMM, 2}, {0xe4, J_CPX, M_ZP, 3}, {0xec, J_CPX, M_ABS, 4},
+	{0xc0, J_CPY, M_IMM, 2}, {0xc4, J_CPY, M_ZP, 3}, {0xcc, J_CPY, M_ABS, 4},
+	{0x24, J_BIT, M_ZP, 3}, {0x2c, J_BIT, M_ABS, 4},
+	{0xe6, J_INC, M_ZP, 5}, {0xf6, J_INC, M_ZPX, 6}, {0xee, J_INC, M_ABS, 6}, {0xfe, J_INC, M_ABSX, 7},
+	{0xc6, J_DEC, M_ZP, 5}, {0xd6, J_DEC, M_ZPX, 6}, {0xce, J_DEC, M_ABS, 6}, {0xde, J_DEC, M_ABSX, 7},
+	{0x0a, J_ASL, M_IMP, 2}, {0x06, J_ASL, M_ZP, 5}, {0x16, J_ASL, M_ZPX, 6}, {0x0e, J_ASL, M_ABS, 6},
+	{0x1e, J_ASL, M_ABSX, 7},
+	{0x4a, J_LSR, M_IMP, 2}, {0x46, J_LSR, M_ZP, 5}, {0x56, J_LSR, M_ZPX, 6}, {0x4e, J_LSR, M_ABS, 6},
+	{0x5e, J_LSR, M_ABSX, 7},
+	{0x2a, J_ROL, M_IMP, 2}, {0x26, J_ROL, M_ZP, 5}, {0x36, J_ROL, M_ZPX, 6}, {0x2e, J_ROL, M_ABS, 6},
+	{0x3e, J_ROL, M_ABSX, 7},
+	{0x6a, J_ROR, M_IMP, 2}, {0x66, J_ROR, M_ZP, 5}, {0x76, J_ROR, M_ZPX, 6}, {0x6e, J_ROR, M_ABS, 6},
+	{0x7e, J_ROR, M_ABSX, 7},
+	{0xe8, J_INX, M_IMP, 2}, {0xc8, J_INY, M_IMP, 2}, {0xca, J_DEX, M_IMP, 2}, {0x88, J_DEY, M_IMP, 2},
+	{0xaa, J_TAX, M_IMP, 2}, {0xa8, J_TAY, M_IMP, 2}, {0x8a, J_TXA, M_IMP, 2}, {0x98, J_TYA, M_IMP, 2},
+	{0xba, J_TSX, M_IMP, 2}, {0x9a, J_TXS, M_IMP, 2},
+	{0x18, J_CLC, M_IMP, 2}, {0x38, J_SEC, M_IMP, 2}, {0xd8, J_CLD, M_IMP, 2}, {0xf8, J_SED, M_IMP, 2},
+	{0xb8, J_CLV, M_IMP, 2}, {0x78, J_SEI, M_IMP, 2},
+	{0x48, J_PHA, M_IMP, 3}, {0x68, J_PLA, M_IMP, 4}, {0x08, J_PHP, M_IMP, 3}, {0xea, J_NOP, M_IMP, 2},
+	{0x4c, J_JMP, M_ABS, 3}, {0x20, J_JSR, M_ABS, 6}, {0x60, J_RTS, M_IMP, 6},
+	{0x10, J_BRANCH, M_REL, 0}, {0x30, J_BRANCH, M_REL, 0}, {0x50, J_BRANCH, M_REL, 0}, {0x70, J_BRANCH, M_REL, 0},
+	{0x90, J_BRANCH, M_REL, 0}, {0xb0, J_BRANCH, M_REL, 0}, {0xd0, J_BRANCH, M_REL, 0}, {0xf0, J_BRANCH, M_REL, 0}
+};
+
+// Can read_byte()/write_byte() of adr be replaced by a RAM access?
+static inline bool fast_read(uint16 adr)
+{
+	return adr < 0xa000 || (adr >= 0xc000 && adr < 0xd000);
+}
+
+static inline bool fast_write(uint16 adr)
+{
+	return adr >= 2 && (adr < 0xd000 || adr >= 0xe000);
+}
+
+static inline uint32 cycles_exit(int cycles)
+{
+	return cycles << JIT_EXIT_CYCLES_SHIFT;
+}
+
+
+/*
+ *  Constructor: Allocate the code buffer
+ */
+
+JIT6510::JIT6510()
+{
+	code = (uint8 *)mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (code == MAP_FAILED)
+		code = NULL;
+	out = code;
+	loop_code = NULL;
+	loop_header = false;
+
+	memset(op_kind, J_NONE, sizeof(op_kind));
+	for (size_t i=0; i<sizeof(jit_ops)/sizeof(jit_ops[0]); i++) {
+		uint8 op = jit_ops[i][0];
+		op_kind[op] = jit_ops[i][1];
+		op_mode[op] = jit_ops[i][2];
+		op_cycles[op] = jit_ops[i][3];
+	}
+}
+
+
+/*
+ *  Destructor
+ */
+
+JIT6510::~JIT6510()
+{
+	if (code)
+		munmap(code, JIT_CODE_SIZE);
+}
+
+
+bool JIT6510::Full(void)
+{
+	return (size_t)(out - code) > JIT_CODE_SIZE - MAX_JIT_OPS * MAX_JIT_OP_CODE;
+}
+
+void JIT6510::Flush(void)
+{
+	out = code;
+}
+
+
+/*
+ *  Translate the straight-line code at p
+ */
+
+JITCode JIT6510::Translate(const uint8 *p, uint16 adr, bool in_ram)
+{
+	if (code == NULL || Full())
+		return NULL;
+	uint8 *start = out;
+	if (!set_writable(start, true))
+		return NULL;
+
+	// mov rsi,[rdi+ram]; mov r8,[rdi+ram_gen]
+	emit8(0x48); emit8(0x8b); emit8(0x77); emit8(S_RAM);
+	emit8(0x4c); emit8(0x8b); emit8(0x47); emit8(S_RAM_GEN);
+
+	int room = 0x100 - (adr & 0xff);	// Like the blocks, don't cross pages
+	int loop_offset = find_loop(p, room);
+	loop_code = NULL;
+	loop_adr = adr + loop_offset;
+
+	int n = 0, offset = 0, prev_cycles = 0;
+	bool ends = false;
+	while (n < MAX_JIT_OPS && !ends) {
+		uint8 op = p[offset];
+		if (op_kind[op] == J_NONE || offset + mode_length[op_mode[op]] > room)
+			break;
+		if (offset == loop_offset) {
+			mov_r9(cycles_exit(prev_cycles));
+			loop_code = out;
+		}
+		loop_header = offset == loop_offset;
+		bool ok = translate_op(p + offset, adr + offset, prev_cycles, in_ram, &ends);
+		loop_header = false;
+		if (!ok)
+			break;
+		prev_cycles = op_cycles[op];
+		offset += mode_length[op_mode[op]];
+		n++;
+	}
+	if (n == 0) {
+		out = start;
+		set_writable(start, false);
+		return NULL;
+	}
+	if (!ends)
+		leave((uint16)(adr + offset) | cycles_exit(prev_cycles));
+	if (!set_writable(start, false)) {
+		out = start;
+		return NULL;
+	}
+	return (JITCode)start;
+}
+
+
+/*
+ *  Make the pages a translation starting at p may write to read/write,
+ *  or read/execute again; false on error
+ */
+
+bool JIT6510::set_writable(uint8 *p, bool writable)
+{
+	uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+	uint8 *first = (uint8 *)((uintptr_t)p & ~page_mask);
+	uint8 *end = p + MAX_JIT_OPS * MAX_JIT_OP_CODE;
+	if (end > code + JIT_CODE_SIZE)
+		end = code + JIT_CODE_SIZE;
+	return mprotect(first, end - first, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+}
+
+
+/*
+ *  Find the opcode a branch at the end of the code at p jumps back to,
+ *  -1 if there is none
+ */
+
+int JIT6510::find_loop(const uint8 *p, int room)
+{
+	int starts[MAX_JIT_OPS];
+	int offset = 0;
+	for (int n=0; n<MAX_JIT_OPS; n++) {
+		uint8 op = p[offset];
+		int len = mode_length[op_mode[op]];
+		if (op_kind[op] == J_NONE || offset + len > room)
+			return -1;
+		starts[n] = offset;
+		if (op_kind[op] == J_BRANCH) {
+			int target = offset + 2 + (int8)p[offset+1];
+			for (int i=0; i<=n; i++)
+				if (starts[i] == target)
+					return target;
+			return -1;
+		}
+		if (op_kind[op] == J_JMP || op_kind[op] == J_JSR || op_kind[op] == J_RTS)
+			return -1;
+		offset += len;
+	}
+	return -1;
+}
+
+
+/*
+ *  Translate one opcode; false if it has to be left to the interpreter
+ *  (nothing is emitted then). Sets *ends if the code returns after it.
+ */
+
+bool JIT6510::translate_op(const uint8 *p, uint16 adr, int prev_cycles, bool in_ram, bool *ends)
+{
+	uint8 op = p[0];
+	int kind = op_kind[op];
+	int mode = op_mode[op];
+	int cycles = op_cycles[op];
+	int len = mode_length[mode];
+	uint16 operand = len == 3 ? p[1] | (p[2] << 8) : p[1];
+	uint16 next = adr + len;
+	uint32 before = adr | cycles_exit(prev_cycles);		// Let the interpreter execute this opcode
+
+	bool rmw = mode != M_IMP && (kind == J_INC || kind == J_DEC || kind == J_ASL || kind == J_LSR || kind == J_ROL || kind == J_ROR);
+	bool reads = rmw || (kind >= J_LDA && kind <= J_BIT && kind != J_STA && kind != J_STX && kind != J_STY);
+	bool writes = rmw || kind == J_STA || kind == J_STX || kind == J_STY;
+	if (mode == M_ABS && ((reads && !fast_read(operand)) || (writes && !fast_write(operand))))
+		return false;
+	if (mode == M_ZP && writes && operand < 2)
+		return false;
+
+	int reg = S_A;
+	if (kind == J_LDX || kind == J_STX || kind == J_CPX)
+		reg = S_X;
+	else if (kind == J_LDY || kind == J_STY || kind == J_CPY)
+		reg = S_Y;
+
+	switch (kind) {
+		case J_LDA: case J_LDX: case J_LDY:
+			access(mode, operand, true, false, before);
+			store(reg, EAX);
+			set_nz(EAX);
+			break;
+
+		case J_STA: case J_STX: case J_STY:
+			access(mode, operand, false, true, before);
+			load(EAX, reg);
+			write_operand(mode, operand, cycles, next, in_ram, adr >> 8, ends);
+			break;
+
+		case J_AND: case J_ORA: case J_EOR:
+			access(mode, operand, true, false, before);
+			load(ECX, S_A);
+			alu(kind == J_AND ? X_AND : kind == J_ORA ? X_OR : X_XOR, ECX, EAX);
+			store(S_A, ECX);
+			set_nz(ECX);
+			break;
+
+		case J_CMP: case J_CPX: case J_CPY:
+			access(mode, operand, true, false, before);
+			load(ECX, reg);
+			alu(X_SUB, ECX, EAX);
+			setcc(CC_AE, S_C);
+			set_nz(ECX);
+			break;
+
+		case J_ADC:
+			cmp_slot(S_D, 0);
+			leave_before_if(CC_NE, before);		// Decimal mode
+			access(mode, operand, true, false, before);
+			load(ECX, S_A);
+			load(EDX, S_C);
+			alu(X_ADD, EDX, ECX);
+			alu(X_ADD, EDX, EAX);		// edx = a + m + c
+			alu_imm(I_CMP, EDX, 0xff);
+			setcc(CC_A, S_C);
+			alu(X_XOR, EAX, ECX);
+			alu_imm(I_XOR, EAX, 0x80);	// ~(a ^ m)
+			alu(X_XOR, ECX, EDX);		// a ^ result
+			alu(X_AND, EAX, ECX);
+			shift(S_SHR, EAX, 7);
+			store(S_V, EAX);
+			store(S_A, EDX);
+			set_nz(EDX);
+			break;
+
+		case J_SBC:
+			cmp_slot(S_D, 0);
+			leave_before_if(CC_NE, before);
+			access(mode, operand, true, false, before);
+			load(ECX, S_A);
+			load(EDX, S_C);
+			alu(X_ADD, EDX, ECX);
+			alu_imm(I_SUB, EDX, 1);
+			alu(X_SUB, EDX, EAX);		// edx = a - m - !c, negative on borrow
+			setcc(CC_NS, S_C);
+			alu(X_XOR, EAX, ECX);		// a ^ m
+			alu(X_XOR, ECX, EDX);		// a ^ result
+			alu(X_AND, EAX, ECX);
+			shift(S_SHR, EAX, 7);
+			store(S_V, EAX);
+			store(S_A, EDX);
+			set_nz(EDX);
+			break;
+
+		case J_BIT:
+			access(mode, operand, true, false, before);
+			load(ECX, S_A);
+			alu(X_AND, ECX, EAX);
+			store(S_Z, ECX);
+			store(S_N, EAX);
+			shift(S_SHR, EAX, 6);
+			alu_imm(I_AND, EAX, 1);
+			store(S_V, EAX);
+			break;
+
+		case J_INC: case J_DEC:
+			access(mode, operand, true, true, before);
+			alu_imm(kind == J_INC ? I_ADD : I_SUB, EAX, 1);
+			set_nz(EAX);
+			write_operand(mode, operand, cycles, next, in_ram, adr >> 8, ends);
+			break;
+
+		case J_ASL: case J_LSR: case J_ROL: case J_ROR:
+			if (rmw)
+				access(mode, operand, true, true, before);
+			else
+				load(EAX, S_A);
+			if (kind == J_ROL || kind == J_ROR)
+				load(EDX, S_C);
+			switch (kind) {
+				case J_ASL:
+					shift(S_SHL, EAX, 1);
+					mov(EDX, EAX);
+					shift(S_SHR, EDX, 8);
+					break;
+				case J_ROL:
+					shift(S_SHL, EAX, 1);
+					alu(X_OR, EAX, EDX);
+					mov(EDX, EAX);
+					shift(S_SHR, EDX, 8);
+					break;
+				case J_ROR:
+					shift(S_SHL, EDX, 8);
+					alu(X_OR, EAX, EDX);
+					// fall through
+				case J_LSR:
+					mov(EDX, EAX);
+					alu_imm(I_AND, EDX, 1);
+					shift(S_SHR, EAX, 1);
+					break;
+			}
+			store(S_C, EDX);
+			set_nz(EAX);
+			if (rmw)
+				write_operand(mode, operand, cycles, next, in_ram, adr >> 8, ends);
+			else
+				store(S_A, EAX);
+			break;
+
+		case J_INX: case J_INY: case J_DEX: case J_DEY:
+			reg = (kind == J_INX || kind == J_DEX) ? S_X : S_Y;
+			if (kind == J_INX || kind == J_INY)
+				inc_slot(reg);
+			else
+				dec_slot(reg);
+			load(EAX, reg);
+			set_nz(EAX);
+			break;
+
+		case J_TAX: case J_TAY: case J_TXA: case J_TYA: case J_TSX: case J_TXS: {
+			static const uint8 from[] = {S_A, S_A, S_X, S_Y, S_SP, S_X};
+			static const uint8 to[] = {S_X, S_Y, S_A, S_A, S_X, S_SP};
+			load(EAX, from[kind - J_TAX]);
+			store(to[kind - J_TAX], EAX);
+			if (kind != J_TXS)
+				set_nz(EAX);
+			break;
+		}
+
+		case J_CLC: store_imm(S_C, 0); break;
+		case J_SEC: store_imm(S_C, 1); break;
+		case J_CLD: store_imm(S_D, 0); break;
+		case J_SED: store_imm(S_D, 1); break;
+		case J_CLV: store_imm(S_V, 0); break;
+		case J_SEI: store_imm(S_I, 1); break;
+
+		case J_PHA:
+			load(EAX, S_A);
+			push(EAX);
+			break;
+
+		case J_PLA:
+			pop(EAX);
+			store(S_A, EAX);
+			set_nz(EAX);
+			break;
+
+		case J_PHP:
+			load(EAX, S_N);
+			alu_imm(I_AND, EAX, 0x80);
+			alu_imm(I_OR, EAX, 0x30);
+			load(ECX, S_V); shift(S_SHL, ECX, 6); alu(X_OR, EAX, ECX);
+			load(ECX, S_D); shift(S_SHL, ECX, 3); alu(X_OR, EAX, ECX);
+			load(ECX, S_I); shift(S_SHL, ECX, 2); alu(X_OR, EAX, ECX);
+			cmp_slot(S_Z, 0);
+			emit8(0x0f); emit8(0x94); emit8(0xc1);	// sete cl
+			movzx8(ECX, ECX); shift(S_SHL, ECX, 1); alu(X_OR, EAX, ECX);
+			load(ECX, S_C); alu(X_OR, EAX, ECX);
+			push(EAX);
+			break;
+
+		case J_NOP:
+			break;
+
+		case J_JSR:
+			mov_imm(EAX, (uint16)(adr + 2) >> 8);
+			push(EAX);
+			mov_imm(EAX, (adr + 2) & 0xff);
+			push(EAX);
+			// fall through
+		case J_JMP:
+			sub_cycles(cycles);
+			leave_if(CC_S, operand | JIT_EXIT_JUMP | JIT_EXIT_LINE_END | cycles_exit(cycles));
+			leave(operand | JIT_EXIT_JUMP | cycles_exit(cycles));
+			*ends = true;
+			return true;
+
+		case J_RTS: {
+			pop(EAX);
+			pop(ECX);
+			shift(S_SHL, ECX, 8);
+			alu(X_OR, EAX, ECX);
+			alu_imm(I_ADD, EAX, 1);
+			movzx16(EAX, EAX);
+			sub_cycles(cycles);
+			int j = jcc8(CC_NS);
+			alu_imm(I_OR, EAX, JIT_EXIT_JUMP | JIT_EXIT_LINE_END | cycles_exit(cycles));
+			emit8(0xc3);
+			bind8(j);
+			alu_imm(I_OR, EAX, JIT_EXIT_JUMP | cycles_exit(cycles));
+			emit8(0xc3);
+			*ends = true;
+			return true;
+		}
+
+		case J_BRANCH: {
+			uint16 target = next + (int8)operand;
+			int slot = op < 0x40 ? S_N : op < 0x80 ? S_V : op < 0xc0 ? S_C : S_Z;
+			int taken = (op & 0x20) ? CC_NE : CC_E;
+			if (slot == S_N)
+				test_slot(S_N, 0x80);
+			else
+				cmp_slot(slot, 0);
+			if (slot == S_Z)			// z_flag is inverted
+				taken ^= 1;
+			int j = jcc8(taken);
+			sub_cycles(2);
+			leave_if(CC_S, next | JIT_EXIT_LINE_END | cycles_exit(2));
+			leave(next | cycles_exit(2));
+			bind8(j);
+			sub_cycles(3);
+			leave_if(CC_S, target | JIT_EXIT_LINE_END | cycles_exit(3));
+			if (loop_code && target == loop_adr) {
+				mov_r9(cycles_exit(3));
+				jmp(loop_code);
+			} else
+				leave(target | cycles_exit(3));
+			*ends = true;
+			return true;
+		}
+	}
+
+	if (!*ends)
+		end_op(cycles, next);
+	return true;
+}
+
+
+/*
+ *  Check the operand address at run time and read the operand into eax
+ *  (if reads); the address of indexed and indirect operands is left in ecx
+ */
+
+void JIT6510::access(int mode, uint16 operand, bool reads, bool writes, uint32 before)
+{
+	switch (mode) {
+		case M_IMM:
+			mov_imm(EAX, operand);
+			return;
+		case M_ZP:
+		case M_ABS:
+			if (reads)
+				load_ram(EAX, operand);
+			return;
+	}
+
+	calc_address(mode, operand);
+	if (mode == M_ZPX || mode == M_ZPY) {
+		// read_zp()/write_zp(), only the processor port is special
+		if (writes) {
+			alu_imm(I_CMP, ECX, 2);
+			leave_before_if(CC_B, before);
+		}
+	} else {
+		mov(EDX, ECX);
+		shift(S_SHR, EDX, 12);
+		if (reads) {
+			alu_imm(I_CMP, EDX, 0x0a);
+			int j = jcc8(CC_B);
+			alu_imm(I_CMP, EDX, 0x0c);
+			leave_before_if(CC_NE, before);
+			bind8(j);
+		} else {
+			alu_imm(I_CMP, EDX, 0x0d);
+			leave_before_if(CC_E, before);
+		}
+		if (writes) {
+			alu_imm(I_CMP, ECX, 2);
+			leave_before_if(CC_B, before);
+		}
+	}
+	if (reads)
+		load_ram_idx(EAX, ECX, 0);
+}
+
+
+/*
+ *  Compute the address of an indexed or indirect operand in ecx
+ */
+
+void JIT6510::calc_address(int mode, uint16 operand)
+{
+	switch (mode) {
+		case M_ZPX:
+		case M_ZPY:
+			load(ECX, mode == M_ZPX ? S_X : S_Y);
+			alu_imm(I_ADD, ECX, operand);
+			movzx8(ECX, ECX);
+			break;
+		case M_ABSX:
+		case M_ABSY:
+			load(ECX, mode == M_ABSX ? S_X : S_Y);
+			alu_imm(I_ADD, ECX, operand);
+			movzx16(ECX, ECX);
+			break;
+		case M_INDX:
+			load(EDX, S_X);
+			alu_imm(I_ADD, EDX, operand);
+			movzx8(EDX, EDX);
+			load_ram_idx(ECX, EDX, 0);
+			alu_imm(I_ADD, EDX, 1);
+			movzx8(EDX, EDX);
+			load_ram_idx(EDX, EDX, 0);
+			shift(S_SHL, EDX, 8);
+			alu(X_OR, ECX, EDX);
+			break;
+		case M_INDY:
+			load_ram(ECX, operand);
+			load_ram(EDX, (operand + 1) & 0xff);
+			shift(S_SHL, EDX, 8);
+			alu(X_OR, ECX, EDX);
+			load(EDX, S_Y);
+			alu(X_ADD, ECX, EDX);
+			movzx16(ECX, ECX);
+			break;
+	}
+}
+
+
+/*
+ *  Write al to the operand (checked by access()), count the write in
+ *  the page generation and return if the code of this block changed
+ */
+
+void JIT6510::write_operand(int mode, uint16 operand, int cycles, uint16 next, bool in_ram, uint8 page, bool *ends)
+{
+	switch (mode) {
+		case M_ZP:
+			store_ram(operand, EAX);
+			break;
+		case M_ZPX:
+		case M_ZPY:
+			store_ram_idx(ECX, 0, EAX);
+			break;
+		case M_ABS:
+			store_ram(operand, EAX);
+			inc_gen_page(operand >> 8);
+			if (in_ram && (operand >> 8) == page) {
+				end_op(cycles, next);
+				leave(next | cycles_exit(cycles));
+				*ends = true;
+			}
+			break;
+		default: {
+			store_ram_idx(ECX, 0, EAX);
+			mov(EDX, ECX);
+			shift(S_SHR, EDX, 8);
+			inc_gen(EDX);
+			if (in_ram) {
+				alu_imm(I_CMP, EDX, page);
+				int j = jcc8(CC_NE);
+				end_op(cycles, next);
+				leave(next | cycles_exit(cycles));
+				bind8(j);
+			}
+			break;
+		}
+	}
+}
+
+
+/*
+ *  Account for the cycles of an opcode like the interpreter loop does
+ */
+
+void JIT6510::end_op(int cycles, uint16 next)
+{
+	sub_cycles(cycles);
+	leave_if(CC_S, next | JIT_EXIT_LINE_END | cycles_exit(cycles));
+}
+
+
+/*
+ *  x86-64 emitter
+ */
+
+void JIT6510::emit32(uint32 v)
+{
+	memcpy(out, &v, 4);
+	out += 4;
+}
+
+// movzx r32,byte [rdi+slot]
+void JIT6510::load(int r, int slot)
+{
+	emit8(0x0f); emit8(0xb6); emit8(0x47 | r << 3); emit8(slot);
+}
+
+// mov [rdi+slot],r8
+void JIT6510::store(int slot, int r)
+{
+	emit8(0x88); emit8(0x47 | r << 3); emit8(slot);
+}
+
+// mov byte [rdi+slot],imm8
+void JIT6510::store_imm(int slot, uint8 v)
+{
+	emit8(0xc6); emit8(0x47); emit8(slot); emit8(v);
+}
+
+// movzx r32,byte [rsi+adr]
+void JIT6510::load_ram(int r, uint16 adr)
+{
+	emit8(0x0f); emit8(0xb6); emit8(0x86 | r << 3); emit32(adr);
+}
+
+// mov [rsi+adr],r8
+void JIT6510::store_ram(uint16 adr, int r)
+{
+	emit8(0x88); emit8(0x86 | r << 3); emit32(adr);
+}
+
+// movzx r32,byte [rsi+idx+disp]
+void JIT6510::load_ram_idx(int r, int idx, uint32 disp)
+{
+	emit8(0x0f); emit8(0xb6); emit8(0x84 | r << 3); emit8(idx << 3 | 6); emit32(disp);
+}
+
+// mov [rsi+idx+disp],r8
+void JIT6510::store_ram_idx(int idx, uint32 disp, int r)
+{
+	emit8(0x88); emit8(0x84 | r << 3); emit8(idx << 3 | 6); emit32(disp);
+}
+
+// op dst,src
+void JIT6510::alu(int op, int dst, int src)
+{
+	emit8(op); emit8(0xc0 | src << 3 | dst);
+}
+
+// op r,imm
+void JIT6510::alu_imm(int n, int r, uint32 imm)
+{
+	if ((int32)imm >= -128 && (int32)imm <= 127) {
+		emit8(0x83); emit8(0xc0 | n << 3 | r); emit8(imm);
+	} else {
+		emit8(0x81); emit8(0xc0 | n << 3 | r); emit32(imm);
+	}
+}
+
+// shl/shr r,count
+void JIT6510::shift(int n, int r, int count)
+{
+	emit8(0xc1); emit8(0xc0 | n << 3 | r); emit8(count);
+}
+
+void JIT6510::mov(int dst, int src)
+{
+	emit8(0x89); emit8(0xc0 | src << 3 | dst);
+}
+
+void JIT6510::mov_imm(int r, uint32 v)
+{
+	emit8(0xb8 + r); emit32(v);
+}
+
+void JIT6510::movzx8(int dst, int src)
+{
+	emit8(0x0f); emit8(0xb6); emit8(0xc0 | dst << 3 | src);
+}
+
+void JIT6510::movzx16(int dst, int src)
+{
+	emit8(0x0f); emit8(0xb7); emit8(0xc0 | dst << 3 | src);
+}
+
+// setcc byte [rdi+slot]
+void JIT6510::setcc(int cc, int slot)
+{
+	emit8(0x0f); emit8(0x90 | cc); emit8(0x47); emit8(slot);
+}
+
+// cmp byte [rdi+slot],v
+void JIT6510::cmp_slot(int slot, uint8 v)
+{
+	emit8(0x80); emit8(0x7f); emit8(slot); emit8(v);
+}
+
+// test byte [rdi+slot],v
+void JIT6510::test_slot(int slot, uint8 v)
+{
+	emit8(0xf6); emit8(0x47); emit8(slot); emit8(v);
+}
+
+// inc/dec byte [rdi+slot]
+void JIT6510::inc_slot(int slot)
+{
+	emit8(0xfe); emit8(0x47); emit8(slot);
+}
+
+void JIT6510::dec_slot(int slot)
+{
+	emit8(0xfe); emit8(0x4f); emit8(slot);
+}
+
+// inc dword [r8+idx*4]
+void JIT6510::inc_gen(int idx)
+{
+	emit8(0x41); emit8(0xff); emit8(0x04); emit8(0x80 | idx << 3);
+}
+
+// inc dword [r8+page*4]
+void JIT6510::inc_gen_page(uint8 page)
+{
+	emit8(0x41); emit8(0xff); emit8(0x80); emit32(page * 4);
+}
+
+void JIT6510::set_nz(int r)
+{
+	store(S_N, r);
+	store(S_Z, r);
+}
+
+// ram[sp-- | 0x100] = r (uses edx)
+void JIT6510::push(int r)
+{
+	load(EDX, S_SP);
+	store_ram_idx(EDX, 0x100, r);
+	dec_slot(S_SP);
+}
+
+// r = ram[++sp | 0x100] (uses edx)
+void JIT6510::pop(int r)
+{
+	inc_slot(S_SP);
+	load(EDX, S_SP);
+	load_ram_idx(r, EDX, 0x100);
+}
+
+// sub dword [rdi+cycles_left],cycles
+void JIT6510::sub_cycles(int cycles)
+{
+	emit8(0x83); emit8(0x6f); emit8(S_CYCLES); emit8(cycles);
+}
+
+// Short forward jump, target set by bind8()
+int JIT6510::jcc8(int cc)
+{
+	emit8(0x70 | cc); emit8(0);
+	return out - code - 1;
+}
+
+void JIT6510::bind8(int at)
+{
+	code[at] = out - code - at - 1;
+}
+
+// mov eax,v; ret
+void JIT6510::leave(uint32 v)
+{
+	mov_imm(EAX, v);
+	emit8(0xc3);
+}
+
+void JIT6510::leave_if(int cc, uint32 v)
+{
+	emit8(0x70 | (cc ^ 1)); emit8(6);
+	leave(v);
+}
+
+// Return before the opcode at before & 0xffff if cc
+void JIT6510::leave_before_if(int cc, uint32 before)
+{
+	if (loop_header) {
+		// mov eax,adr; or eax,r9d; ret
+		emit8(0x70 | (cc ^ 1)); emit8(9);
+		mov_imm(EAX, before & 0xffff);
+		emit8(0x44); emit8(0x09); emit8(0xc8);
+		emit8(0xc3);
+	} else
+		leave_if(cc, before);
+}
+
+// mov r9d,v
+void JIT6510::mov_r9(uint32 v)
+{
+	emit8(0x41); emit8(0xb9); emit32(v);
+}
+
+// jmp to
+void JIT6510::jmp(uint8 *to)
+{
+	emit8(0xe9); emit32(to - (out + 4));
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  CPUJIT.h - Translation of hot 6510 blocks to x86-64 code
+ *
+ *  Only used by the line-based 6510 if CPU_JIT is set (see CPUC64.h),
+ *  the blocks come from its block cache.
+ */
+
+#ifndef _CPU_JIT_H
+#define _CPU_JIT_H
+
+#include "sysdeps.h"
+
+
+// 6510 state the translated code works on, copied from and back to
+// the MOS6510 around each call. Flags have the same representation
+// as in MOS6510 (lazy N and Z, bools for the others).
+struct JITState {
+	uint8 a, x, y, sp;
+	uint8 n_flag, z_flag;
+	uint8 v_flag, d_flag, i_flag, c_flag;
+	int32 cycles_left;		// Of EmulateLine()
+	uint8 *ram;
+	uint32 *ram_gen;		// MOS6510::ram_gen[]
+};
+
+// Translated code returns the 6510 address to continue at (bits 0..15),
+// the cycles of the last opcode it executed (bits 20..23, 0 if it
+// stopped before the first one) and these flags
+const uint32 JIT_EXIT_JUMP = 0x10000;		// Continue with jump(), not relative to pc_base
+const uint32 JIT_EXIT_LINE_END = 0x20000;	// cycles_left underflowed
+const int JIT_EXIT_CYCLES_SHIFT = 20;
+
+typedef uint32 (*JITCode)(JITState *s);
+
+
+// Translates straight-line 6510 code to x86-64 code in a W^X code
+// buffer. Opcodes that may touch I/O, the ROMs or the processor port,
+// and ADC/SBC in decimal mode, make the code return so that the
+// interpreter executes them.
+class JIT6510 {
+public:
+	JIT6510();
+	~JIT6510();
+
+	bool Full(void);		// Flush() before the next Translate()
+	void Flush(void);		// Drop all translations
+
+	// Translate the code at host address p (6510 address adr), NULL if
+	// its first opcode cannot be translated
+	JITCode Translate(const uint8 *p, uint16 adr, bool in_ram);
+
+private:
+	int find_loop(const uint8 *p, int room);
+	bool set_writable(uint8 *p, bool writable);
+	bool translate_op(const uint8 *p, uint16 adr, int prev_cycles, bool in_ram, bool *ends);
+	void access(int mode, uint16 operand, bool reads, bool writes, uint32 before);
+	void write_operand(int mode, uint16 operand, int cycles, uint16 next, bool in_ram, uint8 page, bool *ends);
+	void calc_address(int mode, uint16 operand);
+	void end_op(int cycles, uint16 next);
+
+	// x86-64 emitter
+	void emit8(uint8 b) { *out++ = b; }
+	void emit32(uint32 v);
+	void load(int r, int slot);
+	void store(int slot, int r);
+	void store_imm(int slot, uint8 v);
+	void load_ram(int r, uint16 adr);
+	void store_ram(uint16 adr, int r);
+	void load_ram_idx(int r, int idx, uint32 disp);
+	void store_ram_idx(int idx, uint32 disp, int r);
+	void alu(int op, int dst, int src);
+	void alu_imm(int n, int r, uint32 imm);
+	void shift(int n, int r, int count);
+	void mov(int dst, int src);
+	void mov_imm(int r, uint32 v);
+	void movzx8(int dst, int src);
+	void movzx16(int dst, int src);
+	void setcc(int cc, int slot);
+	void cmp_slot(int slot, uint8 v);
+	void test_slot(int slot, uint8 v);
+	void inc_slot(int slot);
+	void dec_slot(int slot);
+	void inc_gen(int idx);
+	void inc_gen_page(uint8 page);
+	void set_nz(int r);
+	void push(int r);
+	void pop(int r);
+	void sub_cycles(int cycles);
+	int jcc8(int cc);
+	void bind8(int at);
+	void leave(uint32 v);
+	void leave_if(int cc, uint32 v);
+	void leave_before_if(int cc, uint32 before);
+	void mov_r9(uint32 v);
+	void jmp(uint8 *to);
+
+	uint8 *code;			// Code buffer, read/execute outside Translate()
+	uint8 *out;				// Next free byte
+	uint8 *loop_code;		// Code of the opcode at loop_adr, NULL if none
+	uint16 loop_adr;		// Target of a branch back into the translation
+	bool loop_header;		// Translating the opcode at loop_adr
+	uint8 op_kind[256], op_mode[256], op_cycles[256];
+};
+
+#endif
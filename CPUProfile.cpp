@@ -0,0 +1,278 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  CPUProfile.cpp - Instruction-level profiler for the 6510
+ *
+ * Notes:
+ * ------
+ *
+ *  - The call tree is keyed by entry point, so all calls of a
+ *    subroutine from the same path share one node.
+ *  - Games often leave subroutines without RTS (PLA/PLA, resetting
+ *    the stack pointer) or use RTS as a computed jump. Calls and
+ *    returns are therefore matched by stack pointer: a return pops
+ *    every pending call that was made at or below the new stack
+ *    pointer, and a call first drops such stale calls.
+ *  - When the tree is full, new callees are charged to their caller.
+ */
+
+#include "sysdeps.h"
+
+#include "CPUProfile.h"
+
+
+const int MAX_NODES = 16384;
+const int NODE_HASH_SIZE = 32768;	// Power of 2
+
+static const char *io_names[PROF_IO_COUNT] = {
+	"VIC", "SID", "Color RAM", "CIA 1", "CIA 2", "Open I/O"
+};
+
+static const char mnemonics[256][4] = {
+	"BRK","ORA","JAM","SLO","NOP","ORA","ASL","SLO","PHP","ORA","ASL","ANC","NOP","ORA","ASL","SLO",
+	"BPL","ORA","JAM","SLO","NOP","ORA","ASL","SLO","CLC","ORA","NOP","SLO","NOP","ORA","ASL","SLO",
+	"JSR","AND","JAM","RLA","BIT","AND","ROL","RLA","PLP","AND","ROL","ANC","BIT","AND","ROL","RLA",
+	"BMI","AND","JAM","RLA","NOP","AND","ROL","RLA","SEC","AND","NOP","RLA","NOP","AND","ROL","RLA",
+	"RTI","EOR","JAM","SRE","NOP","EOR","LSR","SRE","PHA","EOR","LSR","ALR","JMP","EOR","LSR","SRE",
+	"BVC","EOR","JAM","SRE","NOP","EOR","LSR","SRE","CLI","EOR","NOP","SRE","NOP","EOR","LSR","SRE",
+	"RTS","ADC","JAM","RRA","NOP","ADC","ROR","RRA","PLA","ADC","ROR","ARR","JMP","ADC","ROR","RRA",
+	"BVS","ADC","JAM","RRA","NOP","ADC","ROR","RRA","SEI","ADC","NOP","RRA","NOP","ADC","ROR","RRA",
+	"NOP","STA","NOP","SAX","STY","STA","STX","SAX","DEY","NOP","TXA","ANE","STY","STA","STX","SAX",
+	"BCC","STA","JAM","SHA","STY","STA","STX","SAX","TYA","STA","TXS","TAS","SHY","STA","SHX","SHA",
+	"LDY","LDA","LDX","LAX","LDY","LDA","LDX","LAX","TAY","LDA","TAX","LXA","LDY","LDA","LDX","LAX",
+	"BCS","LDA","JAM","LAX","LDY","LDA","LDX","LAX","CLV","LDA","TSX","LAS","LDY","LDA","LDX","LAX",
+	"CPY","CMP","NOP","DCP","CPY","CMP","DEC","DCP","INY","CMP","DEX","SBX","CPY","CMP","DEC","DCP",
+	"BNE","CMP","JAM","DCP","NOP","CMP","DEC","DCP","CLD","CMP","NOP","DCP","NOP","CMP","DEC","DCP",
+	"CPX","SBC","NOP","ISB","CPX","SBC","INC","ISB","INX","SBC","NOP","SBC","CPX","SBC","INC","ISB",
+	"BEQ","SBC","EXT","ISB","NOP","SBC","INC","ISB","SED","SBC","NOP","ISB","NOP","SBC","INC","ISB"
+};
+
+
+/*
+ *  Constructor/destructor
+ */
+
+CPUProfile::CPUProfile()
+{
+	pc_count = new uint32[0x10000];
+	pc_cycles = new uint64_t[0x10000];
+	pc_io = new uint64_t[0x10000];
+	nodes = new Node[MAX_NODES];
+	node_hash = new int[NODE_HASH_SIZE];
+	Reset();
+}
+
+CPUProfile::~CPUProfile()
+{
+	delete[] node_hash;
+	delete[] nodes;
+	delete[] pc_io;
+	delete[] pc_cycles;
+	delete[] pc_count;
+}
+
+
+/*
+ *  Clear all counters and the call tree
+ */
+
+void CPUProfile::Reset(void)
+{
+	cur_pc = 0;
+	memset(pc_count, 0, 0x10000 * sizeof(uint32));
+	memset(pc_cycles, 0, 0x10000 * sizeof(uint64_t));
+	memset(pc_io, 0, 0x10000 * sizeof(uint64_t));
+	memset(op_count, 0, sizeof(op_count));
+	memset(op_cycles, 0, sizeof(op_cycles));
+	total_cycles = 0;
+	reads = 0;
+	memset(io_reads, 0, sizeof(io_reads));
+	memset(io_writes, 0, sizeof(io_writes));
+
+	nodes[0].parent = -1;
+	nodes[0].addr = 0;
+	nodes[0].kind = PROF_CALL_JSR;
+	nodes[0].cycles = 0;
+	num_nodes = 1;
+	for (int i=0; i<NODE_HASH_SIZE; i++)
+		node_hash[i] = -1;
+	cur_node = 0;
+	depth = 0;
+}
+
+
+/*
+ *  Find or create the callee of a call tree node
+ */
+
+int CPUProfile::child_node(int parent, int kind, uint16 addr)
+{
+	uint32 h = ((uint32)parent * 0x10003 + (kind << 16) + addr) * 2654435761U;
+	for (int i = h >> 17;; i = (i + 1) & (NODE_HASH_SIZE - 1)) {
+		int n = node_hash[i];
+		if (n < 0) {
+			if (num_nodes == MAX_NODES)
+				return parent;
+			n = node_hash[i] = num_nodes++;
+			nodes[n].parent = parent;
+			nodes[n].addr = addr;
+			nodes[n].kind = kind;
+			nodes[n].cycles = 0;
+			return n;
+		}
+		if (nodes[n].parent == parent && nodes[n].addr == addr && nodes[n].kind == kind)
+			return n;
+	}
+}
+
+
+/*
+ *  JSR, interrupt or BRK
+ */
+
+void CPUProfile::Call(int kind, uint16 target, uint8 sp)
+{
+	while (depth && stack[depth-1].sp <= sp)
+		cur_node = stack[--depth].node;
+
+	if (depth == 256)
+		return;
+	stack[depth].node = cur_node;
+	stack[depth].sp = sp;
+	depth++;
+	cur_node = child_node(cur_node, kind, target);
+}
+
+
+/*
+ *  RTS or RTI
+ */
+
+void CPUProfile::Return(uint8 sp)
+{
+	while (depth && stack[depth-1].sp <= sp)
+		cur_node = stack[--depth].node;
+}
+
+
+/*
+ *  Write the flat profile
+ */
+
+static const uint64_t *sort_key;
+
+static int compare_keys(const void *a, const void *b)
+{
+	uint64_t ka = sort_key[*(const int *)a], kb = sort_key[*(const int *)b];
+	return ka < kb ? 1 : ka > kb ? -1 : *(const int *)a - *(const int *)b;
+}
+
+// Indices of the non-zero entries of key, largest first
+static int sorted_indices(const uint64_t *key, int size, int *index)
+{
+	int n = 0;
+	for (int i=0; i<size; i++)
+		if (key[i])
+			index[n++] = i;
+	sort_key = key;
+	qsort(index, n, sizeof(int), compare_keys);
+	return n;
+}
+
+static double percent(uint64_t part, uint64_t total)
+{
+	return total ? part * 100.0 / total : 0.0;
+}
+
+void CPUProfile::DumpFlat(FILE *f, int max_pcs)
+{
+	int *index = new int[0x10000];
+	uint64_t instructions = 0, io_read_total = 0, io_total = 0;
+	for (int i=0; i<256; i++)
+		instructions += op_count[i];
+	for (int i=0; i<PROF_IO_COUNT; i++) {
+		io_read_total += io_reads[i];
+		io_total += io_reads[i] + io_writes[i];
+	}
+
+	fprintf(f, "6510 profile: %llu cycles, %llu instructions\n",
+		(unsigned long long)total_cycles, (unsigned long long)instructions);
+	fprintf(f, "read_byte(): %llu reads, %llu of them I/O (%.1f%%)\n\n",
+		(unsigned long long)reads, (unsigned long long)io_read_total, percent(io_read_total, reads));
+
+	fprintf(f, "I/O            reads      writes\n");
+	for (int i=0; i<PROF_IO_COUNT; i++)
+		fprintf(f, "%-10s %10llu  %10llu\n", io_names[i],
+			(unsigned long long)io_reads[i], (unsigned long long)io_writes[i]);
+
+	fprintf(f, "\nOpcode          count      cycles  cycles%%\n");
+	int n = sorted_indices(op_cycles, 256, index);
+	for (int i=0; i<n; i++) {
+		int op = index[i];
+		fprintf(f, "$%02x %s  %12llu %11llu  %6.2f\n", op, mnemonics[op],
+			(unsigned long long)op_count[op], (unsigned long long)op_cycles[op], percent(op_cycles[op], total_cycles));
+	}
+
+	fprintf(f, "\nPC           count      cycles  cycles%%        I/O\n");
+	n = sorted_indices(pc_cycles, 0x10000, index);
+	for (int i=0; i<n && i<max_pcs; i++) {
+		int pc = index[i];
+		fprintf(f, "$%04x %11u %11llu  %6.2f %10llu\n", pc, pc_count[pc],
+			(unsigned long long)pc_cycles[pc], percent(pc_cycles[pc], total_cycles), (unsigned long long)pc_io[pc]);
+	}
+
+	fprintf(f, "\nPC             I/O    I/O%%\n");
+	n = sorted_indices(pc_io, 0x10000, index);
+	for (int i=0; i<n && i<max_pcs; i++) {
+		int pc = index[i];
+		fprintf(f, "$%04x %10llu  %6.2f\n", pc, (unsigned long long)pc_io[pc], percent(pc_io[pc], io_total));
+	}
+
+	delete[] index;
+}
+
+
+/*
+ *  Write the call tree as folded stacks (flamegraph.pl input)
+ */
+
+int CPUProfile::folded_name(int node, char *buf, int size)
+{
+	if (node == 0)
+		return snprintf(buf, size, "6510");
+
+	int len = folded_name(nodes[node].parent, buf, size);
+	if (len >= size)
+		return len;
+
+	static const char *prefix[] = {"", "irq:", "nmi:"};
+	return len + snprintf(buf + len, size - len, ";%s$%04x", prefix[nodes[node].kind], nodes[node].addr);
+}
+
+void CPUProfile::DumpFolded(FILE *f)
+{
+	char name[4096];
+
+	for (int i=0; i<num_nodes; i++)
+		if (nodes[i].cycles) {
+			folded_name(i, name, sizeof(name));
+			fprintf(f, "%s %llu\n", name, (unsigned long long)nodes[i].cycles);
+		}
+}
@@ -0,0 +1,123 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  CPUProfile.h - Instruction-level profiler for the 6510
+ *
+ *  Only used if PROFILE_6510 is defined, the CPU core has no
+ *  profiling hooks otherwise.
+ */
+
+#ifndef _CPU_PROFILE_H
+#define _CPU_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "sysdeps.h"
+
+
+// I/O chips, see MOS6510::read_byte() and write_byte()
+enum {
+	PROF_IO_VIC,
+	PROF_IO_SID,
+	PROF_IO_COLOR,
+	PROF_IO_CIA1,
+	PROF_IO_CIA2,
+	PROF_IO_OPEN,		// $de00-$dfff
+	PROF_IO_COUNT
+};
+
+// Kinds of call tree frames
+enum {
+	PROF_CALL_JSR,
+	PROF_CALL_IRQ,		// Also BRK
+	PROF_CALL_NMI
+};
+
+
+// Counts executed instructions and emulated cycles per PC and per
+// opcode, and I/O accesses per chip. Cycles are also accumulated in a
+// call tree that follows JSR/RTS and interrupts/RTI.
+class CPUProfile {
+public:
+	CPUProfile();
+	~CPUProfile();
+
+	void Reset(void);
+
+	// Hooks for the CPU core
+	void Fetch(uint16 pc) { cur_pc = pc; }
+	void Instruction(uint8 op, int cycles);
+	void Read(void) { reads++; }
+	void IORead(int chip) { io_reads[chip]++; pc_io[cur_pc]++; }
+	void IOWrite(int chip) { io_writes[chip]++; pc_io[cur_pc]++; }
+	void Call(int kind, uint16 target, uint8 sp);	// sp before the return address was pushed
+	void Return(uint8 sp);							// sp after the return address was pulled
+
+	void DumpFlat(FILE *f, int max_pcs = 40);	// Opcode, I/O and hottest PC tables
+	void DumpFolded(FILE *f);					// One "frame;frame;... cycles" line per call path
+
+private:
+	struct Node {
+		int parent;			// -1 for the root
+		uint16 addr;		// Entry point
+		uint8 kind;			// PROF_CALL_*
+		uint64_t cycles;	// Cycles spent in this node, not in its callees
+	};
+
+	struct Frame {
+		int node;			// Node to return to
+		uint8 sp;			// sp before the call
+	};
+
+	int child_node(int parent, int kind, uint16 addr);
+	int folded_name(int node, char *buf, int size);
+
+	uint16 cur_pc;			// PC of the current instruction
+
+	uint32 *pc_count;		// [0x10000] Instructions executed per PC
+	uint64_t *pc_cycles;	// [0x10000] Cycles per PC
+	uint64_t *pc_io;		// [0x10000] I/O accesses per PC
+	uint64_t op_count[256], op_cycles[256];
+	uint64_t total_cycles;
+	uint64_t reads;			// All reads through read_byte()
+	uint64_t io_reads[PROF_IO_COUNT], io_writes[PROF_IO_COUNT];
+
+	Node *nodes;			// Call tree, nodes[0] is the root
+	int num_nodes;
+	int *node_hash;			// (parent, kind, addr) -> node, -1 if free
+	int cur_node;
+
+	Frame stack[256];		// Shadow stack of pending calls
+	int depth;
+};
+
+
+inline void CPUProfile::Instruction(uint8 op, int cycles)
+{
+	pc_count[cur_pc]++;
+	pc_cycles[cur_pc] += cycles;
+	op_count[op]++;
+	op_cycles[op] += cycles;
+	nodes[cur_node].cycles += cycles;
+	total_cycles += cycles;
+}
+
+
+#endif
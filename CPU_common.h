@@ -18,7 +18,7 @@
  */
 
 /*
- *  CPU_common.h - Definitions common to 6502/6510 SC emulation
+ *  CPU_common.h - Definitions common to 6502/6510 emulation
  *
  *  Frodo (C) 1994-1997,2002 Christian Bauer
  */
@@ -27,6 +27,21 @@
 #define _CPU_COMMON_H_
 
 
+// Timing variants of the line-based cores (template parameter of
+// emulate_line(), see CPU_emulline.i), selected with Prefs::PreciseCPUCycles
+struct CPUFastCycles {			// Fixed cycles per opcode
+	enum { PRECISE_CYCLES = false, PRECISE_CIA = false };
+};
+
+struct CPUPreciseCycles {		// Extra cycles for page crossings and taken branches
+	enum { PRECISE_CYCLES = true, PRECISE_CIA = false };
+};
+
+struct CPUPreciseCIACycles {	// Also count the CIA timers after every opcode (6510 only)
+	enum { PRECISE_CYCLES = true, PRECISE_CIA = true };
+};
+
+
 // States for addressing modes/operations (Frodo SC)
 enum {
 	// Read effective address, no extra cycles
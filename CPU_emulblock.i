@@ -0,0 +1,801 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 1994-1997,2002 Christian Bauer
+ See gpl.txt for license information.
+ 
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  CPU_emulblock.i - Handlers for the pre-decoded blocks of the 6510
+ *                    (part of the body of EmulateLine(), see
+ *                    MOS6510::decode_block())
+ *
+ *  The handlers are the opcode bodies of CPU_emulline.i with the
+ *  operand taken from the DecodedOp instead of the instruction
+ *  stream; keep them in sync. Opcodes without a handler (BRK, RTI,
+ *  CLI, PLP, $f2 and the undocumented ones) end a block and are
+ *  executed by the interpreter.
+ */
+
+#ifdef BLOCK_HANDLER_TABLE
+
+	// Initializer of the handler table, indexed by opcode; the last
+	// entry leaves the block
+	NULL, &&blk_01, NULL, NULL, NULL, &&blk_05, &&blk_06, NULL,
+	&&blk_08, &&blk_09, &&blk_0a, NULL, NULL, &&blk_0d, &&blk_0e, NULL,
+	&&blk_10, &&blk_11, NULL, NULL, NULL, &&blk_15, &&blk_16, NULL,
+	&&blk_18, &&blk_19, NULL, NULL, NULL, &&blk_1d, &&blk_1e, NULL,
+	&&blk_20, &&blk_21, NULL, NULL, &&blk_24, &&blk_25, &&blk_26, NULL,
+	NULL, &&blk_29, &&blk_2a, NULL, &&blk_2c, &&blk_2d, &&blk_2e, NULL,
+	&&blk_30, &&blk_31, NULL, NULL, NULL, &&blk_35, &&blk_36, NULL,
+	&&blk_38, &&blk_39, NULL, NULL, NULL, &&blk_3d, &&blk_3e, NULL,
+	NULL, &&blk_41, NULL, NULL, NULL, &&blk_45, &&blk_46, NULL,
+	&&blk_48, &&blk_49, &&blk_4a, NULL, &&blk_4c, &&blk_4d, &&blk_4e, NULL,
+	&&blk_50, &&blk_51, NULL, NULL, NULL, &&blk_55, &&blk_56, NULL,
+	NULL, &&blk_59, NULL, NULL, NULL, &&blk_5d, &&blk_5e, NULL,
+	&&blk_60, &&blk_61, NULL, NULL, NULL, &&blk_65, &&blk_66, NULL,
+	&&blk_68, &&blk_69, &&blk_6a, NULL, &&blk_6c, &&blk_6d, &&blk_6e, NULL,
+	&&blk_70, &&blk_71, NULL, NULL, NULL, &&blk_75, &&blk_76, NULL,
+	&&blk_78, &&blk_79, NULL, NULL, NULL, &&blk_7d, &&blk_7e, NULL,
+	NULL, &&blk_81, NULL, NULL, &&blk_84, &&blk_85, &&blk_86, NULL,
+	&&blk_88, NULL, &&blk_8a, NULL, &&blk_8c, &&blk_8d, &&blk_8e, NULL,
+	&&blk_90, &&blk_91, NULL, NULL, &&blk_94, &&blk_95, &&blk_96, NULL,
+	&&blk_98, &&blk_99, &&blk_9a, NULL, NULL, &&blk_9d, NULL, NULL,
+	&&blk_a0, &&blk_a1, &&blk_a2, NULL, &&blk_a4, &&blk_a5, &&blk_a6, NULL,
+	&&blk_a8, &&blk_a9, &&blk_aa, NULL, &&blk_ac, &&blk_ad, &&blk_ae, NULL,
+	&&blk_b0, &&blk_b1, NULL, NULL, &&blk_b4, &&blk_b5, &&blk_b6, NULL,
+	&&blk_b8, &&blk_b9, &&blk_ba, NULL, &&blk_bc, &&blk_bd, &&blk_be, NULL,
+	&&blk_c0, &&blk_c1, NULL, NULL, &&blk_c4, &&blk_c5, &&blk_c6, NULL,
+	&&blk_c8, &&blk_c9, &&blk_ca, NULL, &&blk_cc, &&blk_cd, &&blk_ce, NULL,
+	&&blk_d0, &&blk_d1, NULL, NULL, NULL, &&blk_d5, &&blk_d6, NULL,
+	&&blk_d8, &&blk_d9, NULL, NULL, NULL, &&blk_dd, &&blk_de, NULL,
+	&&blk_e0, &&blk_e1, NULL, NULL, &&blk_e4, &&blk_e5, &&blk_e6, NULL,
+	&&blk_e8, &&blk_e9, &&blk_ea, NULL, &&blk_ec, &&blk_ed, &&blk_ee, NULL,
+	&&blk_f0, &&blk_f1, NULL, NULL, NULL, &&blk_f5, &&blk_f6, NULL,
+	&&blk_f8, &&blk_f9, NULL, NULL, NULL, &&blk_fd, &&blk_fe, NULL,
+	&&blk_exit
+
+#else
+
+#ifndef PROFILE_BLOCK_FETCH
+#define PROFILE_BLOCK_FETCH()
+#define PROFILE_BLOCK_INSTRUCTION(cyc)
+#endif
+
+		// Opcodes executed by the switch above continue with the next one
+		continue;
+
+		// Leave the block, the next opcode is executed by the interpreter.
+		// The cycles of the last opcode were already taken, but
+		// last_cycles must stay as the interpreter would have it (illegal
+		// opcodes and $f2 don't set it)
+blk_exit:
+		pc = blk->pc + bop->offset;
+		cycles_left += last_cycles;
+		continue;
+
+
+/*
+ *  Jumps, branches, JSR and RTS end a block. pc is set up as the
+ *  interpreter would have it and the opcode is executed from memory.
+ */
+
+#undef ENDOP
+#define ENDOP(cyc) last_cycles = cyc; PROFILE_BLOCK_INSTRUCTION(cyc); continue;
+
+blk_4c:	// JMP abs
+			pc = blk->pc + bop->offset + 1;
+			jump(read_adr_abs());
+			ENDOP(3);
+
+blk_6c:	// JMP (ind)
+			pc = blk->pc + bop->offset + 1;
+			adr = read_adr_abs();
+			jump(read_byte(adr) | (read_byte((adr + 1) & 0xff | adr & 0xff00) << 8));
+			ENDOP(5);
+
+blk_20:	// JSR abs
+			pc = blk->pc + bop->offset + 1;
+			push_byte((pc-pc_base+1) >> 8); push_byte(pc-pc_base+1);
+			jump(read_adr_abs());
+			PROFILE_CALL(PROF_CALL_JSR, 2);
+			ENDOP(6);
+
+blk_60:	// RTS
+			pc = blk->pc + bop->offset + 1;
+			adr = pop_byte();	// Split because of pop_byte ++sp side-effect
+			jump((adr | pop_byte() << 8) + 1);
+			PROFILE_RETURN();
+			ENDOP(6);
+
+blk_b0:	// BCS rel
+			pc = blk->pc + bop->offset + 1;
+			Branch(c_flag);
+
+blk_90:	// BCC rel
+			pc = blk->pc + bop->offset + 1;
+			Branch(!c_flag);
+
+blk_f0:	// BEQ rel
+			pc = blk->pc + bop->offset + 1;
+			Branch(!z_flag);
+
+blk_d0:	// BNE rel
+			pc = blk->pc + bop->offset + 1;
+			Branch(z_flag);
+
+blk_70:	// BVS rel
+			pc = blk->pc + bop->offset + 1;
+			Branch(v_flag);
+
+blk_50:	// BVC rel
+			pc = blk->pc + bop->offset + 1;
+			Branch(!v_flag);
+
+blk_30:	// BMI rel
+			pc = blk->pc + bop->offset + 1;
+			Branch(n_flag & 0x80);
+
+blk_10:	// BPL rel
+			pc = blk->pc + bop->offset + 1;
+			Branch(!(n_flag & 0x80));
+
+
+/*
+ *  All other opcodes continue with the next DecodedOp, unless the
+ *  line is over
+ */
+
+#undef read_byte_imm
+#define read_byte_imm() ((uint8)bop->operand)
+
+#undef read_u16_imm
+#define read_u16_imm() bop->operand
+
+#define BLOCK_NEXT(cyc) \
+	last_cycles = cyc; \
+	PROFILE_BLOCK_INSTRUCTION(cyc); \
+	bop++; \
+	if ((cycles_left -= cyc) < 0) { \
+		pc = blk->pc + bop->offset; \
+		break; \
+	}
+
+#undef ENDOP
+#define ENDOP(cyc) BLOCK_NEXT(cyc) PROFILE_BLOCK_FETCH(); goto *bop->handler;
+
+blk_a9:	// LDA #imm
+			set_nz(a = read_byte_imm());
+			ENDOP(2);
+
+blk_a5:	// LDA zero
+			set_nz(a = read_byte_zero());
+			ENDOP(3);
+
+blk_b5:	// LDA zero,X
+			set_nz(a = read_byte_zero_x());
+			ENDOP(4);
+
+blk_ad:	// LDA abs
+			set_nz(a = read_byte_abs());
+			ENDOP(4);
+
+blk_bd:	// LDA abs,X
+			set_nz(a = read_byte_abs_x());
+			ENDOP(4);
+
+blk_b9:	// LDA abs,Y
+			set_nz(a = read_byte_abs_y());
+			ENDOP(4);
+
+blk_a1:	// LDA (ind,X)
+			set_nz(a = read_byte_ind_x());
+			ENDOP(6);
+
+blk_b1:	// LDA (ind),Y
+			set_nz(a = read_byte_ind_y());
+			ENDOP(5);
+
+blk_a2:	// LDX #imm
+			set_nz(x = read_byte_imm());
+			ENDOP(2);
+
+blk_a6:	// LDX zero
+			set_nz(x = read_byte_zero());
+			ENDOP(3);
+
+blk_b6:	// LDX zero,Y
+			set_nz(x = read_byte_zero_y());
+			ENDOP(4);
+
+blk_ae:	// LDX abs
+			set_nz(x = read_byte_abs());
+			ENDOP(4);
+
+blk_be:	// LDX abs,Y
+			set_nz(x = read_byte_abs_y());
+			ENDOP(4);
+
+blk_a0:	// LDY #imm
+			set_nz(y = read_byte_imm());
+			ENDOP(2);
+
+blk_a4:	// LDY zero
+			set_nz(y = read_byte_zero());
+			ENDOP(3);
+
+blk_b4:	// LDY zero,X
+			set_nz(y = read_byte_zero_x());
+			ENDOP(4);
+
+blk_ac:	// LDY abs
+			set_nz(y = read_byte_abs());
+			ENDOP(4);
+
+blk_bc:	// LDY abs,X
+			set_nz(y = read_byte_abs_x());
+			ENDOP(4);
+
+blk_85:	// STA zero
+			write_zp(read_adr_zero(), a);
+			ENDOP(3);
+
+blk_95:	// STA zero,X
+			write_zp(read_adr_zero_x(), a);
+			ENDOP(4);
+
+blk_86:	// STX zero
+			write_zp(read_adr_zero(), x);
+			ENDOP(3);
+
+blk_96:	// STX zero,Y
+			write_zp(read_adr_zero_y(), x);
+			ENDOP(4);
+
+blk_84:	// STY zero
+			write_zp(read_adr_zero(), y);
+			ENDOP(3);
+
+blk_94:	// STY zero,X
+			write_zp(read_adr_zero_x(), y);
+			ENDOP(4);
+
+blk_aa:	// TAX
+			set_nz(x = a);
+			ENDOP(2);
+
+blk_8a:	// TXA
+			set_nz(a = x);
+			ENDOP(2);
+
+blk_a8:	// TAY
+			set_nz(y = a);
+			ENDOP(2);
+
+blk_98:	// TYA
+			set_nz(a = y);
+			ENDOP(2);
+
+blk_ba:	// TSX
+			set_nz(x = sp);
+			ENDOP(2);
+
+blk_9a:	// TXS
+			sp = x;
+			ENDOP(2);
+
+blk_69:	// ADC #imm
+			DoAdc(read_byte_imm());
+			ENDOP(2);
+
+blk_65:	// ADC zero
+			DoAdc(read_byte_zero());
+			ENDOP(3);
+
+blk_75:	// ADC zero,X
+			DoAdc(read_byte_zero_x());
+			ENDOP(4);
+
+blk_6d:	// ADC abs
+			DoAdc(read_byte_abs());
+			ENDOP(4);
+
+blk_7d:	// ADC abs,X
+			DoAdc(read_byte_abs_x());
+			ENDOP(4);
+
+blk_79:	// ADC abs,Y
+			DoAdc(read_byte_abs_y());
+			ENDOP(4);
+
+blk_61:	// ADC (ind,X)
+			DoAdc(read_byte_ind_x());
+			ENDOP(6);
+
+blk_71:	// ADC (ind),Y
+			DoAdc(read_byte_ind_y());
+			ENDOP(5);
+
+blk_e9:	// SBC #imm
+			DoSbc(read_byte_imm());
+			ENDOP(2);
+
+blk_e5:	// SBC zero
+			DoSbc(read_byte_zero());
+			ENDOP(3);
+
+blk_f5:	// SBC zero,X
+			DoSbc(read_byte_zero_x());
+			ENDOP(4);
+
+blk_ed:	// SBC abs
+			DoSbc(read_byte_abs());
+			ENDOP(4);
+
+blk_fd:	// SBC abs,X
+			DoSbc(read_byte_abs_x());
+			ENDOP(4);
+
+blk_f9:	// SBC abs,Y
+			DoSbc(read_byte_abs_y());
+			ENDOP(4);
+
+blk_e1:	// SBC (ind,X)
+			DoSbc(read_byte_ind_x());
+			ENDOP(6);
+
+blk_f1:	// SBC (ind),Y
+			DoSbc(read_byte_ind_y());
+			ENDOP(5);
+
+blk_e8:	// INX
+			set_nz(++x);
+			ENDOP(2);
+
+blk_ca:	// DEX
+			set_nz(--x);
+			ENDOP(2);
+
+blk_c8:	// INY
+			set_nz(++y);
+			ENDOP(2);
+
+blk_88:	// DEY
+			set_nz(--y);
+			ENDOP(2);
+
+blk_e6:	// INC zero
+			adr = read_adr_zero();
+			write_zp(adr, set_nz(read_zp(adr) + 1));
+			ENDOP(5);
+
+blk_f6:	// INC zero,X
+			adr = read_adr_zero_x();
+			write_zp(adr, set_nz(read_zp(adr) + 1));
+			ENDOP(6);
+
+blk_c6:	// DEC zero
+			adr = read_adr_zero();
+			write_zp(adr, set_nz(read_zp(adr) - 1));
+			ENDOP(5);
+
+blk_d6:	// DEC zero,X
+			adr = read_adr_zero_x();
+			write_zp(adr, set_nz(read_zp(adr) - 1));
+			ENDOP(6);
+
+blk_29:	// AND #imm
+			set_nz(a &= read_byte_imm());
+			ENDOP(2);
+
+blk_25:	// AND zero
+			set_nz(a &= read_byte_zero());
+			ENDOP(3);
+
+blk_35:	// AND zero,X
+			set_nz(a &= read_byte_zero_x());
+			ENDOP(4);
+
+blk_2d:	// AND abs
+			set_nz(a &= read_byte_abs());
+			ENDOP(4);
+
+blk_3d:	// AND abs,X
+			set_nz(a &= read_byte_abs_x());
+			ENDOP(4);
+
+blk_39:	// AND abs,Y
+			set_nz(a &= read_byte_abs_y());
+			ENDOP(4);
+
+blk_21:	// AND (ind,X)
+			set_nz(a &= read_byte_ind_x());
+			ENDOP(6);
+
+blk_31:	// AND (ind),Y
+			set_nz(a &= read_byte_ind_y());
+			ENDOP(5);
+
+blk_09:	// ORA #imm
+			set_nz(a |= read_byte_imm());
+			ENDOP(2);
+
+blk_05:	// ORA zero
+			set_nz(a |= read_byte_zero());
+			ENDOP(3);
+
+blk_15:	// ORA zero,X
+			set_nz(a |= read_byte_zero_x());
+			ENDOP(4);
+
+blk_0d:	// ORA abs
+			set_nz(a |= read_byte_abs());
+			ENDOP(4);
+
+blk_1d:	// ORA abs,X
+			set_nz(a |= read_byte_abs_x());
+			ENDOP(4);
+
+blk_19:	// ORA abs,Y
+			set_nz(a |= read_byte_abs_y());
+			ENDOP(4);
+
+blk_01:	// ORA (ind,X)
+			set_nz(a |= read_byte_ind_x());
+			ENDOP(6);
+
+blk_11:	// ORA (ind),Y
+			set_nz(a |= read_byte_ind_y());
+			ENDOP(5);
+
+blk_49:	// EOR #imm
+			set_nz(a ^= read_byte_imm());
+			ENDOP(2);
+
+blk_45:	// EOR zero
+			set_nz(a ^= read_byte_zero());
+			ENDOP(3);
+
+blk_55:	// EOR zero,X
+			set_nz(a ^= read_byte_zero_x());
+			ENDOP(4);
+
+blk_4d:	// EOR abs
+			set_nz(a ^= read_byte_abs());
+			ENDOP(4);
+
+blk_5d:	// EOR abs,X
+			set_nz(a ^= read_byte_abs_x());
+			ENDOP(4);
+
+blk_59:	// EOR abs,Y
+			set_nz(a ^= read_byte_abs_y());
+			ENDOP(4);
+
+blk_41:	// EOR (ind,X)
+			set_nz(a ^= read_byte_ind_x());
+			ENDOP(6);
+
+blk_51:	// EOR (ind),Y
+			set_nz(a ^= read_byte_ind_y());
+			ENDOP(5);
+
+blk_c9:	// CMP #imm
+			set_nz(adr = a - read_byte_imm());
+			c_flag = adr < 0x100;
+			ENDOP(2);
+
+blk_c5:	// CMP zero
+			set_nz(adr = a - read_byte_zero());
+			c_flag = adr < 0x100;
+			ENDOP(3);
+
+blk_d5:	// CMP zero,X
+			set_nz(adr = a - read_byte_zero_x());
+			c_flag = adr < 0x100;
+			ENDOP(4);
+
+blk_cd:	// CMP abs
+			set_nz(adr = a - read_byte_abs());
+			c_flag = adr < 0x100;
+			ENDOP(4);
+
+blk_dd:	// CMP abs,X
+			set_nz(adr = a - read_byte_abs_x());
+			c_flag = adr < 0x100;
+			ENDOP(4);
+
+blk_d9:	// CMP abs,Y
+			set_nz(adr = a - read_byte_abs_y());
+			c_flag = adr < 0x100;
+			ENDOP(4);
+
+blk_c1:	// CMP (ind,X)
+			set_nz(adr = a - read_byte_ind_x());
+			c_flag = adr < 0x100;
+			ENDOP(6);
+
+blk_d1:	// CMP (ind),Y
+			set_nz(adr = a - read_byte_ind_y());
+			c_flag = adr < 0x100;
+			ENDOP(5);
+
+blk_e0:	// CPX #imm
+			set_nz(adr = x - read_byte_imm());
+			c_flag = adr < 0x100;
+			ENDOP(2);
+
+blk_e4:	// CPX zero
+			set_nz(adr = x - read_byte_zero());
+			c_flag = adr < 0x100;
+			ENDOP(3);
+
+blk_ec:	// CPX abs
+			set_nz(adr = x - read_byte_abs());
+			c_flag = adr < 0x100;
+			ENDOP(4);
+
+blk_c0:	// CPY #imm
+			set_nz(adr = y - read_byte_imm());
+			c_flag = adr < 0x100;
+			ENDOP(2);
+
+blk_c4:	// CPY zero
+			set_nz(adr = y - read_byte_zero());
+			c_flag = adr < 0x100;
+			ENDOP(3);
+
+blk_cc:	// CPY abs
+			set_nz(adr = y - read_byte_abs());
+			c_flag = adr < 0x100;
+			ENDOP(4);
+
+blk_24:	// BIT zero
+			z_flag = a & (tmp = read_byte_zero());
+			n_flag = tmp;
+			v_flag = tmp & 0x40;
+			ENDOP(3);
+
+blk_2c:	// BIT abs
+			z_flag = a & (tmp = read_byte_abs());
+			n_flag = tmp;
+			v_flag = tmp & 0x40;
+			ENDOP(4);
+
+blk_0a:	// ASL A
+			c_flag = a & 0x80;
+			set_nz(a <<= 1);
+			ENDOP(2);
+
+blk_06:	// ASL zero
+			tmp = read_zp(adr = read_adr_zero());
+			c_flag = tmp & 0x80;
+			write_zp(adr, set_nz(tmp << 1));
+			ENDOP(5);
+
+blk_16:	// ASL zero,X
+			tmp = read_zp(adr = read_adr_zero_x());
+			c_flag = tmp & 0x80;
+			write_zp(adr, set_nz(tmp << 1));
+			ENDOP(6);
+
+blk_4a:	// LSR A
+			c_flag = a & 0x01;
+			set_nz(a >>= 1);
+			ENDOP(2);
+
+blk_46:	// LSR zero
+			tmp = read_zp(adr = read_adr_zero());
+			c_flag = tmp & 0x01;
+			write_zp(adr, set_nz(tmp >> 1));
+			ENDOP(5);
+
+blk_56:	// LSR zero,X
+			tmp = read_zp(adr = read_adr_zero_x());
+			c_flag = tmp & 0x01;
+			write_zp(adr, set_nz(tmp >> 1));
+			ENDOP(6);
+
+blk_2a:	// ROL A
+			tmp = a & 0x80;
+			set_nz(a = c_flag ? (a << 1) | 0x01 : a << 1);
+			c_flag = tmp;
+			ENDOP(2);
+
+blk_26:	// ROL zero
+			tmp = read_zp(adr = read_adr_zero());
+			write_zp(adr, set_nz(c_flag ? (tmp << 1) | 0x01 : tmp << 1));
+			c_flag = tmp & 0x80;
+			ENDOP(5);
+
+blk_36:	// ROL zero,X
+			tmp = read_zp(adr = read_adr_zero_x());
+			write_zp(adr, set_nz(c_flag ? (tmp << 1) | 0x01 : tmp << 1));
+			c_flag = tmp & 0x80;
+			ENDOP(6);
+
+blk_6a:	// ROR A
+			tmp = a & 0x01;
+			set_nz(a = (c_flag ? (a >> 1) | 0x80 : a >> 1));
+			c_flag = tmp;
+			ENDOP(2);
+
+blk_66:	// ROR zero
+			tmp = read_zp(adr = read_adr_zero());
+			write_zp(adr, set_nz(c_flag ? (tmp >> 1) | 0x80 : tmp >> 1));
+			c_flag = tmp & 0x01;
+			ENDOP(5);
+
+blk_76:	// ROR zero,X
+			tmp = read_zp(adr = read_adr_zero_x());
+			write_zp(adr, set_nz(c_flag ? (tmp >> 1) | 0x80 : tmp >> 1));
+			c_flag = tmp & 0x01;
+			ENDOP(6);
+
+blk_48:	// PHA
+			push_byte(a);
+			ENDOP(3);
+
+blk_68:	// PLA
+			set_nz(a = pop_byte());
+			ENDOP(4);
+
+blk_08:	// PHP
+			push_flags(true);
+			ENDOP(3);
+
+blk_38:	// SEC
+			c_flag = true;
+			ENDOP(2);
+
+blk_18:	// CLC
+			c_flag = false;
+			ENDOP(2);
+
+blk_f8:	// SED
+			d_flag = true;
+			ENDOP(2);
+
+blk_d8:	// CLD
+			d_flag = false;
+			ENDOP(2);
+
+blk_78:	// SEI
+			i_flag = true;
+			ENDOP(2);
+
+blk_b8:	// CLV
+			v_flag = false;
+			ENDOP(2);
+
+blk_ea:	// NOP
+			ENDOP(2);
+
+
+/*
+ *  Opcodes that call write_byte() leave the block if they wrote to
+ *  the memory it was decoded from
+ */
+
+#undef ENDOP
+#define ENDOP(cyc) BLOCK_NEXT(cyc) \
+	if (*blk->gen_ptr != blk->gen) goto blk_exit; \
+	PROFILE_BLOCK_FETCH(); goto *bop->handler;
+
+blk_8d:	// STA abs
+			write_byte(read_adr_abs(), a);
+			ENDOP(4);
+
+blk_9d:	// STA abs,X
+			write_byte(read_adr_abs_x(), a);
+			ENDOP(5);
+
+blk_99:	// STA abs,Y
+			write_byte(read_adr_abs_y(), a);
+			ENDOP(5);
+
+blk_81:	// STA (ind,X)
+			write_byte(read_adr_ind_x(), a);
+			ENDOP(6);
+
+blk_91:	// STA (ind),Y
+			write_byte(read_adr_ind_y(), a);
+			ENDOP(6);
+
+blk_8e:	// STX abs
+			write_byte(read_adr_abs(), x);
+			ENDOP(4);
+
+blk_8c:	// STY abs
+			write_byte(read_adr_abs(), y);
+			ENDOP(4);
+
+blk_ee:	// INC abs
+			adr = read_adr_abs();
+			write_byte(adr, set_nz(read_byte(adr) + 1));
+			ENDOP(6);
+
+blk_fe:	// INC abs,X
+			adr = read_adr_abs_x();
+			write_byte(adr, set_nz(read_byte(adr) + 1));
+			ENDOP(7);
+
+blk_ce:	// DEC abs
+			adr = read_adr_abs();
+			write_byte(adr, set_nz(read_byte(adr) - 1));
+			ENDOP(6);
+
+blk_de:	// DEC abs,X
+			adr = read_adr_abs_x();
+			write_byte(adr, set_nz(read_byte(adr) - 1));
+			ENDOP(7);
+
+blk_0e:	// ASL abs
+			tmp = read_byte(adr = read_adr_abs());
+			c_flag = tmp & 0x80;
+			write_byte(adr, set_nz(tmp << 1));
+			ENDOP(6);
+
+blk_1e:	// ASL abs,X
+			tmp = read_byte(adr = read_adr_abs_x());
+			c_flag = tmp & 0x80;
+			write_byte(adr, set_nz(tmp << 1));
+			ENDOP(7);
+
+blk_4e:	// LSR abs
+			tmp = read_byte(adr = read_adr_abs());
+			c_flag = tmp & 0x01;
+			write_byte(adr, set_nz(tmp >> 1));
+			ENDOP(6);
+
+blk_5e:	// LSR abs,X
+			tmp = read_byte(adr = read_adr_abs_x());
+			c_flag = tmp & 0x01;
+			write_byte(adr, set_nz(tmp >> 1));
+			ENDOP(7);
+
+blk_2e:	// ROL abs
+			tmp = read_byte(adr = read_adr_abs());
+			write_byte(adr, set_nz(c_flag ? (tmp << 1) | 0x01 : tmp << 1));
+			c_flag = tmp & 0x80;
+			ENDOP(6);
+
+blk_3e:	// ROL abs,X
+			tmp = read_byte(adr = read_adr_abs_x());
+			write_byte(adr, set_nz(c_flag ? (tmp << 1) | 0x01 : tmp << 1));
+			c_flag = tmp & 0x80;
+			ENDOP(7);
+
+blk_6e:	// ROR abs
+			tmp = read_byte(adr = read_adr_abs());
+			write_byte(adr, set_nz(c_flag ? (tmp >> 1) | 0x80 : tmp >> 1));
+			c_flag = tmp & 0x01;
+			ENDOP(6);
+
+blk_7e:	// ROR abs,X
+			tmp = read_byte(adr = read_adr_abs_x());
+			write_byte(adr, set_nz(c_flag ? (tmp >> 1) | 0x80 : tmp >> 1));
+			c_flag = tmp & 0x01;
+			ENDOP(7);
+
+#undef BLOCK_NEXT
+#undef ENDOP
+#define ENDOP(cyc) last_cycles = cyc; PROFILE_INSTRUCTION(_opcode, cyc); break;
+#undef read_byte_imm
+#define read_byte_imm() (*pc++)
+#undef read_u16_imm
+#define read_u16_imm()	*((uint16*)pc), pc+=2
+
+#endif
@@ -19,12 +19,18 @@
 
 /*
  *  CPU_emulline.i - 6510/6502 emulation core (body of
- *                   EmulateLine() function, the same for
- *                   both 6510 and 6502)
+ *                   emulate_line() function template, the same
+ *                   for both 6510 and 6502)
  *
  *  Frodo (C) 1994-1997,2002 Christian Bauer
  */
 
+/*
+ *  The template parameter Core is one of the timing policies in
+ *  CPU_common.h. Its constants are tested with plain if()s that the
+ *  compiler folds, each instantiation only contains its own variant.
+ */
+
 
 /*
  *  Addressing mode macros
@@ -77,10 +83,9 @@
 //#define read_byte_abs() (adr = ((*(pc+1)) << 8) | *pc, pc+=2, read_byte(adr))
 #define read_byte_abs() (adr = read_u16_imm(), read_byte(adr))
 
-#if PRECISE_CPU_CYCLES
-// Acount for cyles due to crossing page boundaries
+// Acount for cyles due to crossing page boundaries (precise timing only)
 #define page_plus(exp, reg) \
-	(adr = exp, page_cycles = (adr & 0xff) + reg >= 0x100, adr + reg)
+	(adr = exp, Core::PRECISE_CYCLES ? page_cycles = (adr & 0xff) + reg >= 0x100 : 0, adr + reg)
 
 // Read absolute x-indexed operand
 //#define read_byte_abs_x() (adr = ((*(pc+1)) << 8) | *pc, pc+=2, read_byte(page_plus(adr, x)))
@@ -92,20 +97,6 @@
 // Read indirect y-indexed operand
 #define read_byte_ind_y() read_byte(page_plus(read_zp_word(read_byte_imm()), y))
 
-#else
-
-// Read absolute x-indexed operand
-//#define read_byte_abs_x() (adr = ((*(pc+1)) << 8) | *pc, pc+=2, read_byte(adr + x))
-#define read_byte_abs_x() (adr = read_u16_imm(), read_byte(adr + x))
-
-// Read absolute x-indexed operand
-//#define read_byte_abs_y() (adr = ((*(pc+1)) << 8) | *pc, pc+=2, read_byte(adr + y))
-#define read_byte_abs_y() (adr = read_u16_imm(), read_byte(adr + y))
-
-// Read indirect y-indexed operand
-#define read_byte_ind_y() read_byte(read_adr_ind_y())
-#endif
-
 // Read indexed indirect operand
 #define read_byte_ind_x() read_byte(read_adr_ind_x())
 
@@ -122,31 +113,53 @@
  * End of opcode, decrement cycles left
  */
 
-#define ENDOP(cyc) last_cycles = cyc; break;
+#define ENDOP(cyc) last_cycles = cyc; PROFILE_INSTRUCTION(_opcode, cyc); break;
+
+
+/*
+ * Profiling hooks, CPUC64.cpp defines them if PROFILE_6510 is set
+ */
+
+#ifndef PROFILE_FETCH
+#define PROFILE_FETCH()
+#define PROFILE_INSTRUCTION(op, cyc)
+#define PROFILE_CALL(kind, pushed)
+#define PROFILE_RETURN()
+#endif
+
+
+/*
+ * Block cache hook, CPUC64.cpp defines it if CPU_BLOCK_CACHE is set
+ */
+
+#ifndef BLOCK_DISPATCH
+#define BLOCK_DISPATCH()
+#endif
 
 
 	// Main opcode fetch/execute loop
-#if PRECISE_CPU_CYCLES
-	if (cycles_left != 1)
+	if (Core::PRECISE_CYCLES && cycles_left != 1)
 		cycles_left -= borrowed_cycles;
 	int page_cycles = 0;
 	for (;;) {
-		if (last_cycles) {
+		if (Core::PRECISE_CYCLES && last_cycles) {
 			last_cycles += page_cycles;
 			page_cycles = 0;
-#if PRECISE_CIA_CYCLES && !defined(IS_CPU_1541)
-			TheCIA1->EmulateLine(last_cycles);
-			TheCIA2->EmulateLine(last_cycles);
+#ifndef IS_CPU_1541
+			if (Core::PRECISE_CIA) {
+				TheCIA1->EmulateLine(last_cycles);
+				TheCIA2->EmulateLine(last_cycles);
+			}
 #endif
 		}
 		if ((cycles_left -= last_cycles) < 0) {
-			borrowed_cycles = -cycles_left;
+			if (Core::PRECISE_CYCLES)
+				borrowed_cycles = -cycles_left;
 			break;
 		}
-#else
-	while ((cycles_left -= last_cycles) >= 0) {
-#endif
+		PROFILE_FETCH();
 		uint8 _opcode = read_byte_imm();
+		BLOCK_DISPATCH();
 		
 redo_trap:
 		switch (_opcode) {
@@ -785,17 +798,20 @@ redo_trap:
 		case 0x20:	// JSR abs
 			push_byte((pc-pc_base+1) >> 8); push_byte(pc-pc_base+1);
 			jump(read_adr_abs());
+			PROFILE_CALL(PROF_CALL_JSR, 2);
 			ENDOP(6);
 
 		case 0x60:	// RTS
 			adr = pop_byte();	// Split because of pop_byte ++sp side-effect
 			jump((adr | pop_byte() << 8) + 1);
+			PROFILE_RETURN();
 			ENDOP(6);
 
 		case 0x40:	// RTI
 			pop_flags();
 			adr = pop_byte();	// Split because of pop_byte ++sp side-effect
 			jump(adr | pop_byte() << 8);
+			PROFILE_RETURN();
 			if (interrupt.intr_any && !i_flag)
 				goto handle_int;
 			ENDOP(6);
@@ -820,7 +836,8 @@ redo_trap:
 						push_flags(true);
 						i_flag = true;
 						jump(read_word(0xfffe));
-						ENDOP(7);						
+						PROFILE_CALL(PROF_CALL_IRQ, 3);
+						ENDOP(7);
 				}
 			}
 			break;
@@ -833,12 +850,11 @@ redo_trap:
 			ENDOP(7);
 #endif
 
-#if PRECISE_CPU_CYCLES
 #define Branch(flag) \
 	if (flag) { \
 		uint8 *old_pc = pc; \
 		pc += (int8)*pc + 1; \
-		if (((pc-pc_base) ^ (old_pc - pc_base)) & 0xff00) { \
+		if (Core::PRECISE_CYCLES && (((pc-pc_base) ^ (old_pc - pc_base)) & 0xff00)) { \
 			ENDOP(4); \
 		} else { \
 			ENDOP(3); \
@@ -847,16 +863,6 @@ redo_trap:
 		pc++; \
 		ENDOP(2); \
 	}
-#else
-#define Branch(flag) \
-	if (flag) { \
-		pc += (int8)*pc + 1; \
-		ENDOP(3); \
-	} else { \
-		pc++; \
-		ENDOP(2); \
-	}
-#endif
 
 		case 0xb0:	// BCS rel
 			Branch(c_flag);
@@ -974,11 +980,10 @@ redo_trap:
 		case 0x7c:
 		case 0xdc:
 		case 0xfc:
-#if PRECISE_CPU_CYCLES
-			read_byte_abs_x();
-#else
-			pc+=2;
-#endif
+			if (Core::PRECISE_CYCLES)
+				read_byte_abs_x();
+			else
+				pc+=2;
 			ENDOP(4);
 
 
@@ -0,0 +1,410 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ *  D64Image.cpp - Memory-mapped .d64/.x64 disk images
+ *
+ *  Loading a program through D64Drive reads every directory and file
+ *  block separately, and Job1541 converts all 683 sectors to GCR when
+ *  a disk is inserted. With the image mapped, each of these is a
+ *  memory access instead of a seek and a read.
+ *
+ *  Writes never wait for the disk: WriteSector() only stores into the
+ *  private mapping and marks the sector. The write-back thread appends
+ *  the marked sectors to "<image>.journal" (2 byte sector number and
+ *  256 bytes of data per record) and, after COMMIT_DELAY seconds
+ *  without writes, writes the whole image to "<image>.tmp" and renames
+ *  it over the image. The journal is deleted after the rename. Records
+ *  are only collected together with the snapshot of the image that is
+ *  committed, so replaying a journal that survived a crash always
+ *  gives the last committed or a newer state.
+ */
+
+#include "sysdeps.h"
+#include <sys/mman.h>
+#include <pthread.h>
+
+#include "D64Image.h"
+
+
+// Number of sectors of a 35 track disk
+const int NUM_SECTORS = 683;
+
+// Size of a journal record
+const int JOURNAL_RECORD_SIZE = 2 + 256;
+
+// Seconds without writes before the image is committed
+const int COMMIT_DELAY = 2;
+
+// Open images, so that drives opening the same file share it
+static D64Image *open_images = NULL;
+static pthread_mutex_t open_images_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ *  Open and map an image file
+ */
+
+D64Image *D64Image::Open(const char *path)
+{
+	// Try opening the file for reading/writing first, then for reading only
+	bool read_only = false;
+	int fd = open(path, O_RDWR);
+	if (fd < 0) {
+		read_only = true;
+		fd = open(path, O_RDONLY);
+	}
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < NUM_SECTORS * 256) {
+		close(fd);
+		return NULL;
+	}
+
+	// Already open?
+	pthread_mutex_lock(&open_images_lock);
+	for (D64Image *image = open_images; image; image = image->next)
+		if (image->dev == st.st_dev && image->ino == st.st_ino) {
+			image->ref_count++;
+			pthread_mutex_unlock(&open_images_lock);
+			close(fd);
+			return image;
+		}
+
+	// Writes stay in memory until they are committed
+	D64Image *image = NULL;
+	void *p = mmap(NULL, st.st_size, read_only ? PROT_READ : PROT_READ | PROT_WRITE, read_only ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	if (p != MAP_FAILED) {
+		image = new D64Image(path, (uint8 *)p, st.st_size, read_only, &st);
+		if (image->num_sectors < NUM_SECTORS) {
+			delete image;		// .x64 header, but not all sectors
+			image = NULL;
+		} else {
+			if (!read_only)
+				image->replay_journal();
+			image->next = open_images;
+			open_images = image;
+		}
+	}
+	pthread_mutex_unlock(&open_images_lock);
+	close(fd);
+	return image;
+}
+
+
+/*
+ *  Constructor/destructor, only via Open() and Release()
+ */
+
+D64Image::D64Image(const char *path, uint8 *base, size_t size, bool read_only, const struct stat *st)
+ : base(base), size(size), read_only(read_only), generation(0), dev(st->st_dev), ino(st->st_ino), mode(st->st_mode & 0777), ref_count(1)
+{
+	this->path = new char[strlen(path) + 1];
+	strcpy(this->path, path);
+	journal_name = new char[strlen(path) + 9];
+	sprintf(journal_name, "%s.journal", path);
+	temp_name = new char[strlen(path) + 5];
+	sprintf(temp_name, "%s.tmp", path);
+
+	// x64 image?
+	if (base[0] == 0x43 && base[1] == 0x15 && base[2] == 0x41 && base[3] == 0x64)
+		data = base + 64;
+	else
+		data = base;
+	num_sectors = data + 256 <= base + size ? (base + size - data) / 256 : 0;
+
+	// Sector error info, if present
+	if (data == base && size == NUM_SECTORS * 257)
+		error_info = base + NUM_SECTORS * 256;
+	else
+		error_info = NULL;
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&wake, NULL);
+	thread_running = false;
+	quit = false;
+	pending = new uint32[(num_sectors + 31) / 32];
+	memset(pending, 0, (num_sectors + 31) / 32 * sizeof(uint32));
+	pending_any = false;
+	uncommitted = false;
+	journal_buf = NULL;
+	journal_fd = -1;
+}
+
+D64Image::~D64Image()
+{
+	// Stop the write-back thread and commit what it hasn't committed yet
+	if (thread_running) {
+		pthread_mutex_lock(&lock);
+		quit = true;
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&lock);
+		pthread_join(thread, NULL);
+	}
+	if (uncommitted) {
+		pthread_mutex_lock(&lock);
+		commit();
+		pthread_mutex_unlock(&lock);
+	}
+	if (journal_fd >= 0)
+		close(journal_fd);
+
+	pthread_cond_destroy(&wake);
+	pthread_mutex_destroy(&lock);
+	delete[] journal_buf;
+	delete[] pending;
+	delete[] temp_name;
+	delete[] journal_name;
+	delete[] path;
+	munmap(base, size);
+}
+
+
+/*
+ *  Reference counting, Open() returns a new reference
+ */
+
+void D64Image::Retain(void)
+{
+	pthread_mutex_lock(&open_images_lock);
+	ref_count++;
+	pthread_mutex_unlock(&open_images_lock);
+}
+
+void D64Image::Release(void)
+{
+	pthread_mutex_lock(&open_images_lock);
+	if (--ref_count > 0) {
+		pthread_mutex_unlock(&open_images_lock);
+		return;
+	}
+	for (D64Image **p = &open_images; *p; p = &(*p)->next)
+		if (*p == this) {
+			*p = next;
+			break;
+		}
+	pthread_mutex_unlock(&open_images_lock);
+	delete this;
+}
+
+
+/*
+ *  Sector access
+ */
+
+const uint8 *D64Image::Sector(int offset)
+{
+	if (data + offset + 256 > base + size)
+		return NULL;
+	return data + offset;
+}
+
+bool D64Image::WriteSector(int offset, const uint8 *buffer)
+{
+	if (read_only || data + offset + 256 > base + size)
+		return false;
+
+	int sector = offset / 256;
+	pthread_mutex_lock(&lock);
+	memcpy(data + offset, buffer, 256);
+	generation++;
+	pending[sector >> 5] |= 1U << (sector & 31);
+	pending_any = true;
+	uncommitted = true;
+	if (thread_running)
+		pthread_cond_signal(&wake);
+	else
+		start_writer();
+	pthread_mutex_unlock(&lock);
+	return true;
+}
+
+
+/*
+ *  Apply the records of a journal that was not deleted by a commit
+ */
+
+void D64Image::replay_journal(void)
+{
+	FILE *f = fopen(journal_name, "rb");
+	if (f == NULL)
+		return;
+
+	uint8 record[JOURNAL_RECORD_SIZE];
+	int replayed = 0;
+	while (fread(record, 1, JOURNAL_RECORD_SIZE, f) == JOURNAL_RECORD_SIZE) {	// A torn last record is ignored
+		int sector = record[0] | (record[1] << 8);
+		if (sector < num_sectors) {
+			memcpy(data + sector * 256, record + 2, 256);
+			pending[sector >> 5] |= 1U << (sector & 31);
+			replayed++;
+		}
+	}
+	fclose(f);
+
+	// The write-back thread journals and commits them again
+	if (replayed) {
+		pthread_mutex_lock(&lock);
+		pending_any = true;
+		uncommitted = true;
+		start_writer();
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+
+/*
+ *  Write-back thread, started by the first write
+ */
+
+void D64Image::start_writer(void)
+{
+	// Tried again by the next write if the thread can't be created
+	if (journal_buf == NULL)
+		journal_buf = new uint8[num_sectors * JOURNAL_RECORD_SIZE];
+	thread_running = pthread_create(&thread, NULL, writer_entry, this) == 0;
+}
+
+void *D64Image::writer_entry(void *arg)
+{
+	((D64Image *)arg)->writer();
+	return NULL;
+}
+
+void D64Image::writer(void)
+{
+	pthread_mutex_lock(&lock);
+	while (!quit) {
+		if (pending_any) {
+			int length = collect_journal();
+			pthread_mutex_unlock(&lock);
+			append_journal(length);
+			pthread_mutex_lock(&lock);
+		} else if (!uncommitted)
+			pthread_cond_wait(&wake, &lock);
+		else {
+			// Commit when no sector was written for COMMIT_DELAY seconds
+			struct timeval now;
+			gettimeofday(&now, NULL);
+			struct timespec until;
+			until.tv_sec = now.tv_sec + COMMIT_DELAY;
+			until.tv_nsec = now.tv_usec * 1000;
+			if (pthread_cond_timedwait(&wake, &lock, &until) == ETIMEDOUT && !pending_any && !quit)
+				commit();
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+
+/*
+ *  Copy the pending sectors to journal records (lock held), returns
+ *  the number of bytes
+ */
+
+int D64Image::collect_journal(void)
+{
+	uint8 *p = journal_buf;
+	for (int sector=0; sector<num_sectors; sector++)
+		if (pending[sector >> 5] & (1U << (sector & 31))) {
+			p[0] = sector & 0xff;
+			p[1] = sector >> 8;
+			memcpy(p + 2, data + sector * 256, 256);
+			p += JOURNAL_RECORD_SIZE;
+		}
+	memset(pending, 0, (num_sectors + 31) / 32 * sizeof(uint32));
+	pending_any = false;
+	return p - journal_buf;
+}
+
+
+/*
+ *  Append collected records to the journal (lock not held)
+ */
+
+void D64Image::append_journal(int length)
+{
+	if (length == 0)
+		return;
+	if (journal_fd < 0) {
+		journal_fd = open(journal_name, O_WRONLY | O_CREAT | O_APPEND, mode);
+		if (journal_fd < 0)
+			return;			// No journal, the commit still works
+	}
+	if (write(journal_fd, journal_buf, length) == length)
+		fsync(journal_fd);
+}
+
+
+/*
+ *  Write the image to the file (lock held, released during the I/O)
+ */
+
+void D64Image::commit(void)
+{
+	// Journal everything that is in the snapshot, so that the journal
+	// never lags behind the committed file
+	int length = collect_journal();
+	uint8 *snapshot = new uint8[size];
+	memcpy(snapshot, base, size);
+	uncommitted = false;
+	pthread_mutex_unlock(&lock);
+
+	append_journal(length);
+	if (write_file(snapshot) && journal_fd >= 0) {
+		close(journal_fd);
+		journal_fd = -1;
+		unlink(journal_name);
+	}
+	delete[] snapshot;
+
+	pthread_mutex_lock(&lock);
+}
+
+// Replace the image file by buffer, false on error
+bool D64Image::write_file(const uint8 *buffer)
+{
+	int fd = open(temp_name, O_WRONLY | O_CREAT | O_TRUNC, mode);
+	if (fd >= 0) {
+		bool ok = write(fd, buffer, size) == (ssize_t)size && fsync(fd) == 0;
+		struct stat st;
+		ok = ok && fstat(fd, &st) == 0;
+		close(fd);
+		if (ok && rename(temp_name, path) == 0) {
+			// Drives opening the image again find it by its new identity
+			pthread_mutex_lock(&open_images_lock);
+			dev = st.st_dev;
+			ino = st.st_ino;
+			pthread_mutex_unlock(&open_images_lock);
+			return true;
+		}
+		unlink(temp_name);
+	}
+
+	// Directory not writable: overwrite the image in place
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return false;
+	bool ok = pwrite(fd, buffer, size, 0) == (ssize_t)size && fsync(fd) == 0;
+	close(fd);
+	return ok;
+}
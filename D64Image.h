@@ -0,0 +1,102 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ *  D64Image.h - Memory-mapped .d64/.x64 disk images
+ */
+
+#ifndef _D64IMAGE_H
+#define _D64IMAGE_H
+
+#include "sysdeps.h"
+#include <pthread.h>
+
+// A .d64 or .x64 file mapped into memory, shared by all drives that
+// open the same file (D64Drive and Job1541). Sectors are accessed
+// in place. Writable images are mapped privately: written sectors
+// are appended to a journal next to the image by a write-back thread,
+// and the whole image is committed to the file (temp file + rename)
+// once no sector has been written for a while and when the last
+// reference is released. A journal left behind by a crash is replayed
+// when the image is opened again.
+class D64Image {
+public:
+	// Open the image at path, or add a reference to the already open
+	// one; NULL if it can't be mapped or is too short
+	static D64Image *Open(const char *path);
+
+	void Retain(void);
+	void Release(void);			// Commits and unmaps the image when the last reference is gone
+
+	// Sector at byte offset (track/sector * 256) in the image, NULL if
+	// the image is too short
+	const uint8 *Sector(int offset);
+	bool WriteSector(int offset, const uint8 *buffer);	// false if write-protected
+
+	uint32 Generation(void) { return generation; }		// Incremented by every write
+
+	bool WriteProtected(void) { return read_only; }
+	const uint8 *ErrorInfo(void) { return error_info; }	// 683 bytes, NULL if none
+
+private:
+	D64Image(const char *path, uint8 *base, size_t size, bool read_only, const struct stat *st);
+	~D64Image();
+
+	void replay_journal(void);
+	void start_writer(void);
+	static void *writer_entry(void *arg);
+	void writer(void);
+	int collect_journal(void);
+	void append_journal(int length);
+	void commit(void);
+	bool write_file(const uint8 *buffer);
+
+	char *path;
+	char *journal_name;			// path + ".journal"
+	char *temp_name;			// path + ".tmp"
+	uint8 *base;				// Start of the mapping
+	size_t size;
+	uint8 *data;				// Track 1, sector 0
+	int num_sectors;			// 256 byte blocks from data to the end of the mapping
+	const uint8 *error_info;
+	bool read_only;
+	uint32 generation;
+	dev_t dev;					// Identity of the file
+	ino_t ino;
+	mode_t mode;
+	int ref_count;				// Protected by the lock in D64Image.cpp
+	D64Image *next;				// List of open images
+
+	// Write-back, protected by lock
+	pthread_mutex_t lock;
+	pthread_cond_t wake;		// Sector written or quit
+	pthread_t thread;
+	bool thread_running;
+	bool quit;
+	uint32 *pending;			// Sectors written since they were last journaled (1 bit each)
+	bool pending_any;
+	bool uncommitted;			// Sectors written since the last commit
+
+	// Only used by the write-back thread (or after it has stopped)
+	uint8 *journal_buf;			// Records collected for the journal
+	int journal_fd;				// -1 if not open
+};
+
+#endif
@@ -17,8 +17,11 @@
  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#import "SIDRenderer.h"
-#import "sysdeps.h"
+#ifndef _DIGITAL_RENDERER_H
+#define _DIGITAL_RENDERER_H
+
+#include "SIDRenderer.h"
+#include "sysdeps.h"
 #include "Display.h"
 
 #if AUDIO_DRIVER == AD_AUDIO_UNIT
@@ -114,9 +117,13 @@ const ALfloat	SAMPLE_RATE = 44100.0;
 // Renderer class
 class DigitalRenderer {
 public:
-	DigitalRenderer();
+	DigitalRenderer(Prefs *prefs, const void *tables);
 	~DigitalRenderer();
 	
+	// Read-only tables shared by all renderers (see ROMArena)
+	static size_t TablesSize(void);
+	static void InitTables(void *tables);
+	
 	void Reset(void);
 	inline void EmulateLine(void) {
 		sample_buf[sample_in_ptr] = volume;
@@ -143,9 +150,10 @@ private:
 	uint8 volume;					// Master volume
 	bool v3_mute;					// Voice 3 muted
 	bool sid_filters;
+	Prefs *the_prefs;				// Pointer to preferences of the C64
 
 public:
-	static uint16 TriTable[0x1000*2];	// Tables for certain waveforms
+	const uint16 *TriTable;			// Tables for certain waveforms (shared)
 	static const uint16 TriSawTable[0x100];
 	static const uint16 TriRectTable[0x100];
 
@@ -208,3 +216,5 @@ private:
 	int16									mSampleData[kNumberOpenAlBuffers][FRAGMENT_SIZE];
 #endif
 };
+
+#endif
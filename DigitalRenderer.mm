@@ -94,11 +94,30 @@ enum {
 
 #include "DigitalRenderer_samples.i"
 
+/*
+ *  Shared tables: the triangle table
+ */
+
+size_t DigitalRenderer::TablesSize(void)
+{
+	return 0x1000*2 * sizeof(uint16);
+}
+
+void DigitalRenderer::InitTables(void *tables)
+{
+	uint16 *tri_table = (uint16 *)tables;
+	for (int i=0; i<0x1000; i++) {
+		tri_table[i] = (i << 4) | (i >> 8);
+		tri_table[0x1fff-i] = (i << 4) | (i >> 8);
+	}
+}
+
+
 /*
  *  Constructor
  */
 
-DigitalRenderer::DigitalRenderer()
+DigitalRenderer::DigitalRenderer(Prefs *prefs, const void *tables) : the_prefs(prefs), TriTable((const uint16 *)tables)
 {
 	// Link voices together
 	voice[0].mod_by = &voice[2];
@@ -108,12 +127,6 @@ DigitalRenderer::DigitalRenderer()
 	voice[1].mod_to = &voice[2];
 	voice[2].mod_to = &voice[0];
 	
-	// Calculate triangle table
-	for (int i=0; i<0x1000; i++) {
-		TriTable[i] = (i << 4) | (i >> 8);
-		TriTable[0x1fff-i] = (i << 4) | (i >> 8);
-	}
-	
 #ifdef PRECOMPUTE_RESONANCE
 #ifdef USE_FIXPOINT_MATHS
 	// slow floating point doesn't matter much on startup!
@@ -652,7 +665,7 @@ ALvoid  alcMacOSXMixerOutputRateProc(const ALdouble value)
 }
 
 void DigitalRenderer::init_sound() {
-	sid_filters = ThePrefs.SIDFilters;
+	sid_filters = the_prefs->SIDFilters;
 	
 	OSStatus result = noErr;
 	mDevice = alcOpenDevice(NULL);
@@ -660,7 +673,7 @@ void DigitalRenderer::init_sound() {
 	
 	alcMacOSXMixerOutputRateProc(SAMPLE_RATE);
 	
-	if (!ThePrefs.SIDOn)
+	if (!the_prefs->SIDOn)
 		Pause();
 
 	// Create an OpenAL Context
@@ -726,7 +739,7 @@ void DigitalRenderer::Pause() {
 }
 
 void DigitalRenderer::Resume() {
-	if (ThePrefs.SIDOn)
+	if (the_prefs->SIDOn)
 		alSourcePlay(mSourceID);
 }
 
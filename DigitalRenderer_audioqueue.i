@@ -18,12 +18,12 @@
  */
 
 void DigitalRenderer::init_sound() {
-	sid_filters = ThePrefs.SIDFilters;
+	sid_filters = the_prefs->SIDFilters;
 	
 	_audioQueue = new CAudioQueueManager(SAMPLE_FREQ, FRAGMENT_SIZE, MonoSound);
 	_audioQueue->start();
 	
-	if (!ThePrefs.SIDOn)
+	if (!the_prefs->SIDOn)
 		Pause();
 	
 	ready = true;
@@ -38,8 +38,8 @@ DigitalRenderer::~DigitalRenderer() {
 
 void DigitalRenderer::VBlank() {
 	// Convert latency preferences from milliseconds to frags.
-	int lead_hiwater = ThePrefs.LatencyMax;
-	int lead_lowater = ThePrefs.LatencyMin;
+	int lead_hiwater = the_prefs->LatencyMax;
+	int lead_lowater = the_prefs->LatencyMin;
 	
 	long remainingMilliseconds = _audioQueue->remainingMilliseconds();
 	if (remainingMilliseconds > lead_hiwater)
@@ -75,6 +75,6 @@ void DigitalRenderer::Pause() {
 }
 
 void DigitalRenderer::Resume() {
-	if (ThePrefs.SIDOn)
+	if (the_prefs->SIDOn)
 		_audioQueue->resume();
 }
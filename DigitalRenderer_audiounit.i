@@ -18,11 +18,11 @@
  */
 
 void DigitalRenderer::init_sound() {
-	sid_filters = ThePrefs.SIDFilters;
+	sid_filters = the_prefs->SIDFilters;
 
 	_audioQueue = new CAudioUnitQueueManager(this, SAMPLE_FREQ, MonoSound);
 	_audioQueue->start();
-	if (!ThePrefs.SIDOn)
+	if (!the_prefs->SIDOn)
 		Pause();
 	
 	ready = true;
@@ -141,6 +141,6 @@ void DigitalRenderer::Pause() {
 }
 
 void DigitalRenderer::Resume() {
-	if (ThePrefs.SIDOn)
+	if (the_prefs->SIDOn)
 		_audioQueue->resume();
 }
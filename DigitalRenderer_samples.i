@@ -19,7 +19,6 @@
 
 
 // Static data members
-uint16 DigitalRenderer::TriTable[0x1000*2];
 
 #ifndef EMUL_MOS8580
 // Sampled from a 6581R4
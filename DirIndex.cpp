@@ -0,0 +1,247 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  DirIndex.cpp - Index of the file names of a disk or tape image
+ *
+ *  Multi-load games open many files, and every OPEN used to scan the
+ *  whole directory. The drives build the index once per directory
+ *  and only check the few entries it returns.
+ */
+
+#include "sysdeps.h"
+
+#include "DirIndex.h"
+
+
+/*
+ *  Constructor/destructor
+ */
+
+DirIndex::DirIndex(uint8 pad) : pad(pad)
+{
+	max_entries = max_nodes = max_links = 0;
+	keys = NULL;
+	key_len = NULL;
+	hash_next = NULL;
+	nodes = NULL;
+	link_entry = link_next = NULL;
+	result = NULL;
+	Clear();
+}
+
+DirIndex::~DirIndex()
+{
+	delete[] result;
+	delete[] link_next;
+	delete[] link_entry;
+	delete[] nodes;
+	delete[] hash_next;
+	delete[] key_len;
+	delete[] keys;
+}
+
+
+/*
+ *  Remove all entries
+ */
+
+void DirIndex::Clear(void)
+{
+	num_entries = num_links = 0;
+	for (int i=0; i<DIR_HASH_SIZE; i++)
+		hash_first[i] = hash_last[i] = -1;
+
+	num_nodes = 0;
+	new_node(0);		// Root
+}
+
+
+/*
+ *  Add the next entry
+ */
+
+void DirIndex::Add(const uint8 *name)
+{
+	int len = key_length(name);
+
+	if (num_entries == max_entries) {
+		max_entries = max_entries ? max_entries * 2 : 144;	// 18 directory blocks
+
+		uint8 (*new_keys)[16] = new uint8[max_entries][16];
+		uint8 *new_key_len = new uint8[max_entries];
+		int *new_hash_next = new int[max_entries];
+		memcpy(new_keys, keys, num_entries * 16);
+		memcpy(new_key_len, key_len, num_entries);
+		memcpy(new_hash_next, hash_next, num_entries * sizeof(int));
+		delete[] keys;
+		delete[] key_len;
+		delete[] hash_next;
+		keys = new_keys;
+		key_len = new_key_len;
+		hash_next = new_hash_next;
+
+		delete[] result;
+		result = new int[max_entries];
+	}
+
+	int entry = num_entries++;
+	memcpy(keys[entry], name, len);
+	key_len[entry] = len;
+
+	// Append to its hash bucket, so buckets stay in directory order
+	int h = hash_key(name, len);
+	hash_next[entry] = -1;
+	if (hash_last[h] < 0)
+		hash_first[h] = entry;
+	else
+		hash_next[hash_last[h]] = entry;
+	hash_last[h] = entry;
+
+	// Insert into the trie, every node on the way lists the entry
+	int node = 0;
+	add_link(node, entry);
+	for (int i=0; i<len; i++) {
+		int child;
+		for (child = nodes[node].child; child >= 0; child = nodes[child].sibling)
+			if (nodes[child].c == name[i])
+				break;
+		if (child < 0) {
+			child = new_node(name[i]);
+			nodes[child].sibling = nodes[node].child;
+			nodes[node].child = child;
+		}
+		node = child;
+		add_link(node, entry);
+	}
+}
+
+
+/*
+ *  Find the entries a pattern may match
+ */
+
+const int *DirIndex::Candidates(const char *pattern, int *count)
+{
+	const uint8 *p = (const uint8 *)pattern;
+	int n = 0;
+
+	// Length of the pattern and of the part before the first wildcard
+	int len = strlen(pattern);
+	int prefix = 0;
+	while (prefix < len && p[prefix] != '*' && p[prefix] != '?' && p[prefix] != pad)
+		prefix++;
+
+	if (prefix == len && len > 0 && len <= 16) {
+
+		// Exact name
+		int h = hash_key(p, len);
+		for (int entry = hash_first[h]; entry >= 0; entry = hash_next[entry])
+			if (key_len[entry] == len && memcmp(keys[entry], p, len) == 0)
+				result[n++] = entry;
+
+	} else {
+
+		// Names starting with the prefix (no more than 16 characters
+		// of a name are compared)
+		if (prefix > 16)
+			prefix = 16;
+		int node = 0;
+		for (int i=0; i<prefix && node >= 0; i++) {
+			int child;
+			for (child = nodes[node].child; child >= 0; child = nodes[child].sibling)
+				if (nodes[child].c == p[i])
+					break;
+			node = child;
+		}
+		if (node >= 0)
+			for (int link = nodes[node].first; link >= 0; link = link_next[link])
+				result[n++] = link_entry[link];
+	}
+
+	*count = n;
+	return result;
+}
+
+
+/*
+ *  Number of name characters before the pad character
+ */
+
+int DirIndex::key_length(const uint8 *name)
+{
+	int len = 0;
+	while (len < 16 && name[len] != pad)
+		len++;
+	return len;
+}
+
+int DirIndex::hash_key(const uint8 *key, int len)
+{
+	uint32 h = len;
+	for (int i=0; i<len; i++)
+		h = h * 31 + key[i];
+	return h & (DIR_HASH_SIZE - 1);
+}
+
+
+/*
+ *  Trie nodes and their entry lists
+ */
+
+int DirIndex::new_node(uint8 c)
+{
+	if (num_nodes == max_nodes) {
+		max_nodes = max_nodes ? max_nodes * 2 : 256;
+		TrieNode *new_nodes = new TrieNode[max_nodes];
+		memcpy(new_nodes, nodes, num_nodes * sizeof(TrieNode));
+		delete[] nodes;
+		nodes = new_nodes;
+	}
+
+	TrieNode *n = &nodes[num_nodes];
+	n->c = c;
+	n->child = n->sibling = -1;
+	n->first = n->last = -1;
+	return num_nodes++;
+}
+
+void DirIndex::add_link(int node, int entry)
+{
+	if (num_links == max_links) {
+		max_links = max_links ? max_links * 2 : 1024;
+		int *new_entry = new int[max_links];
+		int *new_next = new int[max_links];
+		memcpy(new_entry, link_entry, num_links * sizeof(int));
+		memcpy(new_next, link_next, num_links * sizeof(int));
+		delete[] link_entry;
+		delete[] link_next;
+		link_entry = new_entry;
+		link_next = new_next;
+	}
+
+	int link = num_links++;
+	link_entry[link] = entry;
+	link_next[link] = -1;
+	if (nodes[node].last < 0)
+		nodes[node].first = link;
+	else
+		link_next[nodes[node].last] = link;
+	nodes[node].last = link;
+}
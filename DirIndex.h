@@ -0,0 +1,83 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  DirIndex.h - Index of the file names of a disk or tape image
+ */
+
+#ifndef _DIRINDEX_H
+#define _DIRINDEX_H
+
+#include "sysdeps.h"
+
+
+// Number of hash buckets for exact names
+const int DIR_HASH_SIZE = 64;
+
+// File names of a directory, in directory order (the entry numbers
+// are 0, 1, 2, ...). Names are up to 16 PETSCII characters, ended by
+// the pad character (0xa0 in .d64 directories, 0 for .t64 names).
+// The index only finds the entries a pattern may match, the drive
+// checks them with its own wildcard rules.
+class DirIndex {
+public:
+	DirIndex(uint8 pad);
+	~DirIndex();
+
+	void Clear(void);
+	void Add(const uint8 *name);		// Next entry
+	int Size(void) { return num_entries; }
+
+	// Entries that may match the pattern (null-terminated, with '*'
+	// and '?' wildcards), in directory order. Exact names are looked
+	// up in a hash table, otherwise the characters before the first
+	// wildcard select a subtree of a prefix trie.
+	const int *Candidates(const char *pattern, int *count);
+
+private:
+	struct TrieNode {
+		uint8 c;				// Character leading to this node
+		int child;				// First child, -1 if none
+		int sibling;			// Next child of the parent, -1 if none
+		int first, last;		// Links of the entries below this node, -1 if none
+	};
+
+	int key_length(const uint8 *name);
+	static int hash_key(const uint8 *key, int len);
+	int new_node(uint8 c);
+	void add_link(int node, int entry);
+
+	uint8 pad;
+
+	int num_entries, max_entries;
+	uint8 (*keys)[16];			// Name of each entry, up to the pad character
+	uint8 *key_len;
+	int *hash_next;				// Next entry in the same bucket, -1 if none
+	int hash_first[DIR_HASH_SIZE], hash_last[DIR_HASH_SIZE];
+
+	TrieNode *nodes;			// nodes[0] is the root
+	int num_nodes, max_nodes;
+	int *link_entry;			// Entry lists of the trie nodes
+	int *link_next;
+	int num_links, max_links;
+
+	int *result;				// Returned by Candidates()
+};
+
+#endif
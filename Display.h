@@ -26,7 +26,12 @@
 #ifndef _DISPLAY_H
 #define _DISPLAY_H
 
+#if defined(FRODO_HEADLESS)
+typedef const void *C64ImageRef;	// DISPLAY_X * DISPLAY_Y pixels in the display format
+#else
 #import <CoreGraphics/CoreGraphics.h>
+typedef CGImageRef C64ImageRef;
+#endif
 
 // Display dimensions
 #if defined(SMALL_DISPLAY)
@@ -54,8 +59,12 @@ public:
 	uint8 *BitmapBase(void);
 	int BitmapXMod(void);
 
+	// The rows of the bitmap in lines[] (one bit per row, NULL: all rows)
+	// were redrawn. GetImageBuffer() only converts the redrawn rows.
+	void LinesChanged(const uint32 *lines);
+
 #if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT || FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
-	CGImageRef GetImageBuffer() /*__attribute__((section("__TEXT, __groupme")))*/;
+	C64ImageRef GetImageBuffer() /*__attribute__((section("__TEXT, __groupme")))*/;
 #endif
 
 	void PollKeyboard(uint8 *key_matrix, uint8 *rev_matrix);
@@ -67,6 +76,9 @@ public:
 	C64 *TheC64;
 
 private:
+#if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT || FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
+	void take_dirty_rows(uint32 *rows);
+#endif
 	
 	// buffer used by the emulator
 	uint8			*pixels;
@@ -78,9 +90,13 @@ private:
 	};
 #pragma pack(pop)
 	
+#if !defined(FRODO_HEADLESS)
 	CGContextRef	context;
+#endif
 	uint			*imageBuffer;
 	ColorPalette2	palette2[16];
+	bool			simd_convert;	// Convert with SSSE3 (simulator/headless on x86)
+	uint32			dirty_rows[(DISPLAY_Y+31)/32];	// Rows not converted yet, one bit per row
 #elif FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
 #pragma pack(push,1)
 	struct ColorPalette2 {
@@ -90,9 +106,13 @@ private:
 	};
 #pragma pack(pop)
 
+#if !defined(FRODO_HEADLESS)
 	CGContextRef	context;
+#endif
 	uint			*imageBuffer;
 	ColorPalette2	palette2[16];	
+	bool			simd_convert;	// Convert with SSSE3 (simulator/headless on x86)
+	uint32			dirty_rows[(DISPLAY_Y+31)/32];	// Rows not converted yet, one bit per row
 #elif FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_INDEXED
 	// image buffer data
 	CGImageRef		_image;
@@ -26,17 +26,29 @@
 #include "sysdeps.h"
 #include "Prefs.h"
 #include "Display.h"
+#if !defined(FRODO_HEADLESS)
 #include "DisplayView.h"
+#endif
 #include "C64.h"
 #include "Keyboard.h"
 #include "debug.h"
 
+#if defined(FRODO_HEADLESS)
+
+#if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_INDEXED
+#error "The headless display needs a 16 or 32 bit display format"
+#endif
+
+#else
+
 #import <Foundation/Foundation.h>
 
 extern void UpdateScreen();
 extern void SetImage(CGImageRef image);
 extern void SetPixels(uint8 *pixels);
 
+#endif
+
 // LED states
 enum {
 	LED_OFF,		// LED off
@@ -106,12 +118,118 @@ void C64Display::UpdateLEDs(uint8 led) {
 #if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
 const int kBytesPerPixel			= 2;
 const int kBitsPerComponent			= 5;
+#if !defined(FRODO_HEADLESS)
 const unsigned int kFormat			= kCGBitmapByteOrder16Little | kCGImageAlphaNoneSkipFirst;
+#endif
 #elif FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT
 const int kBytesPerPixel			= 4;
 const int kBitsPerComponent			= 8;
+#if !defined(FRODO_HEADLESS)
 const unsigned int kFormat			= kCGBitmapByteOrder32Little | kCGImageAlphaNoneSkipFirst;
 #endif
+#endif
+
+// The simulator and the headless build convert the pixels in C++, with
+// SSSE3 if the CPU has it. The device uses the ARM code in display.s.
+#if (TARGET_IPHONE_SIMULATOR || defined(FRODO_HEADLESS)) && (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__) \
+	&& FRODO_DISPLAY_FORMAT != DISPLAY_FORMAT_INDEXED
+#define DISPLAY_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+
+#if DISPLAY_SSSE3
+/*
+ *  Convert 16 pixels per iteration. The palette is split into one
+ *  table of 16 bytes for each byte of the output pixels, pshufb looks
+ *  up 16 pixels in such a table at once and unpacks interleave the
+ *  bytes. Only the lower 4 bits of the pixels (the color) are used.
+ */
+
+#if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT
+__attribute__((target("ssse3")))
+static void convert_ssse3(uint *dst, const uint8 *src, int size, const uint *pal)
+{
+	uint8 b[16], g[16], r[16], a[16];
+	for (int i=0; i<16; i++) {
+		b[i] = pal[i];
+		g[i] = pal[i] >> 8;
+		r[i] = pal[i] >> 16;
+		a[i] = pal[i] >> 24;
+	}
+	__m128i tb = _mm_loadu_si128((const __m128i *)b), tg = _mm_loadu_si128((const __m128i *)g);
+	__m128i tr = _mm_loadu_si128((const __m128i *)r), ta = _mm_loadu_si128((const __m128i *)a);
+	__m128i colors = _mm_set1_epi8(0x0f);
+
+	for (int i=0; i<size; i+=16, src+=16, dst+=16) {
+		__m128i px = _mm_and_si128(_mm_loadu_si128((const __m128i *)src), colors);
+		__m128i pb = _mm_shuffle_epi8(tb, px), pg = _mm_shuffle_epi8(tg, px);
+		__m128i pr = _mm_shuffle_epi8(tr, px), pa = _mm_shuffle_epi8(ta, px);
+		__m128i bg_lo = _mm_unpacklo_epi8(pb, pg), bg_hi = _mm_unpackhi_epi8(pb, pg);
+		__m128i ra_lo = _mm_unpacklo_epi8(pr, pa), ra_hi = _mm_unpackhi_epi8(pr, pa);
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(bg_lo, ra_lo));
+		_mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi16(bg_lo, ra_lo));
+		_mm_storeu_si128((__m128i *)(dst + 8), _mm_unpacklo_epi16(bg_hi, ra_hi));
+		_mm_storeu_si128((__m128i *)(dst + 12), _mm_unpackhi_epi16(bg_hi, ra_hi));
+	}
+}
+#else
+__attribute__((target("ssse3")))
+static void convert_ssse3(ushort *dst, const uint8 *src, int size, const ushort *pal)
+{
+	uint8 lo[16], hi[16];
+	for (int i=0; i<16; i++) {
+		lo[i] = pal[i];
+		hi[i] = pal[i] >> 8;
+	}
+	__m128i tlo = _mm_loadu_si128((const __m128i *)lo), thi = _mm_loadu_si128((const __m128i *)hi);
+	__m128i colors = _mm_set1_epi8(0x0f);
+
+	for (int i=0; i<size; i+=16, src+=16, dst+=16) {
+		__m128i px = _mm_and_si128(_mm_loadu_si128((const __m128i *)src), colors);
+		__m128i plo = _mm_shuffle_epi8(tlo, px), phi = _mm_shuffle_epi8(thi, px);
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(plo, phi));
+		_mm_storeu_si128((__m128i *)(dst + 8), _mm_unpackhi_epi8(plo, phi));
+	}
+}
+#endif
+#endif
+
+
+#if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT || FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
+/*
+ *  Find the next run of rows that are set in rows[], starting at *row.
+ *  Returns the number of rows in it (0: none left) and sets *row to the
+ *  first one.
+ */
+
+static int next_rows(const uint32 *rows, int *row)
+{
+	int y = *row;
+	while (y < DISPLAY_Y && !(rows[y >> 5] & (1U << (y & 31))))
+		y++;
+	*row = y;
+	
+	int n = 0;
+	while (y + n < DISPLAY_Y && (rows[(y + n) >> 5] & (1U << ((y + n) & 31))))
+		n++;
+	return n;
+}
+
+
+/*
+ *  Check if the pixels can be converted with SIMD code
+ */
+
+static bool use_simd_convert(const Prefs *prefs)
+{
+#if DISPLAY_SSSE3
+	return prefs->SIMDRenderers && __builtin_cpu_supports("ssse3");
+#else
+	return false;
+#endif
+}
+#endif
 
 
 /*
@@ -120,8 +238,10 @@ const unsigned int kFormat			= kCGBitmapByteOrder32Little | kCGImageAlphaNoneSki
 
 C64Display::C64Display(C64 *the_c64) : TheC64(the_c64)
 {
+#if !defined(FRODO_HEADLESS)
 	// create indexed color palette
 	CGColorSpaceRef rgbColorSpace = CGColorSpaceCreateDeviceRGB();
+#endif
 
 	// allocate image buffer
 	pixels = (uint8*)malloc(DISPLAY_X * (DISPLAY_Y));
@@ -129,9 +249,14 @@ C64Display::C64Display(C64 *the_c64) : TheC64(the_c64)
 #if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT || FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
 	
 	imageBuffer = (uint*)malloc(DISPLAY_X * DISPLAY_Y * kBytesPerPixel + 16);
+#if !defined(FRODO_HEADLESS)
 	context = CGBitmapContextCreate(imageBuffer, 
 									DISPLAY_X, DISPLAY_Y, kBitsPerComponent, 
 									DISPLAY_X * kBytesPerPixel, rgbColorSpace, kFormat);
+#endif
+	
+	simd_convert = use_simd_convert(&the_c64->prefs);
+	memset(dirty_rows, 0xff, sizeof(dirty_rows));
 	
 #if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT
 	for (int i = 0; i < sizeof(palette2) / sizeof(palette2[0]); i++) {
@@ -147,7 +272,9 @@ C64Display::C64Display(C64 *the_c64) : TheC64(the_c64)
 		palette2[i].b = palette_blue[i] >> 3;
 	}
 #endif
+#if !defined(FRODO_HEADLESS)
 	SetImage(nil);
+#endif
 	
 #elif FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_INDEXED
 	
@@ -178,7 +305,9 @@ C64Display::C64Display(C64 *the_c64) : TheC64(the_c64)
 	SetImage(_image);
 	
 #endif
+#if !defined(FRODO_HEADLESS)
 	CGColorSpaceRelease(rgbColorSpace);
+#endif
 }
 
 
@@ -188,8 +317,11 @@ C64Display::C64Display(C64 *the_c64) : TheC64(the_c64)
 
 C64Display::~C64Display() {
 #if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT || FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
+#if !defined(FRODO_HEADLESS)
 	CFRelease(context);
+#endif
 	free(imageBuffer);
+	free(pixels);
 #elif FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_INDEXED
 	CFRelease(_image);
 	free(pixels);
@@ -198,68 +330,97 @@ C64Display::~C64Display() {
 
 #if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT
 
-#if !TARGET_IPHONE_SIMULATOR
+#if !TARGET_IPHONE_SIMULATOR && !defined(FRODO_HEADLESS)
 
 extern "C" void create_bgra(void* dst, size_t size, void* src, void* palette);
 
-CGImageRef C64Display::GetImageBuffer() {
-	int		size = DISPLAY_X * DISPLAY_Y;
-	uint	*dst = imageBuffer;
-	uint8	*src = pixels;
+C64ImageRef C64Display::GetImageBuffer() {
+	uint32	rows[(DISPLAY_Y+31)/32];
 	uint	*pal = (uint *)&palette2;
 	
-	create_bgra(dst, size, src, pal);
+	take_dirty_rows(rows);
+	for (int y = 0, n; (n = next_rows(rows, &y)) > 0; y += n)
+		create_bgra(imageBuffer + y * DISPLAY_X, n * DISPLAY_X, pixels + y * DISPLAY_X, pal);
 	
 	return CGBitmapContextCreateImage(context);
 }
 
 #else
 
-CGImageRef C64Display::GetImageBuffer() {
-	int		size = DISPLAY_X * DISPLAY_Y;
-	uint	*dst = imageBuffer;
-	uint8	*src = pixels;
+C64ImageRef C64Display::GetImageBuffer() {
+	uint32	rows[(DISPLAY_Y+31)/32];
 	uint	*pal = (uint *)&palette2;
-	do {
-		*dst = *(pal + *src);
-		dst++; src++;
-	} while (--size);
 	
+	take_dirty_rows(rows);
+	for (int y = 0, n; (n = next_rows(rows, &y)) > 0; y += n) {
+		int		size = n * DISPLAY_X;
+		uint	*dst = imageBuffer + y * DISPLAY_X;
+		uint8	*src = pixels + y * DISPLAY_X;
+#if DISPLAY_SSSE3
+		if (simd_convert)
+			convert_ssse3(dst, src, size, pal);
+		else
+#endif
+		do {
+			*dst = *(pal + *src);
+			dst++; src++;
+		} while (--size);
+	}
+	
+#if defined(FRODO_HEADLESS)
+	return imageBuffer;
+#else
 	return CGBitmapContextCreateImage(context);
+#endif
 }
 
 #endif
 
 #elif FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
 
-#if TARGET_IPHONE_SIMULATOR
+#if TARGET_IPHONE_SIMULATOR || defined(FRODO_HEADLESS)
 
-CGImageRef C64Display::GetImageBuffer() {
-	int		size = DISPLAY_X * DISPLAY_Y >> 2;
-	uint	*dst = imageBuffer;
-	uint	*src = (uint*)pixels;
+C64ImageRef C64Display::GetImageBuffer() {
+	uint32	rows[(DISPLAY_Y+31)/32];
 	ushort	*pal = (ushort *)&palette2;
-	do {
-		uint upx = *src++;
-		ushort px = upx & 0xFFFF;
-		*dst++ = *(pal + (px & 0x1f)) | *(pal + (px >> 8)) << 16;
-		px = upx >> 16;
-		*dst++ = *(pal + (px & 0x1f)) | *(pal + (px >> 8)) << 16;
-	} while (--size);
 	
+	take_dirty_rows(rows);
+	for (int y = 0, n; (n = next_rows(rows, &y)) > 0; y += n) {
+		int		size = n * DISPLAY_X >> 2;
+		uint	*dst = imageBuffer + (y * DISPLAY_X >> 1);
+		uint	*src = (uint*)(pixels + y * DISPLAY_X);
+#if DISPLAY_SSSE3
+		if (simd_convert)
+			convert_ssse3((ushort *)dst, (uint8 *)src, n * DISPLAY_X, pal);
+		else
+#endif
+		do {
+			uint upx = *src++;
+			ushort px = upx & 0xFFFF;
+			*dst++ = *(pal + (px & 0x1f)) | *(pal + (px >> 8)) << 16;
+			px = upx >> 16;
+			*dst++ = *(pal + (px & 0x1f)) | *(pal + (px >> 8)) << 16;
+		} while (--size);
+	}
+	
+#if defined(FRODO_HEADLESS)
+	return imageBuffer;
+#else
 	return CGBitmapContextCreateImage(context);
+#endif
 }
 
 #else
 
 extern "C" void create_bgrx5551(void* dst, size_t size, void* src, void* palette);
 
-CGImageRef C64Display::GetImageBuffer() {
-	int			size = DISPLAY_X * DISPLAY_Y >> 2;
-	uint	*dst = imageBuffer;
-	uint	*src = (uint*)pixels;
+C64ImageRef C64Display::GetImageBuffer() {
+	uint32	rows[(DISPLAY_Y+31)/32];
 	ushort	*pal = (ushort *)&palette2;
-	create_bgrx5551(dst, size, src, pal);
+	
+	take_dirty_rows(rows);
+	for (int y = 0, n; (n = next_rows(rows, &y)) > 0; y += n)
+		create_bgrx5551(imageBuffer + (y * DISPLAY_X >> 1), n * DISPLAY_X >> 2, pixels + y * DISPLAY_X, pal);
 	return CGBitmapContextCreateImage(context);
 }
 
@@ -267,12 +428,44 @@ CGImageRef C64Display::GetImageBuffer() {
 
 #endif
 
+/*
+ *  Rows of the bitmap were redrawn (called by the emulation thread,
+ *  GetImageBuffer() may run on another one at the same time)
+ */
+
+void C64Display::LinesChanged(const uint32 *lines)
+{
+#if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT || FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
+	for (int i = 0; i < (DISPLAY_Y+31)/32; i++) {
+		uint32 bits = lines ? lines[i] : 0xffffffff;
+		if (bits)
+			__sync_fetch_and_or(&dirty_rows[i], bits);
+	}
+#endif
+}
+
+
+#if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT || FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
+/*
+ *  Get the rows to convert and clear them in dirty_rows[]
+ */
+
+void C64Display::take_dirty_rows(uint32 *rows)
+{
+	for (int i = 0; i < (DISPLAY_Y+31)/32; i++)
+		rows[i] = __sync_fetch_and_and(&dirty_rows[i], 0);
+}
+#endif
+
+
 /*
  *  Redraw bitmap
  */
 
 void C64Display::Update(void) {
+#if !defined(FRODO_HEADLESS)
 	UpdateScreen();
+#endif
 }
 
 static void translate_key(int c64_key, bool key_up, uint8 *key_matrix, uint8 *rev_matrix)
@@ -314,14 +507,18 @@ void C64Display::PollKeyboard(uint8 *key_matrix, uint8 *rev_matrix)
 				return;
 			}
 			else if (event.code == KeyCode_TOGGLE_SPEED) {
-				if (ThePrefs.LimitSpeed) {
-					ThePrefs.LimitSpeed = false;
-					ThePrefs.OldSkipFrames = ThePrefs.SkipFrames;
-					ThePrefs.SkipFrames = 10;
+				if (TheC64->prefs.LimitSpeed) {
+					TheC64->prefs.LimitSpeed = false;
+					TheC64->prefs.OldSkipFrames = TheC64->prefs.SkipFrames;
+					TheC64->prefs.SkipFrames = 10;
 				} else {
-					ThePrefs.LimitSpeed = true;
-					ThePrefs.SkipFrames = ThePrefs.OldSkipFrames;
+					TheC64->prefs.LimitSpeed = true;
+					TheC64->prefs.SkipFrames = TheC64->prefs.OldSkipFrames;
 				}
+				// The settings views build their new prefs from ThePrefs
+				ThePrefs.LimitSpeed = TheC64->prefs.LimitSpeed;
+				ThePrefs.OldSkipFrames = TheC64->prefs.OldSkipFrames;
+				ThePrefs.SkipFrames = TheC64->prefs.SkipFrames;
 				return;
 			} else if (event.code == KeyCode_RESET) {
 				TheC64->Reset();
@@ -341,6 +538,9 @@ void C64Display::PollKeyboard(uint8 *key_matrix, uint8 *rev_matrix)
 
 void C64Display::NewPrefs(Prefs *prefs)
 {
+#if FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT || FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_16BIT
+	simd_convert = use_simd_convert(prefs);
+#endif
 }
 
 
@@ -374,6 +574,20 @@ int C64Display::BitmapXMod(void)
 	return DISPLAY_X;
 }
 
+#if defined(FRODO_HEADLESS)
+
+/*
+ *  Show a requester (error message)
+ */
+
+long int ShowRequester(const char *a, const char *b, const char *)
+{
+	fprintf(stderr, "Error: %s [%s]\n", a, b);
+	return 1;
+}
+
+#else
+
 BOOL showingRequester;
 
 @interface RequesterDelegate : NSObject<UIAlertViewDelegate>
@@ -419,4 +633,6 @@ long int ShowRequester(const char *a, const char *b, const char *)
 	[buttonText release];
 	[theDelegate release];
 	return 1;
-}
\ No newline at end of file
+}
+
+#endif
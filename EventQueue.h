@@ -0,0 +1,150 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  EventQueue.h - Cycle-ordered scheduler of the line-based emulation
+ *
+ *  The chips register the cycle of their next deadline here. The main
+ *  loop dispatches the events that are due, in time order (events due
+ *  at the same time in the order of their IDs), and runs the CPUs up
+ *  to the next deadline. Every source owns one slot, so scheduling an
+ *  event again replaces its old deadline. The slots are kept in a
+ *  binary min-heap. Times are compared as signed differences and may
+ *  wrap.
+ */
+
+#ifndef _EVENT_QUEUE_H
+#define _EVENT_QUEUE_H
+
+
+// Event IDs, in the order the chips were called for each raster line
+enum {
+	EVENT_LINE,		// Start of a raster line (VIC)
+	EVENT_SID,		// SID sample point
+	EVENT_CIA1,		// Timer underflow of CIA 1
+	EVENT_CIA2,		// Timer underflow of CIA 2
+	EVENT_VIA,		// Job IRQ of the 1541 (VIA 2 timer 1)
+	NUM_EVENTS
+};
+
+
+class EventQueue {
+public:
+	EventQueue() : now(0), line_time(0), size(0)
+	{
+		for (int i=0; i<NUM_EVENTS; i++)
+			pos[i] = -1;
+	}
+
+	uint32 Now(void) { return now; }
+	void AdvanceTo(uint32 time) { now = time; }
+
+	// Start time of the current raster line. Lazily counted timers are
+	// up to date up to and including this line.
+	uint32 LineTime(void) { return line_time; }
+	void StartLine(uint32 time) { line_time = time; }
+
+	bool Pending(int event) { return pos[event] >= 0; }
+	uint32 Time(int event) { return when[event]; }
+	uint32 NextTime(void) { return when[heap[0]]; }	// Only if an event is pending
+
+	void Schedule(int event, uint32 time)
+	{
+		int i = pos[event];
+		if (i < 0) {
+			i = size++;
+			heap[i] = event;
+			pos[event] = i;
+		}
+		when[event] = time;
+		up(i);
+		down(pos[event]);
+	}
+
+	void Cancel(int event)
+	{
+		int i = pos[event];
+		if (i < 0)
+			return;
+		pos[event] = -1;
+		if (i == --size)
+			return;
+		int moved = heap[size];
+		heap[i] = moved;
+		pos[moved] = i;
+		up(i);
+		down(pos[moved]);
+	}
+
+	// Remove and return the next event that is due, -1 if there is none
+	int Due(void)
+	{
+		if (!size || (int)(now - when[heap[0]]) < 0)
+			return -1;
+		int event = heap[0];
+		Cancel(event);
+		return event;
+	}
+
+private:
+	bool before(int a, int b)
+	{
+		int d = (int)(when[a] - when[b]);
+		return d < 0 || (d == 0 && a < b);
+	}
+
+	void swap(int i, int j)
+	{
+		int t = heap[i]; heap[i] = heap[j]; heap[j] = t;
+		pos[heap[i]] = i;
+		pos[heap[j]] = j;
+	}
+
+	void up(int i)
+	{
+		while (i > 0 && before(heap[i], heap[(i-1)/2])) {
+			swap(i, (i-1)/2);
+			i = (i-1)/2;
+		}
+	}
+
+	void down(int i)
+	{
+		for (;;) {
+			int min = i, l = 2*i+1, r = 2*i+2;
+			if (l < size && before(heap[l], heap[min]))
+				min = l;
+			if (r < size && before(heap[r], heap[min]))
+				min = r;
+			if (min == i)
+				return;
+			swap(i, min);
+			i = min;
+		}
+	}
+
+	uint32 now;				// Current time in cycles
+	uint32 line_time;		// Time the current raster line started
+	int size;				// Number of scheduled events
+	int heap[NUM_EVENTS];	// Scheduled events, earliest first
+	int pos[NUM_EVENTS];	// Index of each event in heap[], -1 if not scheduled
+	uint32 when[NUM_EVENTS];
+};
+
+#endif
@@ -17,8 +17,11 @@
  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#import "SIDRenderer.h"
-#import "sysdeps.h"
+#ifndef _FAST_DIGITAL_RENDERER_H
+#define _FAST_DIGITAL_RENDERER_H
+
+#include "SIDRenderer.h"
+#include "sysdeps.h"
 #include "Display.h"
 
 class CAudioQueueManager;
@@ -36,9 +39,13 @@ typedef struct sound_s sound_t;
 // Renderer class
 class FastDigitalRenderer {
 public:
-	FastDigitalRenderer();
+	FastDigitalRenderer(Prefs *prefs, const void *tables);
 	~FastDigitalRenderer();
 	
+	// Read-only tables shared by all renderers (see ROMArena)
+	static size_t TablesSize(void);
+	static void InitTables(void *tables);
+	
 	void Reset(void);
 	inline void EmulateLine(void) {
 		sample_buf[sample_in_ptr] = volume;
@@ -57,11 +64,18 @@ private:
 	
 	void init_sound();
 	
+#if defined(FRODO_HEADLESS)
+	short					_fragment[FRAGMENT_SIZE];		// Samples are calculated but discarded
+#else
 	CAudioQueueManager		*_audioQueue;
+#endif
 	sound_t					*_fastSID;
+	Prefs					*the_prefs;						// Pointer to preferences of the C64
 	bool					ready;
 	uint8					sample_buf[SAMPLE_BUF_SIZE];	// Buffer for sampled voice
 	int						sample_in_ptr;					// Index in sample_buf for writing
 	uint8					volume;
 	
 };
+
+#endif
@@ -19,7 +19,9 @@
 
 
 
+#if !defined(FRODO_HEADLESS)
 #include <CoreFoundation/CoreFoundation.h>
+#endif
 
 #include "FastDigitalRenderer.h"
 
@@ -39,18 +41,22 @@ static inline uint8 sid_random(void) {
 }
 
 
+#if !defined(FRODO_HEADLESS)
 # import "AudioQueueManager.h"
+#endif
 
-#import "fastsid.i"
+#include "fastsid.i"
 
 /*
  *  Constructor
  */
 
-FastDigitalRenderer::FastDigitalRenderer() {
+FastDigitalRenderer::FastDigitalRenderer(Prefs *prefs, const void *tables) : the_prefs(prefs) {
 	_fastSID = new sound_t();
 	bzero(_fastSID, sizeof(sound_t));
 	_fastSID->sample_buf = sample_buf;
+	_fastSID->tables = (const fastsid_tables_t *)tables;
+	_fastSID->emulatefilter = the_prefs->SIDFilters;
 	fastsid_init(_fastSID, SAMPLE_FREQ, SID_FREQ);
 	Reset();
 	
@@ -59,6 +65,19 @@ FastDigitalRenderer::FastDigitalRenderer() {
 }
 
 
+/*
+ *  Shared tables
+ */
+
+size_t FastDigitalRenderer::TablesSize(void) {
+	return sizeof(fastsid_tables_t);
+}
+
+void FastDigitalRenderer::InitTables(void *tables) {
+	fastsid_init_tables((fastsid_tables_t *)tables, SAMPLE_FREQ);
+}
+
+
 /*
  *  Reset emulation
  */
@@ -94,13 +113,40 @@ void FastDigitalRenderer::NewPrefs(Prefs *prefs) {
 }
 
 
+#if defined(FRODO_HEADLESS)
+
+/*
+ *  Headless build: no audio device, but the samples are still
+ *  calculated so the SID costs the same as on the device
+ */
+
+void FastDigitalRenderer::init_sound() {
+	ready = true;
+}
+
+FastDigitalRenderer::~FastDigitalRenderer() {
+	delete _fastSID;
+}
+
+void FastDigitalRenderer::VBlank() {
+	fastsid_calculate_samples(_fastSID, _fragment, FRAGMENT_SIZE, sample_in_ptr);
+}
+
+void FastDigitalRenderer::Pause() {
+}
+
+void FastDigitalRenderer::Resume() {
+}
+
+#else
+
 void FastDigitalRenderer::init_sound() {
-	//sid_filters = ThePrefs.SIDFilters;
+	//sid_filters = the_prefs->SIDFilters;
 	
 	_audioQueue = new CAudioQueueManager(SAMPLE_FREQ, FRAGMENT_SIZE, MonoSound);
 	_audioQueue->start();
 	
-	if (!ThePrefs.SIDOn)
+	if (!the_prefs->SIDOn)
 		Pause();
 	
 	ready = true;
@@ -111,12 +157,13 @@ FastDigitalRenderer::~FastDigitalRenderer() {
 		// default is to auto-delete
 		_audioQueue->stop();
 	}
+	delete _fastSID;
 }
 
 void FastDigitalRenderer::VBlank() {
 	// Convert latency preferences from milliseconds to frags.
-	int lead_hiwater = ThePrefs.LatencyMax;
-	int lead_lowater = ThePrefs.LatencyMin;
+	int lead_hiwater = the_prefs->LatencyMax;
+	int lead_lowater = the_prefs->LatencyMin;
 	
 	long remainingMilliseconds = _audioQueue->remainingMilliseconds();
 	if (remainingMilliseconds > lead_hiwater)
@@ -153,6 +200,8 @@ void FastDigitalRenderer::Pause() {
 }
 
 void FastDigitalRenderer::Resume() {
-	if (ThePrefs.SIDOn)
+	if (the_prefs->SIDOn)
 		_audioQueue->resume();
 }
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  FrameSkip.h - Adaptive frame skipping (Prefs::AdaptiveFrameSkip)
+ *
+ *  C64::VBlank() reports the host time every emulated frame took, the
+ *  controller keeps running averages for drawn and skipped frames and
+ *  picks the smallest skip factor that keeps up with 50 frames per
+ *  second. The factor goes up after a few frames over the budget and
+ *  only comes down again after many frames well below it, so it does
+ *  not flip back and forth. If the last drawn frame redrew only a few
+ *  rows, skipping saves little and at most every other frame is skipped.
+ */
+
+#ifndef _FRAME_SKIP_H
+#define _FRAME_SKIP_H
+
+
+class FrameSkipController {
+public:
+	enum {
+		FRAME_TIME = 20000,		// Host time of a PAL frame in real time (us)
+		MAX_SKIP = 5,			// Draw at least every 5th frame
+		RAISE_AFTER = 3,		// Drawn frames over the budget before skipping more
+		LOWER_AFTER = 25,		// Drawn frames below 7/8 of the budget (at the lower factor) before skipping less
+		LOW_DIRTY_LINES = 32	// A drawn frame that redrew fewer rows is cheap
+	};
+
+	FrameSkipController() { Reset(1); }
+
+	void Reset(int skip_frames)
+	{
+		skip = skip_frames < 1 ? 1 : (skip_frames > MAX_SKIP ? MAX_SKIP : skip_frames);
+		drawn_time = skipped_time = 0;
+		over = under = 0;
+		raises = drops = caps = 0;
+		drawn_frames = skipped_frames = 0;
+	}
+
+	int SkipFrames(void) { return skip; }	// Draw every n-th frame
+
+	// A frame took 'time' us of host time; if it was drawn, 'dirty_lines'
+	// rows of the bitmap were redrawn
+	void Frame(bool drawn, uint32 time, int dirty_lines)
+	{
+		if (time > 10 * FRAME_TIME)		// Paused or suspended
+			time = 10 * FRAME_TIME;
+		if (!drawn) {
+			skipped_time += ((int)time - skipped_time) / 8;
+			skipped_frames++;
+			return;
+		}
+		drawn_time += ((int)time - drawn_time) / 8;
+		drawn_frames++;
+
+		int max = dirty_lines < LOW_DIRTY_LINES ? 2 : MAX_SKIP;
+		if (skip > max) {
+			skip = max;
+			caps++;
+			over = under = 0;
+		} else if (frame_time(skip) > FRAME_TIME) {
+			under = 0;
+			if (++over >= RAISE_AFTER && skip < max) {
+				skip++;
+				raises++;
+				over = 0;
+			}
+		} else if (skip > 1 && frame_time(skip - 1) < FRAME_TIME * 7 / 8) {
+			over = 0;
+			if (++under >= LOWER_AFTER) {
+				skip--;
+				drops++;
+				under = 0;
+			}
+		} else
+			over = under = 0;
+	}
+
+	// Metrics
+	uint32 Raises(void) { return raises; }				// Times the factor went up
+	uint32 Drops(void) { return drops; }				// Times the factor went down
+	uint32 Caps(void) { return caps; }					// Times it was lowered to 2 for a cheap frame
+	uint32 DrawnFrames(void) { return drawn_frames; }
+	uint32 SkippedFrames(void) { return skipped_frames; }
+	int DrawnTime(void) { return drawn_time; }			// Average host time of a drawn frame (us)
+	int SkippedTime(void) { return skipped_time; }		// Average host time of a skipped frame (us)
+
+private:
+	// Average host time per frame when every n-th frame is drawn
+	int frame_time(int n)
+	{
+		return (drawn_time + (n - 1) * skipped_time) / n;
+	}
+
+	int skip;				// Current skip factor
+	int drawn_time;			// Running averages of the host time (us)
+	int skipped_time;
+	int over;				// Drawn frames in a row over the budget
+	int under;				// Drawn frames in a row that would fit at skip-1
+	uint32 raises, drops, caps;
+	uint32 drawn_frames, skipped_frames;
+};
+
+#endif
@@ -30,6 +30,7 @@
 
 class C64;
 class Frodo;
+class ROMArena;
 
 typedef Event<void, Frodo*> InitializedEvent;
 
@@ -49,7 +50,7 @@ public:
 	InitializedEvent eventInitialized;
 	
 private:
-	bool load_rom_files(void);
+	ROMArena *load_rom_files(void);	// NULL on error
 	static NSString* s_path;
 };
 
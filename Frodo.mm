@@ -37,6 +37,7 @@
 #include "Display.h"
 #include "Prefs.h"
 #include "Version.h"
+#include "ROMArena.h"
 
 #import "cf_typeref.h"
 
@@ -58,17 +59,15 @@ Frodo::Frodo()
 	Instance = this;
 }
 
-bool Frodo::load_rom_files(void)
+ROMArena *Frodo::load_rom_files(void)
 {
 	NSBundle *mainBundle = [NSBundle mainBundle];
+	uint8 Kernal[0x2000], Char[0x1000], ROM1541[0x4000];
 	try {
 		
 		NSString *path;
 		NSData *data;
 		
-		// BASIC ROM
-		memcpy(TheC64->Basic, BROM, BROM_size);
-		
 		// Load Kernal ROM
 		path = [mainBundle pathForResource:@"Kernal.ROM" ofType:nil];
 		data = [NSData dataWithContentsOfFile:path];
@@ -76,7 +75,7 @@ bool Frodo::load_rom_files(void)
 			[data release];
 			throw "Unable to load 'Kernal ROM'";
 		}
-		[data getBytes:TheC64->Kernal];
+		[data getBytes:Kernal];
 		[data release];
 			
 		// Load Char ROM
@@ -86,7 +85,7 @@ bool Frodo::load_rom_files(void)
 			[data release];
 			throw "Unable to load 'Char ROM'";
 		}
-		[data getBytes:TheC64->Char];
+		[data getBytes:Char];
 		[data release];
 		
 		// Load 1541 ROM
@@ -96,15 +95,17 @@ bool Frodo::load_rom_files(void)
 			[data release];
 			throw "Unable to load '1541 ROM'";
 		}
-		[data getBytes:TheC64->ROM1541];
+		[data getBytes:ROM1541];
 		[data release];
 		
 	}
 	catch (const char * str) {
 		ShowRequester((char*)str, "Quit");
-		return false;
+		return NULL;
 	}
-	return true;
+	
+	// BASIC ROM is built in
+	return ROMArena::Create(BROM, Kernal, Char, ROM1541);
 }
 
 const char* Frodo::prefs_path() {
@@ -118,12 +119,15 @@ void Frodo::ReadyToRun(void)
 	ThePrefs.Load(prefs_path());
 	
 	// Create and start C64
-	TheC64 = new C64;
-	if (load_rom_files()) {
-		eventInitialized(this);
-		TheC64->Run(AutoBoot);
-	}
-		
+	ROMArena *roms = load_rom_files();
+	if (roms == NULL)
+		return;
+	
+	TheC64 = new C64(roms);
+	roms->Release();
+	eventInitialized(this);
+	TheC64->Run(AutoBoot);
+	
 	delete TheC64;
 }
 
@@ -59,16 +59,16 @@
  *  Constructor: Initialize variables
  */
 
-IEC::IEC(C64Display *display) : the_display(display)
+IEC::IEC(C64Display *display, Prefs *prefs) : the_display(display), the_prefs(prefs)
 {
 	// Create drives 8
 	drive = NULL;	// Important because UpdateLEDs is called from the drive constructors (via set_error)
 
-	if (!ThePrefs.Emul1541Proc)
-		if (ThePrefs.DriveType == DRVTYPE_D64)
-			drive = new D64Drive(this, ThePrefs.DrivePath);
+	if (!the_prefs->Emul1541Proc)
+		if (the_prefs->DriveType == DRVTYPE_D64)
+			drive = new D64Drive(this, the_prefs->DrivePath);
 		else
-			drive = new T64Drive(this, ThePrefs.DrivePath);
+			drive = new T64Drive(this, the_prefs->DrivePath);
 
 	listener_active = talker_active = false;
 	listening = false;
@@ -101,14 +101,14 @@ void IEC::Reset(void)
 
 /*
  *  Preferences have changed, prefs points to new preferences,
- *  ThePrefs still holds the previous ones. Check if drive settings
+ *  the_prefs still holds the previous ones. Check if drive settings
  *  have changed.
  */
 
 void IEC::NewPrefs(Prefs *prefs)
 {
 	// Delete and recreate all changed drives
-	if ((ThePrefs.DriveType != prefs->DriveType) || strcmp(ThePrefs.DrivePath, prefs->DrivePath) || ThePrefs.Emul1541Proc != prefs->Emul1541Proc) {
+	if ((the_prefs->DriveType != prefs->DriveType) || strcmp(the_prefs->DrivePath, prefs->DrivePath) || the_prefs->Emul1541Proc != prefs->Emul1541Proc) {
 		delete drive;
 		drive = NULL;	// Important because UpdateLEDs is called from drive constructors (via set_error())
 		if (!prefs->Emul1541Proc) {
@@ -90,7 +90,7 @@ class Prefs;
 // Class for complete IEC bus system with drives 8..11
 class IEC {
 public:
-	IEC(C64Display *display);
+	IEC(C64Display *display, Prefs *prefs);
 	~IEC();
 
 	void Reset(void);
@@ -119,6 +119,7 @@ private:
 	uint8 data_in(uint8 *byte);
 
 	C64Display *the_display;	// Pointer to display object (for drive LEDs)
+	Prefs *the_prefs;			// Pointer to preferences of the C64
 
 	char name_buf[NAMEBUF_LENGTH];	// Buffer for file names and command strings
 	char *name_ptr;			// Pointer for reception of file name
@@ -33,7 +33,7 @@
 
 #define MATRIX(a,b) (((a) << 3) | (b))
 
-#import <Foundation/Foundation.h>
+#include <pthread.h>
 
 #include <queue>
 using std::queue;
@@ -159,5 +159,5 @@ public:
 	
 private:
 	queue<KeyEvent>		_events;
-	NSRecursiveLock		*_lock;
+	pthread_mutex_t		_lock;
 };
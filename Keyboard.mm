@@ -18,20 +18,38 @@
  */
 
 #include "Keyboard.h"
-#import "CNSRecursiveLock.h"
+
+// Holds a pthread mutex for the lifetime of the object
+class CAutoLock {
+public:
+	CAutoLock(pthread_mutex_t *lock) : _lock(lock) {
+		pthread_mutex_lock(_lock);
+	}
+	
+	~CAutoLock() {
+		pthread_mutex_unlock(_lock);
+	}
+	
+private:
+	pthread_mutex_t *_lock;
+};
 
 KeyEvent Keyboard::HoldKey = { KeyCode_HOLD_KEY, KeyStateUp };
 
 Keyboard::Keyboard() {
-	_lock = [NSRecursiveLock alloc];
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
 }
 
 Keyboard::~Keyboard() {
-	[_lock release];
+	pthread_mutex_destroy(&_lock);
 }
 
 void Keyboard::QueueKeyEvent(KeyCode code, KeyState state) {
-	CNSRecursiveLock autolock(_lock);	// this ensures the lock is released on function exit
+	CAutoLock autolock(&_lock);	// this ensures the lock is released on function exit
 	
 	KeyEvent event = { code, state };
 	_events.push(event);
@@ -39,13 +57,13 @@ void Keyboard::QueueKeyEvent(KeyCode code, KeyState state) {
 
 
 void Keyboard::QueueKeyEvent(KeyEvent &event) {
-	CNSRecursiveLock autolock(_lock);	// this ensures the lock is released on function exit
+	CAutoLock autolock(&_lock);	// this ensures the lock is released on function exit
 	
 	_events.push(event);
 }
 
 bool Keyboard::PollKeyEvent(KeyEvent *event) {
-	CNSRecursiveLock autolock(_lock);	// this ensures the lock is released on function exit, regardless of how it exits
+	CAutoLock autolock(&_lock);	// this ensures the lock is released on function exit, regardless of how it exits
 	
 	if (_events.size() > 0) {
 		*event = _events.front();
@@ -65,9 +65,11 @@ public:
 	void Load(const char *filename);
 	bool Save(const char *filename);
 	
+#if !defined(FRODO_HEADLESS)
 	void ChangeRom(NSString *filename);
 	
 	void LuaScript(NSString *filename);
+#endif
 
 	bool operator==(const Prefs &rhs) const;
 	bool operator!=(const Prefs &rhs) const;
@@ -99,11 +101,19 @@ public:
 	bool FastReset;			// Skip RAM test on reset
 	bool CIAIRQHack;		// Write to CIA ICR clears IRQ
 	bool Emul1541Proc;		// Enable processor-level 1541 emulation
+	bool FastLoad;			// Kernal LOAD receives whole files at once (without Emul1541Proc)
 	bool SIDFilters;		// Emulate SID filters
 
-	bool AdaptiveFrameSkip;
+	bool AdaptiveFrameSkip;	// Choose SkipFrames from the host time per frame (with LimitSpeed)
 	bool BordersOn;
 	bool SingleCycleEmulation;
+	bool CPUBlockCache;		// Run the 6510 from pre-decoded basic blocks
+	bool CPUJIT;			// Translate hot blocks to native code (x86-64 only)
+	bool PreciseCPUCycles;	// Extra cycles for page crossings and branches (no block cache/JIT)
+	bool TimerEvents;		// Count CIA and 1541 VIA timers lazily, only touch them on underflow lines
+	bool ExactTimerEvents;	// With TimerEvents: CIA timers count cycles, their IRQs come mid-line
+	bool SIMDRenderers;		// Expand the VIC graphics and convert them to the display format with SIMD code if the CPU has it
+	bool SkipUnchangedLines;	// Don't redraw and convert raster lines that show the same as in the last frame
 	bool SIDOn;
 	bool AutoBoot;
 	bool UseCommodoreKeyboard;			// determines whether to always show Commodore keyboard
@@ -51,7 +51,7 @@ Prefs::Prefs()
 	DriveType = DRVTYPE_DIR;
 	DrivePath[0]='\0';
 	
-	LuaScriptPath[0] = NULL;
+	LuaScriptPath[0] = '\0';
 	
 	SIDType = SIDTYPE_DIGITAL;
 	DisplayType = DISPTYPE_WINDOW;
@@ -67,9 +67,17 @@ Prefs::Prefs()
 	FastReset = false;
 	CIAIRQHack = false;
 	Emul1541Proc = false;
+	FastLoad = false;
 	AdaptiveFrameSkip = true;
 	BordersOn = false;
 	SingleCycleEmulation = false;
+	CPUBlockCache = false;
+	CPUJIT = false;
+	PreciseCPUCycles = false;
+	TimerEvents = false;
+	ExactTimerEvents = false;
+	SIMDRenderers = true;
+	SkipUnchangedLines = true;
 	SIDOn = true;
 	SIDFilters = true;
 	ShowSpeed = false;
@@ -78,6 +86,8 @@ Prefs::Prefs()
 	OptimizeForSpeedAndBattery = true;
 }
 
+#if !defined(FRODO_HEADLESS)
+
 void Prefs::ChangeRom(NSString *filename) {
 	[filename getCString:DrivePath maxLength:sizeof(DrivePath) encoding:[NSString defaultCStringEncoding]];
 	if ([filename rangeOfString:@"d64" options:NSCaseInsensitiveSearch].location == NSNotFound) {
@@ -96,6 +106,8 @@ void Prefs::LuaScript(NSString *filename) {
 
 }
 
+#endif
+
 /*
  *  Check if two Prefs structures are equal
  */
@@ -121,8 +133,17 @@ bool Prefs::operator==(const Prefs &rhs) const
 			&& FastReset == rhs.FastReset
 			&& CIAIRQHack == rhs.CIAIRQHack
 			&& Emul1541Proc == rhs.Emul1541Proc
+			&& FastLoad == rhs.FastLoad
+			&& AdaptiveFrameSkip == rhs.AdaptiveFrameSkip
 			&& SIDFilters == rhs.SIDFilters
 			&& SingleCycleEmulation == rhs.SingleCycleEmulation
+			&& CPUBlockCache == rhs.CPUBlockCache
+			&& CPUJIT == rhs.CPUJIT
+			&& PreciseCPUCycles == rhs.PreciseCPUCycles
+			&& TimerEvents == rhs.TimerEvents
+			&& ExactTimerEvents == rhs.ExactTimerEvents
+			&& SIMDRenderers == rhs.SIMDRenderers
+			&& SkipUnchangedLines == rhs.SkipUnchangedLines
 			&& SIDOn == rhs.SIDOn
 			&& ShowSpeed == rhs.ShowSpeed
 			&& AutoBoot == rhs.AutoBoot
@@ -242,10 +263,28 @@ void Prefs::Load(const char *filename)
 					CIAIRQHack = !strcmp(value, "TRUE");
 				else if (!strcmp(keyword, "Emul1541Proc"))
 					Emul1541Proc = !strcmp(value, "TRUE");
+				else if (!strcmp(keyword, "FastLoad"))
+					FastLoad = !strcmp(value, "TRUE");
+				else if (!strcmp(keyword, "AdaptiveFrameSkip"))
+					AdaptiveFrameSkip = !strcmp(value, "TRUE");
 				else if (!strcmp(keyword, "SIDFilters"))
 					SIDFilters = !strcmp(value, "TRUE");
 				else if (!strcmp(keyword, "SingleCycleEmulation"))
 					SingleCycleEmulation = !strcmp(value, "TRUE");
+				else if (!strcmp(keyword, "CPUBlockCache"))
+					CPUBlockCache = !strcmp(value, "TRUE");
+				else if (!strcmp(keyword, "CPUJIT"))
+					CPUJIT = !strcmp(value, "TRUE");
+				else if (!strcmp(keyword, "PreciseCPUCycles"))
+					PreciseCPUCycles = !strcmp(value, "TRUE");
+				else if (!strcmp(keyword, "TimerEvents"))
+					TimerEvents = !strcmp(value, "TRUE");
+				else if (!strcmp(keyword, "ExactTimerEvents"))
+					ExactTimerEvents = !strcmp(value, "TRUE");
+				else if (!strcmp(keyword, "SIMDRenderers"))
+					SIMDRenderers = !strcmp(value, "TRUE");
+				else if (!strcmp(keyword, "SkipUnchangedLines"))
+					SkipUnchangedLines = !strcmp(value, "TRUE");
 				else if (!strcmp(keyword, "SIDOn"))
 					SIDOn = !strcmp(value, "TRUE");
 				else if (!strcmp(keyword, "ShowSpeed"))
@@ -341,8 +380,17 @@ bool Prefs::Save(const char *filename)
 		fprintf(file, "FastReset = %s\n", FastReset ? "TRUE" : "FALSE");
 		fprintf(file, "CIAIRQHack = %s\n", CIAIRQHack ? "TRUE" : "FALSE");
 		fprintf(file, "Emul1541Proc = %s\n", Emul1541Proc ? "TRUE" : "FALSE");
+		fprintf(file, "FastLoad = %s\n", FastLoad ? "TRUE" : "FALSE");
+		fprintf(file, "AdaptiveFrameSkip = %s\n", AdaptiveFrameSkip ? "TRUE" : "FALSE");
 		fprintf(file, "SIDFilters = %s\n", SIDFilters ? "TRUE" : "FALSE");
 		fprintf(file, "SingleCycleEmulation = %s\n", SingleCycleEmulation ? "TRUE" : "FALSE");
+		fprintf(file, "CPUBlockCache = %s\n", CPUBlockCache ? "TRUE" : "FALSE");
+		fprintf(file, "CPUJIT = %s\n", CPUJIT ? "TRUE" : "FALSE");
+		fprintf(file, "PreciseCPUCycles = %s\n", PreciseCPUCycles ? "TRUE" : "FALSE");
+		fprintf(file, "TimerEvents = %s\n", TimerEvents ? "TRUE" : "FALSE");
+		fprintf(file, "ExactTimerEvents = %s\n", ExactTimerEvents ? "TRUE" : "FALSE");
+		fprintf(file, "SIMDRenderers = %s\n", SIMDRenderers ? "TRUE" : "FALSE");
+		fprintf(file, "SkipUnchangedLines = %s\n", SkipUnchangedLines ? "TRUE" : "FALSE");
 		fprintf(file, "SIDOn = %s\n", SIDOn ? "TRUE" : "FALSE");
 		fprintf(file, "SIDFilters = %s\n", SIDFilters ? "TRUE" : "FALSE");
 		fprintf(file, "ShowSpeed = %s\n", ShowSpeed ? "TRUE" : "FALSE");
@@ -0,0 +1,211 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  ROMArena.cpp - Read-only ROM images and lookup tables shared by C64s
+ *
+ *  The C64 keeps pointers into the arena. The BASIC and Kernal ROMs as
+ *  patched by C64::PatchKernal() are kept here too, the Kernal in all
+ *  its variants, so that the C64s share them. Only pokes and traps
+ *  write to the ROMs; the C64 copies the ROM before the first write,
+ *  see C64::UnshareBasic().
+ */
+
+#include "sysdeps.h"
+#include <sys/mman.h>
+
+#include "ROMArena.h"
+#include "C64.h"
+#include "VIC.h"
+#include "SID.h"
+
+
+// Layout of the arena, followed by RENDERER_TYPE::TablesSize() bytes of SID tables
+struct ROMImage {
+	char magic[8];				// "FrodoROM"
+	uint32 version;				// ROM_IMAGE_VERSION
+	uint32 size;				// Total size including the SID tables
+	uint8 Basic[0x2000];
+	uint8 Kernal[0x2000];
+	uint8 Char[0x1000];
+	uint8 ROM1541[0x4000];
+	uint8 PatchedBasic[0x2000];
+	uint8 PatchedKernal[NUM_KERNAL_VARIANTS][0x2000];
+	uint32 TextColorTable[16*16*16];
+};
+
+static const char ROM_IMAGE_MAGIC[8] = {'F', 'r', 'o', 'd', 'o', 'R', 'O', 'M'};
+const uint32 ROM_IMAGE_VERSION = 2;
+
+static size_t image_size(void)
+{
+	return sizeof(ROMImage) + RENDERER_TYPE::TablesSize();
+}
+
+
+/*
+ *  Apply the 1541 ROM patches, they do not depend on the preferences
+ */
+
+static void patch_1541_rom(uint8 *rom)
+{
+	rom[0x2ae4] = 0xea;		// Don't check ROM checksum
+	rom[0x2ae5] = 0xea;
+	rom[0x2ae8] = 0xea;
+	rom[0x2ae9] = 0xea;
+	rom[0x2c9b] = 0xf2;		// DOS idle loop
+	rom[0x2c9c] = 0x00;
+	rom[0x3594] = 0x20;		// Write sector
+	rom[0x3595] = 0xf2;
+	rom[0x3596] = 0xf5;
+	rom[0x3597] = 0xf2;
+	rom[0x3598] = 0x01;
+	rom[0x3b0c] = 0xf2;		// Format track
+	rom[0x3b0d] = 0x02;
+}
+
+
+/*
+ *  Build a new arena in anonymous memory
+ */
+
+ROMArena *ROMArena::Create(const uint8 *basic, const uint8 *kernal, const uint8 *chr, const uint8 *rom1541)
+{
+	size_t size = image_size();
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	ROMImage *image = (ROMImage *)p;
+	memcpy(image->magic, ROM_IMAGE_MAGIC, sizeof(image->magic));
+	image->version = ROM_IMAGE_VERSION;
+	image->size = size;
+	memcpy(image->Basic, basic, sizeof(image->Basic));
+	memcpy(image->Kernal, kernal, sizeof(image->Kernal));
+	memcpy(image->Char, chr, sizeof(image->Char));
+	memcpy(image->ROM1541, rom1541, sizeof(image->ROM1541));
+	patch_1541_rom(image->ROM1541);
+	memcpy(image->PatchedBasic, basic, sizeof(image->PatchedBasic));
+	C64::PatchBasicROM(image->PatchedBasic);
+	for (int i=0; i<NUM_KERNAL_VARIANTS; i++) {
+		memcpy(image->PatchedKernal[i], kernal, sizeof(image->PatchedKernal[i]));
+		C64::PatchKernalROM(image->PatchedKernal[i], kernal, i);
+	}
+
+	MOS6569::InitTextColorTable(image->TextColorTable);
+	RENDERER_TYPE::InitTables(image + 1);
+
+	// From now on, a write to the arena is a bug
+	mprotect(p, size, PROT_READ);
+	return new ROMArena((uint8 *)p, size);
+}
+
+
+/*
+ *  Map an arena saved with Save()
+ */
+
+ROMArena *ROMArena::Map(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	size_t size = image_size();
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size != size) {
+		close(fd);
+		return NULL;
+	}
+
+	void *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	ROMImage *image = (ROMImage *)p;
+	if (memcmp(image->magic, ROM_IMAGE_MAGIC, sizeof(image->magic)) || image->version != ROM_IMAGE_VERSION || image->size != size) {
+		munmap(p, size);
+		return NULL;
+	}
+	return new ROMArena((uint8 *)p, size);
+}
+
+
+/*
+ *  Write the arena to a file, via a temporary file so that processes
+ *  mapping the old file are not disturbed
+ */
+
+bool ROMArena::Save(const char *path)
+{
+	char tmp_path[1024];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+
+	FILE *f = fopen(tmp_path, "wb");
+	if (f == NULL)
+		return false;
+	bool ok = fwrite(base, 1, size, f) == size;
+	ok = (fclose(f) == 0) && ok;
+
+	if (ok && rename(tmp_path, path) == 0)
+		return true;
+	unlink(tmp_path);
+	return false;
+}
+
+
+/*
+ *  Constructor/destructor, only via Create()/Map() and Release()
+ */
+
+ROMArena::ROMArena(uint8 *base, size_t size) : base(base), size(size), ref_count(1)
+{
+	ROMImage *image = (ROMImage *)base;
+	Basic = image->Basic;
+	Kernal = image->Kernal;
+	Char = image->Char;
+	ROM1541 = image->ROM1541;
+	PatchedBasic = image->PatchedBasic;
+	for (int i=0; i<NUM_KERNAL_VARIANTS; i++)
+		PatchedKernal[i] = image->PatchedKernal[i];
+	TextColorTable = image->TextColorTable;
+	SIDTables = image + 1;
+}
+
+ROMArena::~ROMArena()
+{
+	munmap(base, size);
+}
+
+
+/*
+ *  Reference counting, the creator holds the first reference
+ */
+
+void ROMArena::Retain(void)
+{
+	__sync_add_and_fetch(&ref_count, 1);
+}
+
+void ROMArena::Release(void)
+{
+	if (__sync_sub_and_fetch(&ref_count, 1) == 0)
+		delete this;
+}
@@ -0,0 +1,68 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  ROMArena.h - Read-only ROM images and lookup tables shared by C64s
+ */
+
+#ifndef _ROMARENA_H
+#define _ROMARENA_H
+
+#include "sysdeps.h"
+
+// Variants of the patched Kernal in the arena, see C64::PatchKernalROM()
+enum {
+	KERNAL_FAST_RESET = 1,		// Skip the RAM test
+	KERNAL_EMUL_1541_PROC = 2,	// IEC routines not replaced (processor-level 1541)
+	KERNAL_FAST_LOAD = 4,		// LOAD byte loop replaced (without KERNAL_EMUL_1541_PROC)
+	KERNAL_AUTO_BOOT = 8,		// Standard boot sequence instead of the startup routine
+	NUM_KERNAL_VARIANTS = 16
+};
+
+// One immutable, reference counted block holding the ROMs and the
+// tables the chips would otherwise build per instance. The block is
+// write-protected once built. It can be saved to a file and mapped
+// back, so several processes share the same physical pages.
+class ROMArena {
+public:
+	// Copy the ROM images, apply the 1541 ROM patches and build the tables
+	static ROMArena *Create(const uint8 *basic, const uint8 *kernal, const uint8 *chr, const uint8 *rom1541);
+	// Map an image written by Save(); NULL if missing or not from this build
+	static ROMArena *Map(const char *path);
+	bool Save(const char *path);
+
+	void Retain(void);
+	void Release(void);			// Deletes the arena when the last reference is gone
+
+	const uint8 *Basic, *Kernal, *Char, *ROM1541;	// As loaded (1541 ROM patched)
+	const uint8 *PatchedBasic;		// See C64::PatchBasicROM()
+	const uint8 *PatchedKernal[NUM_KERNAL_VARIANTS];	// See C64::PatchKernalROM()
+	const uint32 *TextColorTable;	// See MOS6569::InitTextColorTable()
+	const void *SIDTables;			// See RENDERER_TYPE::InitTables()
+
+private:
+	ROMArena(uint8 *base, size_t size);
+	~ROMArena();
+
+	uint8 *base;				// Start of the mapping
+	size_t size;
+	int ref_count;
+};
+
+#endif
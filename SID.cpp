@@ -40,6 +40,7 @@
 
 #include "Display.h"
 #include "VIC.h"
+#include "ROMArena.h"
 
 #ifdef USE_FIXPOINT_MATHS
 #include "FixPoint.i"
@@ -56,7 +57,7 @@ MOS6581::MOS6581(C64 *c64) : the_c64(c64)
 		regs[i] = 0;
 
 	// Open the renderer
-	open_close_renderer(SIDTYPE_NONE, ThePrefs.SIDType);
+	open_close_renderer(SIDTYPE_NONE, the_c64->prefs.SIDType);
 }
 
 
@@ -67,7 +68,7 @@ MOS6581::MOS6581(C64 *c64) : the_c64(c64)
 MOS6581::~MOS6581()
 {
 	// Close the renderer
-	open_close_renderer(ThePrefs.SIDType, SIDTYPE_NONE);
+	open_close_renderer(the_c64->prefs.SIDType, SIDTYPE_NONE);
 }
 
 
@@ -95,7 +96,7 @@ void MOS6581::NewPrefs(Prefs *prefs)
 {
 	assert(the_renderer != NULL);
 	
-	open_close_renderer(ThePrefs.SIDType, prefs->SIDType);
+	open_close_renderer(the_c64->prefs.SIDType, prefs->SIDType);
 	the_renderer->NewPrefs(prefs);
 }
 
@@ -205,11 +206,11 @@ void MOS6581::SetState(MOS6581State *ss)
 			the_renderer->WriteRegister(i, regs[i]);
 }
 
-//#import "DigitalRenderer.h"
+//#include "DigitalRenderer.h"
 #ifdef USE_FASTSID
-#import "FastDigitalRenderer.h"
+#include "FastDigitalRenderer.h"
 #else
-#import "DigitalRenderer.h"
+#include "DigitalRenderer.h"
 #endif
 
 
@@ -227,7 +228,7 @@ void MOS6581::open_close_renderer(int old_type, int new_type)
 
 	// Create new renderer
 	if (new_type == SIDTYPE_DIGITAL)
-		the_renderer = new RENDERER_TYPE();
+		the_renderer = new RENDERER_TYPE(&the_c64->prefs, the_c64->ROMs->SIDTables);
 	else
 		the_renderer = NULL;
 
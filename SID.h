@@ -27,14 +27,15 @@
 #define _SID_H
 
 #include <stdlib.h>
+#include "C64.h"
 
 #define USE_FASTSID
 
 #ifdef USE_FASTSID
-#import "FastDigitalRenderer.h"
+#include "FastDigitalRenderer.h"
 #define RENDERER_TYPE		FastDigitalRenderer
 #else
-#import "DigitalRenderer.h"
+#include "DigitalRenderer.h"
 #define RENDERER_TYPE		DigitalRenderer
 #endif
 
@@ -147,7 +148,7 @@ inline uint8 MOS6581::ReadRegister(uint16 adr)
 	// Voice 3 oscillator/EG readout
 	if (adr == 0x1b || adr == 0x1c) {
 		last_sid_byte = 0;
-		return rand();
+		return the_c64->Random();
 	}
 
 	// Write-only register: Return last value written to SID
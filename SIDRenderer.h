@@ -17,11 +17,16 @@
  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#import "frodo_types.h"
-#import "sysdeps.h"
+#ifndef _SID_RENDERER_H
+#define _SID_RENDERER_H
+
+#include "frodo_types.h"
+#include "sysdeps.h"
 
 #define	AD_AUDIO_UNIT			1
 #define AD_AUDIO_QUEUE			2
 #define	AD_OPENAL				3
 
 #define AUDIO_DRIVER			AD_AUDIO_QUEUE
+
+#endif
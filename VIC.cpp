@@ -40,9 +40,32 @@
  *    to a bitplane representation (two bit masks) for easier
  *    handling of priorities and collisions.
  *  - The sprite-sprite priority handling and collision
- *    detection is done in with the byte array spr_coll_buf[],
- *    that is used to keep track of which sprites are already
- *    visible at certain X positions.
+ *    detection is done with bit sets of the whole line (64
+ *    pixels per word): each sprite line is expanded to 64 bit
+ *    masks once, the pixels already covered by sprites with
+ *    lower numbers are masked out with word-wide ANDs, and
+ *    only the pixels that are left are written. A sprite
+ *    collided if another sprite covers one of its pixels.
+ *  - With Prefs::SIMDRenderers, the graphics of the display and idle
+ *    states are expanded 16 pixels (two characters) at a time with
+ *    SSE2 or NEON compares and selects, and stored directly at the
+ *    unaligned x_scroll position. They must produce exactly the pixels
+ *    of the scalar el_* functions (see CheckLineRenderers()).
+ *  - With Prefs::SkipUnchangedLines, every drawn line is described by
+ *    the bytes it is made of: mode, scroll and colors, the latched
+ *    matrix/color line, the graphics bytes and the data of the active
+ *    sprites (see line_changed()). If a row of the bitmap was last drawn
+ *    from the same description, it is not drawn again and only its
+ *    sprite collisions are reported. The rows that were drawn are passed
+ *    on to C64Display, which only converts these.
+ *  - The single cycle emulation (SINGLE_CYCLE) runs every raster
+ *    line from one of four cycle programs (sc_program[], built by
+ *    init_sc_program()), one for each combination of Bad Line and
+ *    drawn/not drawn line. Each cycle holds what the VIC does in it
+ *    and what a Bad Line adds. Since the line type is part of 'cycle',
+ *    a $d011 write in the middle of a line continues in the program of
+ *    the new type. Sprite DMA and the border are still checked when
+ *    the cycle runs.
  *
  * Incompatibilities:
  * ------------------
@@ -70,6 +93,15 @@
 #include "SID.h"
 #include "CIA.h"
 #include "CPU1541.h"
+#include "ROMArena.h"
+
+#if VIC_SIMD
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#else
+#include <arm_neon.h>
+#endif
+#endif
 
 
 // First and last displayed line
@@ -171,14 +203,13 @@ uint16 MultiExpTable[256] = {
 0xFFA0, 0xFFA5, 0xFFAA, 0xFFAF, 0xFFF0, 0xFFF5, 0xFFFA, 0xFFFF
 };
 
-uint32 TextColorTable[16*16*16];
 /*
- *  Constructor: Initialize variables
+ *  Build the text color table (shared by all VICs, see ROMArena)
  */
 
-static void init_text_color_table()
+void MOS6569::InitTextColorTable(uint32 *table)
 {
-	uint8* tct = (uint8*)&TextColorTable;
+	uint8* tct = (uint8*)table;
 	
 	for (int i=0; i<16; i++) // Backcolor
 		for(int j=0; j<16; j++) // Forecolor
@@ -190,6 +221,27 @@ static void init_text_color_table()
 			}
 }
 
+
+/*
+ *  Check if the CPU has the instructions the SIMD line renderers use
+ */
+
+static bool simd_supported(void)
+{
+#if VIC_SIMD && defined(__SSE2__) && defined(__GNUC__)
+	return __builtin_cpu_supports("sse2");
+#elif VIC_SIMD
+	return true;	// NEON code is only in the armv7 slice of the binary
+#else
+	return false;
+#endif
+}
+
+
+/*
+ *  Constructor: Initialize variables
+ */
+
 MOS6569::MOS6569(C64 *c64, C64Display *disp, MOS6510 *CPU, uint8 *RAM, uint8 *Char, uint8 *Color)
 : ram(RAM), char_rom(Char), color_ram(Color), the_c64(c64), the_display(disp), the_cpu(CPU)
 {
@@ -231,6 +283,9 @@ MOS6569::MOS6569(C64 *c64, C64Display *disp, MOS6510 *CPU, uint8 *RAM, uint8 *Ch
 	ml_index = 0;
 	cycle = 1;
 	BALow = false;
+#if SINGLE_CYCLE
+	init_sc_program();
+#endif
 	
 	display_idx = 0;
 	display_state = false;
@@ -253,14 +308,25 @@ MOS6569::MOS6569(C64 *c64, C64Display *disp, MOS6510 *CPU, uint8 *RAM, uint8 *Ch
 	memset(fore_mask_buf, 0, sizeof(fore_mask_buf));
 	
 	// Preset colors to black
-	init_text_color_table();
+	TextColorTable = c64->ROMs->TextColorTable;
 	ec_color = b0c_color = b1c_color = b2c_color = b3c_color = mm0_color = mm1_color = 0;
 	ec_color_long = (ec << 24L) | (ec << 16L) | (ec << 8) | ec;
 	for (i=0; i<8; i++) 
 		spr_color[i] = 0;
 	
 	// SGC: Optimizations
-	prefs_border_on = ThePrefs.BordersOn;
+	prefs_border_on = the_c64->prefs.BordersOn;
+	simd_lines = the_c64->prefs.SIMDRenderers && simd_supported();
+
+	// No row of the bitmap is known yet
+	skip_unchanged = the_c64->prefs.SkipUnchangedLines;
+	disp_row = 0;
+	bitmap_start = chunky_line_start;
+	bitmap_xmod = xmod;
+	forget_lines();
+	memset(dirty_lines, 0, sizeof(dirty_lines));
+	memset(last_dirty, 0, sizeof(last_dirty));
+	dirty_count = last_dirty_count = 0;
 }
 
 
@@ -276,6 +342,12 @@ void MOS6569::make_mc_table(void)
 
 void MOS6569::NewPrefs(Prefs *newPrefs) {
 	prefs_border_on = newPrefs->BordersOn;
+	simd_lines = newPrefs->SIMDRenderers && simd_supported();
+
+	// The descriptions are not kept up to date while this is off
+	if (newPrefs->SkipUnchangedLines != skip_unchanged)
+		forget_lines();
+	skip_unchanged = newPrefs->SkipUnchangedLines;
 }
 /*
  *  Switch from standard emulation to single cycle emulation
@@ -337,6 +409,9 @@ void MOS6569::SwitchToStandard(void)
 	matrix_base = get_physical((vbase & 0xf0) << 6);
 	char_base = get_physical((vbase & 0x0e) << 10);
 	bitmap_base = get_physical((vbase & 0x08) << 10);
+
+	// The single cycle emulation drew over the rows
+	forget_lines();
 }
 
 
@@ -400,7 +475,7 @@ void MOS6569::GetState(MOS6569State *vd)
 	vd->vc_base = vc_base;
 	vd->rc = rc;
 	
-	if(ThePrefs.SingleCycleEmulation)
+	if(the_c64->prefs.SingleCycleEmulation)
 	{
 		vd->spr_dma = spr_dma_on;
 		vd->spr_disp = spr_disp_on;
@@ -473,7 +548,7 @@ void MOS6569::SetState(MOS6569State *vd)
 	border_40_col = ctrl2 & 8;
 	display_idx = ((ctrl1 & 0x60) | (ctrl2 & 0x10)) >> 4;
 	
-	if(ThePrefs.SingleCycleEmulation)
+	if(the_c64->prefs.SingleCycleEmulation)
 		raster_y = vd->raster_y;
 	else
 		raster_y = vd->raster_y | ((vd->ctrl1 & 0x80) << 1);
@@ -864,7 +939,7 @@ void MOS6569::ChangedVA(uint16 new_va)
 {
 	cia_vabase = new_va << 14;
 #if SINGLE_CYCLE
-	if(ThePrefs.SingleCycleEmulation)
+	if(the_c64->prefs.SingleCycleEmulation)
 		WriteRegisterSC(0x18, vbase); // Force update of memory pointers
 	else
 #endif
@@ -882,7 +957,7 @@ void MOS6569::TriggerLightpen(void)
 	{	// Lightpen triggers only once per frame
 		lp_triggered = true;
 		
-		if(ThePrefs.SingleCycleEmulation)
+		if(the_c64->prefs.SingleCycleEmulation)
 		{
 			if((cycle & 0x3f) > 13)
 				raster_x = 0xfffc + 8 * ((cycle & 0x3f) - 13);
@@ -996,7 +1071,7 @@ uint32 MOS6569::graphics_access_ds()
  */
 void MOS6569::draw_graphics(uint32 gfxcharcolor)
 {
-	uint32 *tct = 0;
+	const uint32 *tct = 0;
 	uint8 gfx_data, char_data, color_data;
 	uint8 *p;
 	uint16 *wp;
@@ -1478,7 +1553,7 @@ void MOS6569::draw_sprites(void)
 		}
 	}
 	
-	if (ThePrefs.SpriteCollisions) {
+	if (the_c64->prefs.SpriteCollisions) {
 		
 		// Check sprite-sprite collisions
 		if (clx_spr)
@@ -1509,7 +1584,116 @@ void MOS6569::draw_sprites(void)
 
 
 /*
- *  Emulate one clock cycle, returns true if new raster line has started
+ *  Cycle programs of the single cycle emulation
+ */
+
+// What the VIC does in a cycle (SCCycle::op). The sprite slots have
+// one code per sprite, so that every sprite gets branches of its own.
+enum {
+	SC_IDLE,			// Refresh, idle sprite slots
+	SC_SPR_PTR,			// Sprite pointer (and first data byte) of sprite op-SC_SPR_PTR...
+	SC_BA_KEEP = SC_SPR_PTR + 8,	// ...reset BA unless it or the next sprite has DMA
+	SC_SPR_DATA = SC_BA_KEEP + 8,	// Second and third data byte of sprite op-SC_SPR_DATA...
+	SC_BA_SET = SC_SPR_DATA + 8,	// ...set BA if the sprite two slots ahead has DMA
+	SC_BA_HIGH = SC_BA_SET + 8,		// Cycle 11: reset BA
+	SC_NEW_LINE,		// Cycle 1: raster counter, raster IRQ, line type, sprite pointer 3
+	SC_LINE_SETUP,		// Cycle 2: VBlank, output pointers, sprite data 3
+	SC_RC_RESET,		// Cycle 14: RC=0 on Bad Lines...
+	SC_VC_BASE,			// ...VCBASE->VCCOUNT
+	SC_ML_RESET,		// Cycle 15: start of the matrix line...
+	SC_EXP_Y_2,			// ...mc_base += 2 if the y expansion flipflop is set
+	SC_FETCH_EXP_Y,		// Cycle 16: first graphics access, mc_base += 1, sprite DMA off
+	SC_COUNT_EXP_Y,		// The same if the line is not drawn
+	SC_DRAW_START,		// Cycle 17: borders, display window starts here
+	SC_COUNT_START,
+	SC_DRAW_38_START,	// Cycle 18: side border in 38 column mode
+	SC_COUNT_38_START,
+	SC_DRAW,			// Cycles 19..54: graphics and matrix access
+	SC_COUNT,
+	SC_DRAW_LAST,		// Cycle 55: last graphics access, sprite y expansion and DMA
+	SC_COUNT_LAST,
+	SC_DRAW_END,		// Cycle 56: side border, sprite DMA, display window ends here
+	SC_DISPLAY_END,
+	SC_DRAW_SPRITES,	// Cycle 57: paint sprites...
+	SC_SPRITES_END,		// ...side border in 40 column mode, sprite display off
+	SC_ROW_END,			// Cycle 58: sprite display on, RC/VCBASE, sprite pointer 0
+	SC_ROW_END_BAD,
+	SC_NEXT_ROW,		// Cycle 60: next row of the bitmap, sprite pointer 1
+	SC_LINE_END			// Cycle 63: upper/lower border, SID, sprite data 2
+};
+
+// What a Bad Line adds to a cycle (SCCycle::flags), done after the op
+enum {
+	SCF_DISPLAY = 1,	// Display state
+	SCF_BA_LOW = 2,		// Set BA
+	SCF_MATRIX = 4		// Video matrix access
+};
+
+// Line types, bits of cycle
+const int SC_BAD_LINE = 0x080;
+const int SC_NOT_DRAWN = 0x100;
+
+
+/*
+ *  Build the programs of the four line types
+ */
+
+void MOS6569::init_sc_program(void)
+{
+	memset(sc_program, 0, sizeof(sc_program));	// SC_IDLE
+	for (int type=0; type<0x200; type+=0x80) {
+		SCCycle *p = sc_program + type;
+		bool bad = type & SC_BAD_LINE;
+		bool drawn = !(type & SC_NOT_DRAWN);
+
+		// Sprite pointer and data accesses of sprites 1..7 (sprite 0 is
+		// fetched in cycle 58), lines that are not drawn skip those of
+		// sprites 4..7. Cycles 1, 2, 60 and 63 are replaced below.
+		for (int i=1; i<8; i++) {
+			SCCycle *ptr = &p[i < 3 ? 58 + 2*i : 2*i - 5];
+			if (drawn || i < 4) {
+				ptr[0].op = SC_SPR_PTR + i;
+				ptr[1].op = SC_SPR_DATA + i;
+			} else {
+				ptr[0].op = SC_BA_KEEP + i;
+				ptr[1].op = SC_BA_SET + i;
+			}
+		}
+		p[59].op = SC_SPR_DATA + 0;
+
+		p[1].op = SC_NEW_LINE;
+		p[2].op = SC_LINE_SETUP;
+		p[11].op = SC_BA_HIGH;
+		p[14].op = bad ? SC_RC_RESET : SC_VC_BASE;
+		p[15].op = bad && !drawn ? SC_EXP_Y_2 : SC_ML_RESET;
+		p[16].op = drawn ? SC_FETCH_EXP_Y : SC_COUNT_EXP_Y;
+		p[17].op = drawn ? SC_DRAW_START : SC_COUNT_START;
+		p[18].op = drawn ? SC_DRAW_38_START : SC_COUNT_38_START;
+		for (int c=19; c<=54; c++)
+			p[c].op = drawn ? SC_DRAW : SC_COUNT;
+		p[55].op = drawn ? SC_DRAW_LAST : SC_COUNT_LAST;
+		p[56].op = drawn ? SC_DRAW_END : SC_DISPLAY_END;
+		p[57].op = drawn ? SC_DRAW_SPRITES : SC_SPRITES_END;
+		p[58].op = bad ? SC_ROW_END_BAD : SC_ROW_END;
+		if (drawn)
+			p[60].op = SC_NEXT_ROW;
+		p[63].op = SC_LINE_END;
+
+		if (bad) {
+			for (int c=2; c<=63; c++)
+				p[c].flags |= SCF_DISPLAY;
+			for (int c=12; c<=54; c++)
+				p[c].flags |= SCF_BA_LOW;
+			if (drawn)
+				for (int c=15; c<=54; c++)
+					p[c].flags |= SCF_MATRIX;
+		}
+	}
+}
+
+
+/*
+ *  Emulate one raster line cycle by cycle
  */
 
 // Set BA low
@@ -1543,7 +1727,7 @@ mc[num]++; \
 // Fetch sprite data, increment data counter
 void MOS6569::SprDataAccess23(uint8 spr_dma_on, uint8 num)
 {
-	if (spr_dma_on & (1 << num)) 
+	if (spr_dma_on & (1 << num))
 	{
 		spr_data[num][1] = read_byte(mc[num] & 0x3f | spr_ptr[num]);
 		mc[num]++;
@@ -1554,6 +1738,50 @@ void MOS6569::SprDataAccess23(uint8 spr_dma_on, uint8 num)
 #define SprDataAccess(num) \
 if (spr_dma_on) SprDataAccess23(spr_dma_on, num);
 
+// Sprite pointer and data accesses of sprite num and the BA of the
+// sprites ahead. BA is set two slots before the first access of a
+// sprite and reset after the last one.
+#define SprCases(num) \
+case SC_SPR_PTR + num: \
+SprPtrAccess(num); \
+case SC_BA_KEEP + num: \
+if (!(spr_dma_on & ((3 << num) & 0xff))) \
+BALow = false; \
+break; \
+case SC_SPR_DATA + num: \
+SprDataAccess(num); \
+case SC_BA_SET + num: \
+if (spr_dma_on & ((1 << (num + 2)) & 0xff)) { \
+SetBALow; \
+} \
+break;
+
+// Draw 8 pixels of graphics or upper/lower border
+#define DrawGraphics \
+if (ud_border_on) \
+draw_border(chunky_ptr, ec_color_long) \
+else \
+draw_graphics(gfxcharcolor); \
+chunky_ptr += 8; \
+fore_mask_ptr++;
+
+// The same where the side border may start or end
+#define DrawGraphicsSide \
+if (ud_border_on) \
+draw_border(chunky_ptr, ec_color_long) \
+else { \
+draw_graphics(gfxcharcolor); \
+if (border_on) \
+draw_border(chunky_ptr, ec_color_long) \
+} \
+chunky_ptr += 8; \
+fore_mask_ptr++;
+
+// Count the graphics access of a line that is not drawn
+#define CountGraphics \
+if (display_state) \
+vc++;
+
 
 void MOS6569::EmulateLineSC(void)
 {
@@ -1563,52 +1791,71 @@ void MOS6569::EmulateLineSC(void)
 	int i;
 	uint8 mask;
 	uint32 gfxcharcolor = 0;
-	
+
 	// Use local vars for some members -> smaller and faster code
 	spr_dma_on = this->spr_dma_on;
 	BALow = this->BALow;
 	display_state = this->display_state;
-	
+
+	// The chips that run along with every cycle
+	MOS6526_1 *cia1 = the_c64->TheCIA1;
+	MOS6526_2 *cia2 = the_c64->TheCIA2;
+	MOS6510 *cpu = the_c64->TheCPU;
+	MOS6502_1541 *cpu1541 = the_c64->TheCPU1541;
+	bool emul_1541 = the_c64->prefs.Emul1541Proc;
+
 	while(cycle & 0x3f)
 	{
-		switch (cycle) {
-				
-				//-----------------------------------------------------------
-				//-----------------------------------------------------------
-				// Cycles if bad line is false and draw_this_line is true
-				//-----------------------------------------------------------
-				//-----------------------------------------------------------
+		// The program of the line type, which a write to $d011 may
+		// change in the middle of the line
+		const SCCycle *c = &sc_program[cycle & 0x1ff];
+
+		switch (c->op) {
+			case SC_IDLE:
+				break;
+
+			SprCases(0)
+			SprCases(1)
+			SprCases(2)
+			SprCases(3)
+			SprCases(4)
+			SprCases(5)
+			SprCases(6)
+			SprCases(7)
+
+				// Refresh, reset BA
+			case SC_BA_HIGH:
+				BALow = false;
+				break;
+
 				// Fetch sprite pointer 3, increment raster counter, trigger raster IRQ,
 				// test for Bad Line, reset BA if sprites 3 and 4 off, read data of sprite 3
-			case 1:
-			case 128+1:
-			case 256+1:
-			case 256+128+1:
+			case SC_NEW_LINE:
 				if (raster_y == TOTAL_RASTERS-1)
-					
+
 					// Trigger VBlank in cycle 2
 					vblanking = true;
-				
+
 				else {
-					
+
 					// Increment raster counter
 					raster_y++;
-					
+
 					// Trigger raster IRQ if IRQ line reached
 					if (raster_y == irq_raster)
 						raster_irq();
-					
+
 					// In line $30, the DEN bit controls if Bad Lines can occur
 					if (raster_y == 0x30)
 						bad_lines_enabled = ctrl1 & 0x10;
-					
+
 					// Bad Line condition?
 					is_bad_line = (raster_y >= FIRST_DMA_LINE && raster_y <= LAST_DMA_LINE && ((raster_y & 7) == y_scroll) && bad_lines_enabled);
 					if(is_bad_line)
 						cycle = cycle | 0x080;
 					else
 						cycle = cycle & 0xf7f;
-					
+
 					// Don't draw all lines, hide some at the top and bottom
 					draw_this_line = (raster_y >= FIRST_DISP_LINE && raster_y <= LAST_DISP_LINE && !frame_skipped);
 					if(draw_this_line)
@@ -1616,141 +1863,98 @@ void MOS6569::EmulateLineSC(void)
 					else
 						cycle = cycle | 0x100;
 				}
-				
+
 				SprPtrAccess(3);
 				if (is_bad_line)
 					display_state = true;
 				if (!(spr_dma_on & 0x18))
 					BALow = false;
 				break;
-				
+
 				// Set BA for sprite 5, read data of sprite 3
-			case 2:
-			case 128+2:
-			case 256+2:
-			case 256+128+2:
+			case SC_LINE_SETUP:
 				if (vblanking) {
-					
+
 					// Vertical blank, reset counters
 					raster_y = vc_base = 0;
 					lp_triggered = vblanking = false;
-					
+
 					this->spr_dma_on = spr_dma_on;
 					this->BALow = BALow;
 					this->display_state = display_state;
-					
-					skip_counter--;
-					frame_skipped = skip_counter == 0;
+
+					// The single cycle emulation doesn't keep track of
+					// the rows it draws
+					the_display->LinesChanged(NULL);
 					if (!frame_skipped)
-						skip_counter = ThePrefs.SkipFrames;
-					
+						last_dirty_count = DISPLAY_Y;
+
+					frame_skipped = --skip_counter;
 					the_c64->VBlank(!frame_skipped);
-					
+					if (!frame_skipped)
+						skip_counter = the_c64->SkipFrames();
+					emul_1541 = the_c64->prefs.Emul1541Proc;
+
 					spr_dma_on = this->spr_dma_on;
 					BALow = this->BALow;
 					display_state = this->display_state;
-					
+
 					// Get bitmap pointer for next frame. This must be done
 					// after calling the_c64->VBlank() because the preferences
 					// and screen configuration may have been changed there
 					chunky_line_start = the_display->BitmapBase();
 					xmod = the_display->BitmapXMod();
-					
+
 					// Trigger raster IRQ if IRQ in line 0
 					if (irq_raster == 0)
 						raster_irq();
 				}
-				
+
 				// Our output goes here
 				chunky_ptr = chunky_line_start;
-				
+
 				// Clear foreground mask
 				memset(fore_mask_buf, 0, sizeof(fore_mask_buf));
 				fore_mask_ptr = fore_mask_buf + 4;
-				
+
 				SprDataAccess(3);
-				if (is_bad_line)
-					display_state = true;
-				if (spr_dma_on & 0x20)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 4, reset BA is sprite 4 and 5 off
-			case 3:
-				SprPtrAccess(4);
-				if (!(spr_dma_on & 0x30))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 6, read data of sprite 4 
-			case 4:
-				SprDataAccess(4);
-				if (spr_dma_on & 0x40)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 5, reset BA if sprite 5 and 6 off
-			case 5:
-				SprPtrAccess(5);
-				if (!(spr_dma_on & 0x60))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 7, read data of sprite 5
-			case 6:
-				SprDataAccess(5);
-				if (spr_dma_on & 0x80)
+				if (spr_dma_on & 0x20) {
 					SetBALow;
+				}
 				break;
-				
-				// Fetch sprite pointer 6, reset BA if sprite 6 and 7 off
-			case 7:
-				SprPtrAccess(6);
-				if (!(spr_dma_on & 0xc0))
-					BALow = false;
-				break;
-				
-				// Read data of sprite 6
-			case 8:
-				SprDataAccess(6);
-				break;
-				
-				// Fetch sprite pointer 7, reset BA if sprite 7 off
-			case 9:
-				SprPtrAccess(7);
-				if (!(spr_dma_on & 0x80))
-					BALow = false;
-				break;
-				
-				// Read data of sprite 7
-			case 10:
-				SprDataAccess(7);
-				break;
-				
-				// Refresh, reset BA
-			case 11:
-				BALow = false;
-				break;
-				
+
 				// Refresh, VCBASE->VCCOUNT, turn on matrix access and reset RC if Bad Line
-			case 14:
+			case SC_RC_RESET:
+				rc = 0;
+
+				// Falls through
+
+			case SC_VC_BASE:
 				vc = vc_base;
 				break;
-				
+
 				// Refresh and matrix access, increment mc_base by 2 if y expansion flipflop is set
-			case 15:
+			case SC_ML_RESET:
+				ml_index = 0;
+
+				// Falls through
+
+			case SC_EXP_Y_2:
 				for (i=0; i<8; i++)
 					if (spr_exp_y & (1 << i))
 						mc_base[i] += 2;
-				
-				ml_index = 0;
 				break;
-				
+
 				// Graphics and matrix access, increment mc_base by 1 if y expansion flipflop is set
 				// and check if sprite DMA can be turned off
-			case 16:
-				gfxcharcolor = graphics_access(display_state);
-				
+			case SC_FETCH_EXP_Y:
+			case SC_COUNT_EXP_Y:
+				if (c->op == SC_FETCH_EXP_Y) {
+					gfxcharcolor = graphics_access(display_state);
+				} else {
+					CountGraphics;
+				}
+
 				mask = 1;
 				for (i=0; i<8; i++, mask<<=1) {
 					if (spr_exp_y & mask)
@@ -1759,120 +1963,117 @@ void MOS6569::EmulateLineSC(void)
 						spr_dma_on &= ~mask;
 				}
 				break;
-				
+
 				// Graphics and matrix access, turn off border in 40 column mode, display window starts here
-			case 17:
+			case SC_DRAW_START:
+			case SC_COUNT_START:
 				if (raster_y == dy_stop)
 					ud_border_on = true;
 				else if(ctrl1 & 0x10 && raster_y == dy_start)
 					ud_border_on = false;
-				
-				if (ctrl2 & 8 && !ud_border_on) 
+
+				if (ctrl2 & 8 && !ud_border_on)
 					border_on = false;
-				
-				if (ud_border_on)
-					draw_border(chunky_ptr, ec_color_long)
-				else
-				{
-					draw_graphics(gfxcharcolor);
-					if (border_on)
-						draw_border(chunky_ptr, ec_color_long)
+
+				if (c->op == SC_DRAW_START) {
+					DrawGraphicsSide;
+					gfxcharcolor = graphics_access(display_state);
+				} else {
+					CountGraphics;
 				}
-				chunky_ptr += 8;
-				fore_mask_ptr++;
-				gfxcharcolor = graphics_access(display_state);
 				break;
-				
+
 				// Turn off border in 38 column mode
-			case 18:
+			case SC_DRAW_38_START:
 				if (!(ctrl2 & 8) && !ud_border_on)
 					border_on = false;
-				
+
 				// Falls through
-				
+
 				// Graphics and matrix access
-			case 19: case 20: case 21: case 22: case 23: case 24:
-			case 25: case 26: case 27: case 28: case 29: case 30:
-			case 31: case 32: case 33: case 34: case 35: case 36:
-			case 37: case 38: case 39: case 40: case 41: case 42:
-			case 43: case 44: case 45: case 46: case 47: case 48:
-			case 49: case 50: case 51: case 52: case 53: case 54:	// Gnagna...
-				if (ud_border_on)
-					draw_border(chunky_ptr, ec_color_long)
-				else
-					draw_graphics(gfxcharcolor);
-				chunky_ptr += 8;
-				fore_mask_ptr++;
+			case SC_DRAW:
+				DrawGraphics;
 				gfxcharcolor = graphics_access(display_state);
 				break;
-				
+
+			case SC_COUNT_38_START:
+				if (!(ctrl2 & 8) && !ud_border_on)
+					border_on = false;
+
+				// Falls through
+
+			case SC_COUNT:
+				CountGraphics;
+				break;
+
 				// Last graphics access, turn off matrix access, turn on sprite DMA if Y coordinate is
 				// right and sprite is enabled, handle sprite y expansion, set BA for sprite 0
-			case 55:
-				if (ud_border_on)
-					draw_border(chunky_ptr, ec_color_long)
-				else
-					draw_graphics(gfxcharcolor);
-				chunky_ptr += 8;
-				fore_mask_ptr++;
-				gfxcharcolor = graphics_access(display_state);
-				
+			case SC_DRAW_LAST:
+			case SC_COUNT_LAST:
+				if (c->op == SC_DRAW_LAST) {
+					DrawGraphics;
+					gfxcharcolor = graphics_access(display_state);
+				} else {
+					CountGraphics;
+				}
+
 				// Invert y expansion flipflop if bit in MYE is set
 				mask = 1;
 				for (i=0; i<8; i++, mask<<=1)
 					if (mye & mask)
 						spr_exp_y ^= mask;
 				CheckSpriteDMA;
-				
+
 				if (spr_dma_on & 0x01) {	// Don't remove these braces!
 					SetBALow;
 				} else
 					BALow = false;
 				break;
-				
+
 				// Turn on border in 38 column mode, turn on sprite DMA if Y coordinate is right and
 				// sprite is enabled, set BA for sprite 0, display window ends here
-			case 56:
+			case SC_DRAW_END:
+			case SC_DISPLAY_END:
 				if (!(ctrl2 & 8))
 					border_on = true;
-				
-				if (ud_border_on)
-					draw_border(chunky_ptr, ec_color_long)
-				else
-				{
-					draw_graphics(gfxcharcolor);
-					if (border_on)
-						draw_border(chunky_ptr, ec_color_long)
+
+				if (c->op == SC_DRAW_END) {
+					DrawGraphicsSide;
 				}
-				chunky_ptr += 8;
 				CheckSpriteDMA;
-				
-				if (spr_dma_on & 0x01)
+
+				if (spr_dma_on & 0x01) {
 					SetBALow;
+				}
 				break;
-				
-				// Turn on border in 40 column mode, set BA for sprite 1, paint sprites
-			case 57:
+
+				// Paint sprites
+			case SC_DRAW_SPRITES:
+				if (spr_disp_on && the_c64->prefs.SpritesOn && !ud_border_on)
+					draw_sprites();
+
+				// Falls through
+
+				// Turn on border in 40 column mode, turn off sprite display if DMA is off,
+				// set BA for sprite 1
+			case SC_SPRITES_END:
 				if (ctrl2 & 8)
 					border_on = true;
-				
-				// Draw sprites
-				if (spr_disp_on && ThePrefs.SpritesOn && !ud_border_on)
-					draw_sprites();
-				
-				// Turn off sprite display if DMA is off
+
 				mask = 1;
 				for (i=0; i<8; i++, mask<<=1)
 					if ((spr_disp_on & mask) && !(spr_dma_on & mask))
 						spr_disp_on &= ~mask;
-				
-				if (spr_dma_on & 0x02)
+
+				if (spr_dma_on & 0x02) {
 					SetBALow;
+				}
 				break;
-				
+
 				// Fetch sprite pointer 0, mc_base->mc, turn on sprite display if necessary,
 				// turn off display if RC=7, read data of sprite 0
-			case 58:
+			case SC_ROW_END:
+			case SC_ROW_END_BAD:
 				mask = 1;
 				for (i=0; i<8; i++, mask<<=1) {
 					mc[i] = mc_base[i];
@@ -1880,7 +2081,15 @@ void MOS6569::EmulateLineSC(void)
 						spr_disp_on |= mask;
 				}
 				SprPtrAccess(0);
-				
+
+				if (c->op == SC_ROW_END_BAD) {
+					if (rc == 7)
+						vc_base = vc;
+					display_state = true;
+					rc = (rc + 1) & 7;
+					break;
+				}
+
 				if (rc == 7) {
 					vc_base = vc;
 					display_state = false;
@@ -1888,874 +2097,71 @@ void MOS6569::EmulateLineSC(void)
 				if (display_state)
 					rc = (rc + 1) & 7;
 				break;
-				
-				// Set BA for sprite 2, read data of sprite 0
-			case 59:
-				SprDataAccess(0);
-				if (spr_dma_on & 0x04)
-					SetBALow;
-				break;
-				
+
 				// Fetch sprite pointer 1, reset BA if sprite 1 and 2 off, graphics display ends here
-			case 60:
+			case SC_NEXT_ROW:
 				// Increment pointer in chunky buffer
 				chunky_line_start += xmod;
-				
+
 				SprPtrAccess(1);
 				if (!(spr_dma_on & 0x06))
 					BALow = false;
 				break;
-				
-				// Set BA for sprite 3, read data of sprite 1
-			case 61:
-				SprDataAccess(1);
-				if (spr_dma_on & 0x08)
-					SetBALow;
-				break;
-				
-				// Read sprite pointer 2, reset BA if sprite 2 and 3 off, read data of sprite 2
-			case 62:
-				SprPtrAccess(2);
-				if (!(spr_dma_on & 0x0c))
-					BALow = false;
-				break;
-				
+
 				// Set BA for sprite 4, read data of sprite 2
-			case 63:
+			case SC_LINE_END:
 				SprDataAccess(2);
-				
+				if (spr_dma_on & 0x10) {
+					SetBALow;
+				}
+
 				if (raster_y == dy_stop)
 					ud_border_on = true;
 				else
 					if (ctrl1 & 0x10 && raster_y == dy_start)
 						ud_border_on = false;
-				
-				if (spr_dma_on & 0x10)
-					SetBALow;
-				
+
 				// Last cycle
-				if(ThePrefs.SIDOn)
+				if(the_c64->prefs.SIDOn)
 					the_c64->TheSID->EmulateLine();
 				break;
-				
-				//-----------------------------------------------------------
-				//-----------------------------------------------------------
-				// Cycles if bad line is true and draw_this_line is true
-				// (cycles 1 and 2 always same)
-				//-----------------------------------------------------------
-				//-----------------------------------------------------------
-				
-				// Fetch sprite pointer 4, reset BA is sprite 4 and 5 off
-			case 128+3:
-				SprPtrAccess(4);
-				display_state = true;
-				if (!(spr_dma_on & 0x30))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 6, read data of sprite 4 
-			case 128+4:
-				SprDataAccess(4);
-				display_state = true;
-				if (spr_dma_on & 0x40)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 5, reset BA if sprite 5 and 6 off
-			case 128+5:
-				SprPtrAccess(5);
-				display_state = true;
-				if (!(spr_dma_on & 0x60))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 7, read data of sprite 5
-			case 128+6:
-				SprDataAccess(5);
+		}
+
+		// Bad Line
+		if (c->flags) {
+			if (c->flags & SCF_DISPLAY)
 				display_state = true;
-				if (spr_dma_on & 0x80)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 6, reset BA if sprite 6 and 7 off
-			case 128+7:
-				SprPtrAccess(6);
-				display_state = true;
-				if (!(spr_dma_on & 0xc0))
-					BALow = false;
-				break;
-				
-				// Read data of sprite 6
-			case 128+8:
-				SprDataAccess(6);
-				display_state = true;
-				break;
-				
-				// Fetch sprite pointer 7, reset BA if sprite 7 off
-			case 128+9:
-				SprPtrAccess(7);
-				display_state = true;
-				if (!(spr_dma_on & 0x80))
-					BALow = false;
-				break;
-				
-				// Read data of sprite 7
-			case 128+10:
-				SprDataAccess(7);
-				display_state = true;
-				break;
-				
-				// Refresh, reset BA
-			case 128+11:
-				display_state = true;
-				BALow = false;
-				break;
-				
-				// Refresh, turn on matrix access if Bad Line
-			case 128+12:
-				// Refresh, turn on matrix access if Bad Line, reset raster_x, graphics display starts here
-			case 128+13:
-				display_state = true;
-				SetBALow;
-				break;
-				
-				// Refresh, VCBASE->VCCOUNT, turn on matrix access and reset RC if Bad Line
-			case 128+14:
-				display_state = true;
-				rc = 0;
-				SetBALow;
-				vc = vc_base;
-				break;
-				
-				// Refresh and matrix access, increment mc_base by 2 if y expansion flipflop is set
-			case 128+15:
-				display_state = true;
-				SetBALow;
-				
-				for (i=0; i<8; i++)
-					if (spr_exp_y & (1 << i))
-						mc_base[i] += 2;
-				
-				ml_index = 0;
-				matrix_access();
-				break;
-				
-				// Graphics and matrix access, increment mc_base by 1 if y expansion flipflop is set
-				// and check if sprite DMA can be turned off
-			case 128+16:
-				gfxcharcolor = graphics_access(display_state);
-				display_state = true;
-				SetBALow;
-				
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1) {
-					if (spr_exp_y & mask)
-						mc_base[i]++;
-					if ((mc_base[i] & 0x3f) == 0x3f)
-						spr_dma_on &= ~mask;
-				}
-				
-				matrix_access();
-				break;
-				
-				// Graphics and matrix access, turn off border in 40 column mode, display window starts here
-			case 128+17:
-				if (raster_y == dy_stop)
-					ud_border_on = true;
-				else if(ctrl1 & 0x10 && raster_y == dy_start)
-					ud_border_on = false;
-				
-				if (ctrl2 & 8 && !ud_border_on) 
-					border_on = false;
-				
-				if (ud_border_on)
-					draw_border(chunky_ptr, ec_color_long)
-				else
-				{
-					draw_graphics(gfxcharcolor);
-					if (border_on)
-						draw_border(chunky_ptr, ec_color_long)
-				}
-				chunky_ptr += 8;
-				fore_mask_ptr++;
-				gfxcharcolor = graphics_access(display_state);
-				display_state = true;
-				SetBALow;
-				matrix_access();
-				break;
-				
-				// Turn off border in 38 column mode
-			case 128+18:
-				if (!(ctrl2 & 8) && !ud_border_on)
-					border_on = false;
-				
-				// Falls through
-				
-				// Graphics and matrix access
-			case 128+19: case 128+20: case 128+21: case 128+22: case 128+23: case 128+24:
-			case 128+25: case 128+26: case 128+27: case 128+28: case 128+29: case 128+30:
-			case 128+31: case 128+32: case 128+33: case 128+34: case 128+35: case 128+36:
-			case 128+37: case 128+38: case 128+39: case 128+40: case 128+41: case 128+42:
-			case 128+43: case 128+44: case 128+45: case 128+46: case 128+47: case 128+48:
-			case 128+49: case 128+50: case 128+51: case 128+52: case 128+53: case 128+54:	// Gnagna...
-				if (ud_border_on)
-					draw_border(chunky_ptr, ec_color_long)
-				else
-					draw_graphics(gfxcharcolor);
-				chunky_ptr += 8;
-				fore_mask_ptr++;
-				gfxcharcolor = graphics_access(display_state);
-				display_state = true;
-				SetBALow;
-				matrix_access();
-				break;
-				
-				// Last graphics access, turn off matrix access, turn on sprite DMA if Y coordinate is
-				// right and sprite is enabled, handle sprite y expansion, set BA for sprite 0
-			case 128+55:
-				if (ud_border_on)
-					draw_border(chunky_ptr, ec_color_long)
-				else
-					draw_graphics(gfxcharcolor);
-				chunky_ptr += 8;
-				fore_mask_ptr++;
-				gfxcharcolor = graphics_access(display_state);
-				display_state = true;
-				
-				// Invert y expansion flipflop if bit in MYE is set
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1)
-					if (mye & mask)
-						spr_exp_y ^= mask;
-				CheckSpriteDMA;
-				
-				if (spr_dma_on & 0x01) {	// Don't remove these braces!
-					SetBALow;
-				} else
-					BALow = false;
-				break;
-				
-				// Turn on border in 38 column mode, turn on sprite DMA if Y coordinate is right and
-				// sprite is enabled, set BA for sprite 0, display window ends here
-			case 128+56:
-				if (!(ctrl2 & 8))
-					border_on = true;
-				
-				if (ud_border_on)
-					draw_border(chunky_ptr, ec_color_long)
-				else
-				{
-					draw_graphics(gfxcharcolor);
-					if (border_on)
-						draw_border(chunky_ptr, ec_color_long)
-				}
-				chunky_ptr += 8;
-				display_state = true;
-				CheckSpriteDMA;
-				
-				if (spr_dma_on & 0x01)
-					SetBALow;
-				break;
-				
-				// Turn on border in 40 column mode, set BA for sprite 1, paint sprites
-			case 128+57:
-				if (ctrl2 & 8)
-					border_on = true;
-				
-				// Draw sprites
-				if (spr_disp_on && ThePrefs.SpritesOn && !ud_border_on)
-					draw_sprites();
-				
-				// Turn off sprite display if DMA is off
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1)
-					if ((spr_disp_on & mask) && !(spr_dma_on & mask))
-						spr_disp_on &= ~mask;
-				
-				display_state = true;
-				if (spr_dma_on & 0x02)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 0, mc_base->mc, turn on sprite display if necessary,
-				// turn off display if RC=7, read data of sprite 0
-			case 128+58:
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1) {
-					mc[i] = mc_base[i];
-					if ((spr_dma_on & mask) && (raster_y & 0xff) == my[i])
-						spr_disp_on |= mask;
-				}
-				SprPtrAccess(0);
-				
-				if (rc == 7) {
-					vc_base = vc;
-				}
-				display_state = true;
-				rc = (rc + 1) & 7;
-				break;
-				
-				// Set BA for sprite 2, read data of sprite 0
-			case 128+59:
-				SprDataAccess(0);
-				display_state = true;
-				if (spr_dma_on & 0x04)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 1, reset BA if sprite 1 and 2 off, graphics display ends here
-			case 128+60:
-				// Increment pointer in chunky buffer
-				chunky_line_start += xmod;
-				
-				SprPtrAccess(1);
-				display_state = true;
-				if (!(spr_dma_on & 0x06))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 3, read data of sprite 1
-			case 128+61:
-				SprDataAccess(1);
-				display_state = true;
-				if (spr_dma_on & 0x08)
-					SetBALow;
-				break;
-				
-				// Read sprite pointer 2, reset BA if sprite 2 and 3 off, read data of sprite 2
-			case 128+62:
-				SprPtrAccess(2);
-				display_state = true;
-				if (!(spr_dma_on & 0x0c))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 4, read data of sprite 2
-			case 128+63:
-				SprDataAccess(2);
-				display_state = true;
-				
-				if (raster_y == dy_stop)
-					ud_border_on = true;
-				else
-					if (ctrl1 & 0x10 && raster_y == dy_start)
-						ud_border_on = false;
-				
-				if (spr_dma_on & 0x10)
-					SetBALow;
-				
-				// Last cycle
-				if(ThePrefs.SIDOn)
-					the_c64->TheSID->EmulateLine();
-				break;
-				
-				
-				//-----------------------------------------------------------
-				//-----------------------------------------------------------
-				// Cycles if bad line is false and draw_this_line is false
-				//-----------------------------------------------------------
-				//-----------------------------------------------------------
-				
-				// Fetch sprite pointer 4, reset BA is sprite 4 and 5 off
-			case 256+3:
-				if (!(spr_dma_on & 0x30))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 6, read data of sprite 4 
-			case 256+4:
-				if (spr_dma_on & 0x40)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 5, reset BA if sprite 5 and 6 off
-			case 256+5:
-				if (!(spr_dma_on & 0x60))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 7, read data of sprite 5
-			case 256+6:
-				if (spr_dma_on & 0x80)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 6, reset BA if sprite 6 and 7 off
-			case 256+7:
-				if (!(spr_dma_on & 0xc0))
-					BALow = false;
-				break;
-				
-				// Fetch sprite pointer 7, reset BA if sprite 7 off
-			case 256+9:
-				if (!(spr_dma_on & 0x80))
-					BALow = false;
-				break;
-				
-				// Refresh, reset BA
-			case 256+11:
-				BALow = false;
-				break;
-				
-				// Refresh, VCBASE->VCCOUNT, turn on matrix access and reset RC if Bad Line
-			case 256+14:
-				vc = vc_base;
-				break;
-				
-				// Refresh and matrix access, increment mc_base by 2 if y expansion flipflop is set
-			case 256+15:
-				for (i=0; i<8; i++)
-					if (spr_exp_y & (1 << i))
-						mc_base[i] += 2;
-				
-				ml_index = 0;
-				break;
-				
-				// Graphics and matrix access, increment mc_base by 1 if y expansion flipflop is set
-				// and check if sprite DMA can be turned off
-			case 256+16:
-				if(display_state)
-					vc++;
-				
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1) {
-					if (spr_exp_y & mask)
-						mc_base[i]++;
-					if ((mc_base[i] & 0x3f) == 0x3f)
-						spr_dma_on &= ~mask;
-				}
-				break;
-				
-				// Graphics and matrix access, turn off border in 40 column mode, display window starts here
-			case 256+17:
-				if (raster_y == dy_stop)
-					ud_border_on = true;
-				else if(ctrl1 & 0x10 && raster_y == dy_start)
-					ud_border_on = false;
-				
-				if (ctrl2 & 8 && !ud_border_on) 
-					border_on = false;
-				
-				if(display_state)
-					vc++;
-				break;
-				
-				// Turn off border in 38 column mode
-			case 256+18:
-				if (!(ctrl2 & 8) && !ud_border_on)
-					border_on = false;
-				
-				// Falls through
-				
-				// Graphics and matrix access
-			case 256+19: case 256+20: case 256+21: case 256+22: case 256+23: case 256+24:
-			case 256+25: case 256+26: case 256+27: case 256+28: case 256+29: case 256+30:
-			case 256+31: case 256+32: case 256+33: case 256+34: case 256+35: case 256+36:
-			case 256+37: case 256+38: case 256+39: case 256+40: case 256+41: case 256+42:
-			case 256+43: case 256+44: case 256+45: case 256+46: case 256+47: case 256+48:
-			case 256+49: case 256+50: case 256+51: case 256+52: case 256+53: case 256+54:	// Gnagna...
-				if(display_state)
-					vc++;
-				break;
-				
-				// Last graphics access, turn off matrix access, turn on sprite DMA if Y coordinate is
-				// right and sprite is enabled, handle sprite y expansion, set BA for sprite 0
-			case 256+55:
-				if(display_state)
-					vc++;
-				
-				// Invert y expansion flipflop if bit in MYE is set
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1)
-					if (mye & mask)
-						spr_exp_y ^= mask;
-				CheckSpriteDMA;
-				
-				if (spr_dma_on & 0x01) {	// Don't remove these braces!
-					SetBALow;
-				} else
-					BALow = false;
-				break;
-				
-				// Turn on border in 38 column mode, turn on sprite DMA if Y coordinate is right and
-				// sprite is enabled, set BA for sprite 0, display window ends here
-			case 256+56:
-				if (!(ctrl2 & 8))
-					border_on = true;
-				
-				CheckSpriteDMA;
-				
-				if (spr_dma_on & 0x01)
-					SetBALow;
-				break;
-				
-				// Turn on border in 40 column mode, set BA for sprite 1, paint sprites
-			case 256+57:
-				if (ctrl2 & 8)
-					border_on = true;
-				
-				// Turn off sprite display if DMA is off
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1)
-					if ((spr_disp_on & mask) && !(spr_dma_on & mask))
-						spr_disp_on &= ~mask;
-				
-				if (spr_dma_on & 0x02)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 0, mc_base->mc, turn on sprite display if necessary,
-				// turn off display if RC=7, read data of sprite 0
-			case 256+58:
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1) {
-					mc[i] = mc_base[i];
-					if ((spr_dma_on & mask) && (raster_y & 0xff) == my[i])
-						spr_disp_on |= mask;
-				}
-				SprPtrAccess(0);
-				
-				if (rc == 7) {
-					vc_base = vc;
-					display_state = false;
-				}
-				if (display_state)
-					rc = (rc + 1) & 7;
-				break;
-				
-				// Set BA for sprite 2, read data of sprite 0
-			case 256+59:
-				SprDataAccess(0);
-				if (spr_dma_on & 0x04)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 1, reset BA if sprite 1 and 2 off, graphics display ends here
-			case 256+60:
-				SprPtrAccess(1);
-				if (!(spr_dma_on & 0x06))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 3, read data of sprite 1
-			case 256+61:
-				SprDataAccess(1);
-				if (spr_dma_on & 0x08)
-					SetBALow;
-				break;
-				
-				// Read sprite pointer 2, reset BA if sprite 2 and 3 off, read data of sprite 2
-			case 256+62:
-				SprPtrAccess(2);
-				if (!(spr_dma_on & 0x0c))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 4, read data of sprite 2
-			case 256+63:
-				SprDataAccess(2);
-				
-				if (raster_y == dy_stop)
-					ud_border_on = true;
-				else
-					if (ctrl1 & 0x10 && raster_y == dy_start)
-						ud_border_on = false;
-				
-				if (spr_dma_on & 0x10)
-					SetBALow;
-				
-				// Last cycle
-				if(ThePrefs.SIDOn)
-					the_c64->TheSID->EmulateLine();
-				break;
-				
-				//-----------------------------------------------------------
-				//-----------------------------------------------------------
-				// Cycles if bad line is true and draw_this_line is false
-				// (cycles 1 and 2 always same)
-				//-----------------------------------------------------------
-				//-----------------------------------------------------------
-				
-				// Fetch sprite pointer 4, reset BA is sprite 4 and 5 off
-			case 256+128+3:
-				display_state = true;
-				if (!(spr_dma_on & 0x30))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 6, read data of sprite 4 
-			case 256+128+4:
-				display_state = true;
-				if (spr_dma_on & 0x40)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 5, reset BA if sprite 5 and 6 off
-			case 256+128+5:
-				display_state = true;
-				if (!(spr_dma_on & 0x60))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 7, read data of sprite 5
-			case 256+128+6:
-				display_state = true;
-				if (spr_dma_on & 0x80)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 6, reset BA if sprite 6 and 7 off
-			case 256+128+7:
-				display_state = true;
-				if (!(spr_dma_on & 0xc0))
-					BALow = false;
-				break;
-				
-				// Read data of sprite 6
-			case 256+128+8:
-				display_state = true;
-				break;
-				
-				// Fetch sprite pointer 7, reset BA if sprite 7 off
-			case 256+128+9:
-				display_state = true;
-				if (!(spr_dma_on & 0x80))
-					BALow = false;
-				break;
-				
-				// Read data of sprite 7
-			case 256+128+10:
-				display_state = true;
-				break;
-				
-				// Refresh, reset BA
-			case 256+128+11:
-				display_state = true;
-				BALow = false;
-				break;
-				
-				// Refresh, turn on matrix access if Bad Line
-			case 256+128+12:
-				// Refresh, turn on matrix access if Bad Line, reset raster_x, graphics display starts here
-			case 256+128+13:
-				display_state = true;
-				SetBALow;
-				break;
-				
-				// Refresh, VCBASE->VCCOUNT, turn on matrix access and reset RC if Bad Line
-			case 256+128+14:
-				display_state = true;
-				rc = 0;
-				SetBALow;
-				vc = vc_base;
-				break;
-				
-				// Refresh and matrix access, increment mc_base by 2 if y expansion flipflop is set
-			case 256+128+15:
-				display_state = true;
-				SetBALow;
-				
-				for (i=0; i<8; i++)
-					if (spr_exp_y & (1 << i))
-						mc_base[i] += 2;
-				break;
-				
-				// Graphics and matrix access, increment mc_base by 1 if y expansion flipflop is set
-				// and check if sprite DMA can be turned off
-			case 256+128+16:
-				if(display_state)
-					vc++;
-				display_state = true;
-				SetBALow;
-				
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1) {
-					if (spr_exp_y & mask)
-						mc_base[i]++;
-					if ((mc_base[i] & 0x3f) == 0x3f)
-						spr_dma_on &= ~mask;
-				}
-				break;
-				
-				// Graphics and matrix access, turn off border in 40 column mode, display window starts here
-			case 256+128+17:
-				if (raster_y == dy_stop)
-					ud_border_on = true;
-				else if(ctrl1 & 0x10 && raster_y == dy_start)
-					ud_border_on = false;
-				
-				if (ctrl2 & 8 && !ud_border_on) 
-					border_on = false;
-				
-				if(display_state)
-					vc++;
-				display_state = true;
-				SetBALow;
-				break;
-				
-				// Turn off border in 38 column mode
-			case 256+128+18:
-				if (!(ctrl2 & 8) && !ud_border_on)
-					border_on = false;
-				
-				// Falls through
-				
-				// Graphics and matrix access
-			case 256+128+19: case 256+128+20: case 256+128+21: case 256+128+22: case 256+128+23: case 256+128+24:
-			case 256+128+25: case 256+128+26: case 256+128+27: case 256+128+28: case 256+128+29: case 256+128+30:
-			case 256+128+31: case 256+128+32: case 256+128+33: case 256+128+34: case 256+128+35: case 256+128+36:
-			case 256+128+37: case 256+128+38: case 256+128+39: case 256+128+40: case 256+128+41: case 256+128+42:
-			case 256+128+43: case 256+128+44: case 256+128+45: case 256+128+46: case 256+128+47: case 256+128+48:
-			case 256+128+49: case 256+128+50: case 256+128+51: case 256+128+52: case 256+128+53: case 256+128+54:	// Gnagna...
-				if(display_state)
-					vc++;
-				display_state = true;
-				SetBALow;
-				break;
-				
-				// Last graphics access, turn off matrix access, turn on sprite DMA if Y coordinate is
-				// right and sprite is enabled, handle sprite y expansion, set BA for sprite 0
-			case 256+128+55:
-				if(display_state)
-					vc++;
-				display_state = true;
-				
-				// Invert y expansion flipflop if bit in MYE is set
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1)
-					if (mye & mask)
-						spr_exp_y ^= mask;
-				CheckSpriteDMA;
-				
-				if (spr_dma_on & 0x01) {	// Don't remove these braces!
-					SetBALow;
-				} else
-					BALow = false;
-				break;
-				
-				// Turn on border in 38 column mode, turn on sprite DMA if Y coordinate is right and
-				// sprite is enabled, set BA for sprite 0, display window ends here
-			case 256+128+56:
-				if (!(ctrl2 & 8))
-					border_on = true;
-				
-				display_state = true;
-				CheckSpriteDMA;
-				
-				if (spr_dma_on & 0x01)
-					SetBALow;
-				break;
-				
-				// Turn on border in 40 column mode, set BA for sprite 1, paint sprites
-			case 256+128+57:
-				if (ctrl2 & 8)
-					border_on = true;
-				
-				// Turn off sprite display if DMA is off
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1)
-					if ((spr_disp_on & mask) && !(spr_dma_on & mask))
-						spr_disp_on &= ~mask;
-				
-				display_state = true;
-				if (spr_dma_on & 0x02)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 0, mc_base->mc, turn on sprite display if necessary,
-				// turn off display if RC=7, read data of sprite 0
-			case 256+128+58:
-				mask = 1;
-				for (i=0; i<8; i++, mask<<=1) {
-					mc[i] = mc_base[i];
-					if ((spr_dma_on & mask) && (raster_y & 0xff) == my[i])
-						spr_disp_on |= mask;
-				}
-				SprPtrAccess(0);
-				
-				if (rc == 7) {
-					vc_base = vc;
-				}
-				display_state = true;
-				rc = (rc + 1) & 7;
-				break;
-				
-				// Set BA for sprite 2, read data of sprite 0
-			case 256+128+59:
-				SprDataAccess(0);
-				display_state = true;
-				if (spr_dma_on & 0x04)
-					SetBALow;
-				break;
-				
-				// Fetch sprite pointer 1, reset BA if sprite 1 and 2 off, graphics display ends here
-			case 256+128+60:
-				SprPtrAccess(1);
-				display_state = true;
-				if (!(spr_dma_on & 0x06))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 3, read data of sprite 1
-			case 256+128+61:
-				SprDataAccess(1);
-				display_state = true;
-				if (spr_dma_on & 0x08)
-					SetBALow;
-				break;
-				
-				// Read sprite pointer 2, reset BA if sprite 2 and 3 off, read data of sprite 2
-			case 256+128+62:
-				SprPtrAccess(2);
-				display_state = true;
-				if (!(spr_dma_on & 0x0c))
-					BALow = false;
-				break;
-				
-				// Set BA for sprite 4, read data of sprite 2
-			case 256+128+63:
-				SprDataAccess(2);
-				display_state = true;
-				
-				if (raster_y == dy_stop)
-					ud_border_on = true;
-				else
-					if (ctrl1 & 0x10 && raster_y == dy_start)
-						ud_border_on = false;
-				
-				if (spr_dma_on & 0x10)
-					SetBALow;
-				
-				// Last cycle
-				if(ThePrefs.SIDOn)
-					the_c64->TheSID->EmulateLine();
-				break;
+			if (c->flags & SCF_BA_LOW) {
+				SetBALow;
+			}
+			if (c->flags & SCF_MATRIX)
+				matrix_access();
 		}
-		
+
 		// Next cycle
 		++cycle;
-		
-		if(--the_c64->TheCIA1->CyclesTillActionCnt == 0)
-			the_c64->TheCIA1->EmulateCycles();
-		
-		if(--the_c64->TheCIA2->CyclesTillActionCnt == 0)
-			the_c64->TheCIA2->EmulateCycles();
-		
-		the_c64->TheCPU->EmulateCycle(BALow);
-		
-		if (ThePrefs.Emul1541Proc) 
+
+		if(--cia1->CyclesTillActionCnt == 0)
+			cia1->EmulateCycles();
+
+		if(--cia2->CyclesTillActionCnt == 0)
+			cia2->EmulateCycles();
+
+		cpu->EmulateCycle(BALow);
+
+		if (emul_1541)
 		{
-			the_c64->TheCPU1541->CountVIATimers(1);
-			if (!the_c64->TheCPU1541->Idle)
-				the_c64->TheCPU1541->EmulateCycle();
+			cpu1541->CountVIATimers(1);
+			if (!cpu1541->Idle)
+				cpu1541->EmulateCycle();
 		}
 		the_c64->CycleCounter++;
 	}
-	
+
 	this->spr_dma_on = spr_dma_on;
 	this->BALow = BALow;
 	this->display_state = display_state;
-	
+
 	// First cycle in next line
 	cycle = (cycle & 0xf80) | 0x01;
 }
@@ -2770,16 +2176,151 @@ inline void MOS6569::vblank(void)
 	raster_y = vc_base = 0;
 	lp_triggered = false;
 	
-	if (!(frame_skipped = --skip_counter))
-		skip_counter = ThePrefs.SkipFrames;
+	// Pass the rows drawn in this frame on to the display
+	if (!frame_skipped) {
+		the_display->LinesChanged(dirty_lines);
+		memcpy(last_dirty, dirty_lines, sizeof(last_dirty));
+		last_dirty_count = dirty_count;
+		memset(dirty_lines, 0, sizeof(dirty_lines));
+		dirty_count = 0;
+	}
 	
+	frame_skipped = --skip_counter;
 	the_c64->VBlank(!frame_skipped);
 	
+	// After the_c64->VBlank(), which measures the frame for the
+	// adaptive frame skipping
+	if (!frame_skipped)
+		skip_counter = the_c64->SkipFrames();
+	
 	// Get bitmap pointer for next frame. This must be done
 	// after calling the_c64->VBlank() because the preferences
 	// and screen configuration may have been changed there
 	chunky_line_start = the_display->BitmapBase();
 	xmod = the_display->BitmapXMod();
+	disp_row = 0;
+	if (chunky_line_start != bitmap_start || xmod != bitmap_xmod) {
+		bitmap_start = chunky_line_start;
+		bitmap_xmod = xmod;
+		forget_lines();
+	}
+}
+
+
+/*
+ *  Forget what the rows of the bitmap show, so that they are all drawn
+ */
+
+void MOS6569::forget_lines(void)
+{
+	memset(row_key_len, 0, sizeof(row_key_len));
+}
+
+
+/*
+ *  Drawing a line changed pixels of the given row of the bitmap
+ */
+
+void MOS6569::row_overwritten(int row)
+{
+	if (row >= DISPLAY_Y)
+		return;
+	row_key_len[row] = 0;
+	if (!(dirty_lines[row >> 5] & (1U << (row & 31)))) {
+		dirty_lines[row >> 5] |= 1U << (row & 31);
+		dirty_count++;
+	}
+}
+
+
+/*
+ *  Describe the line that is about to be drawn in line_key[]: everything
+ *  its pixels and sprite collisions depend on. Returns the size of the
+ *  description. Must be called before vc is advanced.
+ */
+
+int MOS6569::describe_line(void)
+{
+	uint8 *k = line_key;
+	if (border_on) {
+		*k++ = 0xff;
+		*k++ = ec;
+	} else {
+		*k++ = display_idx | (display_state ? 0x08 : 0) | (border_40_col ? 0x10 : 0);
+		*k++ = x_scroll;
+		*k++ = ec;
+		*k++ = b0c; *k++ = b1c; *k++ = b2c; *k++ = b3c;
+		*k++ = sprite_on;
+		*k++ = mc_color_lookup[0]; *k++ = mc_color_lookup[1]; *k++ = mc_color_lookup[2];
+		
+		// Graphics bytes as the el_* functions fetch them
+		if (display_state) {
+			uint8 *q;
+			int i;
+			switch (display_idx) {
+				case 0: case 1:
+					q = char_base + rc;
+					for (i=0; i<40; i++)
+						*k++ = q[matrix_line[i] << 3];
+					break;
+				case 2: case 3:
+					q = bitmap_base + (vc << 3) + rc;
+					for (i=0; i<40; i++, q+=8)
+						*k++ = *q;
+					break;
+				case 4:
+					q = char_base + rc;
+					for (i=0; i<40; i++)
+						*k++ = q[(matrix_line[i] & 0x3f) << 3];
+					break;
+			}
+			memcpy(k, matrix_line, 40);
+			memcpy(k + 40, color_line, 40);
+			k += 80;
+		} else if (display_idx == 3)
+			*k++ = *get_physical(0x3fff);
+		else
+			*k++ = *get_physical(ctrl1 & 0x40 ? 0x39ff : 0x3fff);
+		
+		if (sprite_on) {
+			*k++ = mm0; *k++ = mm1;
+			*k++ = mxe; *k++ = mmc; *k++ = mdp;
+			for (int snum=0; snum<8; snum++)
+				if (sprite_on & (1 << snum)) {
+					uint8 *sdatap = get_physical(matrix_base[0x3f8 + snum] << 6 | mc[snum]);
+					*k++ = mx[snum];
+					*k++ = mx[snum] >> 8;
+					*k++ = sc[snum];
+					*k++ = sdatap[0]; *k++ = sdatap[1]; *k++ = sdatap[2];
+				}
+		}
+	}
+	return k - line_key;
+}
+
+
+/*
+ *  Check if the line that is about to be drawn into the given row of
+ *  the bitmap differs from what the row shows. Returns false if the row
+ *  was last drawn from the same description, otherwise the row is marked
+ *  as redrawn in this frame.
+ */
+
+bool MOS6569::line_changed(int row)
+{
+	if (row >= DISPLAY_Y)
+		return true;
+	
+	if (skip_unchanged) {
+		int len = describe_line();
+		if (row_key_len[row] == len && !memcmp(row_key[row], line_key, len))
+			return false;
+		row_overwritten(row);
+		memcpy(row_key[row], line_key, len);
+		row_key_len[row] = len;
+	} else
+		row_overwritten(row);
+	return true;
 }
 
 
@@ -2798,7 +2339,7 @@ inline void MOS6569::vblank(void)
 
 void MOS6569::el_std_text(uint8 *p, uint8 *q)
 {
-	uint32 *tct = &TextColorTable[b0c << 8];
+	const uint32 *tct = &TextColorTable[b0c << 8];
 	uint32 *lp = (uint32 *)p;
 	uint8 *cp = color_line;
 	uint8 *mp = matrix_line;
@@ -2826,7 +2367,7 @@ void MOS6569::el_std_text_spr(uint8 *q, uint8 *r)
 
 void MOS6569::el_mc_text(uint8 *p, uint8 *q)
 {
-	uint32 *tct = &TextColorTable[b0c << 8];
+	const uint32 *tct = &TextColorTable[b0c << 8];
  	uint32 *lp = (uint32 *)p;
  	uint8 *cp = color_line;
  	uint8 *mp = matrix_line;
@@ -2935,10 +2476,6 @@ void MOS6569::el_mc_bitmap_spr(uint8 *q, uint8 *r)
 void MOS6569::el_ecm_text(uint8 *p, uint8 *q)
 {
  	uint32 *lp = (uint32 *)p;
-	if ((int)p & 3) {
-		int tmp = 4-((int)p&3);
-		lp = (uint32 *)(p + tmp);
-	}
  	uint8 *cp = color_line;
  	uint8 *mp = matrix_line;
  	uint8 *bcp = &b0c;
@@ -2982,236 +2519,581 @@ void MOS6569::el_std_idle(uint8 *p)
 }
 void MOS6569::el_std_idle_spr(uint8 *r)
 {
- 	uint8 data = *get_physical(ctrl1 & 0x40 ? 0x39ff : 0x3fff);
- 	memset(r, data, 40);
+ 	uint8 data = *get_physical(ctrl1 & 0x40 ? 0x39ff : 0x3fff);
+ 	memset(r, data, 40);
+}
+
+
+void MOS6569::el_mc_idle(uint8 *p)
+{
+ 	uint16 data = *get_physical(0x3fff);
+ 	uint32 *lp = (uint32 *)p;
+ 	uint16 lookup[4];
+	
+ 	lookup[0] = mc_color_lookup[0];
+ 	lookup[1] = lookup[2] = lookup[3] = 0;
+	
+	uint32 conva =  lookup[(data >> 6) & 3] | (lookup[(data >> 4) & 3] << 16);
+ 	uint32 convb =  lookup[(data >> 2) & 3] | (lookup[data & 3]        << 16);
+	
+ 	for (int i=0; i<40; i++) {
+		*lp++ = conva;
+		*lp++ = convb;
+ 	}
+}
+void MOS6569::el_mc_idle_spr(uint8 *r)
+{
+ 	uint16 data = *get_physical(0x3fff);
+	memset(r, data, 40);
+}
+
+
+/*
+ *  Draw the graphics of a line of the display window at p, the
+ *  foreground mask for the sprites at r
+ */
+
+void MOS6569::el_graphics(uint8 *p, uint8 *r)
+{
+	if (display_state)
+	{
+		switch (display_idx) {
+			case 0: // Standard text
+#if VIC_SIMD
+				if (simd_lines)
+					el_std_text_simd(p, char_base + rc);
+				else
+#endif
+					el_std_text(p, char_base + rc);
+				if(sprite_on)
+					el_std_text_spr(char_base + rc, r);
+				break;
+				
+			case 1: // Multicolor text
+#if VIC_SIMD
+				if (simd_lines)
+					el_mc_text_simd(p, char_base + rc);
+				else
+#endif
+				if (x_scroll & 3) {
+					el_mc_text(text_chunky_buf, char_base + rc);
+					memcpy(p, text_chunky_buf, 8*40);
+				} else
+					el_mc_text(p, char_base + rc);
+				if(sprite_on)
+					el_mc_text_spr(char_base + rc, r);
+				break;
+				
+			case 2: // Standard bitmap
+#if VIC_SIMD
+				if (simd_lines)
+					el_std_bitmap_simd(p, bitmap_base + (vc << 3) + rc);
+				else
+#endif
+				if (x_scroll & 3) {
+					el_std_bitmap(text_chunky_buf, bitmap_base + (vc << 3) + rc);
+					memcpy(p, text_chunky_buf, 8*40);             
+				} else
+					el_std_bitmap(p, bitmap_base + (vc << 3) + rc);
+				if(sprite_on)
+					el_std_bitmap_spr(bitmap_base + (vc << 3) + rc, r);
+				break;
+				
+			case 3: // Multicolor bitmap
+#if VIC_SIMD
+				if (simd_lines)
+					el_mc_bitmap_simd(p, bitmap_base + (vc << 3) + rc);
+				else
+#endif
+				if (x_scroll & 3) {
+					el_mc_bitmap(text_chunky_buf, bitmap_base + (vc << 3) + rc);
+					memcpy(p, text_chunky_buf, 8*40);             
+				} else
+					el_mc_bitmap(p, bitmap_base + (vc << 3) + rc);
+				if(sprite_on)
+					el_mc_bitmap_spr(bitmap_base + (vc << 3) + rc, r);
+				break;
+				
+			case 4: // ECM text
+#if VIC_SIMD
+				if (simd_lines)
+					el_ecm_text_simd(p, char_base + rc);
+				else
+#endif
+				if (x_scroll & 3) {
+					el_ecm_text(text_chunky_buf, char_base + rc);
+					memcpy(p, text_chunky_buf, 8*40);             
+				} else
+					el_ecm_text(p, char_base + rc);
+				if(sprite_on)
+					el_ecm_text_spr(char_base + rc, r);
+				break;
+				
+			default: // Invalid mode (all black)
+				memset(p, 0, 320);
+				if(sprite_on)
+					memset(r, 0, 40);
+				break;
+		}
+	}
+	else
+	{ // Idle state graphics
+		switch (display_idx) {
+				
+			case 0:  // Standard text
+			case 1:  // Multicolor text
+			case 4:  // ECM text
+#if VIC_SIMD
+				if (simd_lines)
+					el_std_idle_simd(p);
+				else
+#endif
+				if (x_scroll & 3) {
+					el_std_idle(text_chunky_buf);
+					memcpy(p, text_chunky_buf, 8*40);             
+				} else
+					el_std_idle(p);
+				if(sprite_on)
+					el_std_idle_spr(r);
+				break;
+				
+			case 3:  // Multicolor bitmap
+#if VIC_SIMD
+				if (simd_lines)
+					el_mc_idle_simd(p);
+				else
+#endif
+				if (x_scroll & 3) {
+					el_mc_idle(text_chunky_buf);
+					memcpy(p, text_chunky_buf, 8*40);             
+				} else
+					el_mc_idle(p);
+				if(sprite_on)
+					el_mc_idle_spr(r);
+				break;
+				
+			default: // Invalid mode (all black)
+				memset(p, 0, 320);
+				if(sprite_on)
+					memset(r, 0, 40);
+				break;
+		}
+	}
+}
+
+
+#if VIC_SIMD
+/*
+ * SIMD versions of the el_* functions. Each vector holds the 16
+ * pixels of two characters. A pixel gets the foreground color if its
+ * bit in the graphics data is set, which is a compare against a
+ * vector of single bit masks and a select (and/andnot/or on SSE2).
+ * Multicolor pixels are selected from four colors by two such masks.
+ */
+
+#if defined(__SSE2__)
+typedef __m128i vec8x16;
+
+static inline vec8x16 v_load(const uint8 *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void v_store(uint8 *p, vec8x16 v) { _mm_storeu_si128((__m128i *)p, v); }
+
+// Byte a in the lower 8 lanes, byte b in the upper 8 lanes
+static inline vec8x16 v_dup2(uint8 a, uint8 b)
+{
+	vec8x16 v = _mm_cvtsi32_si128(a | (b << 8));
+	v = _mm_unpacklo_epi8(v, v);
+	v = _mm_unpacklo_epi16(v, v);
+	return _mm_unpacklo_epi32(v, v);
+}
+
+// All ones in the lanes in which data has the (single) bit of bits set
+static inline vec8x16 v_test(vec8x16 data, vec8x16 bits) { return _mm_cmpeq_epi8(_mm_and_si128(data, bits), bits); }
+
+static inline vec8x16 v_select(vec8x16 mask, vec8x16 a, vec8x16 b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+#else
+typedef uint8x16_t vec8x16;
+
+static inline vec8x16 v_load(const uint8 *p) { return vld1q_u8(p); }
+static inline void v_store(uint8 *p, vec8x16 v) { vst1q_u8(p, v); }
+static inline vec8x16 v_dup2(uint8 a, uint8 b) { return vcombine_u8(vdup_n_u8(a), vdup_n_u8(b)); }
+static inline vec8x16 v_test(vec8x16 data, vec8x16 bits) { return vtstq_u8(data, bits); }
+static inline vec8x16 v_select(vec8x16 mask, vec8x16 a, vec8x16 b) { return vbslq_u8(mask, a, b); }
+#endif
+
+// Bit of each pixel in the graphics data byte, for standard and
+// multicolor (upper/lower bit of the pixel pair) graphics
+static const uint8 std_bits[16] = {
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+};
+static const uint8 mc_hi_bits[16] = {
+	0x80, 0x80, 0x20, 0x20, 0x08, 0x08, 0x02, 0x02,
+	0x80, 0x80, 0x20, 0x20, 0x08, 0x08, 0x02, 0x02
+};
+static const uint8 mc_lo_bits[16] = {
+	0x40, 0x40, 0x10, 0x10, 0x04, 0x04, 0x01, 0x01,
+	0x40, 0x40, 0x10, 0x10, 0x04, 0x04, 0x01, 0x01
+};
+
+// Multicolor pixels: 00 -> c0, 01 -> c1, 10 -> c2, 11 -> c3
+static inline vec8x16 v_mc(vec8x16 data, vec8x16 c0, vec8x16 c1, vec8x16 c2, vec8x16 c3)
+{
+	vec8x16 hi = v_test(data, v_load(mc_hi_bits));
+	vec8x16 lo = v_test(data, v_load(mc_lo_bits));
+	return v_select(hi, v_select(lo, c3, c2), v_select(lo, c1, c0));
+}
+
+
+void MOS6569::el_std_text_simd(uint8 *p, uint8 *q)
+{
+	vec8x16 bits = v_load(std_bits);
+	vec8x16 back = v_dup2(b0c, b0c);
+	uint8 *cp = color_line;
+	uint8 *mp = matrix_line;
+
+	// Loop for 40 characters, two at a time
+	for (int i=0; i<40; i+=2, p+=16) {
+		vec8x16 data = v_dup2(q[mp[i] << 3], q[mp[i+1] << 3]);
+		v_store(p, v_select(v_test(data, bits), v_dup2(cp[i], cp[i+1]), back));
+	}
+}
+
+
+void MOS6569::el_mc_text_simd(uint8 *p, uint8 *q)
+{
+	vec8x16 bits = v_load(std_bits);
+	vec8x16 c0 = v_dup2(mc_color_lookup[0], mc_color_lookup[0]);
+	vec8x16 c1 = v_dup2(mc_color_lookup[1], mc_color_lookup[1]);
+	vec8x16 c2 = v_dup2(mc_color_lookup[2], mc_color_lookup[2]);
+	uint8 *cp = color_line;
+	uint8 *mp = matrix_line;
+
+	// Loop for 40 characters, two at a time
+	for (int i=0; i<40; i+=2, p+=16) {
+		vec8x16 data = v_dup2(q[mp[i] << 3], q[mp[i+1] << 3]);
+		vec8x16 color = v_dup2(cp[i] & 7, cp[i+1] & 7);
+
+		// Color bit 3 selects multicolor mode per character
+		vec8x16 mc = v_mc(data, c0, c1, c2, color);
+		vec8x16 std = v_select(v_test(data, bits), color, v_dup2(b0c, b0c));
+		v_store(p, v_select(v_test(v_dup2(cp[i], cp[i+1]), v_dup2(8, 8)), mc, std));
+	}
+}
+
+
+void MOS6569::el_std_bitmap_simd(uint8 *p, uint8 *q)
+{
+	vec8x16 bits = v_load(std_bits);
+	uint8 *mp = matrix_line;
+
+	// Loop for 40 characters, two at a time
+	for (int i=0; i<40; i+=2, p+=16, q+=16) {
+		vec8x16 data = v_dup2(q[0], q[8]);
+		vec8x16 fore = v_dup2(mp[i] >> 4, mp[i+1] >> 4);
+		vec8x16 back = v_dup2(mp[i] & 0xf, mp[i+1] & 0xf);
+		v_store(p, v_select(v_test(data, bits), fore, back));
+	}
+}
+
+
+void MOS6569::el_mc_bitmap_simd(uint8 *p, uint8 *q)
+{
+	vec8x16 c0 = v_dup2(mc_color_lookup[0], mc_color_lookup[0]);
+	uint8 *cp = color_line;
+	uint8 *mp = matrix_line;
+
+	// Loop for 40 characters, two at a time
+	for (int i=0; i<40; i+=2, p+=16, q+=16) {
+		vec8x16 data = v_dup2(q[0], q[8]);
+		vec8x16 c1 = v_dup2(mp[i] >> 4, mp[i+1] >> 4);
+		vec8x16 c2 = v_dup2(mp[i] & 0xf, mp[i+1] & 0xf);
+		vec8x16 c3 = v_dup2(cp[i], cp[i+1]);
+		v_store(p, v_mc(data, c0, c1, c2, c3));
+	}
+}
+
+
+void MOS6569::el_ecm_text_simd(uint8 *p, uint8 *q)
+{
+	vec8x16 bits = v_load(std_bits);
+	uint8 *cp = color_line;
+	uint8 *mp = matrix_line;
+	uint8 *bcp = &b0c;
+
+	// Loop for 40 characters, two at a time
+	for (int i=0; i<40; i+=2, p+=16) {
+		uint8 a = mp[i], b = mp[i+1];
+		vec8x16 data = v_dup2(q[(a & 0x3f) << 3], q[(b & 0x3f) << 3]);
+		vec8x16 back = v_dup2(bcp[a >> 6], bcp[b >> 6]);
+		v_store(p, v_select(v_test(data, bits), v_dup2(cp[i], cp[i+1]), back));
+	}
+}
+
+
+void MOS6569::el_std_idle_simd(uint8 *p)
+{
+	uint8 data = *get_physical(ctrl1 & 0x40 ? 0x39ff : 0x3fff);
+	vec8x16 pixels = v_select(v_test(v_dup2(data, data), v_load(std_bits)), v_dup2(0, 0), v_dup2(b0c, b0c));
+
+	for (int i=0; i<40; i+=2, p+=16)
+		v_store(p, pixels);
+}
+
+
+void MOS6569::el_mc_idle_simd(uint8 *p)
+{
+	uint8 data = *get_physical(0x3fff);
+	vec8x16 black = v_dup2(0, 0);
+	vec8x16 pixels = v_mc(v_dup2(data, data), v_dup2(mc_color_lookup[0], mc_color_lookup[0]), black, black, black);
+
+	for (int i=0; i<40; i+=2, p+=16)
+		v_store(p, pixels);
 }
+#endif
 
 
-void MOS6569::el_mc_idle(uint8 *p)
+/*
+ *  Render lines in all display modes, states and x_scroll positions
+ *  from random video matrix, color and graphics data with the scalar
+ *  and the SIMD functions and count the lines that differ in the
+ *  pixels or in the foreground mask. The VIC state and the RAM that
+ *  are used are restored afterwards.
+ */
+
+static uint8 check_random(uint32 &seed)
 {
- 	uint16 data = *get_physical(0x3fff);
- 	uint32 *lp = (uint32 *)p;
- 	uint16 lookup[4];
-	
- 	lookup[0] = mc_color_lookup[0];
- 	lookup[1] = lookup[2] = lookup[3] = 0;
-	
-	uint32 conva =  lookup[(data >> 6) & 3] | (lookup[(data >> 4) & 3] << 16);
- 	uint32 convb =  lookup[(data >> 2) & 3] | (lookup[data & 3]        << 16);
-	
- 	for (int i=0; i<40; i++) {
-		*lp++ = conva;
-		*lp++ = convb;
- 	}
+	seed = seed * 1103515245L + 12345;
+	return (seed >> 16) & 0xff;
 }
-void MOS6569::el_mc_idle_spr(uint8 *r)
+
+int MOS6569::CheckLineRenderers(int rounds)
 {
- 	uint16 data = *get_physical(0x3fff);
-	memset(r, data, 40);
+#if VIC_SIMD
+	if (!simd_supported())
+		return -1;
+
+	// Line and mask buffers with a margin on both sides to catch stray writes
+	const int MARGIN = 16;
+	uint32 scalar_buf[(MARGIN + 8 + 320 + MARGIN) / 4];
+	uint32 simd_buf[(MARGIN + 8 + 320 + MARGIN) / 4];
+	uint8 scalar_mask[MARGIN + 40 + MARGIN];
+	uint8 simd_mask[MARGIN + 40 + MARGIN];
+
+	// Save what is changed below
+	uint8 *saved_ram = new uint8[0x2000];
+	memcpy(saved_ram, ram, 0x2000);
+	uint8 saved_matrix_line[40], saved_color_line[40];
+	memcpy(saved_matrix_line, matrix_line, 40);
+	memcpy(saved_color_line, color_line, 40);
+	uint8 saved_bc[4] = {b0c, b1c, b2c, b3c};
+	uint8 *saved_char_base = char_base, *saved_bitmap_base = bitmap_base;
+	uint8 saved_sprite_on = sprite_on;
+	uint16 saved_rc = rc, saved_vc = vc, saved_x_scroll = x_scroll;
+	int saved_display_idx = display_idx;
+	bool saved_display_state = display_state, saved_simd_lines = simd_lines;
+
+	uint32 seed = 1;
+	char_base = bitmap_base = ram;
+	sprite_on = 0xff;
+	int errors = 0;
+	for (int n=0; n<rounds; n++) {
+		for (int i=0; i<0x2000; i++)
+			ram[i] = check_random(seed);
+		for (int i=0; i<40; i++) {
+			matrix_line[i] = check_random(seed);
+			color_line[i] = check_random(seed) & 0x0f;
+		}
+		b0c = check_random(seed) & 0xf; b1c = check_random(seed) & 0xf;
+		b2c = check_random(seed) & 0xf; b3c = check_random(seed) & 0xf;
+		make_mc_table();
+		rc = check_random(seed) & 7;
+		vc = ((check_random(seed) << 8) | check_random(seed)) % (1024 - 40);
+
+		for (int state=0; state<2; state++)
+			for (display_idx=0; display_idx<8; display_idx++)
+				for (x_scroll=0; x_scroll<8; x_scroll++) {
+					display_state = state;
+					memset(scalar_buf, 0xaa, sizeof(scalar_buf));
+					memset(simd_buf, 0xaa, sizeof(simd_buf));
+					memset(scalar_mask, 0xaa, sizeof(scalar_mask));
+					memset(simd_mask, 0xaa, sizeof(simd_mask));
+					simd_lines = false;
+					el_graphics((uint8 *)scalar_buf + MARGIN + x_scroll, scalar_mask + MARGIN);
+					simd_lines = true;
+					el_graphics((uint8 *)simd_buf + MARGIN + x_scroll, simd_mask + MARGIN);
+					if (memcmp(scalar_buf, simd_buf, sizeof(scalar_buf)) || memcmp(scalar_mask, simd_mask, sizeof(scalar_mask)))
+						errors++;
+				}
+	}
+
+	memcpy(ram, saved_ram, 0x2000);
+	delete[] saved_ram;
+	memcpy(matrix_line, saved_matrix_line, 40);
+	memcpy(color_line, saved_color_line, 40);
+	b0c = saved_bc[0]; b1c = saved_bc[1]; b2c = saved_bc[2]; b3c = saved_bc[3];
+	make_mc_table();
+	char_base = saved_char_base; bitmap_base = saved_bitmap_base;
+	sprite_on = saved_sprite_on;
+	rc = saved_rc; vc = saved_vc; x_scroll = saved_x_scroll;
+	display_idx = saved_display_idx;
+	display_state = saved_display_state;
+	simd_lines = saved_simd_lines;
+	return errors;
+#else
+	return -1;
+#endif
 }
 
 
 // Sprites
 
-#define PUT_PIXEL() \
-if (q[i]) \
-	spr_coll |= q[i] | sbit;\
-else { \
-	p[i] = col;\
-	q[i] = sbit;\
+// A line of sprite pixels as a bit set, bit 63 of word 0 is the leftmost
+// pixel (like in the sprite data). One more word than the 0x180 pixels,
+// for a sprite at the right end.
+const int SPR_LINE_WORDS = 0x180/64 + 1;
+
+/*
+ *  Get the 64 bits of a bit set line that start at bit pos
+ */
+
+static inline uint64_t line_bits(const uint64_t *line, int pos)
+{
+	int k = pos >> 6, s = pos & 63;
+	return s ? (line[k] << s) | (line[k+1] >> (64 - s)) : line[k];
 }
 
+/*
+ *  OR 64 bits into a bit set line, starting at bit pos
+ */
 
-void MOS6569::el_sprites(uint8 *chunky_ptr)
+static inline void line_or(uint64_t *line, int pos, uint64_t bits)
+{
+	int k = pos >> 6, s = pos & 63;
+	line[k] |= bits >> s;
+	if (s)
+		line[k+1] |= bits << (64 - s);
+}
+
+/*
+ *  Set the pixels at p that are set in mask (bit 63: p[0]) to col
+ */
+
+static inline void put_pixels(uint8 *p, uint64_t mask, uint8 col)
+{
+	while (mask) {
+		int i = __builtin_clzll(mask);
+		p[i] = col;
+		mask &= ~(0x8000000000000000ULL >> i);
+	}
+}
+
+
+/*
+ *  Draw the active sprites of a line, returns the sprite-sprite
+ *  collisions in bits 0..7 and the sprite-graphics collisions in
+ *  bits 8..15
+ */
+
+int MOS6569::el_sprites(uint8 *chunky_ptr)
 {
-	int i;
 	int snum, sbit;		// Sprite number/bit mask
 	int spr_coll=0, gfx_coll=0;
 	const int xoffs = (C64DISPLAY_X-DISPLAY_X)/2; // 32 if the screen is 320 wide
 	
-	// Draw each active sprite
-	for (snum=0, sbit=1; snum<8; snum++, sbit<<=1)
-		if ((sprite_on & sbit) && mx[snum] < C64DISPLAY_X-32) {
-			int spr_mask_pos;	// Sprite bit position in fore_mask_buf
-			uint32 sdata, fore_mask;
-			
-			uint8 *p = chunky_ptr + (mx[snum]-xoffs) + 8;;
-			uint8 *q = spr_coll_buf + mx[snum] + 8;
-			
-			uint8 *sdatap = get_physical(matrix_base[0x3f8 + snum] << 6 | mc[snum]);
-			sdata = (*sdatap << 24) | (*(sdatap+1) << 16) | (*(sdatap+2) << 8);
-			uint8 color = sc[snum], col;
-			
-			spr_mask_pos = mx[snum] + 8 - x_scroll;
-			
-			uint8 *fmbp = fore_mask_buf + (spr_mask_pos >> 3);
-			int sshift = spr_mask_pos & 7;
-			fore_mask = (((*(fmbp+0) << 24) | (*(fmbp+1) << 16) | (*(fmbp+2) << 8)
-						  | (*(fmbp+3))) << sshift) | (*(fmbp+4) >> (8-sshift));
-			
-			// Don't draw outside the screen buffer!
-			uint8 xstart=0, xstop=24, xstop1 = 24;
-			if (mxe & sbit) {
-				xstop=48;
-				xstop1=32;
-			}
-			// DEBUG
-			
-			if (mx[snum]+8 < xoffs) xstart=xoffs-mx[snum]-8;
-			if (mx[snum]+8-xoffs+xstop > DISPLAY_X) {
-				xstop = DISPLAY_X-mx[snum]-8+xoffs;
-				if (xstop<xstop1) xstop1=xstop;
+	// Foreground mask of the graphics as a bit set
+	uint64_t fore[SPR_LINE_WORDS];
+	for (int k=0; k<0x180/64; k++) {
+		const uint8 *f = fore_mask_buf + k*8;
+		fore[k] = (uint64_t)f[0] << 56 | (uint64_t)f[1] << 48 | (uint64_t)f[2] << 40 | (uint64_t)f[3] << 32
+				| (uint32)(f[4] << 24 | f[5] << 16 | f[6] << 8 | f[7]);
+	}
+	fore[0x180/64] = 0;
+	
+	// Pixels covered by a sprite and by more than one sprite, at the
+	// positions of spr_coll_buf[] (mx + 8)
+	uint64_t covered[SPR_LINE_WORDS], overlap[SPR_LINE_WORDS];
+	memset(covered, 0, sizeof(covered));
+	memset(overlap, 0, sizeof(overlap));
+	uint64_t shown[8];		// Visible pixels of each sprite
+	uint8 spr_drawn = 0;
+	
+	for (snum=0, sbit=1; snum<8; snum++, sbit<<=1) {
+		if (!(sprite_on & sbit) || mx[snum] >= C64DISPLAY_X-32)
+			continue;
+		bool expanded = mxe & sbit;
+		if (expanded && mx[snum] >= C64DISPLAY_X-56)
+			continue;
+		
+		// Expand the sprite line to 24 or 48 pixels. Standard sprites
+		// only have plane 1 (sprite color), multicolor sprites are
+		// converted from their chunky format to two bit planes.
+		uint8 *sdatap = get_physical(matrix_base[0x3f8 + snum] << 6 | mc[snum]);
+		uint64_t sdata, plane0, plane1;
+		if (expanded) {
+			const uint16 *exp = (mmc & sbit) ? MultiExpTable : ExpTable;
+			sdata = (uint64_t)exp[sdatap[0]] << 48 | (uint64_t)exp[sdatap[1]] << 32 | (uint64_t)exp[sdatap[2]] << 16;
+		} else
+			sdata = (uint64_t)sdatap[0] << 56 | (uint64_t)sdatap[1] << 48 | (uint64_t)sdatap[2] << 40;
+		if (mmc & sbit) {
+			plane0 = (sdata & 0x5555555555555555ULL) | (sdata & 0x5555555555555555ULL) << 1;
+			plane1 = (sdata & 0xaaaaaaaaaaaaaaaaULL) | (sdata & 0xaaaaaaaaaaaaaaaaULL) >> 1;
+		} else {
+			plane0 = 0;
+			plane1 = sdata;
+		}
+		
+		// Collision with graphics?
+		uint64_t fore_mask = line_bits(fore, mx[snum] + 8 - x_scroll);
+		if (fore_mask & (plane0 | plane1)) {
+			gfx_coll |= sbit;
+			if (mdp & sbit) {
+				plane0 &= ~fore_mask;	// Mask sprite if in background
+				plane1 &= ~fore_mask;
 			}
-			
-			if (mxe & sbit) {		// X-expanded
-				if (mx[snum] >= C64DISPLAY_X-56)
-					continue;
-				
-				uint32 sdata_l = 0, sdata_r = 0, fore_mask_r;
-				fore_mask_r = (((*(fmbp+4) << 24) | (*(fmbp+5) << 16) | (*(fmbp+6) << 8)
-								| (*(fmbp+7))) << sshift) | (*(fmbp+8) >> (8-sshift));
-				if (mmc & sbit) {	// Multicolor mode
-					uint32 plane0_l, plane0_r, plane1_l, plane1_r;
-					
-					// Expand sprite data
-					sdata_l = MultiExpTable[sdata >> 24 & 0xff] << 16 | MultiExpTable[sdata >> 16 & 0xff];
-					sdata_r = MultiExpTable[sdata >> 8 & 0xff] << 16;
-					
-					// Convert sprite chunky pixels to bitplanes
-					plane0_l = (sdata_l & 0x55555555) | (sdata_l & 0x55555555) << 1;
-					plane1_l = (sdata_l & 0xaaaaaaaa) | (sdata_l & 0xaaaaaaaa) >> 1;
-					plane0_r = (sdata_r & 0x55555555) | (sdata_r & 0x55555555) << 1;
-					plane1_r = (sdata_r & 0xaaaaaaaa) | (sdata_r & 0xaaaaaaaa) >> 1;
-					
-					// Collision with graphics?
-					if ((fore_mask & (plane0_l | plane1_l)) || (fore_mask_r & (plane0_r | plane1_r))) {
-						gfx_coll |= sbit;
-						if (mdp & sbit)	{
-							plane0_l &= ~fore_mask;	// Mask sprite if in background
-							plane1_l &= ~fore_mask;
-							plane0_r &= ~fore_mask_r;
-							plane1_r &= ~fore_mask_r;
-						}
-					}
-					
-					// Paint sprite
-					plane0_l<<=xstart; plane1_l<<=xstart;
-					for (i=xstart; i<xstop1; i++, plane0_l<<=1, plane1_l<<=1) {
-						if (plane1_l & 0x80000000) {
-							if (plane0_l & 0x80000000)
-								col = mm1;
-							else
-								col = color;
-						} else {
-							if (plane0_l & 0x80000000)
-								col = mm0;
-							else
-								continue;
-						}
-						PUT_PIXEL();
-					}
-					if (xstart>32) {
-						plane0_r<<=xstart-32;
-						plane1_r<<=xstart-32;
-					}
-					for (; i<xstop; i++, plane0_r<<=1, plane1_r<<=1) {
-						if (plane1_r & 0x80000000) {
-							if (plane0_r & 0x80000000)
-								col = mm1;
-							else
-								col = color;
-						} else {
-							if (plane0_r & 0x80000000)
-								col = mm0;
-							else
-								continue;
-						}
-						PUT_PIXEL();
-					}
-					
-				} else {			// Standard mode
-					
-					// Expand sprite data
-					sdata_l = ((uint32)ExpTable[sdata >> 24 & 0xff]) << 16 | ExpTable[sdata >> 16 & 0xff];
-					sdata_r = ((uint32)ExpTable[sdata >> 8 & 0xff]) << 16;
-					// Collision with graphics?
-					if ((fore_mask & sdata_l) || (fore_mask_r & sdata_r)) {
-						gfx_coll |= sbit;
-						if (mdp & sbit)	{
-							sdata_l &= ~fore_mask;	// Mask sprite if in background
-							sdata_r &= ~fore_mask_r;
-						}
-					}
-					
-					// Paint sprite
-					col = color;
-					sdata_l<<=xstart;
-					for (i=xstart; i<xstop1; i++, sdata_l<<=1)
-						if (sdata_l & 0x80000000) {
-							PUT_PIXEL();
-						}
-					if (xstart>32)
-						sdata_r<<=xstart-32;
-					for (; i<xstop; i++, sdata_r<<=1)
-						if (sdata_r & 0x80000000) {
-							PUT_PIXEL();
-						}
-				}
-				
-			} else					// Unexpanded
-				
-				if (mmc & sbit) {	// Multicolor mode
-					uint32 plane0, plane1;
-					
-					// Convert sprite chunky pixels to bitplanes
-					plane0 = (sdata & 0x55555555) | (sdata & 0x55555555) << 1;
-					plane1 = (sdata & 0xaaaaaaaa) | (sdata & 0xaaaaaaaa) >> 1;
-					
-					// Collision with graphics?
-					if (fore_mask & (plane0 | plane1)) {
-						gfx_coll |= sbit;
-						if (mdp & sbit) {
-							plane0 &= ~fore_mask;	// Mask sprite if in background
-							plane1 &= ~fore_mask;
-						}
-					}
-					
-					// Paint sprite
-					plane0<<=xstart; plane1<<=xstart;
-					for (i=xstart; i<xstop; i++, plane0<<=1, plane1<<=1) {
-						if (plane1 & 0x80000000) {
-							if (plane0 & 0x80000000)
-								col = mm1;
-							else
-								col = color;
-						} else {
-							if (plane0 & 0x80000000)
-								col = mm0;
-							else
-								continue;
-						}
-						PUT_PIXEL();
-					}
-					
-				} else {			// Standard mode
-					
-					// Collision with graphics?
-					if (fore_mask & sdata) {
-						gfx_coll |= sbit;
-						if (mdp & sbit)
-							sdata &= ~fore_mask;	// Mask sprite if in background
-					}
-					
-					// Paint sprite
-					col = color;
-					sdata<<=xstart;
-					for (i=xstart; i<xstop; i++, sdata<<=1)
-						if (sdata & 0x80000000) {
-							PUT_PIXEL();
-						}
-					
-				}
 		}
+		
+		// Don't draw outside the screen buffer!
+		int xstart = 0, xstop = expanded ? 48 : 24;
+		if (mx[snum]+8 < xoffs)
+			xstart = xoffs-mx[snum]-8;
+		if (mx[snum]+8-xoffs+xstop > DISPLAY_X)
+			xstop = DISPLAY_X-mx[snum]-8+xoffs;
+		uint64_t pixels = (plane0 | plane1) & (~0ULL >> xstart) & ~(~0ULL >> xstop);
+		
+		// Sprites with lower numbers are in front
+		int pos = mx[snum] + 8;
+		uint64_t behind = line_bits(covered, pos) & pixels;
+		line_or(overlap, pos, behind);
+		line_or(covered, pos, pixels);
+		shown[snum] = pixels;
+		spr_drawn |= sbit;
+		
+		// Paint sprite
+		uint8 *p = chunky_ptr + pos - xoffs;
+		pixels &= ~behind;
+		put_pixels(p, pixels & plane1 & ~plane0, sc[snum]);
+		if (plane0) {
+			put_pixels(p, pixels & plane1 & plane0, mm1);
+			put_pixels(p, pixels & plane0 & ~plane1, mm0);
+		}
+	}
+	
+	// A sprite collided if another one covers one of its pixels
+	for (snum=0, sbit=1; snum<8; snum++, sbit<<=1)
+		if ((spr_drawn & sbit) && (line_bits(overlap, mx[snum] + 8) & shown[snum]))
+			spr_coll |= sbit;
+	
+	return spr_coll | (gfx_coll << 8);
+}
+
+
+/*
+ *  Report the sprite collisions of a line (as returned by el_sprites())
+ */
+
+void MOS6569::el_collisions(int coll)
+{
+	int spr_coll = coll & 0xff, gfx_coll = coll >> 8;
 	
 	//if (ThePrefs.SpriteCollisions) {
 		
@@ -3365,114 +3247,43 @@ int MOS6569::EmulateLine(void)
 		if (raster == dy_start && (ctrl1 & 0x10)) // Don't turn off border if DEN bit cleared
 			border_on = false;
 		
-		if (!border_on)
+		if (!line_changed(disp_row)) {
+			
+			// The row already shows this line
+			if (!border_on) {
+				if (display_state)
+					vc += 40;
+				if (sprite_on)
+					el_collisions(row_coll[disp_row]);
+			}
+			
+		} else if (!border_on)
 		{
 			// Draw line
 			uint8 *p = chunky_ptr + COL40_XSTART + x_scroll; // Pointer in chunky display buffer
 			uint8 *r = fore_mask_buf + (COL40_XSTART >> 3);
 			
+			el_graphics(p, r);
 			if (display_state)
-			{
-				switch (display_idx) {
-					case 0: // Standard text
-						//if (x_scroll & 3) {
-						//	el_std_text(text_chunky_buf, char_base + rc);
-						//	memcpy(p, text_chunky_buf, 8*40);             
-						//} else
-							el_std_text(p, char_base + rc);
-						if(sprite_on)
-							el_std_text_spr(char_base + rc, r);
-						break;
-						
-					case 1: // Multicolor text
-						if (x_scroll & 3) {
-							el_mc_text(text_chunky_buf, char_base + rc);
-							memcpy(p, text_chunky_buf, 8*40);
-						} else
-							el_mc_text(p, char_base + rc);
-						if(sprite_on)
-							el_mc_text_spr(char_base + rc, r);
-						break;
-						
-					case 2: // Standard bitmap
-						if (x_scroll & 3) {
-							el_std_bitmap(text_chunky_buf, bitmap_base + (vc << 3) + rc);
-							memcpy(p, text_chunky_buf, 8*40);             
-						} else
-							el_std_bitmap(p, bitmap_base + (vc << 3) + rc);
-						if(sprite_on)
-							el_std_bitmap_spr(bitmap_base + (vc << 3) + rc, r);
-						break;
-						
-					case 3: // Multicolor bitmap
-						if (x_scroll & 3) {
-							el_mc_bitmap(text_chunky_buf, bitmap_base + (vc << 3) + rc);
-							memcpy(p, text_chunky_buf, 8*40);             
-						} else
-							el_mc_bitmap(p, bitmap_base + (vc << 3) + rc);
-						if(sprite_on)
-							el_mc_bitmap_spr(bitmap_base + (vc << 3) + rc, r);
-						break;
-						
-					case 4: // ECM text
-						//if (x_scroll & 3) {
-						//	el_ecm_text(text_chunky_buf, char_base + rc);
-						//	memcpy(p, text_chunky_buf, 8*40);             
-						//} else
-							el_ecm_text(p, char_base + rc);
-						if(sprite_on)
-							el_ecm_text_spr(char_base + rc, r);
-						break;
-						
-					default: // Invalid mode (all black)
-						memset(p, 0, 320);
-						if(sprite_on)
-							memset(r, 0, 40);
-						break;
-				}
-	 			
-	 			vc += 40;
-			} // if (display_state)
-			else
-			{ // Idle state graphics
-				switch (display_idx) {
-						
-					case 0:  // Standard text
-					case 1:  // Multicolor text
-					case 4:  // ECM text
-						if (x_scroll & 3) {
-							el_std_idle(text_chunky_buf);
-							memcpy(p, text_chunky_buf, 8*40);             
-						} else
-							el_std_idle(p);
-						if(sprite_on)
-							el_std_idle_spr(r);
-						break;
-						
-					case 3:  // Multicolor bitmap
-						if (x_scroll & 3) {
-							el_mc_idle(text_chunky_buf);
-							memcpy(p, text_chunky_buf, 8*40);             
-						} else
-							el_mc_idle(p);
-						if(sprite_on)
-							el_mc_idle_spr(r);
-						break;
-						
-					default: // Invalid mode (all black)
-						memset(p, 0, 320);
-						if(sprite_on)
-							memset(r, 0, 40);
-						break;
-				}
-			} // if (display_state)
+				vc += 40;
 			
 			// Draw sprites
 			if (sprite_on /* SGC: && ThePrefs.SpritesOn */) {
-				memset(spr_coll_buf, 0x0, sizeof(spr_coll_buf));
-				el_sprites(chunky_ptr);
+				int coll = el_sprites(chunky_ptr);
+				if (disp_row < DISPLAY_Y)
+					row_coll[disp_row] = coll;
+				el_collisions(coll);
 			}
 			
+			// The right border (and with SMALL_DISPLAY the scrolled
+			// graphics) reach into the next row
+#if defined(SMALL_DISPLAY)
+			if (!border_40_col || x_scroll)
+#else
+			if (!border_40_col)
+#endif
+				row_overwritten(disp_row + 1);
+			
 			// Handle left/right border
 			if (!border_40_col) {
 				int limit = (COL38_XSTART & 0xfc)>>2;
@@ -3547,6 +3358,7 @@ int MOS6569::EmulateLine(void)
 		
 		// Increment pointer in chunky buffer
 		chunky_line_start += xmod;
+		disp_row++;
 		
 		// Increment row counter, go to idle state on overflow
 		if (rc == 7) {
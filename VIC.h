@@ -35,13 +35,34 @@ extern "C" {
 
 #define draw_border(ptr, val) { *(uint32*)ptr = (uint32)val; *((uint32*)ptr+1) = (uint32)val; }
 
+// The line renderers of the standard emulation have SSE2/NEON versions
+#if defined(__SSE2__) || defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define VIC_SIMD 1
+#endif
+
+#include "Display.h"
+
 
 // Total number of raster lines (PAL)
 const unsigned TOTAL_RASTERS = 0x138;
 
+// Cycles per raster line (PAL)
+const unsigned CYCLES_PER_LINE = 63;
+
 // Screen refresh frequency (PAL)
 const unsigned SCREEN_FREQ = 50;
 
+// Size of the description of a drawn line (see line_changed())
+const int LINE_KEY_SIZE = 8 + 3 + 40*3 + 5 + 8*6;
+
+#if SINGLE_CYCLE
+// One cycle of a raster line in the single cycle emulation
+struct SCCycle {
+	uint8 op;		// What the VIC does (SC_*, see VIC.cpp)
+	uint8 flags;	// Bad Line extras (SCF_*)
+};
+#endif
+
 
 class MOS6510;
 class C64Display;
@@ -69,6 +90,18 @@ public:
 	void SwitchToSC(void);
 	void SwitchToStandard(void);
 
+	static void InitTextColorTable(uint32 *table);	// 16*16*16 entries
+
+	// Compare the SIMD line renderers with the scalar ones on random
+	// data, returns the number of differing cases (-1: no SIMD). Leaves
+	// the VIC state and the RAM as they were.
+	int CheckLineRenderers(int rounds);
+
+	// Rows of the bitmap that were redrawn in the last drawn frame, one
+	// bit per row, and their number
+	const uint32 *DirtyLines(void) { return last_dirty; }
+	int DirtyLineCount(void) { return last_dirty_count; }
+
 private:
 	void vblank(void);
 	void raster_irq(void);
@@ -96,6 +129,7 @@ private:
 	uint8 spr_color[8];			// Indices for MOB colors
 
 	uint32 ec_color_long;		// ec_color expanded to 32 bits
+	const uint32 *TextColorTable;	// 4 pixels for each back/fore color and nibble (shared)
 
 	uint8 matrix_line[40];		// Buffer for video line, read in Bad Lines
 	uint8 color_line[40];		// Buffer for color line, read in Bad Lines
@@ -120,7 +154,7 @@ private:
 	int skip_counter;			// Counter for frame-skipping
 
 	long pad0;	// Keep buffers long-aligned
-	uint8 spr_coll_buf[0x180];	// Buffer for sprite-sprite collisions and priorities
+	uint8 spr_coll_buf[0x180];	// Buffer for sprite-sprite collisions and priorities (single cycle emulation)
 	uint8 fore_mask_buf[0x180/8];	// Foreground mask for sprite-graphics collisions and priorities
 	uint8 text_chunky_buf[40*8];	// Line graphics buffer
 
@@ -136,6 +170,11 @@ private:
 	void draw_graphics(uint32 gfxcharcolor);
 	void draw_sprites(void);
 	void SprDataAccess23(uint8 spr_dma_on, uint8 num);
+#if SINGLE_CYCLE
+	void init_sc_program(void);
+
+	SCCycle sc_program[0x200];	// Cycles of the four line types, indexed by cycle (bit 7: Bad Line, bit 8: not drawn)
+#endif
   
 	uint16 cycle;					// Current cycle in line (1..63)
 
@@ -152,7 +191,7 @@ private:
 	bool draw_this_line;		// Flag: This line is drawn on the screen
 	bool ud_border_on;			// Flag: Upper/lower border on
 	bool vblanking;				// Flag: VBlank in next cycle
-	bool prefs_border_on;		// Flag: Stores ThePrefs.BordersOn
+	bool prefs_border_on;		// Flag: Stores prefs.BordersOn
 	
 	uint8 spr_exp_y;			// 8 sprite y expansion flipflops
 	uint8 spr_dma_on;			// 8 flags: Sprite DMA active
@@ -173,6 +212,8 @@ private:
 	uint8 *get_physical(uint16 adr);
 	void make_mc_table(void);
 
+	void el_graphics(uint8 *p, uint8 *r);
+
 	void el_std_text(uint8 *p, uint8 *q);
 	void el_std_text_spr(uint8 *q, uint8 *r);
 	void el_mc_text(uint8 *p, uint8 *q);
@@ -187,18 +228,46 @@ private:
 	void el_std_idle_spr(uint8 *r);
 	void el_mc_idle(uint8 *p);
 	void el_mc_idle_spr(uint8 *r);
+#if VIC_SIMD
+	void el_std_text_simd(uint8 *p, uint8 *q);
+	void el_mc_text_simd(uint8 *p, uint8 *q);
+	void el_std_bitmap_simd(uint8 *p, uint8 *q);
+	void el_mc_bitmap_simd(uint8 *p, uint8 *q);
+	void el_ecm_text_simd(uint8 *p, uint8 *q);
+	void el_std_idle_simd(uint8 *p);
+	void el_mc_idle_simd(uint8 *p);
+#endif
 
-	void el_sprites(uint8 *chunky_ptr);
+	int el_sprites(uint8 *chunky_ptr);
+	void el_collisions(int coll);
 	int el_update_mc(int raster);
+	int describe_line(void);
+	bool line_changed(int row);
+	void row_overwritten(int row);
+	void forget_lines(void);
 
 	uint16 mc_color_lookup[4];
 
 	bool border_40_col;			// Flag: 40 column border
+	bool simd_lines;			// Flag: Use the SIMD line renderers
 	uint8 sprite_on;			// 8 flags: Sprite display/DMA active
 
 	uint8 *matrix_base;			// Video matrix base
 	uint8 *char_base;			// Character generator base
 	uint8 *bitmap_base;			// Bitmap base
+
+	bool skip_unchanged;		// Flag: Don't redraw unchanged lines
+	int disp_row;				// Row of chunky_line_start in the bitmap
+	uint8 *bitmap_start;		// Bitmap base and row size the rows below refer to
+	int bitmap_xmod;
+	uint8 line_key[LINE_KEY_SIZE];	// Description of the current line
+	uint8 row_key[DISPLAY_Y][LINE_KEY_SIZE];	// Description of what each row shows
+	uint8 row_key_len[DISPLAY_Y];	// Size of row_key[], 0: unknown
+	uint16 row_coll[DISPLAY_Y];	// Sprite collisions of each row
+	uint32 dirty_lines[(DISPLAY_Y+31)/32];	// Rows redrawn in the current frame
+	int dirty_count;
+	uint32 last_dirty[(DISPLAY_Y+31)/32];	// Rows redrawn in the last drawn frame
+	int last_dirty_count;
 	// Only used in standard emulation (end)
 
 };
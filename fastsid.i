@@ -85,9 +85,9 @@
     (((v) << (n))    \
     | ((((v) >> (23 - (n))) ^ (v >> (18 - (n)))) & ((1 << (n)) - 1)))
 
-#define NVALUE(v)                                   \
-    (noiseLSB[v & 0xff] | noiseMID[(v >> 8) & 0xff] \
-    | noiseMSB[(v >> 16) & 0xff])
+#define NVALUE(t, v)                                         \
+    ((t)->noiseLSB[v & 0xff] | (t)->noiseMID[(v >> 8) & 0xff] \
+    | (t)->noiseMSB[(v >> 16) & 0xff])
 
 #define NSEED 0x7ffff8
 
@@ -96,22 +96,37 @@
 #include "wave6581.h"
 #include "wave8580.h"
 
-static WORD wavetable00[2];
-static WORD wavetable10[4096];
-static WORD wavetable20[4096];
-static WORD wavetable30[4096];
-static WORD wavetable40[8192];
-static WORD wavetable50[8192];
-static WORD wavetable60[8192];
-static WORD wavetable70[8192];
-
 #endif
 
 /* Noise tables */
 #define NOISETABLESIZE 256
-static BYTE noiseMSB[NOISETABLESIZE];
-static BYTE noiseMID[NOISETABLESIZE];
-static BYTE noiseLSB[NOISETABLESIZE];
+
+/* read-only tables, built once and shared by all SIDs (see ROMArena) */
+typedef struct fastsid_tables_s
+{
+#ifdef WAVETABLES
+    WORD                 wavetable00[2];
+    WORD                 wavetable10[4096];
+    WORD                 wavetable20[4096];
+    WORD                 wavetable30[4096];
+    WORD                 wavetable40[8192];
+    WORD                 wavetable50[8192];
+    WORD                 wavetable60[8192];
+    WORD                 wavetable70[8192];
+#endif
+    BYTE                 noiseMSB[NOISETABLESIZE];
+    BYTE                 noiseMID[NOISETABLESIZE];
+    BYTE                 noiseLSB[NOISETABLESIZE];
+
+    /* clockcycles for each dropping bit when write-only register read is done */
+    DWORD                sidreadclocks[9];
+
+    vreal_t              lowPassParam[0x800];
+    vreal_t              bandPassParam[0x800];
+    vreal_t              filterResTable[16];
+    /* only referenced when filters are emulated */
+    signed char          ampMod1x8[256];
+} fastsid_tables_t;
 
 /* needed data for one voice */
 typedef struct voice_s
@@ -229,30 +244,26 @@ struct sound_s
     WORD                 filterValue;
 	
 	BYTE*				 sample_buf;
+
+    /* shared tables, set by the caller before fastsid_init() */
+    const fastsid_tables_t *tables;
 };
 
 /* XXX: check these */
 /* table for internal ADSR counter step calculations */
-static WORD adrtable[16] =
+static const WORD adrtable[16] =
 {
     1, 4, 8, 12, 19, 28, 34, 40, 50, 125, 250, 400, 500, 1500, 2500, 4000
 };
 
 /* XXX: check these */
 /* table for pseudo-exponential ADSR calculations */
-static DWORD exptable[6] =
+static const DWORD exptable[6] =
 {
     0x30000000, 0x1c000000, 0x0e000000, 0x08000000, 0x04000000, 0x00000000
 };
 
-/* clockcycles for each dropping bit when write-only register read is done */
-static DWORD sidreadclocks[9];
-
-static vreal_t lowPassParam[0x800];
-static vreal_t bandPassParam[0x800];
-static vreal_t filterResTable[16];
 static const float filterRefFreq = 44100.0;
-static signed char ampMod1x8[256];
 
 inline static void dofilter(voice_t *pVoice)
 {
@@ -321,7 +332,7 @@ inline static void dofilter(voice_t *pVoice)
 inline static DWORD doosc(voice_t *pv)
 {
     if (pv->noise)
-	return ((DWORD)NVALUE(NSHIFT(pv->rv, pv->f >> 28))) << 7;
+	return ((DWORD)NVALUE(pv->s->tables, NSHIFT(pv->rv, pv->f >> 28))) << 7;
     return pv->wt[(pv->f + pv->wtpf) >> pv->wtl] ^ pv->wtr[pv->vprev->f >> 31];
 }
 #else
@@ -348,7 +359,7 @@ static DWORD doosc(voice_t *pv)
             return f >> 16;
         return 0xffff - (f >> 16);
       case NOISEWAVE:
-        return ((DWORD)NVALUE(NSHIFT(pv->rv, pv->f >> 28))) << 7;
+        return ((DWORD)NVALUE(pv->s->tables, NSHIFT(pv->rv, pv->f >> 28))) << 7;
       case PULSEWAVE:
         if (f >= pv->pw)
             return 0x7fff;
@@ -474,10 +485,10 @@ inline static void setup_sid(sound_t *psid)
         psid->filterValue = 0x7ff & ((psid->d[0x15] & 7)
                       | ((WORD)psid->d[0x16]) << 3);
         if (psid->filterType == 0x20)
-            psid->filterDy = bandPassParam[psid->filterValue];
+            psid->filterDy = psid->tables->bandPassParam[psid->filterValue];
         else
-            psid->filterDy = lowPassParam[psid->filterValue];
-        psid->filterResDy = filterResTable[psid->d[0x17] >> 4]
+            psid->filterDy = psid->tables->lowPassParam[psid->filterValue];
+        psid->filterResDy = psid->tables->filterResTable[psid->d[0x17] >> 4]
                             - psid->filterDy;
         if (psid->filterResDy < REAL_VALUE(1.0))
             psid->filterResDy = REAL_VALUE(1.0);
@@ -516,43 +527,43 @@ inline static void setup_voice(voice_t *pv)
 
     switch ((pv->d[4] & 0xf0) >> 4) {
       case 0:
-        pv->wt = wavetable00;
+        pv->wt = pv->s->tables->wavetable00;
         pv->wtl = 31;
         break;
       case 1:
-        pv->wt = wavetable10;
+        pv->wt = pv->s->tables->wavetable10;
         if (pv->d[4] & 0x04)
             pv->wtr[1] = 0x7fff;
         break;
       case 2:
-        pv->wt = wavetable20;
+        pv->wt = pv->s->tables->wavetable20;
         break;
       case 3:
-        pv->wt = wavetable30;
+        pv->wt = pv->s->tables->wavetable30;
         if (pv->d[4] & 0x04)
             pv->wtr[1] = 0x7fff;
         break;
       case 4:
         if (pv->d[4] & 0x08)
-            pv->wt = &wavetable40[4096];
+            pv->wt = &pv->s->tables->wavetable40[4096];
         else
-            pv->wt = &wavetable40[4096 - (pv->d[2]
+            pv->wt = &pv->s->tables->wavetable40[4096 - (pv->d[2]
                      + (pv->d[3] & 0x0f) * 0x100)];
         break;
       case 5:
-        pv->wt = &wavetable50[pv->wtpf = 4096 - (pv->d[2]
+        pv->wt = &pv->s->tables->wavetable50[pv->wtpf = 4096 - (pv->d[2]
                                          + (pv->d[3] & 0x0f) * 0x100)];
         pv->wtpf <<= 20;
         if (pv->d[4] & 0x04)
             pv->wtr[1] = 0x7fff;
         break;
       case 6:
-        pv->wt = &wavetable60[pv->wtpf = 4096 - (pv->d[2]
+        pv->wt = &pv->s->tables->wavetable60[pv->wtpf = 4096 - (pv->d[2]
                                          + (pv->d[3] & 0x0f) * 0x100)];
         pv->wtpf <<= 20;
         break;
       case 7:
-        pv->wt = &wavetable70[pv->wtpf = 4096 - (pv->d[2]
+        pv->wt = &pv->s->tables->wavetable70[pv->wtpf = 4096 - (pv->d[2]
                                          + (pv->d[3] & 0x0f) * 0x100)];
         pv->wtpf <<= 20;
         if (pv->d[4] & 0x04 && pv->s->newsid)
@@ -566,7 +577,7 @@ inline static void setup_voice(voice_t *pv)
       default:
         /* XXX: noise locking correct? */
         pv->rv = 0;
-        pv->wt = wavetable00;
+        pv->wt = pv->s->tables->wavetable00;
         pv->wtl = 31;
     }
 #else
@@ -631,6 +642,7 @@ static int fastsid_calculate_samples(sound_t *psid, SWORD *pbuf, int nr, int sam
     DWORD o0, o1, o2;
     int dosync1, dosync2, i;
     voice_t *v0, *v1, *v2;
+    const signed char *ampMod1x8 = psid->tables->ampMod1x8;
 
     setup_sid(psid);
     v0 = &psid->v[0];
@@ -724,11 +736,23 @@ static int fastsid_calculate_samples(sound_t *psid, SWORD *pbuf, int nr, int sam
 }
 
 
-static void init_filter(sound_t *psid, int freq)
+static void init_filter(sound_t *psid)
+{
+    psid->filterValue = 0;
+    psid->filterType = 0;
+    psid->filterCurType = 0;
+    psid->filterDy = 0;
+    psid->filterResDy = 0;
+}
+
+/* build the shared tables for the given sample frequency */
+static void fastsid_init_tables(fastsid_tables_t *t, int freq)
 {
     WORD uk;
     vreal_t rk;
     long int si;
+    DWORD i;
+    int sid_model = 0;
 
     float yMax = 1.0;
     float yMin = (float)0.01;
@@ -742,13 +766,7 @@ static void init_filter(sound_t *psid, int freq)
     float filterFm = 60.0;
     float filterFt = (float)0.05;
 
-    float filterAmpl = 1.0;
-
-    psid->filterValue = 0;
-    psid->filterType = 0;
-    psid->filterCurType = 0;
-    psid->filterDy = 0;
-    psid->filterResDy = 0;
+    float filterAmpl = (float)0.7;
 
     for (uk = 0, rk = 0; rk < 0x800; rk++, uk++) {
         float h;
@@ -759,7 +777,7 @@ static void init_filter(sound_t *psid, int freq)
             h = yMin;
         if (h > yMax)
             h = yMax;
-        lowPassParam[uk] = REAL_VALUE(h);
+        t->lowPassParam[uk] = REAL_VALUE(h);
     }
 
     yMax = (float)0.22;
@@ -768,26 +786,54 @@ static void init_filter(sound_t *psid, int freq)
     yTmp = yMin;
 
     for (uk = 0, rk = 0; rk < 0x800; rk++, uk++) {
-        bandPassParam[uk] = REAL_VALUE((yTmp * filterRefFreq) / freq);
+        t->bandPassParam[uk] = REAL_VALUE((yTmp * filterRefFreq) / freq);
         yTmp += yAdd;
     }
 
     for (uk = 0; uk < 16; uk++) {
-        filterResTable[uk] = REAL_VALUE(resDy);
+        t->filterResTable[uk] = REAL_VALUE(resDy);
         resDy -= ((resDyMin - resDyMax ) / 15);
     }
 
-    filterResTable[0] = REAL_VALUE(resDyMin);
-    filterResTable[15] = REAL_VALUE(resDyMax);
-
-    /* XXX: if psid->emulatefilter = 0, ampMod1x8 is never referenced */
-    if (psid->emulatefilter)
-        filterAmpl = (float)0.7;
-    else
-        filterAmpl = (float)1.0;
+    t->filterResTable[0] = REAL_VALUE(resDyMin);
+    t->filterResTable[15] = REAL_VALUE(resDyMax);
 
+    /* with psid->emulatefilter = 0, ampMod1x8 is never referenced */
     for (uk = 0, si = 0; si < 256; si++, uk++)
-        ampMod1x8[uk] = (signed char)((si - 0x80) * filterAmpl);
+        t->ampMod1x8[uk] = (signed char)((si - 0x80) * filterAmpl);
+
+#ifdef WAVETABLES
+    //if (resources_get_int("SidModel", &sid_model) < 0) {
+    //    return 0;
+    //}
+
+    for (i = 0; i < 4096; i++) {
+        t->wavetable10[i] = (WORD)(i < 2048 ? i << 4 : 0xffff - (i << 4));
+        t->wavetable20[i] = (WORD)(i << 3);
+        t->wavetable30[i] = waveform30_8580[i] << 7;
+        t->wavetable40[i + 4096] = 0x7fff;
+        if (sid_model == 1) {
+            t->wavetable50[i + 4096] = waveform50_8580[i] << 7;
+            t->wavetable60[i + 4096] = waveform60_8580[i] << 7;
+            t->wavetable70[i + 4096] = waveform70_8580[i] << 7;
+        } else {
+            t->wavetable50[i + 4096] = waveform50_6581[i >> 3] << 7;
+            t->wavetable60[i + 4096] = 0;
+            t->wavetable70[i + 4096] = 0;
+        }
+    }
+#endif
+    for (i = 0; i < NOISETABLESIZE; i++) {
+        t->noiseLSB[i] = (BYTE)((((i >> (7 - 2)) & 0x04) | ((i >> (4 - 1)) & 0x02)
+                      | ((i >> (2 - 0)) & 0x01)));
+        t->noiseMID[i] = (BYTE)((((i >> (13 - 8 - 4)) & 0x10)
+                      | ((i << (3 - (11 - 8))) & 0x08)));
+        t->noiseMSB[i] = (BYTE)((((i << (7 - (22 - 16))) & 0x80)
+                      | ((i << (6 - (20 - 16))) & 0x40)
+                      | ((i << (5 - (16 - 16))) & 0x20)));
+    }
+    for (i = 0; i < 9; i++)
+        t->sidreadclocks[i] = 13;
 }
 
 /* SID initialization routine */
@@ -816,10 +862,9 @@ static int fastsid_init(sound_t *psid, int speed, int cycles_per_sec)
 
     //if (resources_get_int("SidFilters", &(psid->emulatefilter)) < 0)
     //    return 0;
-	
-	psid->emulatefilter = ThePrefs.SIDFilters;
+	// psid->emulatefilter and psid->tables are set by the caller
 
-    init_filter(psid, speed);
+    init_filter(psid);
     setup_sid(psid);
     for (i = 0; i < 3; i++) {
         psid->v[i].vprev = &psid->v[(i + 2) % 3];
@@ -835,38 +880,8 @@ static int fastsid_init(sound_t *psid, int speed, int cycles_per_sec)
         setup_voice(&psid->v[i]);
     }
 #ifdef WAVETABLES
-    //if (resources_get_int("SidModel", &sid_model) < 0) {
-    //    return 0;
-    //}
-
     psid->newsid = sid_model == 1;
-    for (i = 0; i < 4096; i++) {
-        wavetable10[i] = (WORD)(i < 2048 ? i << 4 : 0xffff - (i << 4));
-        wavetable20[i] = (WORD)(i << 3);
-        wavetable30[i] = waveform30_8580[i] << 7;
-        wavetable40[i + 4096] = 0x7fff;
-        if (psid->newsid) {
-            wavetable50[i + 4096] = waveform50_8580[i] << 7;
-            wavetable60[i + 4096] = waveform60_8580[i] << 7;
-            wavetable70[i + 4096] = waveform70_8580[i] << 7;
-        } else {
-            wavetable50[i + 4096] = waveform50_6581[i >> 3] << 7;
-            wavetable60[i + 4096] = 0;
-            wavetable70[i + 4096] = 0;
-        }
-    }
 #endif
-    for (i = 0; i < NOISETABLESIZE; i++) {
-        noiseLSB[i] = (BYTE)((((i >> (7 - 2)) & 0x04) | ((i >> (4 - 1)) & 0x02)
-                      | ((i >> (2 - 0)) & 0x01)));
-        noiseMID[i] = (BYTE)((((i >> (13 - 8 - 4)) & 0x10)
-                      | ((i << (3 - (11 - 8))) & 0x08)));
-        noiseMSB[i] = (BYTE)((((i << (7 - (22 - 16))) & 0x80)
-                      | ((i << (6 - (20 - 16))) & 0x40)
-                      | ((i << (5 - (16 - 16))) & 0x20)));
-    }
-    for (i = 0; i < 9; i++)
-        sidreadclocks[i] = 13;
 
     return 1;
 }
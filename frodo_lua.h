@@ -19,7 +19,9 @@
 
 #import "lua.hxx"
 
+class C64;
+
 extern int luaopen_frodolib(lua_State *L);
 
-extern lua_State* lua_openFrodo(const char* script);
+extern lua_State* lua_openFrodo(C64 *the_c64, const char* script);
 extern void lua_closeFrodo(lua_State *L);
\ No newline at end of file
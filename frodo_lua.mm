@@ -21,10 +21,22 @@
 #import "frodo_lua.h"
 #import "OpenFeintLuaModule.h"
 #import "frodo.h"
+#import "C64.h"
 #import "CPUC64.h"
 #import "C64AppLuaModule.h"
 #import "MMDigitalVerification.h"
 
+// Registry key of the C64 a Lua state belongs to
+static const char kC64Key = 0;
+
+static C64 *lua_getc64(lua_State *L) {
+	lua_pushlightuserdata(L, (void*)&kC64Key);
+	lua_rawget(L, LUA_REGISTRYINDEX);
+	C64 *the_c64 = (C64*)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	return the_c64;
+}
+
 static void stackDump (lua_State *L) {
 	int i;
 	int top = lua_gettop(L);
@@ -67,7 +79,7 @@ static int getmem(lua_State *L) {
 		IntArray *a = (IntArray*)lua_newuserdata(L, nbytes);
 		a->type = "RAM";
 		a->size = 65536;
-		a->elems = Frodo::Instance->TheC64->RAM;
+		a->elems = lua_getc64(L)->RAM;
 	} else {
 		luaL_argerror(L, 1, "invalid buffer");
 	}
@@ -98,6 +110,7 @@ static int setarrayV(lua_State *L) {
 	int value = luaL_checkinteger(L, 3);
 	luaL_argcheck(L, 0 <= value && value < 255, 3, "value out of range");
     *getelem(L) = value;
+	lua_getc64(L)->TheCPU->FlushCode();
 	return 0;
 }
 
@@ -172,11 +185,26 @@ static int add_trap(lua_State *L) {
 	trap->handler = (trap_handler_t)&trap_handler;
 	trap->org[0] = (uint8)oldInstruction;
 	
-	Frodo::Instance->TheC64->TheCPU->InstallTrap(trap);
+	lua_getc64(L)->TheCPU->InstallTrap(trap);
 	
 	return 0;
 }
 
+// trap_hits(address): number of times the traps at address were hit
+static int trap_hits(lua_State *L) {
+	int addr = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, 0 <= addr && addr < 65536, 1, "address out of range: 0 <= addr < 65536");
+	
+	int hits = 0;
+	for (trap_t *trap = lua_getc64(L)->TheCPU->Traps(); trap; trap = trap->next_trap)
+		if (trap->addr == addr)
+			hits += trap->hits;
+	
+	lua_pushinteger(L, hits);
+	
+	return 1;
+}
+
 static int to_int(uint8 bcd) {
 	return (int)((bcd&0x0f) + ((bcd>>4)&0x0f) * 10);
 }
@@ -192,7 +220,7 @@ static int be_read_bcd(lua_State *L) {
 	luaL_argcheck(L, 0 < size && size < 8, 1, "size is of range: 0 < size < 8");
 	addr += size-1;
 	
-	uint8 *ram = Frodo::Instance->TheC64->RAM;
+	uint8 *ram = lua_getc64(L)->RAM;
 	int result = 0;
 	int mag = 1;
 	while (size--) {
@@ -216,7 +244,7 @@ static int le_read_bcd(lua_State *L) {
 	int size = luaL_checkinteger(L, 2);
 	luaL_argcheck(L, 0 < size && size < 8, 1, "size is of range: 0 < size < 8");
 	
-	uint8 *ram = Frodo::Instance->TheC64->RAM;
+	uint8 *ram = lua_getc64(L)->RAM;
 	int result = 0;
 	int mag = 1;
 	while (size--) {
@@ -233,6 +261,7 @@ static int le_read_bcd(lua_State *L) {
 static const struct luaL_Reg cpulib_f[] = {
 	{"getmem", getmem},
 	{"add_trap", add_trap},				// add_trap(address, function:string)
+	{"trap_hits", trap_hits},			// trap_hits(address)
 	{"be_read_bcd", be_read_bcd},		
 	{"le_read_bcd", le_read_bcd},		
 	{NULL, NULL}
@@ -261,9 +290,13 @@ int luaopen_cpulib(lua_State *L) {
 
 #define cStringToNSStringNoCopy(x)	[[NSString alloc] initWithBytesNoCopy:(void*)x length:strlen(x) encoding:NSASCIIStringEncoding freeWhenDone:NO]
 
-lua_State* lua_openFrodo(const char* script) {
+lua_State* lua_openFrodo(C64 *the_c64, const char* script) {
 	lua_State *L = lua_open();
 	
+	lua_pushlightuserdata(L, (void*)&kC64Key);
+	lua_pushlightuserdata(L, the_c64);
+	lua_rawset(L, LUA_REGISTRYINDEX);
+	
 	luaopen_base(L);
 	luaopen_cpulib(L);
 	luaopen_openfeintlib(L);
@@ -17,6 +17,9 @@
  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef _FRODO_TYPES_H
+#define _FRODO_TYPES_H
+
 typedef unsigned char uint8;
 typedef unsigned int uint32;
 typedef unsigned short uint16;
@@ -38,6 +41,8 @@ typedef struct __trap
 	trap_handler_t handler;
 	void* data;
 	void (*trap_release)(struct __trap *trap);		// called when trap handler is being released
+	struct __trap *next_hash;	// next trap in the same bucket of the trap index (private)
+	uint32 hits;				// number of times the handler was called
 } trap_t;
 
 struct trap_result2_t {
@@ -45,3 +50,4 @@ struct trap_result2_t {
 	trap_t *trap;
 };
 
+#endif
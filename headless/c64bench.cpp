@@ -0,0 +1,447 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ *  c64bench.cpp - Headless frame throughput benchmark
+ *
+ *  Boots a C64, starts a PRG or D64 and runs the emulation unthrottled
+ *  for a number of frames, then reports the emulated frames per second.
+ *  The hash of the final frame and RAM can be used to check that an
+ *  optimization did not change the emulation.
+ *
+ *  With -k, several machines run the same program in lockstep on a
+ *  C64Batch thread pool. They must all end up with the same hash as a
+ *  single machine, otherwise they share state they should not.
+ *  All machines use the same ROMArena; with -a it is mapped from a
+ *  file, so several c64bench processes share it too.
+ *
+ *  With -c, every frame is converted to the display format (as for a
+ *  video capture) and the time of the conversion is reported. The
+ *  hash then covers the converted frame instead of the VIC's pixels.
+ *  Only the rows the VIC redrew are converted, -u redraws all of them.
+ *
+ *  With -A, the emulation is limited to real time and the skip factor
+ *  is chosen by the adaptive frame skipping (starting from -s), which
+ *  reports its decisions at the end.
+ *
+ *  With -V, the SIMD line renderers of the VIC are compared with the
+ *  scalar ones on random data in all display modes after the run.
+ *
+ *  If the core is built with PROFILE_6510, -p writes the 6510 profile
+ *  of the (first) machine: the flat profile to stdout and the call
+ *  paths as folded stacks to a file, for flamegraph.pl.
+ */
+
+#include "sysdeps.h"
+
+#include "C64.h"
+#include "C64Batch.h"
+#include "CPUC64.h"
+#include "CPUProfile.h"
+#include "Display.h"
+#include "Prefs.h"
+#include "ROMArena.h"
+#include "VIC.h"
+
+static uint8 BROM[] = {
+#include "BASIC_ROM.i"
+};
+
+
+/*
+ *  Load a ROM image of the given size from dir/name
+ */
+
+static bool load_rom(const char *dir, const char *name, uint8 *dest, size_t size)
+{
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Unable to open '%s'\n", path);
+		return false;
+	}
+	size_t actual = fread(dest, 1, size, f);
+	fclose(f);
+	if (actual != size) {
+		fprintf(stderr, "'%s' is not a %u byte ROM image\n", path, (unsigned)size);
+		return false;
+	}
+	return true;
+}
+
+
+/*
+ *  Build the ROM arena from the ROM files in rom_dir, or map it from
+ *  arena_path (which is created if it does not exist yet)
+ */
+
+static ROMArena *load_roms(const char *rom_dir, const char *arena_path)
+{
+	if (arena_path) {
+		ROMArena *roms = ROMArena::Map(arena_path);
+		if (roms)
+			return roms;
+	}
+
+	uint8 Kernal[0x2000], Char[0x1000], ROM1541[0x4000];
+	if (!load_rom(rom_dir, "Kernal.ROM", Kernal, sizeof(Kernal))
+	 || !load_rom(rom_dir, "Char.ROM", Char, sizeof(Char))
+	 || !load_rom(rom_dir, "1541.ROM", ROM1541, sizeof(ROM1541)))
+		return NULL;
+
+	ROMArena *roms = ROMArena::Create(BROM, Kernal, Char, ROM1541);
+	if (roms == NULL) {
+		fprintf(stderr, "Unable to allocate the ROM arena\n");
+		return NULL;
+	}
+	if (arena_path && !roms->Save(arena_path))
+		fprintf(stderr, "Unable to write '%s'\n", arena_path);
+	return roms;
+}
+
+
+/*
+ *  Copy a PRG file into C64 RAM and type RUN into the keyboard buffer
+ */
+
+static bool inject_prg(C64 *the_c64, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Unable to open '%s'\n", path);
+		return false;
+	}
+
+	uint8 header[2];
+	if (fread(header, 1, 2, f) != 2) {
+		fclose(f);
+		fprintf(stderr, "'%s' is not a PRG file\n", path);
+		return false;
+	}
+	uint16 start = header[0] | (header[1] << 8);
+	uint16 end = start + fread(the_c64->RAM + start, 1, 0x10000 - start, f);
+	fclose(f);
+
+	uint8 *ram = the_c64->RAM;
+	if (start == 0x0801) {
+		// BASIC program: set end of program and variable pointers
+		ram[0x2d] = ram[0x2f] = ram[0x31] = end & 0xff;
+		ram[0x2e] = ram[0x30] = ram[0x32] = end >> 8;
+	}
+	ram[0xae] = end & 0xff;
+	ram[0xaf] = end >> 8;
+
+	static const char run_cmd[] = "RUN\r";
+	memcpy(ram + 0x277, run_cmd, 4);
+	ram[0xc6] = 4;
+	the_c64->TheCPU->FlushCode();
+	return true;
+}
+
+
+/*
+ *  FNV-1a hash over a block of memory
+ */
+
+static uint32 hash_block(const uint8 *p, size_t size, uint32 h = 2166136261U)
+{
+	while (size--) {
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+
+/*
+ *  Create a C64, boot it and start the program
+ */
+
+static C64 *boot_c64(ROMArena *roms, const Prefs &prefs, const char *program, bool is_d64, uint32 warmup, bool single_cycle)
+{
+	C64 *the_c64 = new C64(roms, prefs);
+
+	// Boot; a D64 is started by the auto-boot handler, a PRG is
+	// copied into RAM once BASIC is up
+	the_c64->Run(is_d64, warmup);
+	if (!is_d64 && !inject_prg(the_c64, program)) {
+		delete the_c64;
+		return NULL;
+	}
+
+	// The switch to the single cycle emulation happens at the start of
+	// the next raster line
+	if (single_cycle) {
+		Prefs sc_prefs = the_c64->prefs;
+		sc_prefs.SingleCycleEmulation = true;
+		the_c64->NewPrefs(&sc_prefs);
+	}
+
+#ifdef PROFILE_6510
+	// Only profile the measured frames
+	the_c64->TheCPU->Profile->Reset();
+#endif
+	return the_c64;
+}
+
+static uint32 hash_c64(C64 *the_c64, C64ImageRef image = NULL)
+{
+	uint32 hash;
+	if (image)
+		hash = hash_block((const uint8 *)image, DISPLAY_X * DISPLAY_Y * (FRODO_DISPLAY_FORMAT == DISPLAY_FORMAT_32BIT ? 4 : 2));
+	else
+		hash = hash_block(the_c64->TheDisplay->BitmapBase(), DISPLAY_X * DISPLAY_Y);
+	hash = hash_block(the_c64->RAM, 0x10000, hash);
+	if (the_c64->prefs.Emul1541Proc)
+		hash = hash_block(the_c64->RAM1541, 0x800, hash);
+	return hash;
+}
+
+
+/*
+ *  Print the 6510 profile and write the folded stacks
+ */
+
+static void write_profile(C64 *the_c64, const char *path)
+{
+#ifdef PROFILE_6510
+	CPUProfile *profile = the_c64->TheCPU->Profile;
+	printf("\n");
+	profile->DumpFlat(stdout);
+
+	printf("\nTrap             hits\n");
+	for (trap_t *trap = the_c64->TheCPU->Traps(); trap; trap = trap->next_trap)
+		printf("$%04x %14u\n", trap->addr, trap->hits);
+
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		fprintf(stderr, "Unable to write '%s'\n", path);
+		return;
+	}
+	profile->DumpFolded(f);
+	fclose(f);
+#endif
+}
+
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: c64bench [options] <file.prg|file.d64>\n"
+		"  -r DIR  directory with Kernal.ROM, Char.ROM and 1541.ROM (default: .)\n"
+		"  -a FILE map the ROMs and tables from FILE, create it from -r if missing\n"
+		"  -n N    number of frames to measure (default: 3000)\n"
+		"  -w N    frames to run before the measurement (default: 200)\n"
+		"  -s N    draw every N-th frame (default: 1)\n"
+		"  -1      enable processor-level 1541 emulation\n"
+		"  -l      kernal LOAD receives whole files at once (not with -1)\n"
+		"  -q      disable SID emulation\n"
+		"  -b      run the 6510 from pre-decoded basic blocks\n"
+		"  -J      translate hot 6510 blocks to x86-64 code\n"
+		"  -t      precise 6510 timing (page crossings, branches; no -b/-J)\n"
+		"  -e      count the CIA and VIA timers lazily, driven by events\n"
+		"  -E      like -e, but CIA timer IRQs come on their exact cycle\n"
+		"  -S      use the scalar VIC line renderers and pixel conversion\n"
+		"  -u      redraw (and convert) every line, also the unchanged ones\n"
+#if SINGLE_CYCLE
+		"  -C      single cycle emulation after the warmup\n"
+#endif
+		"  -c      convert every frame to the display format (single machine)\n"
+		"  -A      run in real time with adaptive frame skipping (single machine)\n"
+		"  -V      check the SIMD VIC line renderers against the scalar ones\n"
+		"  -k N    run N machines on a thread pool (default: 1)\n"
+		"  -j N    number of threads for -k (default: one per CPU)\n"
+#ifdef PROFILE_6510
+		"  -p FILE print the 6510 profile, write folded stacks to FILE\n"
+#endif
+		);
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *rom_dir = ".";
+	const char *arena_path = NULL;
+	uint32 frames = 3000;
+	uint32 warmup = 200;
+	int skip = 1;
+	bool emul_1541 = false;
+	bool fast_load = false;
+	bool sid_on = true;
+	bool block_cache = false;
+	bool jit = false;
+	bool precise_cycles = false;
+	bool timer_events = false;
+	bool exact_events = false;
+	bool simd = true;
+	bool skip_unchanged = true;
+	bool check_simd = false;
+	bool single_cycle = false;
+	bool convert = false;
+	bool adaptive = false;
+	int num_machines = 1;
+	int num_threads = 0;
+	const char *profile_path = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "r:a:n:w:s:1lqbJteESuVCcAk:j:p:")) != -1) {
+		switch (opt) {
+			case 'r': rom_dir = optarg; break;
+			case 'a': arena_path = optarg; break;
+			case 'n': frames = strtoul(optarg, NULL, 0); break;
+			case 'w': warmup = strtoul(optarg, NULL, 0); break;
+			case 's': skip = atoi(optarg); break;
+			case '1': emul_1541 = true; break;
+			case 'l': fast_load = true; break;
+			case 'q': sid_on = false; break;
+			case 'b': block_cache = true; break;
+			case 'J': jit = true; break;
+			case 't': precise_cycles = true; break;
+			case 'e': timer_events = true; break;
+			case 'E': timer_events = exact_events = true; break;
+			case 'S': simd = false; break;
+			case 'u': skip_unchanged = false; break;
+			case 'V': check_simd = true; break;
+#if SINGLE_CYCLE
+			case 'C': single_cycle = true; break;
+#endif
+			case 'c': convert = true; break;
+			case 'A': adaptive = true; break;
+			case 'k': num_machines = atoi(optarg); break;
+			case 'j': num_threads = atoi(optarg); break;
+#ifdef PROFILE_6510
+			case 'p': profile_path = optarg; break;
+#endif
+			default: usage(); return 1;
+		}
+	}
+	if (optind != argc - 1 || frames == 0 || warmup == 0 || skip < 1 || num_machines < 1 || num_threads < 0 || ((convert || adaptive) && num_machines > 1)) {
+		usage();
+		return 1;
+	}
+
+	const char *program = argv[optind];
+	const char *ext = strrchr(program, '.');
+	bool is_d64 = ext && !strcasecmp(ext, ".d64");
+
+	Prefs prefs;
+	prefs.LimitSpeed = adaptive;
+	prefs.AdaptiveFrameSkip = adaptive;
+	prefs.SkipFrames = skip;
+	prefs.Emul1541Proc = emul_1541;
+	prefs.FastLoad = fast_load;
+	prefs.SIDOn = sid_on;
+	prefs.CPUBlockCache = block_cache;
+	prefs.CPUJIT = jit;
+	prefs.PreciseCPUCycles = precise_cycles;
+	prefs.TimerEvents = timer_events;
+	prefs.ExactTimerEvents = exact_events;
+	prefs.SIMDRenderers = simd;
+	prefs.SkipUnchangedLines = skip_unchanged;
+	prefs.DriveType = DRVTYPE_D64;
+	if (is_d64)
+		strncpy(prefs.DrivePath, program, sizeof(prefs.DrivePath) - 1);
+
+	ROMArena *roms = load_roms(rom_dir, arena_path);
+	if (roms == NULL)
+		return 1;
+
+	if (num_machines == 1) {
+		C64 *the_c64 = boot_c64(roms, prefs, program, is_d64, warmup, single_cycle);
+		roms->Release();
+		if (the_c64 == NULL)
+			return 1;
+
+		C64ImageRef image = NULL;
+		double convert_time = 0;
+		uint32 dirty_lines = 0;
+		double start = C64::getAbsoluteTime();
+		if (convert) {
+			for (uint32 f=0; f<frames; f++) {
+				the_c64->RunFrames(1);
+				double convert_start = C64::getAbsoluteTime();
+				image = the_c64->TheDisplay->GetImageBuffer();
+				convert_time += C64::getAbsoluteTime() - convert_start;
+				dirty_lines += the_c64->TheVIC->DirtyLineCount();
+			}
+		} else
+			the_c64->RunFrames(frames);
+		double elapsed = C64::getAbsoluteTime() - start;
+
+		double fps = frames / elapsed;
+		printf("%s: %u frames in %.3f s, %.1f frames/s (%.1fx PAL), hash %08x\n",
+			program, frames, elapsed, fps, fps / SCREEN_FREQ, hash_c64(the_c64, image));
+		if (convert)
+			printf("Pixel conversion: %.1f us/frame, %.1f lines/frame redrawn\n", convert_time / frames * 1e6, (double)dirty_lines / frames);
+		if (adaptive) {
+			FrameSkipController &fs = the_c64->FrameSkip;
+			printf("Adaptive frame skip: every %d. frame drawn, %u drawn, %u skipped, %u raises, %u drops, %u caps, %d us per drawn and %d us per skipped frame\n",
+				fs.SkipFrames(), fs.DrawnFrames(), fs.SkippedFrames(), fs.Raises(), fs.Drops(), fs.Caps(), fs.DrawnTime(), fs.SkippedTime());
+		}
+		if (profile_path)
+			write_profile(the_c64, profile_path);
+
+		int errors = 0;
+		if (check_simd) {
+			const int rounds = 100;
+			errors = the_c64->TheVIC->CheckLineRenderers(rounds);
+			if (errors < 0)
+				printf("No SIMD line renderers on this CPU\n");
+			else
+				printf("SIMD line renderers: %d of %d lines differ from the scalar ones\n", errors, rounds * 2 * 8 * 8);
+		}
+
+		delete the_c64;
+		return errors > 0 ? 1 : 0;
+	}
+
+	C64Batch *batch = new C64Batch(num_threads);
+	for (int i=0; i<num_machines; i++) {
+		C64 *the_c64 = boot_c64(roms, prefs, program, is_d64, warmup, single_cycle);
+		if (the_c64 == NULL)
+			return 1;
+		batch->Add(the_c64);
+	}
+	roms->Release();
+
+	double start = C64::getAbsoluteTime();
+	batch->RunFrames(frames);
+	double elapsed = C64::getAbsoluteTime() - start;
+
+	uint32 hash = hash_c64(batch->Machine(0));
+	int mismatches = 0;
+	for (int i=1; i<num_machines; i++)
+		if (hash_c64(batch->Machine(i)) != hash)
+			mismatches++;
+
+	double fps = (double)frames * num_machines / elapsed;
+	printf("%s: %d machines x %u frames on %d threads in %.3f s, %.1f frames/s (%.1fx PAL), %u steals, hash %08x\n",
+		program, num_machines, frames, batch->Threads(), elapsed, fps, fps / SCREEN_FREQ, batch->Steals(), hash);
+	if (mismatches)
+		printf("%d machines ended with a different hash\n", mismatches);
+	if (profile_path)
+		write_profile(batch->Machine(0), profile_path);
+
+	for (int i=0; i<num_machines; i++)
+		delete batch->Machine(i);
+	delete batch;
+	return mismatches ? 1 : 0;
+}
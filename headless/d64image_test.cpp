@@ -0,0 +1,204 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ *  d64image_test.cpp - Test of the D64Image journal
+ *
+ *  A child process writes sectors to an image and exits after the
+ *  write-back thread has journaled them, but before the commit, as if
+ *  it had crashed. The test then checks that the image file is still
+ *  unchanged, that opening the image replays "<image>.journal" (and
+ *  ignores a torn last record), and that releasing it commits the
+ *  sectors to the file and deletes the journal. Exits with 1 if any
+ *  check fails.
+ */
+
+#include "sysdeps.h"
+#include <sys/wait.h>
+
+#include "D64Image.h"
+
+
+// Number of sectors of a 35 track disk
+const int NUM_SECTORS = 683;
+
+// Size of a journal record
+const int JOURNAL_RECORD_SIZE = 2 + 256;
+
+// Sectors written by the child
+const int written[] = {0, 357, 682};
+const int NUM_WRITTEN = 3;
+
+static int failures = 0;
+
+static void fail(const char *what)
+{
+	failures++;
+	printf("FAIL: %s\n", what);
+}
+
+
+/*
+ *  Contents of a sector: the original image or written by the child
+ */
+
+static void fill_sector(uint8 *buffer, int sector, bool written)
+{
+	for (int i=0; i<256; i++)
+		buffer[i] = written ? (sector * 7 + i) ^ 0x5a : sector + i;
+}
+
+static bool is_written(int sector)
+{
+	for (int i=0; i<NUM_WRITTEN; i++)
+		if (written[i] == sector)
+			return true;
+	return false;
+}
+
+
+/*
+ *  Compare the sectors of a file or an open image with the expected ones
+ */
+
+static bool check_file(const char *path, bool with_written)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
+	uint8 sector[256], expected[256];
+	bool ok = true;
+	for (int i=0; ok && i<NUM_SECTORS; i++) {
+		fill_sector(expected, i, with_written && is_written(i));
+		ok = fread(sector, 1, 256, f) == 256 && memcmp(sector, expected, 256) == 0;
+	}
+	fclose(f);
+	return ok;
+}
+
+static bool check_image(D64Image *image)
+{
+	uint8 expected[256];
+	for (int i=0; i<NUM_SECTORS; i++) {
+		fill_sector(expected, i, is_written(i));
+		const uint8 *sector = image->Sector(i * 256);
+		if (sector == NULL || memcmp(sector, expected, 256))
+			return false;
+	}
+	return true;
+}
+
+static off_t file_size(const char *path)
+{
+	struct stat st;
+	return stat(path, &st) == 0 ? st.st_size : -1;
+}
+
+
+/*
+ *  Child: write the sectors, wait for the journal and "crash"
+ */
+
+static void write_and_crash(const char *path, const char *journal)
+{
+	D64Image *image = D64Image::Open(path);
+	if (image == NULL)
+		_exit(2);
+
+	uint8 buffer[256];
+	for (int i=0; i<NUM_WRITTEN; i++) {
+		fill_sector(buffer, written[i], true);
+		if (!image->WriteSector(written[i] * 256, buffer))
+			_exit(3);
+	}
+
+	// The commit follows only after seconds without writes
+	for (int i=0; i<1000; i++) {
+		if (file_size(journal) == NUM_WRITTEN * JOURNAL_RECORD_SIZE)
+			_exit(0);
+		usleep(1000);
+	}
+	_exit(4);
+}
+
+
+int main(int argc, char **argv)
+{
+	char dir[] = "/tmp/d64image_test.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		printf("Can't create a temporary directory\n");
+		return 1;
+	}
+	char path[64], journal[80];
+	sprintf(path, "%s/test.d64", dir);
+	sprintf(journal, "%s.journal", path);
+
+	FILE *f = fopen(path, "wb");
+	uint8 buffer[256];
+	for (int i=0; i<NUM_SECTORS; i++) {
+		fill_sector(buffer, i, false);
+		fwrite(buffer, 1, 256, f);
+	}
+	fclose(f);
+
+	pid_t pid = fork();
+	if (pid == 0)
+		write_and_crash(path, journal);
+	int status;
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		fail("child did not journal the sectors");
+
+	if (file_size(journal) != NUM_WRITTEN * JOURNAL_RECORD_SIZE)
+		fail("no journal after the crash");
+	if (!check_file(path, false))
+		fail("image file changed before the commit");
+
+	// A torn record at the end is ignored
+	f = fopen(journal, "ab");
+	memset(buffer, 0xff, 100);
+	fwrite(buffer, 1, 100, f);
+	fclose(f);
+
+	D64Image *image = D64Image::Open(path);
+	if (image == NULL) {
+		fail("can't open the image again");
+	} else {
+		if (!check_image(image))
+			fail("replayed sectors differ");
+		image->Release();
+	}
+
+	if (file_size(journal) >= 0)
+		fail("journal not deleted after the commit");
+	if (!check_file(path, true))
+		fail("committed image file differs");
+
+	unlink(path);
+	unlink(journal);
+	rmdir(dir);
+
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ Frodo, Commodore 64 emulator for the iPhone
+ Copyright (C) 2007-2010 Stuart Carnie
+ See gpl.txt for license information.
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ *  dirindex_test.cpp - Test of the DirIndex candidates
+ *
+ *  Builds indexes of .d64 (padded with 0xa0) and .t64 (null-terminated)
+ *  style names and checks the entries Candidates() returns for exact
+ *  names, wildcard and pad prefixes, overlong names and patterns and
+ *  an empty directory. Exits with 1 if any check fails.
+ */
+
+#include "sysdeps.h"
+
+#include "DirIndex.h"
+
+
+static int failures = 0;
+
+/*
+ *  Add a name, padded to 16 characters
+ */
+
+static void add_name(DirIndex &index, const char *name, uint8 pad)
+{
+	uint8 buf[16];
+	memset(buf, pad, 16);
+	memcpy(buf, name, strlen(name) < 16 ? strlen(name) : 16);
+	index.Add(buf);
+}
+
+/*
+ *  Check the candidates of a pattern, expected is terminated by -1
+ */
+
+static void check(DirIndex &index, const char *pattern, const int *expected)
+{
+	int count;
+	const int *entries = index.Candidates(pattern, &count);
+
+	int n = 0;
+	while (expected[n] >= 0)
+		n++;
+	bool ok = count == n;
+	for (int i=0; ok && i<n; i++)
+		ok = entries[i] == expected[i];
+	if (ok)
+		return;
+
+	failures++;
+	printf("FAIL: \"%s\": got", pattern);
+	for (int i=0; i<count; i++)
+		printf(" %d", entries[i]);
+	printf(", expected");
+	for (int i=0; i<n; i++)
+		printf(" %d", expected[i]);
+	printf("\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	// .d64 directory
+	DirIndex d64(0xa0);
+
+	const int none[] = {-1};
+	check(d64, "GAME", none);
+	check(d64, "*", none);
+	check(d64, "", none);
+
+	add_name(d64, "GAME", 0xa0);				// 0
+	add_name(d64, "GAMES", 0xa0);				// 1
+	add_name(d64, "INTRO", 0xa0);				// 2
+	add_name(d64, "GAME", 0xa0);				// 3, same name again
+	add_name(d64, "G", 0xa0);					// 4
+	add_name(d64, "ABCDEFGHIJKLMNOPQRS", 0xa0);	// 5, only 16 characters kept
+	add_name(d64, "ABCDEFGHIJKLMNOX", 0xa0);	// 6
+
+	// Exact names, in directory order
+	const int game[] = {0, 3, -1};
+	check(d64, "GAME", game);
+	const int games[] = {1, -1};
+	check(d64, "GAMES", games);
+	const int g[] = {4, -1};
+	check(d64, "G", g);
+	check(d64, "GAM", none);
+	check(d64, "OUTRO", none);
+	const int long16[] = {5, -1};
+	check(d64, "ABCDEFGHIJKLMNOP", long16);
+
+	// Wildcards select the names starting with the characters before them
+	const int all[] = {0, 1, 2, 3, 4, 5, 6, -1};
+	check(d64, "*", all);
+	check(d64, "?", all);
+	check(d64, "", all);
+	const int game_prefix[] = {0, 1, 3, -1};
+	check(d64, "GAME*", game_prefix);
+	check(d64, "GAM?S", game_prefix);
+	const int g_prefix[] = {0, 1, 3, 4, -1};
+	check(d64, "G*", g_prefix);
+	check(d64, "G?ME", g_prefix);
+	const int in_prefix[] = {2, -1};
+	check(d64, "IN*", in_prefix);
+	check(d64, "X*", none);
+
+	// The pad character ends the prefix like a wildcard
+	check(d64, "GAME\xa0", game_prefix);
+	check(d64, "G\xa0ME", g_prefix);
+
+	// Patterns over 16 characters compare the first 16
+	check(d64, "ABCDEFGHIJKLMNOPQRS", long16);
+	check(d64, "ABCDEFGHIJKLMNOPZZ", long16);
+	const int abc[] = {5, 6, -1};
+	check(d64, "ABC*", abc);
+	check(d64, "ABCDEFGHIJKLMNO?", abc);
+
+	// Clear() empties it
+	d64.Clear();
+	check(d64, "*", none);
+	check(d64, "GAME", none);
+
+	// .t64 names, more than fit in the first allocation
+	DirIndex t64(0);
+	char name[17];
+	for (int i=0; i<300; i++) {
+		sprintf(name, "FILE%d", i);
+		add_name(t64, name, 0);
+	}
+	if (t64.Size() != 300) {
+		failures++;
+		printf("FAIL: %d entries, expected 300\n", t64.Size());
+	}
+	for (int i=0; i<300; i++) {
+		sprintf(name, "FILE%d", i);
+		const int exact[] = {i, -1};
+		check(t64, name, exact);
+	}
+	const int file29x[] = {29, 290, 291, 292, 293, 294, 295, 296, 297, 298, 299, -1};
+	check(t64, "FILE29*", file29x);
+	int count;
+	t64.Candidates("F*", &count);
+	if (count != 300) {
+		failures++;
+		printf("FAIL: \"F*\": %d entries, expected 300\n", count);
+	}
+
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All checks passed\n");
+	return 0;
+}
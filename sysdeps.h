@@ -24,6 +24,9 @@
  *  Frodo (C) 1994-1997,2002 Christian Bauer
  */
 
+#ifndef _SYSDEPS_H
+#define _SYSDEPS_H
+
 #include "sysconfig.h"
 
 extern "C"
@@ -203,3 +206,5 @@ typedef long int32;
 
 #define UNUSED(x) (x = x)
 }
+
+#endif